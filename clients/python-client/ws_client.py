@@ -3,7 +3,7 @@
 import ctypes
 import os
 import sys
-from ctypes import c_int32, c_char_p, c_void_p, c_size_t, CFUNCTYPE, POINTER, Structure
+from ctypes import c_int32, c_char_p, c_void_p, c_size_t, c_double, c_bool, CFUNCTYPE, POINTER, Structure
 import time
 
 # Define the callback function types
@@ -49,10 +49,69 @@ lib.wsClientListen.restype = c_int32
 lib.wsDeinitClient.argtypes = [c_void_p]
 lib.wsDeinitClient.restype = c_int32
 
+# wsJson accessors, the node layout is private to the C library
+# wsJsonType wsJsonGetType(const wsJson* obj);
+lib.wsJsonGetType.argtypes = [c_void_p]
+lib.wsJsonGetType.restype = c_int32
+
+# const char* wsJsonGetKey(const wsJson* obj);
+lib.wsJsonGetKey.argtypes = [c_void_p]
+lib.wsJsonGetKey.restype = c_char_p
+
+# const char* wsJsonStringValue(const wsJson* obj, size_t* len);
+lib.wsJsonStringValue.argtypes = [c_void_p, POINTER(c_size_t)]
+lib.wsJsonStringValue.restype = c_void_p
+
+# double wsJsonNumberValue(const wsJson* obj);
+lib.wsJsonNumberValue.argtypes = [c_void_p]
+lib.wsJsonNumberValue.restype = c_double
+
+# bool wsJsonBoolValue(const wsJson* obj);
+lib.wsJsonBoolValue.argtypes = [c_void_p]
+lib.wsJsonBoolValue.restype = c_bool
+
+# int32_t wsJsonCount(const wsJson* obj);
+lib.wsJsonCount.argtypes = [c_void_p]
+lib.wsJsonCount.restype = c_int32
+
+# wsJson* wsJsonAt(const wsJson* obj, int32_t index);
+lib.wsJsonAt.argtypes = [c_void_p, c_int32]
+lib.wsJsonAt.restype = c_void_p
+
 # Constants
 WS_ERROR = -1
 WS_OK = 0
 
+# wsJsonType
+WS_JSON_STRING = 0
+WS_JSON_NUMBER = 1
+WS_JSON_OBJECT = 2
+WS_JSON_BOOL = 3
+WS_JSON_ARRAY = 4
+WS_JSON_NULL = 5
+
+def json_to_python(json_ptr):
+    """Copy a wsJson tree into dicts, lists and plain values
+
+    The tree passed to a JSON callback is only valid during the callback.
+    """
+    kind = lib.wsJsonGetType(json_ptr)
+    if kind == WS_JSON_STRING:
+        length = c_size_t()
+        value = lib.wsJsonStringValue(json_ptr, ctypes.byref(length))
+        return ctypes.string_at(value, length.value).decode('utf-8', 'replace')
+    if kind == WS_JSON_NUMBER:
+        number = lib.wsJsonNumberValue(json_ptr)
+        return int(number) if number.is_integer() else number
+    if kind == WS_JSON_BOOL:
+        return lib.wsJsonBoolValue(json_ptr)
+    if kind == WS_JSON_OBJECT:
+        children = (lib.wsJsonAt(json_ptr, i) for i in range(lib.wsJsonCount(json_ptr)))
+        return {lib.wsJsonGetKey(child).decode('utf-8', 'replace'): json_to_python(child) for child in children}
+    if kind == WS_JSON_ARRAY:
+        return [json_to_python(lib.wsJsonAt(json_ptr, i)) for i in range(lib.wsJsonCount(json_ptr))]
+    return None
+
 class WSClient:
     """Python wrapper for WebSocket client library"""
 
@@ -138,7 +197,7 @@ class WSClient:
         """
         if use_json:
             def wrapper(client_ptr, timestamp, json_ptr):
-                # For JSON mode, just pass the pointer - user must handle it
+                # For JSON mode, just pass the pointer - json_to_python() copies it out
                 callback(self, json_ptr, timestamp)
 
             self.callback = MessageCallbackJsonType(wrapper)
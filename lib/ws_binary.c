@@ -0,0 +1,66 @@
+#include "ws_binary.h"
+#include "ws_globals.h"
+
+#include <string.h>
+
+static inline void wsBinaryPut32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+static inline void wsBinaryPut64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+
+static inline uint32_t wsBinaryGet32(const uint8_t* in) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static inline uint64_t wsBinaryGet64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; i--) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+void wsBinaryEncode(const wsBinaryMessage* msg, uint8_t* out) {
+    out[0] = WS_BINARY_VERSION;
+    out[1] = msg->userLen;
+    out[2] = msg->roomLen;
+    out[3] = 0;
+    wsBinaryPut32(out + 4, msg->flags);
+    wsBinaryPut64(out + 8, msg->seq);
+    wsBinaryPut32(out + 16, msg->textLen);
+
+    uint8_t* p = out + WS_BINARY_HEADER_SIZE;
+    if (msg->userLen) memcpy(p, msg->user, msg->userLen);
+    p += msg->userLen;
+    if (msg->roomLen) memcpy(p, msg->room, msg->roomLen);
+    p += msg->roomLen;
+    if (msg->textLen) memcpy(p, msg->text, msg->textLen);
+}
+
+int32_t wsBinaryDecode(const uint8_t* data, size_t len, wsBinaryMessage* msg) {
+    if (len < WS_BINARY_HEADER_SIZE || data[0] != WS_BINARY_VERSION) return WS_ERROR;
+
+    msg->userLen = data[1];
+    msg->roomLen = data[2];
+    msg->flags = wsBinaryGet32(data + 4);
+    msg->seq = wsBinaryGet64(data + 8);
+    msg->textLen = wsBinaryGet32(data + 16);
+    if (wsBinarySize(msg) != len) return WS_ERROR;
+
+    const char* p = (const char*)data + WS_BINARY_HEADER_SIZE;
+    msg->user = p;
+    msg->room = p + msg->userLen;
+    msg->text = p + msg->userLen + msg->roomLen;
+    return WS_OK;
+}
@@ -0,0 +1,43 @@
+#ifndef WS_BINARY_H
+#define WS_BINARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compact chat message carried in binary frames (opcode 0x2), the same fields
+// as the JSON message without any text to parse. Integers are little endian:
+//
+//   u8  version   WS_BINARY_VERSION
+//   u8  userLen
+//   u8  roomLen   0 for a message to everyone
+//   u8  reserved  0
+//   u32 flags     wsMessageInfo bits
+//   u64 seq       set by the server on broadcast, the history position to resume after in a replay request
+//   u32 textLen
+//   user, room and text bytes, not NUL terminated
+#define WS_BINARY_VERSION 1
+#define WS_BINARY_HEADER_SIZE 20
+
+typedef struct {
+    uint32_t flags;
+    uint64_t seq;
+    const char* user;
+    const char* room;
+    const char* text;
+    uint8_t userLen;
+    uint8_t roomLen;
+    uint32_t textLen;
+} wsBinaryMessage;
+
+static inline size_t wsBinarySize(const wsBinaryMessage* msg) {
+    return WS_BINARY_HEADER_SIZE + (size_t)msg->userLen + msg->roomLen + msg->textLen;
+}
+
+// Writes wsBinarySize(msg) bytes to out
+void wsBinaryEncode(const wsBinaryMessage* msg, uint8_t* out);
+
+// Reads a message, the strings point into data. WS_ERROR if the lengths do not
+// add up to len or the version is unknown.
+int32_t wsBinaryDecode(const uint8_t* data, size_t len, wsBinaryMessage* msg);
+
+#endif
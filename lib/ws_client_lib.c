@@ -5,6 +5,102 @@
 #include "ws_json.h"
 #include <asm-generic/errno.h>
 #include <netdb.h>
+#include <sys/random.h>
+
+// Default for the largest message accepted, see wsSetMaxMessageSize
+#define WS_CLIENT_MAX_MESSAGE (1024 * 1024)
+// Messages above this go out as several frames
+#define WS_CLIENT_FRAGMENT_SIZE (64 * 1024)
+
+// Sets up both directions from the server's answer. Without context takeover a
+// side resets its window after every message, absent window bits mean 15.
+static int32_t wsClientInitDeflate(wsClient* client, const wsDeflateParams* params) {
+    uint8_t serverBits = params->serverMaxWindowBits ? params->serverMaxWindowBits : WS_DEFLATE_MAX_WINDOW_BITS;
+    uint8_t clientBits = params->clientMaxWindowBits ? params->clientMaxWindowBits : WS_DEFLATE_MAX_WINDOW_BITS;
+
+    client->inflate = wsInflateCreate(serverBits, !params->serverNoContextTakeover);
+    if (!client->inflate) return WS_ERROR;
+
+    // Messages may always go out uncompressed, which is all that is left when
+    // the server asks for a window zlib cannot produce
+    if (clientBits >= WS_DEFLATE_MIN_WINDOW_BITS) {
+        client->deflate = wsDeflateCreate(clientBits, !params->clientNoContextTakeover);
+    }
+    return WS_OK;
+}
+
+// RFC 6455 wants masks nobody on the path can predict, they come from the kernel
+static int32_t wsClientNewMask(uint8_t mask[4]) {
+    if (getrandom(mask, 4, 0) != 4) {
+        WS_LOG_ERROR("Failed to generate frame mask\n");
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
+
+static void wsClientMaskPayload(uint8_t* out, const uint8_t* payload, size_t len, const uint8_t mask[4]) {
+    for (size_t i = 0; i < len; i++) {
+        out[i] = payload[i] ^ mask[i & 3];
+    }
+}
+
+// Every message goes out through here, compressed once permessage-deflate is on.
+// Large ones are split into a frame with the opcode followed by continuations.
+static int32_t wsClientSendFrame(wsClient* client, uint8_t opcode, const void* data, size_t len) {
+    const uint8_t* payload = data;
+    wsBuffer compressed = {0};
+    bool deflated = false;
+    if (client->deflate) {
+        // The window already holds this message, it has to go out compressed
+        if (wsDeflateMessage(client->deflate, payload, len, &compressed) != WS_OK) {
+            wsBufferFree(&compressed);
+            return WS_ERROR;
+        }
+        payload = compressed.data;
+        len = compressed.len;
+        deflated = true;
+    }
+
+    wsBuffer frame = {0};
+    size_t fragment = len < WS_CLIENT_FRAGMENT_SIZE ? len : WS_CLIENT_FRAGMENT_SIZE;
+    int32_t ret = wsBufferReserve(&frame, WS_FRAME_MAX_HEADER + fragment);
+    size_t offset = 0;
+    while (ret == WS_OK) {
+        size_t chunk = len - offset < fragment ? len - offset : fragment;
+        bool fin = offset + chunk == len;
+
+        uint8_t mask[4];
+        if (wsClientNewMask(mask) != WS_OK) {
+            ret = WS_ERROR;
+            break;
+        }
+
+        // RSV1 belongs to the first frame of a compressed message only
+        frame.len = wsFrameWriteHeader(frame.data, offset ? WS_OPCODE_CONTINUATION : opcode, fin, chunk, mask);
+        if (deflated && offset == 0) frame.data[0] |= WS_FRAME_RSV1;
+        wsClientMaskPayload(frame.data + frame.len, payload + offset, chunk, mask);
+        frame.len += chunk;
+        if (send(client->id, frame.data, frame.len, 0) < 0) ret = WS_ERROR;
+
+        offset += chunk;
+        if (fin) break;
+    }
+    wsBufferFree(&frame);
+    wsBufferFree(&compressed);
+    return ret;
+}
+
+// Control frames are never compressed or fragmented
+static int32_t wsClientSendControl(wsClient* client, uint8_t opcode, const uint8_t* payload, size_t len) {
+    uint8_t frame[WS_FRAME_MAX_HEADER + 125];
+    uint8_t mask[4];
+    if (wsClientNewMask(mask) != WS_OK) return WS_ERROR;
+
+    int32_t headerLen = wsFrameWriteHeader(frame, opcode, true, len, mask);
+    wsClientMaskPayload(frame + headerLen, payload, len, mask);
+    if (send(client->id, frame, headerLen + len, 0) < 0) return WS_ERROR;
+    return WS_OK;
+}
 
 int32_t wsInitClient(wsClient* client, const char* ip, const char* port, const char* username) {
 
@@ -79,12 +175,34 @@ int32_t wsInitClient(wsClient* client, const char* ip, const char* port, const c
     WS_LOG_DEBUG("Connected to server at %s:%s\n", ip, port);
 
     // websocket handshake 
-    if (__ws_client_handshake(sockfd, ip) == WS_ERROR) {
+    wsDeflateParams deflate = {0};
+    bool deflateAccepted = false;
+#ifdef WS_ENABLE_DEFLATE
+    wsDeflateParams* offer = &deflate;
+#else
+    wsDeflateParams* offer = NULL;
+#endif
+    if (__ws_client_handshake(sockfd, ip, offer, &deflateAccepted) == WS_ERROR) {
         WS_LOG_ERROR("Websocket handshake failed\n");
         close(sockfd);
         return WS_ERROR;
     }
 
+    client->deflate = NULL;
+    client->inflate = NULL;
+    client->onBinaryCallback = NULL;
+    client->onChunkCallback = NULL;
+    client->in = (wsBuffer){0};
+    client->message = (wsBuffer){0};
+    client->messageOpcode = 0;
+    client->maxMessage = WS_CLIENT_MAX_MESSAGE;
+    wsJsonArenaInit(&client->json);
+    if (deflateAccepted && wsClientInitDeflate(client, &deflate) != WS_OK) {
+        WS_LOG_ERROR("Failed to set up permessage-deflate\n");
+        close(sockfd);
+        return WS_ERROR;
+    }
+
     WS_LOG_DEBUG("WebSocket handshake complete\n");
     
     client->id = sockfd;
@@ -103,27 +221,12 @@ int32_t wsInitClient(wsClient* client, const char* ip, const char* port, const c
 }
 
 int32_t wsSendMessage(wsClient* client, const char *message) {
-    size_t len = strlen(message);
-    uint8_t frame[WS_BUFFER_SIZE];
-    int32_t frameLen = __ws_encode_frame(message, len, frame);
-    send(client->id, frame, frameLen, 0);
-
-    return WS_OK;
+    return wsClientSendFrame(client, WS_OPCODE_TEXT, message, strlen(message));
 }
 
 int32_t wsSendMessageN(wsClient *client, const char *message, size_t n) {
-    char tmp[WS_BUFFER_SIZE];
-    if (n >= sizeof(tmp)) n = sizeof(tmp) - 1;
-    strncpy(tmp, message, n);
-    tmp[n] = '\0';
-
-    size_t len = strlen(tmp);
-
-    uint8_t frame[WS_BUFFER_SIZE];
-    int32_t frameLen = __ws_encode_frame(tmp, len, frame);
-    send(client->id, frame, frameLen, 0);
-
-    return WS_OK;
+    // Like strncpy the message ends early at a NUL
+    return wsClientSendFrame(client, WS_OPCODE_TEXT, message, strnlen(message, n));
 }
 
 int32_t wsSendJson(wsClient *client, wsJson *obj) {
@@ -132,11 +235,34 @@ int32_t wsSendJson(wsClient *client, wsJson *obj) {
         return WS_ERROR;
     }
 
-    char buffer[WS_BUFFER_SIZE];
-    wsJsonToString(obj, buffer, WS_BUFFER_SIZE);
-    wsSendMessage(client, buffer);
+    wsBuffer json = {0};
+    int32_t result = wsJsonToBuffer(obj, &json);
+    if (result == WS_OK) result = wsClientSendFrame(client, WS_OPCODE_TEXT, json.data, json.len);
+    wsBufferFree(&json);
+    return result;
+}
 
-    return WS_OK;
+int32_t wsSendBinary(wsClient* client, const wsBinaryMessage* message) {
+    if (!client || !message) {
+        WS_LOG_ERROR("Invalid Input parameters are NULL\n");
+        return WS_ERROR;
+    }
+
+    wsBinaryMessage msg = *message;
+    if (!msg.user) {
+        size_t userLen = strlen(client->username);
+        msg.user = client->username;
+        msg.userLen = (uint8_t)(userLen > UINT8_MAX ? UINT8_MAX : userLen);
+    }
+
+    wsBuffer payload = {0};
+    int32_t ret = wsBufferReserve(&payload, wsBinarySize(&msg));
+    if (ret == WS_OK) {
+        wsBinaryEncode(&msg, payload.data);
+        ret = wsClientSendFrame(client, WS_OPCODE_BINARY, payload.data, wsBinarySize(&msg));
+    }
+    wsBufferFree(&payload);
+    return ret;
 }
 
 int32_t wsSetOnMessageCallback(wsClient* client, wsOnMessageCallbackPFN functionPtr, wsOnMessageCallbackType type) {
@@ -145,6 +271,187 @@ int32_t wsSetOnMessageCallback(wsClient* client, wsOnMessageCallbackPFN function
     return WS_OK;
 }
 
+int32_t wsSetOnBinaryCallback(wsClient* client, wsOnBinaryCallbackPFN functionPtr) {
+    client->onBinaryCallback = functionPtr;
+    return WS_OK;
+}
+
+int32_t wsSetOnChunkCallback(wsClient* client, wsOnChunkCallbackPFN functionPtr) {
+    client->onChunkCallback = functionPtr;
+    return WS_OK;
+}
+
+int32_t wsSetMaxMessageSize(wsClient* client, size_t size) {
+    if (size == 0) return WS_ERROR;
+    client->maxMessage = size;
+    return WS_OK;
+}
+
+// Hands a whole message to the callbacks, a text payload is NUL terminated
+static void wsClientDeliver(wsClient* client, uint8_t opcode, const uint8_t* payload, size_t len) {
+    // Binary frames carry a wsBinaryMessage, they only go to the binary callback
+    if (opcode == WS_OPCODE_BINARY) {
+        wsBinaryMessage message;
+        if (wsBinaryDecode(payload, len, &message) != WS_OK) {
+            WS_LOG_ERROR("Failed to decode binary message\n");
+        }
+        else if (client->onBinaryCallback) {
+            client->onBinaryCallback(client, time(NULL), &message);
+        }
+        return;
+    }
+
+    const char* text = (const char*)payload;
+    printf("%s\n", text);
+    if (client->onMessageCallbackType == WS_MESSAGE_CALLBACK_JSON) {
+        const char* cp = text;
+        wsJson* root = wsStringToJsonArena(&cp, &client->json);
+        client->onMessageCallback.json(client, time(NULL), root);
+        wsJsonArenaReset(&client->json);
+    }
+    else if (client->onMessageCallbackType == WS_MESSAGE_CALLBACK_RAW) {
+        client->onMessageCallback.raw(client, time(NULL), text);
+    }
+}
+
+// payload must have a spare byte behind it, it is NUL terminated in place
+static int32_t wsClientHandleMessage(wsClient* client, uint8_t opcode, bool compressed, uint8_t* payload, size_t len) {
+    // RSV1 marks a compressed message
+    wsBuffer inflated = {0};
+    if (compressed) {
+        if (!client->inflate ||
+            wsInflateMessage(client->inflate, payload, len, client->maxMessage, &inflated) != WS_OK ||
+            wsBufferReserve(&inflated, 1) != WS_OK) {
+            WS_LOG_ERROR("Failed to inflate message\n");
+            wsBufferFree(&inflated);
+            return WS_ERROR;
+        }
+        payload = inflated.data;
+        len = inflated.len;
+    }
+
+    uint8_t saved = payload[len];
+    payload[len] = '\0';
+    wsClientDeliver(client, opcode, payload, len);
+    payload[len] = saved;
+    wsBufferFree(&inflated);
+    return WS_OK;
+}
+
+// Streaming: every frame goes to the chunk callback as it arrives, compressed
+// ones are inflated piece by piece, so no message is ever held whole
+static int32_t wsClientStreamFrame(wsClient* client, uint8_t opcode, bool compressed, const uint8_t* payload,
+                                   size_t len, bool last) {
+    if (!compressed) {
+        client->onChunkCallback(client, opcode, payload, len, last);
+        return WS_OK;
+    }
+
+    wsBuffer inflated = {0};
+    if (!client->inflate ||
+        wsInflateFragment(client->inflate, payload, len, last, client->maxMessage, &inflated) != WS_OK) {
+        WS_LOG_ERROR("Failed to inflate message\n");
+        wsBufferFree(&inflated);
+        return WS_ERROR;
+    }
+    client->onChunkCallback(client, opcode, inflated.data, inflated.len, last);
+    wsBufferFree(&inflated);
+    return WS_OK;
+}
+
+static int32_t wsClientHandleFrame(wsClient* client, wsFrame* frame) {
+    if (frame->opcode >= WS_OPCODE_CLOSE && (!frame->fin || frame->payloadLen > 125)) {
+        WS_LOG_ERROR("Invalid control frame\n");
+        return WS_ERROR;
+    }
+
+    switch (frame->opcode) {
+        case WS_OPCODE_CLOSE:
+            WS_LOG_DEBUG("Server closed the connection\n");
+            return WS_OK;
+        case WS_OPCODE_PING:
+            // Keeps the server's heartbeat from dropping a quiet client
+            return wsClientSendControl(client, WS_OPCODE_PONG, frame->payload, frame->payloadLen);
+        case WS_OPCODE_TEXT:
+        case WS_OPCODE_BINARY:
+        case WS_OPCODE_CONTINUATION:
+            break;
+        default:
+            return WS_OK;
+    }
+
+    bool first = frame->opcode != WS_OPCODE_CONTINUATION;
+    if (first && frame->fin && !client->messageOpcode && !client->onChunkCallback) {
+        return wsClientHandleMessage(client, frame->opcode, frame->rsv1, frame->payload, frame->payloadLen);
+    }
+    if (first == (client->messageOpcode != 0)) {
+        WS_LOG_ERROR("Unexpected %s frame\n", first ? "data" : "continuation");
+        return WS_ERROR;
+    }
+    if (first) {
+        client->messageOpcode = frame->opcode;
+        client->messageCompressed = frame->rsv1;
+    }
+    uint8_t opcode = client->messageOpcode;
+    if (frame->fin) client->messageOpcode = 0;
+
+    if (client->onChunkCallback) {
+        return wsClientStreamFrame(client, opcode, client->messageCompressed, frame->payload, frame->payloadLen,
+                                   frame->fin);
+    }
+
+    // Fragments are collected until the last one, up to the size limit
+    if (frame->payloadLen > client->maxMessage - client->message.len) {
+        WS_LOG_ERROR("Message larger than %zu bytes\n", client->maxMessage);
+        wsBufferFree(&client->message);
+        client->messageOpcode = 0;
+        return WS_ERROR;
+    }
+    if (wsBufferAppend(&client->message, frame->payload, frame->payloadLen) != WS_OK) return WS_ERROR;
+    if (!frame->fin) return WS_OK;
+
+    int32_t ret = wsBufferReserve(&client->message, 1);
+    if (ret == WS_OK) {
+        ret = wsClientHandleMessage(client, opcode, client->messageCompressed, client->message.data,
+                                    client->message.len);
+    }
+    wsBufferFree(&client->message);
+    return ret;
+}
+
+// Adds child to parent. A child that could not be added is freed and ret set
+// to WS_ERROR, so a message can be built without checking every step.
+static void wsClientAddField(wsJson* parent, wsJson* child, int32_t* ret) {
+    if (wsJsonAddField(parent, child) != WS_OK) {
+        if (child) wsJsonFree(child);
+        *ret = WS_ERROR;
+    }
+}
+
+// {"user":{"name":...},"message":{"text":...,"text_len":...,"info":...}}, what
+// every message to the server starts with
+static wsJson* wsClientBuildMessage(wsClient* client, const char* text, uint64_t info, int32_t* ret) {
+    wsJson* root = wsJsonInitChild(NULL);
+
+    wsJson* user = wsJsonInitChild("user");
+    wsClientAddField(user, wsJsonInitString("name", client->username), ret);
+    wsClientAddField(root, user, ret);
+
+    wsJson* message = wsJsonInitChild("message");
+    wsClientAddField(message, wsJsonInitString("text", text), ret);
+    wsClientAddField(message, wsJsonInitNumber("text_len", strlen(text)), ret);
+    wsClientAddField(message, wsJsonInitNumber("info", info), ret);
+    wsClientAddField(root, message, ret);
+    return root;
+}
+
+// Sends a message built by wsClientBuildMessage unless building it failed
+static int32_t wsClientSendBuilt(wsClient* client, wsJson* root, int32_t ret) {
+    if (ret == WS_OK) ret = wsSendJson(client, root);
+    if (root) wsJsonFree(root);
+    return ret;
+}
+
 int32_t wsClientListen(wsClient *client) {
     int32_t pollResult = poll(client->fds, 2, 50000);
     if (pollResult < 0) {
@@ -163,49 +470,41 @@ int32_t wsClientListen(wsClient *client) {
             buffer[len - 1] = '\0';
 
             // construct send message
-            wsJson* root = wsJsonInitChild(NULL);
-            wsJson* user = wsJsonInitChild("user");
-            wsJsonAddField(user, wsJsonInitString("name", client->username));
-            wsJsonAddField(root, user);
-
-            wsJson* message = wsJsonInitChild("message");
-            wsJsonAddField(message, wsJsonInitString("text", buffer));
-            wsJsonAddField(message, wsJsonInitNumber("text_len", strlen(buffer)));
-            wsJsonAddField(message, wsJsonInitNumber("info", 0));
-            wsJsonAddField(root, message);
-
-            char tmp[WS_BUFFER_SIZE];
-            int jsonLen = wsJsonToString(root, tmp, WS_BUFFER_SIZE);
-            wsJsonFree(root);
-
-            uint8_t frame[WS_BUFFER_SIZE];
-            int frameLen = __ws_encode_frame(tmp, jsonLen, frame);
-            send(client->id, frame, frameLen, 0);
+            int32_t ret = WS_OK;
+            wsJson* root = wsClientBuildMessage(client, buffer, 0, &ret);
+            wsClientSendBuilt(client, root, ret);
         }
     }
 
-    // Socket has data
+    // Socket has data, every complete frame in it is handled and a partial one waits for the next call
     if (client->fds[1].revents & POLLIN) {
-        uint8_t buffer[WS_BUFFER_SIZE];
-        int32_t len = recv(client->id, buffer, WS_BUFFER_SIZE, 0);
+        if (wsBufferReserve(&client->in, WS_BUFFER_SIZE) != WS_OK) return WS_ERROR;
+        ssize_t len = recv(client->id, client->in.data + client->in.len, client->in.capacity - client->in.len, 0);
 
         if (len == 0) {
             WS_LOG_DEBUG("Server disconnected\n");
             return WS_OK;
         }
         if (len > 0) {
-            char msg[WS_BUFFER_SIZE];
-            int32_t msgLen = __ws_decode_frame(buffer, len, msg);
-            printf("%s\n", msg);
-            if (client->onMessageCallbackType == WS_MESSAGE_CALLBACK_JSON) {
-                const char* cp = msg;
-                wsJson* root = wsStringToJson(&cp);
-                client->onMessageCallback.json(client, time(NULL), root);
-                wsJsonFree(root);
-            }
-            else if (client->onMessageCallbackType == WS_MESSAGE_CALLBACK_RAW) {
-                client->onMessageCallback.raw(client, time(NULL), msg);
+            client->in.len += len;
+            // Spare byte to NUL terminate the last payload in place
+            if (wsBufferReserve(&client->in, 1) != WS_OK) return WS_ERROR;
+
+            size_t used = 0;
+            int32_t ret = WS_OK;
+            while (ret == WS_OK && used < client->in.len) {
+                wsFrame frame;
+                uint8_t* data = client->in.data + used;
+                int64_t frameLen = wsFrameParse(data, client->in.len - used, client->maxMessage, &frame);
+                if (frameLen == WS_FRAME_INCOMPLETE) break;
+                if (frameLen == WS_ERROR) return WS_ERROR;
+
+                used += frameLen;
+                ret = wsClientHandleFrame(client, &frame);
             }
+            wsBufferConsume(&client->in, used);
+            if (client->in.len == 0) wsBufferFree(&client->in);
+            if (ret != WS_OK) return WS_ERROR;
         }
     } 
 
@@ -214,6 +513,13 @@ int32_t wsClientListen(wsClient *client) {
 
 int32_t wsDeinitClient(wsClient* client) {
     close(client->id);
+    wsDeflateFree(client->deflate);
+    wsInflateFree(client->inflate);
+    client->deflate = NULL;
+    client->inflate = NULL;
+    wsBufferFree(&client->in);
+    wsBufferFree(&client->message);
+    wsJsonArenaFree(&client->json);
     return WS_OK;
 }
 
@@ -224,24 +530,58 @@ int32_t wsChangeUsername(wsClient *client, const char *username) {
     } 
 
     client->username = username;
-    wsJson* root = wsJsonInitChild(NULL);
+    int32_t ret = WS_OK;
+    wsJson* root = wsClientBuildMessage(client, "null", WS_NO_BROADCAST | WS_CHANGE_USERNAME, &ret);
+    return wsClientSendBuilt(client, root, ret);
+}
 
-    wsJson* user = wsJsonInitChild("user");
-    wsJsonAddField(user, wsJsonInitString("name", client->username));
-    wsJsonAddField(root, user);
-    
-    wsJson* message = wsJsonInitChild("message");
-    wsJsonAddField(message, wsJsonInitString("text", "null"));
-    wsJsonAddField(message, wsJsonInitNumber("text_len", 4));
-    wsJsonAddField(message, wsJsonInitNumber("info", WS_NO_BROADCAST | WS_CHANGE_USERNAME));
-    wsJsonAddField(root, message);
+static int32_t wsSendRoomJson(wsClient* client, const char* room, const char* text, uint64_t info) {
+    if (!client || !room || !text) {
+        WS_LOG_ERROR("Invalid function input parameters are NULL\n");
+        return WS_ERROR;
+    }
 
-    wsSendJson(client, root);
+    int32_t ret = WS_OK;
+    wsJson* root = wsClientBuildMessage(client, text, info, &ret);
 
-    wsJsonFree(root);
+    wsJson* roomObj = wsJsonInitChild("room");
+    wsClientAddField(roomObj, wsJsonInitString("name", room), &ret);
+    wsClientAddField(root, roomObj, &ret);
 
+    return wsClientSendBuilt(client, root, ret);
+}
 
-    return WS_OK;
+int32_t wsJoinRoom(wsClient* client, const char* room) {
+    return wsSendRoomJson(client, room, "null", WS_NO_BROADCAST | WS_JOIN_ROOM);
+}
+
+int32_t wsLeaveRoom(wsClient* client, const char* room) {
+    return wsSendRoomJson(client, room, "null", WS_NO_BROADCAST | WS_LEAVE_ROOM);
+}
+
+int32_t wsSendRoomMessage(wsClient* client, const char* room, const char* text) {
+    return wsSendRoomJson(client, room, text, 0);
 }
 
+int32_t wsRequestHistory(wsClient* client, const char* room, uint64_t afterSeq, uint32_t limit) {
+    if (!client) {
+        WS_LOG_ERROR("Invalid function input parameters are NULL\n");
+        return WS_ERROR;
+    }
+
+    int32_t ret = WS_OK;
+    wsJson* root = wsClientBuildMessage(client, "null", WS_NO_BROADCAST | WS_REPLAY_HISTORY, &ret);
 
+    if (room) {
+        wsJson* roomObj = wsJsonInitChild("room");
+        wsClientAddField(roomObj, wsJsonInitString("name", room), &ret);
+        wsClientAddField(root, roomObj, &ret);
+    }
+
+    wsJson* history = wsJsonInitChild("history");
+    wsClientAddField(history, wsJsonInitNumber("after", (double)afterSeq), &ret);
+    wsClientAddField(history, wsJsonInitNumber("limit", limit), &ret);
+    wsClientAddField(root, history, &ret);
+
+    return wsClientSendBuilt(client, root, ret);
+}
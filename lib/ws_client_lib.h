@@ -11,10 +11,34 @@ int32_t wsSendMessage(wsClient* client, const char* message);
 int32_t wsSendMessageN(wsClient* client, const char* message, size_t n);
 int32_t wsSendJson(wsClient* client, wsJson* obj);
 
+// Sends a compact binary message, user NULL sends the client's username. Once a
+// client sent one, the server delivers every broadcast to it in binary as well.
+int32_t wsSendBinary(wsClient* client, const wsBinaryMessage* message);
+
 int32_t wsSetOnMessageCallback(wsClient* client, wsOnMessageCallbackPFN functionPtr, wsOnMessageCallbackType type);
+int32_t wsSetOnBinaryCallback(wsClient* client, wsOnBinaryCallbackPFN functionPtr);
+
+// Streaming receive: with a chunk callback set every frame of a text or binary
+// message is passed on as it arrives (inflated if compressed) instead of being
+// collected, the other callbacks are not called any more.
+int32_t wsSetOnChunkCallback(wsClient* client, wsOnChunkCallbackPFN functionPtr);
+
+// Largest message that is collected, and largest single frame (1 MiB by default)
+int32_t wsSetMaxMessageSize(wsClient* client, size_t size);
 int32_t wsClientListen(wsClient* client);
 
 int32_t wsChangeUsername(wsClient* client, const char* username);
 
+// Room messages only reach clients that joined the room, the sender has to be one of them
+int32_t wsJoinRoom(wsClient* client, const char* room);
+int32_t wsLeaveRoom(wsClient* client, const char* room);
+int32_t wsSendRoomMessage(wsClient* client, const char* room, const char* text);
+
+// Asks for the messages the server still keeps for room (NULL for messages to
+// everyone) with a seq above afterSeq, at most limit of them (0 for all). Every
+// broadcast carries its "seq", pass the last one seen to resume after a reconnect.
+// Joining a room replays its history on its own.
+int32_t wsRequestHistory(wsClient* client, const char* room, uint64_t afterSeq, uint32_t limit);
+
 
 #endif
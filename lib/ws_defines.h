@@ -4,11 +4,19 @@
 
 #include "ws_globals.h"
 #include "ws_json.h"
+#include "ws_frame.h"
+#include "ws_deflate.h"
+#include "ws_binary.h"
+
+#include <strings.h>
 
 typedef enum {  
     WS_NO_BROADCAST = (1 << 0),
     WS_SEND_BACK = (1 << 1),
     WS_CHANGE_USERNAME = (1 << 2),
+    WS_JOIN_ROOM = (1 << 3),
+    WS_LEAVE_ROOM = (1 << 4),
+    WS_REPLAY_HISTORY = (1 << 5),
 } wsMessageInfo;
 
 typedef enum {
@@ -26,6 +34,12 @@ typedef union {
     wsOnMessageCallbackRawPFN raw;
 } wsOnMessageCallbackPFN;
 
+// The message's strings point into the receive buffer and are not NUL terminated
+typedef void (*wsOnBinaryCallbackPFN)(wsClient* client, time_t time, const wsBinaryMessage* message);
+
+// One piece of a text or binary message, last is set on the final one
+typedef void (*wsOnChunkCallbackPFN)(wsClient* client, uint8_t opcode, const uint8_t* data, size_t len, bool last);
+
 struct wsClient {
     int32_t id;
     const char* ip;
@@ -34,78 +48,26 @@ struct wsClient {
     const char* username;
     wsOnMessageCallbackType onMessageCallbackType;
     wsOnMessageCallbackPFN onMessageCallback;
+    wsOnBinaryCallbackPFN onBinaryCallback;
+    wsOnChunkCallbackPFN onChunkCallback;
     bool sendMessagefromTerminal;
+    // permessage-deflate, both NULL when the server did not accept it
+    wsDeflateStream* deflate;
+    wsInflateStream* inflate;
+    // Received bytes of an unfinished frame and the fragmented message being put together
+    wsBuffer in;
+    wsBuffer message;
+    uint8_t messageOpcode; // opcode of the open fragmented message, 0 while there is none
+    bool messageCompressed;
+    size_t maxMessage;
+    // Holds the tree handed to a JSON callback, it is only valid during the call
+    wsJsonArena json;
 };
 
 // Internal
-static inline int32_t __ws_encode_frame(const char* payload, int32_t len, uint8_t* frame) {
-    frame[0] = 0x81;
-
-    unsigned char mask[4];
-    srand(time(NULL));
-    for (int i = 0; i < 4; i++) {
-        mask[i] = rand() % 256;  // Random byte (0-255)
-    }
-
-    if (len <= 125) {
-        frame[1] = 0x80 | len;
-        memcpy(&frame[2], mask, 4);
-        for (int i = 0; i < len; i++) {
-            frame[6 + i] = payload[i] ^ mask[i % 4];
-        }
-        return len + 6;
-    }
-    else if (len <= 65535) {
-        frame[1] = 0x80 | 126;
-        frame[2] = (len >> 8) & 0xFF;  // High byte
-        frame[3] = len & 0xFF;          // Low byte
-        memcpy(&frame[4], mask, 4);
-        for (int i = 0; i < len; i++) {
-            frame[8 + i] = payload[i] ^ mask[i % 4];
-        }
-        return len + 8;
-    }
-    return WS_ERROR;
-}
-
-static inline int32_t __ws_decode_frame(uint8_t* data, int32_t len, char* payload) {
-    if (len < 2) return WS_ERROR;
-
-    int opcode = data[0] & 0x0F;
-    if (opcode == 0x8) return WS_ERROR; // Close
-
-    int masked = (data[1] & 0x80) != 0;
-    uint64_t payload_len = data[1] & 0x7F;
-    int pos = 2;
-
-    if (payload_len == 126) {
-        payload_len = (data[2] << 8) | data[3];
-        pos = 4;
-    }
-    else if (payload_len == 127) {
-        payload_len = 0;
-        for (int i = 0; i < 8; i++) {
-            payload_len = (payload_len << 8) | data[2 + i];
-        }
-        pos = 10;
-    }
-
-    uint8_t mask[4];
-    if (masked) {
-        memcpy(mask, &data[pos], 4);
-        pos += 4;
-    }
-
-    for (uint64_t i = 0; i < payload_len; i++) {
-        if (masked)
-            payload[i] = data[pos + i] ^ mask[i % 4];
-        else
-            payload[i] = data[pos + i];
-    }
-    payload[payload_len] = '\0';
-    return payload_len;}
-
-static inline int32_t __ws_client_handshake(int32_t sockfd, const char* ip) {
+// Offers permessage-deflate unless deflate is NULL. *accepted tells whether the
+// server took it, deflate then holds the parameters it answered with.
+static inline int32_t __ws_client_handshake(int32_t sockfd, const char* ip, wsDeflateParams* deflate, bool* accepted) {
     char request[WS_BUFFER_SIZE];
     char key[] = "dGhlIHNhbXBsZSBub25jZQ==";
     snprintf(request, sizeof(request),
@@ -114,8 +76,10 @@ static inline int32_t __ws_client_handshake(int32_t sockfd, const char* ip) {
         "Upgrade: websocket\r\n"                
         "Connection: Upgrade\r\n"                
         "Sec-WebSocket-Key: %s\r\n"              
+        "%s"
         "Sec-WebSocket-Version: 13\r\n\r\n",     
-        ip, key);
+        ip, key, deflate ? "Sec-WebSocket-Extensions: " WS_DEFLATE_EXTENSION "; client_max_window_bits\r\n" : "");
+    *accepted = false;
 
     send(sockfd, request, strlen(request), 0);
 
@@ -129,24 +93,25 @@ static inline int32_t __ws_client_handshake(int32_t sockfd, const char* ip) {
 
     fprintf(stderr, "Server response:\n%s\n", buffer);
 
-    if (strstr(buffer, "101 Switching Protocols")) {
-        return WS_OK;
+    if (!strstr(buffer, "101 Switching Protocols")) {
+        return WS_ERROR;
     }
-    return WS_ERROR;
-}
 
-static inline int __ws_server_handshake(unsigned char *buffer, int len) {
-    printf("Received handshake:\n%s\n", buffer);
-    fflush(stdout);
-
-    if (strcasestr((char*)buffer, "upgrade: websocket") &&
-        strcasestr((char*)buffer, "sec-websocket-key:")) {
-        return 0;
+    // Only permessage-deflate was offered, anything else in the answer fails the handshake
+    static const char header[] = "Sec-WebSocket-Extensions:";
+    for (char* line = strstr(buffer, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, header, sizeof(header) - 1) != 0) continue;
+
+        const char* value = line + sizeof(header) - 1;
+        const char* end = strstr(value, "\r\n");
+        size_t pos = 0;
+        if (!deflate || *accepted || !end || wsDeflateNextOffer(value, end - value, &pos, deflate) != WS_OK) {
+            return WS_ERROR;
+        }
+        *accepted = true;
     }
-
-    printf("Invalid WebSocket handshake\n");
-    fflush(stdout);
-    return -1;
+    return WS_OK;
 }
 
 #endif
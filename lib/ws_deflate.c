@@ -0,0 +1,323 @@
+#include "ws_deflate.h"
+#include "ws_globals.h"
+
+#include <string.h>
+#include <strings.h>
+
+#ifdef WS_ENABLE_DEFLATE
+#include <zlib.h>
+#endif
+
+// Output is grown by at least this much per inflate or deflate call
+#define WS_DEFLATE_CHUNK 4096
+
+static inline bool wsDeflateIsBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static void wsDeflateTrim(const char* s, size_t* start, size_t* end) {
+    while (*start < *end && wsDeflateIsBlank(s[*start])) (*start)++;
+    while (*end > *start && wsDeflateIsBlank(s[*end - 1])) (*end)--;
+}
+
+static bool wsDeflateTokenIs(const char* s, size_t len, const char* token) {
+    return len == strlen(token) && strncasecmp(s, token, len) == 0;
+}
+
+// 8 to 15 without leading zeros, optionally quoted
+static bool wsDeflateParseBits(const char* s, size_t len, uint8_t* bits) {
+    if (len >= 2 && s[0] == '"' && s[len - 1] == '"') {
+        s++;
+        len -= 2;
+    }
+    if (len == 0 || len > 2 || s[0] == '0') return false;
+
+    uint32_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        value = value * 10 + (s[i] - '0');
+    }
+    if (value < 8 || value > 15) return false;
+    *bits = (uint8_t)value;
+    return true;
+}
+
+// One element of the list: the extension name and ';' separated parameters
+static bool wsDeflateParseElement(const char* s, size_t len, wsDeflateParams* params) {
+    memset(params, 0, sizeof(*params));
+
+    size_t i = 0;
+    bool first = true;
+    for (;;) {
+        size_t end = i;
+        while (end < len && s[end] != ';') end++;
+        size_t start = i;
+        size_t stop = end;
+        wsDeflateTrim(s, &start, &stop);
+
+        if (first) {
+            if (!wsDeflateTokenIs(s + start, stop - start, WS_DEFLATE_EXTENSION)) return false;
+            first = false;
+        }
+        else {
+            const char* eq = memchr(s + start, '=', stop - start);
+            size_t nameEnd = eq ? (size_t)(eq - s) : stop;
+            size_t valueStart = eq ? nameEnd + 1 : stop;
+            size_t valueEnd = stop;
+            wsDeflateTrim(s, &start, &nameEnd);
+            wsDeflateTrim(s, &valueStart, &valueEnd);
+            const char* name = s + start;
+            size_t nameLen = nameEnd - start;
+
+            // Every parameter may appear once
+            if (wsDeflateTokenIs(name, nameLen, "server_no_context_takeover")) {
+                if (eq || params->serverNoContextTakeover) return false;
+                params->serverNoContextTakeover = true;
+            }
+            else if (wsDeflateTokenIs(name, nameLen, "client_no_context_takeover")) {
+                if (eq || params->clientNoContextTakeover) return false;
+                params->clientNoContextTakeover = true;
+            }
+            else if (wsDeflateTokenIs(name, nameLen, "server_max_window_bits")) {
+                if (!eq || params->serverMaxWindowBits) return false;
+                if (!wsDeflateParseBits(s + valueStart, valueEnd - valueStart, &params->serverMaxWindowBits)) {
+                    return false;
+                }
+            }
+            else if (wsDeflateTokenIs(name, nameLen, "client_max_window_bits")) {
+                if (params->clientMaxWindowBits) return false;
+                if (!eq) params->clientMaxWindowBits = WS_DEFLATE_MAX_WINDOW_BITS;
+                else if (!wsDeflateParseBits(s + valueStart, valueEnd - valueStart, &params->clientMaxWindowBits)) {
+                    return false;
+                }
+            }
+            else {
+                return false;
+            }
+        }
+
+        if (end == len) return true;
+        i = end + 1;
+    }
+}
+
+int32_t wsDeflateNextOffer(const char* value, size_t len, size_t* pos, wsDeflateParams* params) {
+    size_t i = *pos;
+    while (i < len) {
+        // Elements are ',' separated, a quoted value cannot hold one of ours
+        size_t end = i;
+        bool quoted = false;
+        while (end < len && (quoted || value[end] != ',')) {
+            if (value[end] == '"') quoted = !quoted;
+            end++;
+        }
+
+        size_t start = i;
+        i = end < len ? end + 1 : len;
+        if (wsDeflateParseElement(value + start, end - start, params)) {
+            *pos = i;
+            return WS_OK;
+        }
+    }
+    *pos = len;
+    return WS_ERROR;
+}
+
+int32_t wsDeflateFormat(const wsDeflateParams* params, char* out, size_t size) {
+    int len = snprintf(out, size, "%s%s%s", WS_DEFLATE_EXTENSION,
+                       params->serverNoContextTakeover ? "; server_no_context_takeover" : "",
+                       params->clientNoContextTakeover ? "; client_no_context_takeover" : "");
+    if (len >= 0 && (size_t)len < size && params->serverMaxWindowBits) {
+        len += snprintf(out + len, size - len, "; server_max_window_bits=%u", params->serverMaxWindowBits);
+    }
+    if (len >= 0 && (size_t)len < size && params->clientMaxWindowBits) {
+        len += snprintf(out + len, size - len, "; client_max_window_bits=%u", params->clientMaxWindowBits);
+    }
+    if (len < 0 || (size_t)len >= size) return WS_ERROR;
+    return len;
+}
+
+#ifdef WS_ENABLE_DEFLATE
+
+struct wsDeflateStream {
+    z_stream z;
+    bool contextTakeover;
+};
+
+struct wsInflateStream {
+    z_stream z;
+    bool contextTakeover;
+};
+
+wsDeflateStream* wsDeflateCreate(uint8_t windowBits, bool contextTakeover) {
+    wsDeflateStream* stream = calloc(1, sizeof(wsDeflateStream));
+    if (!stream) return NULL;
+
+    if (windowBits < WS_DEFLATE_MIN_WINDOW_BITS) windowBits = WS_DEFLATE_MIN_WINDOW_BITS;
+    // Negative window bits select raw deflate data without the zlib header
+    if (deflateInit2(&stream->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -(int)windowBits, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        WS_LOG_ERROR("Failed to set up deflate with %u window bits\n", windowBits);
+        free(stream);
+        return NULL;
+    }
+    stream->contextTakeover = contextTakeover;
+    return stream;
+}
+
+void wsDeflateFree(wsDeflateStream* stream) {
+    if (!stream) return;
+    deflateEnd(&stream->z);
+    free(stream);
+}
+
+int32_t wsDeflateMessage(wsDeflateStream* stream, const uint8_t* data, size_t len, wsBuffer* out) {
+    z_stream* z = &stream->z;
+    if (len > UINT32_MAX) return WS_ERROR;
+    z->next_in = (Bytef*)data;
+    z->avail_in = (uInt)len;
+    size_t start = out->len;
+    size_t chunk = deflateBound(z, len) + 8;
+
+    // A sync flush ends the message on a byte boundary with an empty stored block
+    for (;;) {
+        if (wsBufferReserve(out, chunk) != WS_OK) return WS_ERROR;
+        z->next_out = out->data + out->len;
+        z->avail_out = (uInt)(out->capacity - out->len);
+        int ret = deflate(z, Z_SYNC_FLUSH);
+        out->len = out->capacity - z->avail_out;
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            WS_LOG_ERROR("deflate failed: %d\n", ret);
+            return WS_ERROR;
+        }
+        if (z->avail_out > 0) break;
+        chunk = WS_DEFLATE_CHUNK;
+    }
+
+    // That block's 00 00 ff ff is left out on the wire, the receiver appends it
+    if (out->len - start >= 4 && memcmp(out->data + out->len - 4, "\x00\x00\xff\xff", 4) == 0) {
+        out->len -= 4;
+    }
+    // With nothing pending zlib flushes no block at all, but the receiver appends
+    // the 00 00 ff ff regardless. The header byte of an empty stored block goes
+    // first (RFC 7692 7.2.1).
+    else if (out->len == start) {
+        out->data[out->len++] = 0x00;
+    }
+    if (!stream->contextTakeover) deflateReset(z);
+    return WS_OK;
+}
+
+wsInflateStream* wsInflateCreate(uint8_t windowBits, bool contextTakeover) {
+    wsInflateStream* stream = calloc(1, sizeof(wsInflateStream));
+    if (!stream) return NULL;
+
+    if (inflateInit2(&stream->z, -(int)windowBits) != Z_OK) {
+        WS_LOG_ERROR("Failed to set up inflate with %u window bits\n", windowBits);
+        free(stream);
+        return NULL;
+    }
+    stream->contextTakeover = contextTakeover;
+    return stream;
+}
+
+void wsInflateFree(wsInflateStream* stream) {
+    if (!stream) return;
+    inflateEnd(&stream->z);
+    free(stream);
+}
+
+// Feeds one piece of input, returns 1 once a final block ended the deflate stream
+static int32_t wsInflateRun(z_stream* z, const uint8_t* data, size_t len, size_t limit, wsBuffer* out) {
+    z->next_in = (Bytef*)data;
+    z->avail_in = (uInt)len;
+    do {
+        if (wsBufferReserve(out, WS_DEFLATE_CHUNK) != WS_OK) return WS_ERROR;
+        z->next_out = out->data + out->len;
+        z->avail_out = (uInt)(out->capacity - out->len);
+        int ret = inflate(z, Z_SYNC_FLUSH);
+        out->len = out->capacity - z->avail_out;
+        if (out->len > limit) {
+            WS_LOG_ERROR("Compressed message inflates past %zu bytes\n", limit);
+            return WS_ERROR;
+        }
+        if (ret == Z_STREAM_END) return 1;
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            WS_LOG_ERROR("inflate failed: %d\n", ret);
+            return WS_ERROR;
+        }
+    } while (z->avail_in > 0 || z->avail_out == 0);
+    return WS_OK;
+}
+
+int32_t wsInflateFragment(wsInflateStream* stream, const uint8_t* data, size_t len, bool last, size_t maxLen,
+                          wsBuffer* out) {
+    static const uint8_t trailer[4] = {0x00, 0x00, 0xff, 0xff};
+    if (len > UINT32_MAX) return WS_ERROR;
+    size_t limit = out->len + maxLen;
+
+    int32_t ret = wsInflateRun(&stream->z, data, len, limit, out);
+    if (ret == WS_OK && last) ret = wsInflateRun(&stream->z, trailer, sizeof(trailer), limit, out);
+
+    // A final block starts a fresh stream, the window cannot be carried over it
+    if (ret != WS_OK || (last && !stream->contextTakeover)) inflateReset(&stream->z);
+    return ret == WS_ERROR ? WS_ERROR : WS_OK;
+}
+
+int32_t wsInflateMessage(wsInflateStream* stream, const uint8_t* data, size_t len, size_t maxLen, wsBuffer* out) {
+    return wsInflateFragment(stream, data, len, true, maxLen, out);
+}
+
+int32_t wsInflateGetWindow(wsInflateStream* stream, wsBuffer* out) {
+    uInt len = 0;
+    if (wsBufferReserve(out, 1u << WS_DEFLATE_MAX_WINDOW_BITS) != WS_OK) return WS_ERROR;
+    if (inflateGetDictionary(&stream->z, out->data + out->len, &len) != Z_OK) return WS_ERROR;
+    out->len += len;
+    return WS_OK;
+}
+
+// A raw stream takes a dictionary at any point between messages
+int32_t wsInflateSetWindow(wsInflateStream* stream, const uint8_t* data, size_t len) {
+    if (len == 0) return WS_OK;
+    if (len > UINT32_MAX || inflateSetDictionary(&stream->z, data, (uInt)len) != Z_OK) return WS_ERROR;
+    return WS_OK;
+}
+
+#else
+
+wsDeflateStream* wsDeflateCreate(uint8_t windowBits, bool contextTakeover) {
+    return NULL;
+}
+
+void wsDeflateFree(wsDeflateStream* stream) {
+}
+
+int32_t wsDeflateMessage(wsDeflateStream* stream, const uint8_t* data, size_t len, wsBuffer* out) {
+    return WS_ERROR;
+}
+
+wsInflateStream* wsInflateCreate(uint8_t windowBits, bool contextTakeover) {
+    return NULL;
+}
+
+void wsInflateFree(wsInflateStream* stream) {
+}
+
+int32_t wsInflateMessage(wsInflateStream* stream, const uint8_t* data, size_t len, size_t maxLen, wsBuffer* out) {
+    return WS_ERROR;
+}
+
+int32_t wsInflateFragment(wsInflateStream* stream, const uint8_t* data, size_t len, bool last, size_t maxLen,
+                          wsBuffer* out) {
+    return WS_ERROR;
+}
+
+int32_t wsInflateGetWindow(wsInflateStream* stream, wsBuffer* out) {
+    return WS_ERROR;
+}
+
+int32_t wsInflateSetWindow(wsInflateStream* stream, const uint8_t* data, size_t len) {
+    return WS_ERROR;
+}
+
+#endif
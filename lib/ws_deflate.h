@@ -0,0 +1,63 @@
+#ifndef WS_DEFLATE_H
+#define WS_DEFLATE_H
+
+#include "ws_frame.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// permessage-deflate, RFC 7692. A compressed message has RSV1 set on its first
+// frame and its payload is raw deflate data without the trailing 00 00 ff ff.
+#define WS_DEFLATE_EXTENSION "permessage-deflate"
+#define WS_DEFLATE_MIN_WINDOW_BITS 9 // zlib cannot deflate with the 256 byte window RFC 7692 allows
+#define WS_DEFLATE_MAX_WINDOW_BITS 15
+
+// Parameters of one extension offer or response. Window bits are 0 when the
+// parameter is absent, client_max_window_bits without a value reads as 15.
+typedef struct {
+    bool serverNoContextTakeover;
+    bool clientNoContextTakeover;
+    uint8_t serverMaxWindowBits;
+    uint8_t clientMaxWindowBits;
+} wsDeflateParams;
+
+// Finds the next permessage-deflate element of a Sec-WebSocket-Extensions value
+// at or after *pos and moves *pos behind it. Other extensions and elements with
+// unknown or invalid parameters are skipped. WS_ERROR once there are no more.
+int32_t wsDeflateNextOffer(const char* value, size_t len, size_t* pos, wsDeflateParams* params);
+
+// Writes params as an extension element, returns its length or WS_ERROR if size is too small
+int32_t wsDeflateFormat(const wsDeflateParams* params, char* out, size_t size);
+
+// Compression state of one direction. Without context takeover the stream is
+// reset after every message, so its output can be decoded on its own.
+typedef struct wsDeflateStream wsDeflateStream;
+typedef struct wsInflateStream wsInflateStream;
+
+// NULL if allocation fails or the library was built without WS_ENABLE_DEFLATE
+wsDeflateStream* wsDeflateCreate(uint8_t windowBits, bool contextTakeover);
+void wsDeflateFree(wsDeflateStream* stream);
+
+// Appends the compressed payload of one whole message to out
+int32_t wsDeflateMessage(wsDeflateStream* stream, const uint8_t* data, size_t len, wsBuffer* out);
+
+wsInflateStream* wsInflateCreate(uint8_t windowBits, bool contextTakeover);
+void wsInflateFree(wsInflateStream* stream);
+
+// Appends the decompressed payload of one whole message to out. WS_ERROR if the
+// data is corrupt or would grow past maxLen, the stream starts over afterwards.
+int32_t wsInflateMessage(wsInflateStream* stream, const uint8_t* data, size_t len, size_t maxLen, wsBuffer* out);
+
+// The same for one frame of a fragmented message, last marks its final frame.
+// Lets a receiver pass a large message on in pieces without collecting it.
+int32_t wsInflateFragment(wsInflateStream* stream, const uint8_t* data, size_t len, bool last, size_t maxLen,
+                          wsBuffer* out);
+
+// Appends the window a stream with context takeover carries into its next
+// message, wsInflateSetWindow loads it into a fresh stream in another process.
+// Only valid between messages.
+int32_t wsInflateGetWindow(wsInflateStream* stream, wsBuffer* out);
+int32_t wsInflateSetWindow(wsInflateStream* stream, const uint8_t* data, size_t len);
+
+#endif
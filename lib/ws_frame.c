@@ -0,0 +1,132 @@
+#include "ws_frame.h"
+#include "ws_globals.h"
+
+#include <string.h>
+
+int64_t wsFrameParse(uint8_t* data, size_t len, uint64_t maxPayload, wsFrame* frame) {
+    if (!data || !frame) {
+        WS_LOG_ERROR("Invalid input parameters are NULL\n");
+        return WS_ERROR;
+    }
+    if (len < 2) return WS_FRAME_INCOMPLETE;
+
+    bool masked = (data[1] & 0x80) != 0;
+    uint64_t payloadLen = data[1] & 0x7F;
+    size_t pos = 2;
+
+    if (payloadLen == 126) {
+        if (len < 4) return WS_FRAME_INCOMPLETE;
+        payloadLen = ((uint64_t)data[2] << 8) | data[3];
+        pos = 4;
+    }
+    else if (payloadLen == 127) {
+        if (len < 10) return WS_FRAME_INCOMPLETE;
+        payloadLen = 0;
+        for (int i = 0; i < 8; i++) {
+            payloadLen = (payloadLen << 8) | data[2 + i];
+        }
+        pos = 10;
+    }
+
+    // RSV1 is left to the caller, no extension here uses the other two
+    if (data[0] & 0x30) {
+        WS_LOG_ERROR("Frame uses reserved bits\n");
+        return WS_ERROR;
+    }
+    if (payloadLen > maxPayload) {
+        WS_LOG_ERROR("Frame payload too large: %llu\n", (unsigned long long)payloadLen);
+        return WS_ERROR;
+    }
+
+    const uint8_t* mask = NULL;
+    if (masked) {
+        if (len < pos + 4) return WS_FRAME_INCOMPLETE;
+        mask = &data[pos];
+        pos += 4;
+    }
+
+    if (len - pos < payloadLen) return WS_FRAME_INCOMPLETE;
+
+    uint8_t* payload = &data[pos];
+    if (mask) {
+        for (uint64_t i = 0; i < payloadLen; i++) {
+            payload[i] ^= mask[i & 3];
+        }
+    }
+
+    frame->opcode = data[0] & 0x0F;
+    frame->fin = (data[0] & 0x80) != 0;
+    frame->rsv1 = (data[0] & WS_FRAME_RSV1) != 0;
+    frame->masked = masked;
+    frame->payload = payload;
+    frame->payloadLen = payloadLen;
+    return (int64_t)(pos + payloadLen);
+}
+
+int32_t wsFrameWriteHeader(uint8_t* out, uint8_t opcode, bool fin, uint64_t payloadLen, const uint8_t* mask) {
+    int32_t pos = 2;
+    out[0] = (fin ? 0x80 : 0x00) | (opcode & 0x0F);
+    uint8_t maskBit = mask ? 0x80 : 0x00;
+
+    if (payloadLen <= 125) {
+        out[1] = maskBit | (uint8_t)payloadLen;
+    }
+    else if (payloadLen <= 65535) {
+        out[1] = maskBit | 126;
+        out[2] = (payloadLen >> 8) & 0xFF;
+        out[3] = payloadLen & 0xFF;
+        pos = 4;
+    }
+    else {
+        out[1] = maskBit | 127;
+        for (int i = 0; i < 8; i++) {
+            out[2 + i] = (payloadLen >> (56 - i * 8)) & 0xFF;
+        }
+        pos = 10;
+    }
+
+    if (mask) {
+        memcpy(&out[pos], mask, 4);
+        pos += 4;
+    }
+    return pos;
+}
+
+int32_t wsBufferReserve(wsBuffer* buf, size_t extra) {
+    if (buf->capacity - buf->len >= extra) return WS_OK;
+
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity - buf->len < extra) capacity *= 2;
+
+    uint8_t* data = realloc(buf->data, capacity);
+    if (!data) {
+        WS_LOG_ERROR("Failed to grow buffer to %zu bytes\n", capacity);
+        return WS_ERROR;
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+    return WS_OK;
+}
+
+int32_t wsBufferAppend(wsBuffer* buf, const void* data, size_t len) {
+    if (wsBufferReserve(buf, len) != WS_OK) return WS_ERROR;
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return WS_OK;
+}
+
+void wsBufferConsume(wsBuffer* buf, size_t n) {
+    if (n >= buf->len) {
+        buf->len = 0;
+        return;
+    }
+    memmove(buf->data, buf->data + n, buf->len - n);
+    buf->len -= n;
+}
+
+void wsBufferFree(wsBuffer* buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->capacity = 0;
+}
@@ -0,0 +1,59 @@
+#ifndef WS_FRAME_H
+#define WS_FRAME_H
+
+#include "ws_globals.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// wsFrameParse result when the frame is not complete yet
+#define WS_FRAME_INCOMPLETE 0
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+// First header byte bit an extension may claim, permessage-deflate marks compressed messages with it
+#define WS_FRAME_RSV1 0x40
+
+// Largest frame header: 2 bytes + 8 byte length + 4 byte mask
+#define WS_FRAME_MAX_HEADER 14
+
+typedef struct {
+    uint8_t opcode;
+    bool fin;
+    bool rsv1;           // only valid with a negotiated extension, the caller checks
+    bool masked;         // client frames must be, server frames must not, the caller checks
+    uint8_t* payload;    // points into the parsed buffer, already unmasked
+    uint64_t payloadLen;
+} wsFrame;
+
+// Growable byte buffer used to carry partial input between reads
+typedef struct {
+    uint8_t* data;
+    size_t len;
+    size_t capacity;
+} wsBuffer;
+
+// Parses one frame at the start of data and unmasks its payload in place.
+// Returns the number of bytes the whole frame occupies, WS_FRAME_INCOMPLETE
+// if more data is needed, or WS_ERROR if the frame is invalid or larger than maxPayload.
+// Nothing is modified until the whole frame is available, so the call can be
+// repeated after every read.
+int64_t wsFrameParse(uint8_t* data, size_t len, uint64_t maxPayload, wsFrame* frame);
+
+// Writes a frame header and returns its length (at most WS_FRAME_MAX_HEADER).
+// mask may be NULL, server to client frames are never masked.
+int32_t wsFrameWriteHeader(uint8_t* out, uint8_t opcode, bool fin, uint64_t payloadLen, const uint8_t* mask);
+
+// Makes room for at least extra more bytes
+int32_t wsBufferReserve(wsBuffer* buf, size_t extra);
+int32_t wsBufferAppend(wsBuffer* buf, const void* data, size_t len);
+// Drops n bytes from the front
+void wsBufferConsume(wsBuffer* buf, size_t n);
+void wsBufferFree(wsBuffer* buf);
+
+#endif
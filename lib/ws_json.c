@@ -2,389 +2,977 @@
 #include "ws_json.h"
 #include "ws_globals.h"
 
-#include <ctype.h>
+#include <float.h>
 #include <string.h>
 
-wsJson* wsJsonInitChild(const char* key) {
-    wsJson* obj = malloc(sizeof(wsJson));
-    if (!obj) {
-        WS_LOG_ERROR("Failed to allocate memory for json object: %s\n", key);
-        return NULL;
+struct wsJsonArenaBlock {
+    wsJsonArenaBlock* next;
+    size_t size;
+};
+
+void wsJsonArenaInit(wsJsonArena* arena) {
+    memset(arena, 0, sizeof(*arena));
+}
+
+void wsJsonArenaFree(wsJsonArena* arena) {
+    while (arena->blocks) {
+        wsJsonArenaBlock* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
     }
-    memset(obj, 0, sizeof(wsJson));
-    obj->type = WS_JSON_OBJECT;
-    if (key) strncpy(obj->key, key, sizeof(obj->key) - 1);
-    return obj;
+    arena->used = 0;
+    arena->total = 0;
 }
 
-wsJson* wsJsonInitString(const char* key, const char* val) {
-    wsJson* obj = malloc(sizeof(wsJson));
+void wsJsonArenaReset(wsJsonArena* arena) {
+    if (arena->blocks && arena->blocks->next) {
+        size_t total = arena->total;
+        wsJsonArenaFree(arena);
+        arena->nextSize = total;
+    }
+    arena->used = 0;
+    arena->total = 0;
+}
+
+void* wsJsonArenaAlloc(wsJsonArena* arena, size_t size) {
+    size = (size + 15) & ~(size_t)15;
+    wsJsonArenaBlock* block = arena->blocks;
+    if (!block || block->size - arena->used < size) {
+        size_t blockSize = arena->nextSize > WS_JSON_ARENA_BLOCK_SIZE ? arena->nextSize : WS_JSON_ARENA_BLOCK_SIZE;
+        if (blockSize < size) blockSize = size;
+        block = malloc(sizeof(wsJsonArenaBlock) + blockSize);
+        if (!block) return NULL;
+        block->next = arena->blocks;
+        block->size = blockSize;
+        arena->blocks = block;
+        arena->used = 0;
+        arena->nextSize = blockSize * 2;
+    }
+
+    void* p = (uint8_t*)(block + 1) + arena->used;
+    arena->used += size;
+    arena->total += size;
+    return p;
+}
+
+static const char wsJsonNoKey[] = "";
+
+static int32_t wsJsonHex4(const char* p, uint32_t* out) {
+    uint32_t value = 0;
+    for (int32_t i = 0; i < 4; i++) {
+        char c = p[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return WS_ERROR;
+    }
+    *out = value;
+    return WS_OK;
+}
+
+static size_t wsJsonUtf8(char* out, uint32_t cp) {
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | cp >> 6);
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | cp >> 12);
+        out[1] = (char)(0x80 | (cp >> 6 & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | cp >> 18);
+    out[1] = (char)(0x80 | (cp >> 12 & 0x3F));
+    out[2] = (char)(0x80 | (cp >> 6 & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Decodes the escapes of a JSON string, the result never gets longer than
+// the input. Unpaired surrogates become U+FFFD.
+static int32_t wsJsonUnescape(char* out, const char* in, size_t len, size_t* outLen) {
+    const char* end = in + len;
+    char* p = out;
+    while (in < end) {
+        const char* backslash = memchr(in, '\\', end - in);
+        size_t plain = (backslash ? backslash : end) - in;
+        memcpy(p, in, plain);
+        p += plain;
+        in += plain;
+        if (!backslash) break;
+
+        if (end - in < 2) return WS_ERROR;
+        char c = in[1];
+        in += 2;
+        switch (c) {
+            case '"': *p++ = '"'; break;
+            case '\\': *p++ = '\\'; break;
+            case '/': *p++ = '/'; break;
+            case 'b': *p++ = '\b'; break;
+            case 'f': *p++ = '\f'; break;
+            case 'n': *p++ = '\n'; break;
+            case 'r': *p++ = '\r'; break;
+            case 't': *p++ = '\t'; break;
+            case 'u': {
+                uint32_t cp, low;
+                if (end - in < 4 || wsJsonHex4(in, &cp) != WS_OK) return WS_ERROR;
+                in += 4;
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    if (end - in >= 6 && in[0] == '\\' && in[1] == 'u' && wsJsonHex4(in + 2, &low) == WS_OK &&
+                        low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        in += 6;
+                    } else {
+                        cp = 0xFFFD;
+                    }
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    cp = 0xFFFD;
+                }
+                p += wsJsonUtf8(p, cp);
+                break;
+            }
+            default:
+                return WS_ERROR;
+        }
+    }
+    *outLen = p - out;
+    return WS_OK;
+}
+
+// Copies len bytes and a terminator, escaped input is decoded on the way
+static int32_t wsJsonCopy(char* out, const char* in, size_t len, bool escaped, size_t* outLen) {
+    if (escaped && memchr(in, '\\', len)) {
+        if (wsJsonUnescape(out, in, len, outLen) != WS_OK) return WS_ERROR;
+    } else {
+        if (len) memcpy(out, in, len);
+        *outLen = len;
+    }
+    out[*outLen] = '\0';
+    return WS_OK;
+}
+
+// One allocation holds the node, its key and its string, from the arena or
+// from malloc. A NULL key leaves the node without one, val is only read for
+// strings. Key and val are taken as the contents of JSON strings when escaped
+// is set.
+static wsJson* wsJsonNew(wsJsonArena* arena, wsJsonType type, const char* key, size_t keyLen,
+                         const char* val, size_t valLen, bool escaped) {
+    size_t size = sizeof(wsJson) + (key ? keyLen + 1 : 0) + (type == WS_JSON_STRING ? valLen + 1 : 0);
+    wsJson* obj = arena ? wsJsonArenaAlloc(arena, size) : malloc(size);
     if (!obj) {
-        WS_LOG_ERROR("Failed to allocate memory for json object: %s\n", key);
+        WS_LOG_ERROR("Failed to allocate memory for json node\n");
         return NULL;
     }
     memset(obj, 0, sizeof(wsJson));
-    obj->type = WS_JSON_STRING;
-    if (key) strncpy(obj->key, key, sizeof(obj->key) - 1);
-    if (val) strncpy(obj->stringValue, val, sizeof(obj->stringValue) - 1);
+    obj->type = type;
+    obj->inArena = arena != NULL;
+
+    char* p = (char*)(obj + 1);
+    obj->key = wsJsonNoKey;
+    if (key) {
+        if (wsJsonCopy(p, key, keyLen, escaped, &keyLen) != WS_OK) goto invalid;
+        obj->key = p;
+        p += keyLen + 1;
+    }
+    if (type == WS_JSON_STRING) {
+        if (wsJsonCopy(p, val, valLen, escaped, &obj->stringLen) != WS_OK) goto invalid;
+        obj->stringValue = p;
+    } else if (type == WS_JSON_OBJECT) {
+        obj->object.arena = arena;
+    } else if (type == WS_JSON_ARRAY) {
+        obj->array.arena = arena;
+    }
     return obj;
+
+invalid:
+    WS_LOG_ERROR("Invalid escape in json string\n");
+    if (!arena) free(obj);
+    return NULL;
 }
 
-wsJson* wsJsonInitNumber(const char* key, double val) {
-    wsJson* obj = malloc(sizeof(wsJson));
-    if (!obj) {
-        WS_LOG_ERROR("Failed to allocate memory for json object: %s\n", key);
+static wsJson* wsJsonNewKeyed(wsJsonArena* arena, wsJsonType type, const char* key) {
+    return wsJsonNew(arena, type, key, key ? strlen(key) : 0, NULL, 0, false);
+}
+
+wsJson* wsJsonArenaNode(wsJsonArena* arena, wsJsonType type, const char* key) {
+    if (!arena) {
+        WS_LOG_ERROR("Invalid input arena is NULL\n");
         return NULL;
     }
-    memset(obj, 0, sizeof(wsJson));
-    obj->type = WS_JSON_NUMBER;
-    if (key) strncpy(obj->key, key, sizeof(obj->key) - 1);
-    obj->numberValue = val;
+    return wsJsonNewKeyed(arena, type, key);
+}
+
+int32_t wsJsonArenaSetString(wsJsonArena* arena, wsJson* node, const char* val) {
+    if (!arena || !node || !val) {
+        WS_LOG_ERROR("Invalid input is NULL\n");
+        return WS_ERROR;
+    }
+    size_t len = strlen(val);
+    char* copy = wsJsonArenaAlloc(arena, len + 1);
+    if (!copy) {
+        WS_LOG_ERROR("Failed to allocate json string\n");
+        return WS_ERROR;
+    }
+    memcpy(copy, val, len + 1);
+    node->type = WS_JSON_STRING;
+    node->stringValue = copy;
+    node->stringLen = len;
+    return WS_OK;
+}
+
+wsJson* wsJsonInitChild(const char* key) {
+    return wsJsonNewKeyed(NULL, WS_JSON_OBJECT, key);
+}
+
+wsJson* wsJsonInitString(const char* key, const char* val) {
+    return wsJsonInitStringN(key, val, val ? strlen(val) : 0);
+}
+
+wsJson* wsJsonInitStringN(const char* key, const char* val, size_t len) {
+    return wsJsonNew(NULL, WS_JSON_STRING, key, key ? strlen(key) : 0, val, len, false);
+}
+
+wsJson* wsJsonInitNumber(const char* key, double val) {
+    wsJson* obj = wsJsonNewKeyed(NULL, WS_JSON_NUMBER, key);
+    if (obj) obj->numberValue = val;
     return obj;
 }
 
 wsJson* wsJsonInitBool(const char* key, bool val) {
-    wsJson* obj = malloc(sizeof(wsJson));
-    if (!obj) {
-        WS_LOG_ERROR("Failed to allocate memory for json object: %s\n", key);
-        return NULL;
-    }
-    memset(obj, 0, sizeof(wsJson));
-    obj->type = WS_JSON_BOOL;
-    if (key) strncpy(obj->key, key, sizeof(obj->key) - 1);
-    obj->boolValue = val;
+    wsJson* obj = wsJsonNewKeyed(NULL, WS_JSON_BOOL, key);
+    if (obj) obj->boolValue = val;
     return obj;
 }
 
 wsJson* wsJsonInitArray(const char* key) {
-    wsJson* obj = malloc(sizeof(wsJson));
-    if (!obj) {
-        WS_LOG_ERROR("Failed to allocate memory for json array: %s\n", key);
-        return NULL;
-    }
-    memset(obj, 0, sizeof(wsJson));
-    obj->type = WS_JSON_ARRAY;
-    if (key) strncpy(obj->key, key, sizeof(obj->key) - 1);
-    return obj;
+    return wsJsonNewKeyed(NULL, WS_JSON_ARRAY, key);
 }
 
 wsJson* wsJsonInitNull(const char* key) {
-    wsJson* obj = malloc(sizeof(wsJson));
-    if (!obj) {
-        WS_LOG_ERROR("Failed to allocate memory for json null: %s\n", key);
-        return NULL;
+    return wsJsonNewKeyed(NULL, WS_JSON_NULL, key);
+}
+
+// Doubles the list when it is full. The old list of an arena tree stays in the
+// arena until its reset.
+static int32_t wsJsonPush(wsJson*** items, int32_t* count, int32_t* capacity, wsJsonArena* arena, wsJson* item) {
+    if (*count == *capacity) {
+        int32_t grown = *capacity ? *capacity * 2 : 4;
+        wsJson** list;
+        if (arena) {
+            list = wsJsonArenaAlloc(arena, grown * sizeof(wsJson*));
+            if (list && *count) memcpy(list, *items, *count * sizeof(wsJson*));
+        } else {
+            list = realloc(*items, grown * sizeof(wsJson*));
+        }
+        if (!list) {
+            WS_LOG_ERROR("Failed to grow json child list\n");
+            return WS_ERROR;
+        }
+        *items = list;
+        *capacity = grown;
     }
-    memset(obj, 0, sizeof(wsJson));
-    obj->type = WS_JSON_NULL;
-    if (key) strncpy(obj->key, key, sizeof(obj->key) - 1);
-    return obj;
+    (*items)[(*count)++] = item;
+    return WS_OK;
+}
+
+int32_t wsJsonAddField(wsJson *parent, wsJson *child) {
+    if (!parent || !child || parent->type != WS_JSON_OBJECT) return WS_ERROR;
+    return wsJsonPush(&parent->object.children, &parent->object.childCount, &parent->object.capacity,
+                      parent->object.arena, child);
+}
+
+int32_t wsJsonAddElement(wsJson *array, wsJson *element) {
+    if (!array || !element || array->type != WS_JSON_ARRAY) return WS_ERROR;
+    return wsJsonPush(&array->array.elements, &array->array.elementCount, &array->array.capacity,
+                      array->array.arena, element);
 }
 
-void wsJsonAddField(wsJson *parent, wsJson *child) {
-    if (parent && parent->type == WS_JSON_OBJECT && parent->object.childCount < WS_JSON_OBJECT_MAX_FIELDS) {
-        parent->object.children[parent->object.childCount++] = child;
+// Serialization target, either a wsBuffer that grows or a fixed buffer that
+// keeps counting once it is full, which makes a NULL buffer a length query
+typedef struct {
+    char* out;
+    size_t size;
+    size_t len;        // length of the whole output so far
+    wsBuffer* buffer;  // out and size follow its storage
+    bool failed;       // the buffer could not grow
+} wsJsonWriter;
+
+static void wsJsonWriteSlow(wsJsonWriter* w, const char* data, size_t n) {
+    if (w->buffer && !w->failed) {
+        w->buffer->len = w->len;
+        if (wsBufferReserve(w->buffer, n) == WS_OK) {
+            w->out = (char*)w->buffer->data;
+            w->size = w->buffer->capacity;
+            memcpy(w->out + w->len, data, n);
+        } else {
+            w->failed = true;
+            w->size = 0;
+        }
+    } else if (!w->buffer && w->len < w->size) {
+        memcpy(w->out + w->len, data, w->size - w->len);
     }
+    w->len += n;
 }
 
-void wsJsonAddElement(wsJson *array, wsJson *element) {
-    if (array && array->type == WS_JSON_ARRAY && array->array.elementCount < WS_JSON_OBJECT_MAX_FIELDS) {
-        array->array.elements[array->array.elementCount++] = element;
+// Most writes are a few bytes into room that is already there
+static inline void wsJsonWrite(wsJsonWriter* w, const char* data, size_t n) {
+    if (w->len + n <= w->size) {
+        memcpy(w->out + w->len, data, n);
+        w->len += n;
+        return;
     }
+    wsJsonWriteSlow(w, data, n);
 }
 
-int32_t wsJsonToString(wsJson *obj, char *out, size_t size) {
-    if (!obj) {
-        WS_LOG_ERROR("Input json obj is NULL\n");
-        return WS_ERROR;
+static int32_t wsJsonWriterFinish(wsJsonWriter* w) {
+    if (w->buffer) {
+        if (w->failed) return WS_ERROR;
+        w->buffer->len = w->len;
+        return WS_OK;
     }
-    if (!out) {
-        WS_LOG_ERROR("Input buffer for output is NULL\n");
-        return WS_ERROR;
+    if (w->len > INT32_MAX) return WS_ERROR;
+    if (w->size) {
+        if (w->len < w->size) w->out[w->len] = '\0';
+        else if (w->len > w->size) w->out[w->size - 1] = '\0';
+    }
+    return (int32_t)w->len;
+}
+
+// Whether any of 8 bytes is a control character, a quote or a backslash
+static inline bool wsJsonNeedsEscape(uint64_t v) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t quote = v ^ (ones * '"');
+    uint64_t slash = v ^ (ones * '\\');
+    uint64_t found = (v - ones * 0x20) | (quote - ones) | (slash - ones);
+    return (found & ~v & high) != 0;
+}
+
+// Plain runs go out in one piece, only quotes, backslashes and control
+// characters are escaped. Clean text is skipped 8 bytes at a time.
+static void wsJsonWriteString(wsJsonWriter* w, const char* s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    const char* run = s;
+    wsJsonWrite(w, "\"", 1);
+    for (size_t i = 0; i < len; i++) {
+        if ((i & 7) == 0 && i + 8 <= len) {
+            uint64_t v;
+            memcpy(&v, s + i, 8);
+            if (!wsJsonNeedsEscape(v)) {
+                i += 7;
+                continue;
+            }
+        }
+        unsigned char c = s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        wsJsonWrite(w, run, s + i - run);
+        run = s + i + 1;
+        char esc[6] = { '\\', (char)c };
+        size_t n = 2;
+        switch (c) {
+            case '"': case '\\': break;
+            case '\b': esc[1] = 'b'; break;
+            case '\f': esc[1] = 'f'; break;
+            case '\n': esc[1] = 'n'; break;
+            case '\r': esc[1] = 'r'; break;
+            case '\t': esc[1] = 't'; break;
+            default:
+                memcpy(esc + 1, "u00", 3);
+                esc[4] = hex[c >> 4];
+                esc[5] = hex[c & 0xF];
+                n = 6;
+                break;
+        }
+        wsJsonWrite(w, esc, n);
+    }
+    wsJsonWrite(w, run, s + len - run);
+    wsJsonWrite(w, "\"", 1);
+}
+
+// Integers up to 2^53 are exact and skip printf, like text_len, info and seq.
+// Other numbers take the shortest of 15, 16 or 17 significant digits that
+// reads back as the same double. JSON has no NaN or infinity, they become null.
+static void wsJsonWriteNumber(wsJsonWriter* w, double value) {
+    char buf[32];
+    if (value != value || value - value != 0) {
+        wsJsonWrite(w, "null", 4);
+        return;
     }
-    
-    size_t used = 0;
 
+    if (value > -9007199254740992.0 && value < 9007199254740992.0 && value == (double)(int64_t)value) {
+        int64_t i = (int64_t)value;
+        uint64_t u = i < 0 ? -(uint64_t)i : (uint64_t)i;
+        char* p = buf + sizeof(buf);
+        do {
+            *--p = (char)('0' + u % 10);
+            u /= 10;
+        } while (u);
+        if (i < 0 || (i == 0 && 1 / value < 0)) *--p = '-';
+        wsJsonWrite(w, p, buf + sizeof(buf) - p);
+        return;
+    }
+
+    // Subnormals carry fewer digits, so they search from the first one
+    int32_t n = 0;
+    int32_t precision = value > -DBL_MIN && value < DBL_MIN ? 1 : 15;
+    for (; precision <= 17; precision++) {
+        n = snprintf(buf, sizeof(buf), "%.*g", precision, value);
+        if (strtod(buf, NULL) == value) break;
+    }
+    wsJsonWrite(w, buf, n);
+}
+
+static void wsJsonWriteValue(wsJsonWriter* w, const wsJson* obj) {
     switch (obj->type) {
         case WS_JSON_STRING:
-            used += snprintf(out + used, size - used, "\"%s\"", obj->stringValue);
+            wsJsonWriteString(w, obj->stringValue, obj->stringLen);
             break;
         case WS_JSON_NUMBER:
-            used += snprintf(out + used, size - used, "%g", obj->numberValue);
+            wsJsonWriteNumber(w, obj->numberValue);
             break;
         case WS_JSON_BOOL:
-            used += snprintf(out + used, size - used, "%s", obj->boolValue ? "true" : "false");
+            if (obj->boolValue) wsJsonWrite(w, "true", 4);
+            else wsJsonWrite(w, "false", 5);
             break;
         case WS_JSON_NULL:
-            used += snprintf(out + used, size - used, "null");
+            wsJsonWrite(w, "null", 4);
             break;
         case WS_JSON_OBJECT:
-            used += snprintf(out + used, size - used, "{");
+            wsJsonWrite(w, "{", 1);
             for (int32_t i = 0; i < obj->object.childCount; i++) {
                 wsJson* child = obj->object.children[i];
-                if (i > 0) {
-                    used += snprintf(out + used, size - used, ",");
-                }
-                used += snprintf(out + used, size - used, "\"%s\": ", child->key);
-                wsJsonToString(child, out + used, size - used);
-                used = strlen(out);
+                if (i > 0) wsJsonWrite(w, ",", 1);
+                wsJsonWriteString(w, child->key, strlen(child->key));
+                wsJsonWrite(w, ": ", 2);
+                wsJsonWriteValue(w, child);
             }
-            used += snprintf(out + used, size - used, "}");
+            wsJsonWrite(w, "}", 1);
             break;
         case WS_JSON_ARRAY:
-            used += snprintf(out + used, size - used, "[");
+            wsJsonWrite(w, "[", 1);
             for (int32_t i = 0; i < obj->array.elementCount; i++) {
-                wsJson* element = obj->array.elements[i];
-                if (i > 0) {
-                    used += snprintf(out + used, size - used, ",");
-                }
-                wsJsonToString(element, out + used, size - used);
-                used = strlen(out);
+                if (i > 0) wsJsonWrite(w, ",", 1);
+                wsJsonWriteValue(w, obj->array.elements[i]);
             }
-            used += snprintf(out + used, size - used, "]");
+            wsJsonWrite(w, "]", 1);
             break;
-        default:
-            WS_LOG_ERROR("Failed to parse json into string\n");
-            return WS_ERROR;
     }
-
-    return used;
 }
 
-static char* skipWhitespaces(const char* string) {
-    while (*string && isspace((unsigned char)*string)) string++;
-    return (char*)string;
+int32_t wsJsonToString(wsJson *obj, char *out, size_t size) {
+    if (!obj) {
+        WS_LOG_ERROR("Input json obj is NULL\n");
+        return WS_ERROR;
+    }
+    if (!out && size) {
+        WS_LOG_ERROR("Input buffer for output is NULL\n");
+        return WS_ERROR;
+    }
+
+    wsJsonWriter w = { .out = out, .size = size };
+    wsJsonWriteValue(&w, obj);
+    return wsJsonWriterFinish(&w);
 }
 
-static char* parseString(const char** string) {
-    (*string)++; // skip "
-    const char* start = *string;
+int32_t wsJsonToBuffer(wsJson* obj, wsBuffer* out) {
+    if (!obj || !out) {
+        WS_LOG_ERROR("Invalid input is NULL\n");
+        return WS_ERROR;
+    }
 
-    // Find end 
-    while (**string && **string != '"') (*string)++;
-    size_t len = *string - start;
+    size_t start = out->len;
+    wsJsonWriter w = { .out = (char*)out->data, .size = out->capacity, .len = out->len, .buffer = out };
+    wsJsonWriteValue(&w, obj);
+    if (wsJsonWriterFinish(&w) != WS_OK) {
+        out->len = start;
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
 
-    char* out = malloc(len + 1);
-    if (!out) {
-        WS_LOG_ERROR("Failed to allocate for parsing json key\n");
-        return NULL;
+int32_t wsJsonQuote(const char* s, char* out, size_t size) {
+    if (!s || (!out && size)) {
+        WS_LOG_ERROR("Invalid input is NULL\n");
+        return WS_ERROR;
     }
-    strncpy(out, start, len);
-    out[len] = '\0';
-    if (**string == '"') (*string)++; // skip closing " 
-    return out;
+
+    wsJsonWriter w = { .out = out, .size = size };
+    wsJsonWriteString(&w, s, strlen(s));
+    return wsJsonWriterFinish(&w);
 }
 
-static wsJson* parseValue(const char** string);
+// Bits of one 64 byte block, bit i stands for byte i
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t structural; // { } [ ] : ,
+    uint64_t control;    // below 0x20
+} wsJsonBlock;
 
-static wsJson* parseArray(const char** string) {
-    wsJson* array = wsJsonInitArray(NULL);
-    if (!array) {
-        WS_LOG_ERROR("Failed to allocate json array\n");
-        return NULL;
-    }
+#define WS_JSON_INLINE static inline __attribute__((always_inline))
 
-    *string = skipWhitespaces(*string);
-    if (**string != '[') {
-        WS_LOG_ERROR("Failed to parse array: missing '['\n");
-        wsJsonFree(array);
-        return NULL;
+WS_JSON_INLINE wsJsonBlock wsJsonClassifyScalar(const uint8_t* p) {
+    wsJsonBlock block = {0};
+    for (int32_t i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        if (p[i] < 0x20) block.control |= bit;
+        switch (p[i]) {
+            case '"': block.quote |= bit; break;
+            case '\\': block.backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': block.structural |= bit; break;
+        }
     }
-    (*string)++;
+    return block;
+}
 
-    while (**string) {
-        *string = skipWhitespaces(*string);
-        if (**string == ']') {
-            (*string)++;
-            break;
+// Stage one: the offsets of every quote that opens or closes a string and of
+// every structural character outside of strings, in order. index has room for
+// len entries. *checkStrings is set when a string holds a backslash or a
+// control character, only then stage two reads strings byte by byte. Each
+// instruction set gets its own copy with the classifier inlined.
+WS_JSON_INLINE size_t wsJsonIndexWith(const char* buf, size_t len, uint32_t* index, bool* checkStrings,
+                                      wsJsonBlock (*classify)(const uint8_t* p)) {
+    uint64_t escapeCarry = 0; // the previous block ended in an escaping backslash
+    uint64_t stringCarry = 0; // all ones when the previous block ended inside a string
+    uint8_t tail[64];
+    size_t count = 0;
+    uint64_t suspect = 0;
+
+    for (size_t base = 0; base < len; base += 64) {
+        const uint8_t* p = (const uint8_t*)buf + base;
+        if (len - base < 64) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, len - base);
+            p = tail;
         }
+        wsJsonBlock block = classify(p);
 
-        wsJson* element = parseValue(string);
-        if (!element) {
-            WS_LOG_ERROR("Failed to parse array element\n");
-            wsJsonFree(array);
-            return NULL;
+        // Backslashes are rare in chat messages. Each one escapes the next
+        // byte, unless it is escaped itself.
+        uint64_t escaped = escapeCarry;
+        uint64_t backslash = block.backslash & ~escapeCarry;
+        escapeCarry = 0;
+        while (backslash) {
+            int32_t bit = __builtin_ctzll(backslash);
+            if (bit == 63) {
+                escapeCarry = 1;
+            } else {
+                escaped |= 1ULL << (bit + 1);
+                backslash &= ~(1ULL << (bit + 1));
+            }
+            backslash &= backslash - 1;
         }
 
-        wsJsonAddElement(array, element);
+        // The prefix xor of the quotes covers each opening quote up to its closing one
+        uint64_t quote = block.quote & ~escaped;
+        uint64_t inString = quote;
+        inString ^= inString << 1;
+        inString ^= inString << 2;
+        inString ^= inString << 4;
+        inString ^= inString << 8;
+        inString ^= inString << 16;
+        inString ^= inString << 32;
+        inString ^= stringCarry;
+        stringCarry = (uint64_t)((int64_t)inString >> 63);
+        suspect |= block.backslash | (block.control & inString);
 
-        *string = skipWhitespaces(*string);
-        if (**string == ',') (*string)++;
+        uint64_t bits = (block.structural & ~inString) | quote;
+        while (bits) {
+            index[count++] = (uint32_t)(base + __builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
     }
-
-    return array;
+    *checkStrings = suspect != 0;
+    return count;
 }
 
-static wsJson* parseValue(const char** string) {
-    (*string) = skipWhitespaces(*string);
+static wsJsonIsa wsJsonIsaForced = WS_JSON_ISA_AUTO;
 
-    // Is String 
-    if (**string == '"') {
-        char* val = parseString(string);
-        if (!val) {
-            WS_LOG_ERROR("Failed to parse json value when parsing string\n");
-            return NULL;
-        }
-        wsJson* node = calloc(1, sizeof(wsJson));
-        if (!node) {
-            WS_LOG_ERROR("Failed to allocate json node when parsing string\n");
-            free(val);
-            return NULL;
-        }
-        node->type = WS_JSON_STRING;
+static size_t wsJsonIndexScalar(const char* buf, size_t len, uint32_t* index, bool* checkStrings) {
+    return wsJsonIndexWith(buf, len, index, checkStrings, wsJsonClassifyScalar);
+}
 
-        size_t valLen = strlen(val);
-        if (valLen + 1 > WS_JSON_MAX_VALUE_SIZE) {
-            WS_LOG_ERROR("Value string is too long\n");
-            free(val);
-            wsJsonFree(node);
-            return NULL;
-        }
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
 
-        strncpy(node->stringValue, val, valLen);
-        node->stringValue[valLen] = '\0';
-        free(val);
-        return node;
+// Brackets and braces only differ in bit 5, one OR folds [ and ] onto { and }
+WS_JSON_INLINE wsJsonBlock wsJsonClassifySse2(const uint8_t* p) {
+    wsJsonBlock block = {0};
+    for (int32_t i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i structural = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        block.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+        block.backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+        block.structural |= (uint64_t)(uint16_t)_mm_movemask_epi8(structural) << i;
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+        block.control |= (uint64_t)(uint16_t)_mm_movemask_epi8(control) << i;
     }
-    
-    // Is Field/Object 
-    else if (**string == '{') {
-        return wsStringToJson(string);
+    return block;
+}
+
+__attribute__((target("avx2"))) WS_JSON_INLINE wsJsonBlock wsJsonClassifyAvx2(const uint8_t* p) {
+    wsJsonBlock block = {0};
+    for (int32_t i = 0; i < 64; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i structural = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                            _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+        block.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+        block.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+        block.structural |= (uint64_t)(uint32_t)_mm256_movemask_epi8(structural) << i;
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v);
+        block.control |= (uint64_t)(uint32_t)_mm256_movemask_epi8(control) << i;
     }
+    return block;
+}
 
-    // Is Digit 
-    else if (isdigit(**string) || **string == '-') {
-        char* endPtr;
-        double num = strtod(*string, &endPtr);
-        wsJson* node = calloc(1, sizeof(wsJson));
-        if (!node) {
-            WS_LOG_ERROR("Failed to allocate json node when parsing string\n");
-            return NULL;
-        }
-        node->type = WS_JSON_NUMBER;
-        node->numberValue = num;
-        *string = endPtr;
-        return node;
+static size_t wsJsonIndexSse2(const char* buf, size_t len, uint32_t* index, bool* checkStrings) {
+    return wsJsonIndexWith(buf, len, index, checkStrings, wsJsonClassifySse2);
+}
+
+__attribute__((target("avx2")))
+static size_t wsJsonIndexAvx2(const char* buf, size_t len, uint32_t* index, bool* checkStrings) {
+    return wsJsonIndexWith(buf, len, index, checkStrings, wsJsonClassifyAvx2);
+}
+
+// SSE2 is part of x86_64, AVX2 is picked at runtime so one build runs everywhere
+static size_t wsJsonIndex(const char* buf, size_t len, uint32_t* index, bool* checkStrings) {
+    switch (wsJsonIsaForced) {
+        case WS_JSON_ISA_SCALAR: return wsJsonIndexScalar(buf, len, index, checkStrings);
+        case WS_JSON_ISA_SSE2: return wsJsonIndexSse2(buf, len, index, checkStrings);
+        case WS_JSON_ISA_AVX2: return wsJsonIndexAvx2(buf, len, index, checkStrings);
+        case WS_JSON_ISA_AUTO: break;
     }
+    if (__builtin_cpu_supports("avx2")) return wsJsonIndexAvx2(buf, len, index, checkStrings);
+    return wsJsonIndexSse2(buf, len, index, checkStrings);
+}
 
-    // Is Bool (true)
-    else if (strncmp(*string, "true", 4) == 0) {
-        wsJson* node = calloc(1, sizeof(wsJson));
-        if (!node) {
-            WS_LOG_ERROR("Failed to allocate json node when parsing string\n");
-            return NULL;
+bool wsJsonSetIsa(wsJsonIsa isa) {
+    if (isa == WS_JSON_ISA_AVX2 && !__builtin_cpu_supports("avx2")) return false;
+    wsJsonIsaForced = isa;
+    return true;
+}
+#else
+static size_t wsJsonIndex(const char* buf, size_t len, uint32_t* index, bool* checkStrings) {
+    return wsJsonIndexScalar(buf, len, index, checkStrings);
+}
+
+bool wsJsonSetIsa(wsJsonIsa isa) {
+    if (isa != WS_JSON_ISA_AUTO && isa != WS_JSON_ISA_SCALAR) return false;
+    wsJsonIsaForced = isa;
+    return true;
+}
+#endif
+
+// Both parsers check scalars against RFC 8259 with these two. From the first
+// byte of a string's contents to its closing quote, NULL for raw control
+// characters, unknown escapes and surrogates that are not a pair.
+static const char* wsJsonStringEnd(const char* p, const char* end) {
+    for (;;) {
+        while (end - p >= 8) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            if (wsJsonNeedsEscape(v)) break;
+            p += 8;
         }
-        node->type = WS_JSON_BOOL;
-        node->boolValue = true;
-        *string += 4;
-        return node;
-    }
+        if (p >= end) return NULL;
 
-    // Is Bool (false)
-    else if (strncmp(*string, "false", 5) == 0) {
-        wsJson* node = calloc(1, sizeof(wsJson));
-        if (!node) {
-            WS_LOG_ERROR("Failed to allocate json node when parsing string\n");
-            return NULL;
+        unsigned char c = *p;
+        if (c == '"') return p;
+        if (c < 0x20) return NULL;
+        if (c != '\\') {
+            p++;
+            continue;
         }
-        node->type = WS_JSON_BOOL;
-        node->boolValue = false;
-        *string += 5;
-        return node;
-    }
 
-    // Is Null
-    else if (strncmp(*string, "null", 4) == 0) {
-        wsJson* node = calloc(1, sizeof(wsJson));
-        if (!node) {
-            WS_LOG_ERROR("Failed to allocate json node when parsing null\n");
-            return NULL;
+        if (end - p < 2) return NULL;
+        if (p[1] != 'u') {
+            if (!memchr("\"\\/bfnrt", p[1], 8)) return NULL;
+            p += 2;
+            continue;
+        }
+        uint32_t cp, low;
+        if (end - p < 6 || wsJsonHex4(p + 2, &cp) != WS_OK) return NULL;
+        p += 6;
+        if (cp >= 0xDC00 && cp <= 0xDFFF) return NULL;
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || wsJsonHex4(p + 2, &low) != WS_OK ||
+                low < 0xDC00 || low > 0xDFFF) {
+                return NULL;
+            }
+            p += 6;
         }
-        node->type = WS_JSON_NULL;
-        *string += 4;
-        return node;
     }
+}
 
-    // Is Array
-    else if (**string == '[') {
-        return parseArray(string);
+static const char* wsJsonDigitsEnd(const char* p, const char* end) {
+    const char* start = p;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+    return p > start ? p : NULL;
+}
+
+// Past the number at p, NULL for leading zeros, a bare dot or exponent
+static const char* wsJsonNumberEnd(const char* p, const char* end) {
+    if (p < end && *p == '-') p++;
+    if (p < end && *p == '0') p++;
+    else if (!(p = wsJsonDigitsEnd(p, end))) return NULL;
+    if (p < end && *p == '.' && !(p = wsJsonDigitsEnd(p + 1, end))) return NULL;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) p++;
+        if (!(p = wsJsonDigitsEnd(p, end))) return NULL;
     }
+    return p;
+}
 
-    return NULL;
+// Stage two walks the index, only scalars and the gaps between entries are
+// read byte by byte
+typedef struct {
+    const char* buf;
+    const char* end;
+    const uint32_t* index;
+    size_t count;
+    size_t next;     // first unused index entry
+    size_t pos;      // first byte after the last token
+    int32_t depth;
+    bool checkStrings; // some string holds a backslash or a control character
+    wsJsonArena* arena;
+} wsJsonParser;
+
+static size_t skipWhitespaces(const char* buf, size_t pos) {
+    while (buf[pos] == ' ' || buf[pos] == '\n' || buf[pos] == '\r' || buf[pos] == '\t') pos++;
+    return pos;
 }
 
-wsJson* wsStringToJson(const char** string) {
-    if (!string) {
-        WS_LOG_ERROR("Invalid input paramerter is NULL\n");
-        return NULL;
+// Takes the next entry if it is c and only whitespace comes before it
+static bool wsJsonExpect(wsJsonParser* parser, char c) {
+    if (parser->next >= parser->count) return false;
+    size_t at = parser->index[parser->next];
+    if (parser->buf[at] != c || skipWhitespaces(parser->buf, parser->pos) != at) return false;
+    parser->next++;
+    parser->pos = at + 1;
+    return true;
+}
+
+// Called after the opening quote, nothing inside a string is indexed so the
+// next entry closes it
+static bool parseString(wsJsonParser* parser, const char** start, size_t* len) {
+    if (parser->next >= parser->count) return false;
+    size_t open = parser->index[parser->next - 1];
+    size_t close = parser->index[parser->next++];
+    if (parser->checkStrings &&
+        wsJsonStringEnd(parser->buf + open + 1, parser->buf + close + 1) != parser->buf + close) {
+        return false;
     }
+    *start = parser->buf + open + 1;
+    *len = close - open - 1;
+    parser->pos = close + 1;
+    return true;
+}
 
-    wsJson* root = wsJsonInitChild(NULL);
+// Integers of up to 15 digits are exact in a double and skip strtod
+static const char* parseNumber(const char* p, const char* end, double* out) {
+    const char* start = p;
+    end = wsJsonNumberEnd(p, end);
+    if (!end) return NULL;
+
+    bool negative = *p == '-';
+    if (negative) p++;
+    const char* digits = p;
+    uint64_t value = 0;
+    while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (uint64_t)(*p++ - '0');
+    if (p == end && p - digits <= 15) {
+        *out = negative ? -(double)value : (double)value;
+        return end;
+    }
+
+    *out = strtod(start, NULL);
+    return end;
+}
+
+// Nodes of an arena go away with its reset
+static void releaseNode(wsJson* node, wsJsonArena* arena) {
+    if (!arena) wsJsonFree(node);
+}
+
+static wsJson* parseValue(wsJsonParser* parser, const char* key, size_t keyLen);
+
+// Called after the opening brace
+static wsJson* parseObject(wsJsonParser* parser, const char* key, size_t keyLen) {
+    wsJson* root = wsJsonNew(parser->arena, WS_JSON_OBJECT, key, keyLen, NULL, 0, true);
     if (!root) {
         WS_LOG_ERROR("Failed to allocate json object\n");
         return NULL;
     }
+    if (wsJsonExpect(parser, '}')) return root;
 
-    *string = skipWhitespaces(*string);
-    if (**string != '{') {
-        WS_LOG_ERROR("Failed to convert string to json\n");
-        wsJsonFree(root);
+    do {
+        const char* field;
+        size_t fieldLen;
+        if (!wsJsonExpect(parser, '"') || !parseString(parser, &field, &fieldLen) || !wsJsonExpect(parser, ':')) {
+            goto fail;
+        }
+        wsJson* val = parseValue(parser, field, fieldLen);
+        if (!val) {
+            WS_LOG_ERROR("Failed to parse json value\n");
+            goto fail;
+        }
+        if (wsJsonAddField(root, val) != WS_OK) {
+            releaseNode(val, parser->arena);
+            goto fail;
+        }
+    } while (wsJsonExpect(parser, ','));
+
+    if (wsJsonExpect(parser, '}')) return root;
+fail:
+    releaseNode(root, parser->arena);
+    return NULL;
+}
+
+// Called after the opening bracket
+static wsJson* parseArray(wsJsonParser* parser, const char* key, size_t keyLen) {
+    wsJson* array = wsJsonNew(parser->arena, WS_JSON_ARRAY, key, keyLen, NULL, 0, true);
+    if (!array) {
+        WS_LOG_ERROR("Failed to allocate json array\n");
         return NULL;
     }
-    (*string)++;
+    if (wsJsonExpect(parser, ']')) return array;
 
-    while (**string) {
-        *string = skipWhitespaces(*string);
-        if (**string == '}') {
-            (*string)++;
-            break;
+    do {
+        wsJson* element = parseValue(parser, NULL, 0);
+        if (!element) {
+            WS_LOG_ERROR("Failed to parse array element\n");
+            goto fail;
         }
-
-        // read key
-        char* key = parseString(string);
-        if (!key) {
-            WS_LOG_ERROR("Failed to parse json key\n");
-            wsJsonFree(root);
-            break;
+        if (wsJsonAddElement(array, element) != WS_OK) {
+            releaseNode(element, parser->arena);
+            goto fail;
         }
+    } while (wsJsonExpect(parser, ','));
 
-        *string = skipWhitespaces(*string);
-        if (**string != ':') {
-            free(key);
-            break;
-        }
-        (*string)++;
+    if (wsJsonExpect(parser, ']')) return array;
+fail:
+    releaseNode(array, parser->arena);
+    return NULL;
+}
 
-        // Read value
-        *string = skipWhitespaces(*string);
-        wsJson* val = parseValue(string);
-        if (!val) {
-            WS_LOG_ERROR("Failed to parse json value\n");
-            free(key);
-            wsJsonFree(root);
-            break;
-        }
+static wsJson* parseValue(wsJsonParser* parser, const char* key, size_t keyLen) {
+    size_t pos = skipWhitespaces(parser->buf, parser->pos);
+    const char* p = parser->buf + pos;
+    wsJson* node = NULL;
 
-        size_t keyLen = strlen(key);
-        if (keyLen + 1 > WS_JSON_MAX_KEY_SIZE) {
-            WS_LOG_ERROR("Json key Size is too long\n");
-            free(key);
-            wsJsonFree(val);
-            wsJsonFree(root);
-            break;
+    // Is String 
+    if (*p == '"') {
+        const char* value;
+        size_t len;
+        if (!wsJsonExpect(parser, '"') || !parseString(parser, &value, &len)) return NULL;
+        return wsJsonNew(parser->arena, WS_JSON_STRING, key, keyLen, value, len, true);
+    }
+
+    // Is Field/Object or Array
+    else if (*p == '{' || *p == '[') {
+        if (parser->depth == WS_JSON_MAX_DEPTH) {
+            WS_LOG_ERROR("Json is nested too deep\n");
+            return NULL;
         }
-        strncpy(val->key, key, keyLen);
-        val->key[keyLen] = '\0';
-        wsJsonAddField(root, val);
+        if (!wsJsonExpect(parser, *p)) return NULL;
+        parser->depth++;
+        node = parser->buf[pos] == '{' ? parseObject(parser, key, keyLen) : parseArray(parser, key, keyLen);
+        parser->depth--;
+        return node;
+    }
 
-        *string = skipWhitespaces(*string);
-        if (**string == ',') (*string)++;
+    // Is Digit 
+    else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        double num;
+        const char* end = parseNumber(p, parser->end, &num);
+        if (!end) return NULL;
+        node = wsJsonNew(parser->arena, WS_JSON_NUMBER, key, keyLen, NULL, 0, true);
+        if (node) node->numberValue = num;
+        pos = end - parser->buf;
+    }
 
-        free(key);
+    // Is Bool
+    else if (strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0) {
+        node = wsJsonNew(parser->arena, WS_JSON_BOOL, key, keyLen, NULL, 0, true);
+        if (node) node->boolValue = *p == 't';
+        pos += *p == 't' ? 4 : 5;
+    }
+
+    // Is Null
+    else if (strncmp(p, "null", 4) == 0) {
+        node = wsJsonNew(parser->arena, WS_JSON_NULL, key, keyLen, NULL, 0, true);
+        pos += 4;
+    }
+
+    parser->pos = pos;
+    return node;
+}
+
+// Both stages run over the whole string, the index lives in the arena or is
+// malloced for the parse
+static wsJson* wsJsonParse(const char** string, wsJsonArena* arena) {
+    const char* buf = *string;
+    size_t len = strlen(buf);
+    if (len >= UINT32_MAX) {
+        WS_LOG_ERROR("Json string is too long\n");
+        return NULL;
+    }
+
+    size_t indexSize = (len + 1) * sizeof(uint32_t);
+    uint32_t* index = arena ? wsJsonArenaAlloc(arena, indexSize) : malloc(indexSize);
+    if (!index) {
+        WS_LOG_ERROR("Failed to allocate json index\n");
+        return NULL;
     }
 
+    bool checkStrings;
+    size_t count = wsJsonIndex(buf, len, index, &checkStrings);
+    wsJsonParser parser = {
+        .buf = buf,
+        .end = buf + len,
+        .index = index,
+        .count = count,
+        .depth = 1,
+        .checkStrings = checkStrings,
+        .arena = arena,
+    };
+    wsJson* root = wsJsonExpect(&parser, '{') ? parseObject(&parser, NULL, 0) : NULL;
+    if (root) *string = buf + parser.pos;
+    else WS_LOG_ERROR("Failed to convert string to json\n");
+
+    if (!arena) free(index);
     return root;
 }
 
+wsJson* wsStringToJson(const char** string) {
+    if (!string || !*string) {
+        WS_LOG_ERROR("Invalid input paramerter is NULL\n");
+        return NULL;
+    }
+    return wsJsonParse(string, NULL);
+}
+
+wsJson* wsStringToJsonArena(const char** string, wsJsonArena* arena) {
+    if (!string || !*string || !arena) {
+        WS_LOG_ERROR("Invalid input paramerter is NULL\n");
+        return NULL;
+    }
+    return wsJsonParse(string, arena);
+}
+
 wsJson* wsJsonGet(wsJson* obj, const char* key) {
     if (!obj || !key) {
         WS_LOG_ERROR("Invalid input is NULL\n");
@@ -426,15 +1014,284 @@ void wsJsonFree(wsJson *obj) {
         WS_LOG_ERROR("JSON obj is NULL on free!\n");
         return;
     }
+    if (obj->inArena) return;
     if (obj->type == WS_JSON_OBJECT) {
         for (int32_t i = 0; i < obj->object.childCount; i++) {
             wsJsonFree(obj->object.children[i]);
         }
+        free(obj->object.children);
     } else if (obj->type == WS_JSON_ARRAY) {
         for (int32_t i = 0; i < obj->array.elementCount; i++) {
             wsJsonFree(obj->array.elements[i]);
         }
+        free(obj->array.elements);
     }
     free(obj);
 }
 
+wsJsonType wsJsonGetType(const wsJson* obj) {
+    return obj ? obj->type : WS_JSON_NULL;
+}
+
+const char* wsJsonGetKey(const wsJson* obj) {
+    return obj ? obj->key : wsJsonNoKey;
+}
+
+const char* wsJsonStringValue(const wsJson* obj, size_t* len) {
+    if (!obj || obj->type != WS_JSON_STRING) return NULL;
+    if (len) *len = obj->stringLen;
+    return obj->stringValue;
+}
+
+double wsJsonNumberValue(const wsJson* obj) {
+    return obj && obj->type == WS_JSON_NUMBER ? obj->numberValue : 0;
+}
+
+bool wsJsonBoolValue(const wsJson* obj) {
+    return obj && obj->type == WS_JSON_BOOL && obj->boolValue;
+}
+
+int32_t wsJsonCount(const wsJson* obj) {
+    if (!obj) return 0;
+    if (obj->type == WS_JSON_OBJECT) return obj->object.childCount;
+    if (obj->type == WS_JSON_ARRAY) return obj->array.elementCount;
+    return 0;
+}
+
+wsJson* wsJsonAt(const wsJson* obj, int32_t index) {
+    if (index < 0 || index >= wsJsonCount(obj)) return NULL;
+    return obj->type == WS_JSON_OBJECT ? obj->object.children[index] : obj->array.elements[index];
+}
+
+
+// The on-demand scanner checks the text like the parser does but only keeps
+// the slices it was asked for
+typedef struct {
+    const char* p;
+    const char* end;
+    wsJsonSlice* out;
+    uint32_t pending; // paths not found yet
+    int32_t depth;
+    bool duplicate;   // a key on the way to a path came twice in one object
+} wsJsonScanner;
+
+static void scanWhitespace(wsJsonScanner* s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\n' || *s->p == '\r' || *s->p == '\t')) s->p++;
+}
+
+static bool scanChar(wsJsonScanner* s, char c) {
+    scanWhitespace(s);
+    if (s->p >= s->end || *s->p != c) return false;
+    s->p++;
+    return true;
+}
+
+// From the opening quote past the closing one
+static bool scanString(wsJsonScanner* s) {
+    const char* quote = wsJsonStringEnd(s->p + 1, s->end);
+    if (!quote) return false;
+    s->p = quote + 1;
+    return true;
+}
+
+static bool scanNumber(wsJsonScanner* s) {
+    const char* end = wsJsonNumberEnd(s->p, s->end);
+    if (!end) return false;
+    s->p = end;
+    return true;
+}
+
+static bool scanLiteral(wsJsonScanner* s, const char* word, size_t len) {
+    if ((size_t)(s->end - s->p) < len || memcmp(s->p, word, len) != 0) return false;
+    s->p += len;
+    return true;
+}
+
+static wsJsonType wsJsonSliceType(char c) {
+    switch (c) {
+        case '"': return WS_JSON_STRING;
+        case '{': return WS_JSON_OBJECT;
+        case '[': return WS_JSON_ARRAY;
+        case 't': case 'f': return WS_JSON_BOOL;
+        case 'n': return WS_JSON_NULL;
+        default: return WS_JSON_NUMBER;
+    }
+}
+
+static bool scanValue(wsJsonScanner* s, uint32_t live, const char** segments);
+
+// Called on the opening brace. live holds the paths that lead into this
+// object, segments their part that is still to match.
+static bool scanObject(wsJsonScanner* s, uint32_t live, const char** segments) {
+    uint32_t seen = 0;
+    s->p++;
+    if (scanChar(s, '}')) return true;
+
+    do {
+        scanWhitespace(s);
+        if (s->p >= s->end || *s->p != '"') return false;
+        const char* key = s->p + 1;
+        if (!scanString(s)) return false;
+        size_t keyLen = s->p - 1 - key;
+        if (!scanChar(s, ':')) return false;
+
+        // Readers decode keys, so "na\u006de" is a name too. Decoding never
+        // grows a key, a long one takes the heap.
+        char small[128];
+        char* decoded = NULL;
+        if (live && memchr(key, '\\', keyLen)) {
+            decoded = keyLen < sizeof(small) ? small : malloc(keyLen + 1);
+            if (!decoded || wsJsonUnescape(decoded, key, keyLen, &keyLen) != WS_OK) {
+                if (decoded != small) free(decoded);
+                return false;
+            }
+            key = decoded;
+        }
+
+        // Which paths go on into the value and which end at it. A second key
+        // of the same name could carry a value the scan never looked at.
+        const char* next[WS_JSON_PATH_MAX];
+        uint32_t deeper = 0;
+        uint32_t found = 0;
+        for (uint32_t bits = live; bits; bits &= bits - 1) {
+            int32_t i = __builtin_ctz(bits);
+            const char* dot = strchr(segments[i], '.');
+            size_t segmentLen = dot ? (size_t)(dot - segments[i]) : strlen(segments[i]);
+            if (segmentLen != keyLen || memcmp(segments[i], key, keyLen) != 0) continue;
+            if (dot) {
+                deeper |= 1u << i;
+                next[i] = dot + 1;
+            } else {
+                found |= 1u << i;
+            }
+        }
+        if (decoded != small) free(decoded);
+        if ((deeper | found) & seen) {
+            s->duplicate = true;
+            return false;
+        }
+        seen |= deeper | found;
+        found &= s->pending;
+
+        scanWhitespace(s);
+        const char* start = s->p;
+        if (!scanValue(s, deeper, next)) return false;
+        for (; found; found &= found - 1) {
+            int32_t i = __builtin_ctz(found);
+            s->out[i] = (wsJsonSlice){ .data = start, .len = s->p - start, .type = wsJsonSliceType(*start) };
+            s->pending &= ~(1u << i);
+        }
+    } while (scanChar(s, ','));
+
+    return scanChar(s, '}');
+}
+
+static bool scanArray(wsJsonScanner* s) {
+    s->p++;
+    if (scanChar(s, ']')) return true;
+    do {
+        if (!scanValue(s, 0, NULL)) return false;
+    } while (scanChar(s, ','));
+    return scanChar(s, ']');
+}
+
+static bool scanValue(wsJsonScanner* s, uint32_t live, const char** segments) {
+    scanWhitespace(s);
+    if (s->p >= s->end) return false;
+
+    switch (*s->p) {
+        case '"':
+            return scanString(s);
+        case '{':
+        case '[': {
+            if (s->depth == WS_JSON_MAX_DEPTH) return false;
+            s->depth++;
+            bool ok = *s->p == '{' ? scanObject(s, live, segments) : scanArray(s);
+            s->depth--;
+            return ok;
+        }
+        case 't':
+            return scanLiteral(s, "true", 4);
+        case 'f':
+            return scanLiteral(s, "false", 5);
+        case 'n':
+            return scanLiteral(s, "null", 4);
+        default:
+            return scanNumber(s);
+    }
+}
+
+int32_t wsJsonPathFindAll(const char* buf, size_t len, const char* const* paths, wsJsonSlice* out, int32_t count) {
+    if (!buf || !paths || !out || count < 0 || count > WS_JSON_PATH_MAX) {
+        WS_LOG_ERROR("Invalid input for json path lookup\n");
+        return WS_ERROR;
+    }
+
+    wsJsonScanner s = { .p = buf, .end = buf + len, .out = out, .depth = 1 };
+    const char* segments[WS_JSON_PATH_MAX];
+    uint32_t root = 0;
+    for (int32_t i = 0; i < count; i++) {
+        out[i] = (wsJsonSlice){0};
+        segments[i] = paths[i];
+        if (paths[i][0]) s.pending |= 1u << i;
+        else root |= 1u << i;
+    }
+
+    scanWhitespace(&s);
+    const char* start = s.p;
+    if (s.p >= s.end || *s.p != '{' || !scanObject(&s, s.pending, segments)) {
+        for (int32_t i = 0; i < count; i++) out[i] = (wsJsonSlice){0};
+        return s.duplicate ? WS_JSON_DUPLICATE : WS_ERROR;
+    }
+    for (; root; root &= root - 1) {
+        out[__builtin_ctz(root)] = (wsJsonSlice){ .data = start, .len = s.p - start, .type = WS_JSON_OBJECT };
+    }
+    return WS_OK;
+}
+
+int32_t wsJsonPathFind(const char* buf, size_t len, const char* path, wsJsonSlice* out) {
+    if (wsJsonPathFindAll(buf, len, &path, out, 1) != WS_OK) return WS_ERROR;
+    return out->data ? WS_OK : WS_ERROR;
+}
+
+const char* wsJsonSliceString(const wsJsonSlice* slice, wsJsonArena* arena, size_t* len) {
+    if (!slice || !arena || !slice->data || slice->type != WS_JSON_STRING) return NULL;
+    char* out = wsJsonArenaAlloc(arena, slice->len - 1);
+    size_t outLen;
+    if (!out || wsJsonCopy(out, slice->data + 1, slice->len - 2, true, &outLen) != WS_OK) return NULL;
+    if (len) *len = outLen;
+    return out;
+}
+
+double wsJsonSliceNumber(const wsJsonSlice* slice) {
+    double value;
+    if (!slice || !slice->data || slice->type != WS_JSON_NUMBER || !parseNumber(slice->data, slice->data + slice->len, &value)) return -1;
+    return value;
+}
+
+int32_t wsJsonSplice(const char* buf, size_t len, const wsJsonEdit* edits, int32_t count, char* out, size_t size) {
+    size_t total = len;
+    const char* prev = buf;
+    for (int32_t i = 0; i < count; i++) {
+        if (edits[i].at < prev || edits[i].len > (size_t)(buf + len - edits[i].at)) {
+            WS_LOG_ERROR("Json edits overlap or leave the buffer\n");
+            return WS_ERROR;
+        }
+        total = total - edits[i].len + edits[i].valueLen;
+        prev = edits[i].at + edits[i].len;
+    }
+    if (total > INT32_MAX) return WS_ERROR;
+    if (!out || size < total) return (int32_t)total;
+
+    char* p = out;
+    prev = buf;
+    for (int32_t i = 0; i < count; i++) {
+        memcpy(p, prev, edits[i].at - prev);
+        p += edits[i].at - prev;
+        memcpy(p, edits[i].value, edits[i].valueLen);
+        p += edits[i].valueLen;
+        prev = edits[i].at + edits[i].len;
+    }
+    memcpy(p, prev, buf + len - prev);
+    return (int32_t)total;
+}
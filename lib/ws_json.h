@@ -3,10 +3,12 @@
 #define WS_JSON_H
 
 #include "ws_globals.h"
+#include "ws_frame.h"
 
-#define WS_JSON_MAX_KEY_SIZE 64 
-#define WS_JSON_MAX_VALUE_SIZE 256
-#define WS_JSON_OBJECT_MAX_FIELDS 16
+#define WS_JSON_ARENA_BLOCK_SIZE 16384
+#define WS_JSON_MAX_DEPTH 256 // deeper input is rejected instead of running out of stack
+#define WS_JSON_PATH_MAX 32
+#define WS_JSON_DUPLICATE -2 // wsJsonPathFindAll met a key twice on the way to a path   // paths one wsJsonPathFindAll call looks for
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -21,43 +23,163 @@ typedef enum {
     WS_JSON_NULL,
 } wsJsonType;
 
+// Instruction set of the first parse stage
+typedef enum {
+    WS_JSON_ISA_AUTO,   // the best one the CPU has
+    WS_JSON_ISA_SCALAR,
+    WS_JSON_ISA_SSE2,
+    WS_JSON_ISA_AVX2,
+} wsJsonIsa;
+
+typedef struct wsJsonArenaBlock wsJsonArenaBlock;
+
+// Bump allocator for parse trees. A tree parsed into an arena is released with
+// wsJsonArenaReset, which drops all of its nodes at once and keeps the memory
+// for the next parse. A parse that needed more than one block gets a single
+// block of its size after the reset, so a reused arena settles at one
+// allocation that lives as long as the arena.
+typedef struct {
+    wsJsonArenaBlock* blocks; // newest first, only the newest one has room left
+    size_t used;              // bytes taken from the newest block
+    size_t total;             // bytes taken since the last reset
+    size_t nextSize;          // size of the next block
+} wsJsonArena;
+
+// 40 bytes on 64 bit. The key and the string of a node sit right behind it in
+// the same allocation, NUL terminated and of any length, and objects and arrays
+// grow their child list as needed. Bindings use the accessors further down,
+// this layout is not part of the ABI.
 typedef struct wsJson {
-    char key[WS_JSON_MAX_KEY_SIZE];
+    const char* key; // "" for the root and array elements
     wsJsonType type;
+    bool inArena;    // released with its arena, wsJsonFree leaves it alone
     union {
-        char stringValue[WS_JSON_MAX_VALUE_SIZE];
+        struct {
+            char* stringValue;
+            size_t stringLen;
+        };
         double numberValue;
         bool boolValue;
         struct {
-            struct wsJson* children[WS_JSON_OBJECT_MAX_FIELDS];
+            struct wsJson** children;
             int32_t childCount;
+            int32_t capacity;
+            wsJsonArena* arena; // the child list grows in here, NULL uses realloc
         } object;
         struct {
-            struct wsJson* elements[WS_JSON_OBJECT_MAX_FIELDS];
+            struct wsJson** elements;
             int32_t elementCount;
+            int32_t capacity;
+            wsJsonArena* arena;
         } array;
     };
 } wsJson;
 
+// The raw bytes of one value inside a JSON text, strings keep their quotes.
+// data is NULL when the value was not found.
+typedef struct {
+    const char* data;
+    size_t len;
+    wsJsonType type;
+} wsJsonSlice;
+
+// Replaces len bytes at at with value, a len of 0 inserts value in front of at
+typedef struct {
+    const char* at;
+    size_t len;
+    const char* value;
+    size_t valueLen;
+} wsJsonEdit;
+
 // Create functions
 wsJson* wsJsonInitChild(const char* key);
 wsJson* wsJsonInitString(const char* key, const char* val);
+// val does not need a terminator
+wsJson* wsJsonInitStringN(const char* key, const char* val, size_t len);
 wsJson* wsJsonInitNumber(const char* key, double val);
 wsJson* wsJsonInitBool(const char* key, bool val);
 wsJson* wsJsonInitArray(const char* key);
 wsJson* wsJsonInitNull(const char* key);
 
-// Adds a new child to the json object
-void wsJsonAddField(wsJson* parent, wsJson* child);
-// Adds an element to a json array
-void wsJsonAddElement(wsJson* array, wsJson* element);
+// Adds a new child to the json object. WS_ERROR if either is NULL, parent is
+// not an object or the list cannot grow, the child then still belongs to the
+// caller.
+int32_t wsJsonAddField(wsJson* parent, wsJson* child);
+// Adds an element to a json array, fails like wsJsonAddField
+int32_t wsJsonAddElement(wsJson* array, wsJson* element);
+// Serializes obj in one pass and returns the length of the JSON text. out
+// holds all of it when the result is at most size, with a terminator when
+// there is room for one. A larger result means out was cut short, it is still
+// terminated. wsJsonToString(obj, NULL, 0) only asks for the length.
 int32_t wsJsonToString(wsJson* obj, char* out, size_t size);
+// Appends the JSON text of obj to out, which grows as needed. No terminator.
+int32_t wsJsonToBuffer(wsJson* obj, wsBuffer* out);
+// Parses the object at *string and moves it past the object. Finds strings and
+// structural characters in one SIMD pass first (AVX2 or SSE2, scalar elsewhere),
+// then builds the tree from that index. Escapes in keys and strings are decoded.
 wsJson* wsStringToJson(const char** string);
+// Forces the instruction set of every following parse in the process, so tests
+// reach each path on one machine. false if this build or CPU lacks it.
+bool wsJsonSetIsa(wsJsonIsa isa);
 wsJson* wsJsonGet(wsJson* obj, const char* key);
 const char* wsJsonGetString(wsJson* obj, const char* key);
 double wsJsonGetNumber(wsJson* obj, const char* key);
 
-// Goes recursive trough the json tree and frees everything
+// Goes recursive trough the json tree and frees everything, nodes of an arena are skipped
 void wsJsonFree(wsJson* obj);
 
+void wsJsonArenaInit(wsJsonArena* arena);
+void wsJsonArenaReset(wsJsonArena* arena);
+void wsJsonArenaFree(wsJsonArena* arena);
+// 16 byte aligned memory that lives until the next reset
+void* wsJsonArenaAlloc(wsJsonArena* arena, size_t size);
+
+// Like wsStringToJson, every node comes from the arena
+wsJson* wsStringToJsonArena(const char** string, wsJsonArena* arena);
+
+// A zeroed node from the arena, to add fields to a tree parsed into it. A tree
+// in an arena only takes children from the same arena.
+wsJson* wsJsonArenaNode(wsJsonArena* arena, wsJsonType type, const char* key);
+// Turns node into a string holding a copy of val taken from the arena
+int32_t wsJsonArenaSetString(wsJsonArena* arena, wsJson* node, const char* val);
+
+// Accessors for bindings, they work on any node and never change with the layout
+wsJsonType wsJsonGetType(const wsJson* obj);
+const char* wsJsonGetKey(const wsJson* obj);
+// NULL unless obj is a string, len may be NULL
+const char* wsJsonStringValue(const wsJson* obj, size_t* len);
+// 0 unless obj is a number
+double wsJsonNumberValue(const wsJson* obj);
+bool wsJsonBoolValue(const wsJson* obj);
+// Fields of an object or elements of an array, 0 for everything else
+int32_t wsJsonCount(const wsJson* obj);
+// NULL past the end
+wsJson* wsJsonAt(const wsJson* obj, int32_t index);
+
+// Finds values by dotted path, like "message.info" or "" for the root object,
+// in one forward scan of buf without building any nodes. The whole object is
+// validated, WS_ERROR means buf does not start with a JSON object. Paths only
+// lead through objects and keys are compared decoded. Readers disagree on
+// which of two equal keys counts, so a key that comes twice in an object on
+// the way to a path fails the scan with WS_JSON_DUPLICATE. Missing values
+// leave their slice empty.
+int32_t wsJsonPathFindAll(const char* buf, size_t len, const char* const* paths, wsJsonSlice* out, int32_t count);
+// The same for one path, WS_ERROR as well when it is missing
+int32_t wsJsonPathFind(const char* buf, size_t len, const char* path, wsJsonSlice* out);
+
+// A decoded, NUL terminated copy of a string value taken from the arena, NULL
+// for anything else. len may be NULL.
+const char* wsJsonSliceString(const wsJsonSlice* slice, wsJsonArena* arena, size_t* len);
+// -1 unless the slice is a number, like wsJsonGetNumber
+double wsJsonSliceNumber(const wsJsonSlice* slice);
+
+// Copies buf to out with the edits applied, they have to be in order and must
+// not overlap. Returns the length of the result and only writes out when size
+// holds all of it, a NULL out asks for the length. WS_ERROR for bad edits.
+int32_t wsJsonSplice(const char* buf, size_t len, const wsJsonEdit* edits, int32_t count, char* out, size_t size);
+
+// Writes s as a quoted and escaped JSON string, returns its length and
+// terminates out like wsJsonToString
+int32_t wsJsonQuote(const char* s, char* out, size_t size);
+
 #endif
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Runs the fan-out benchmark against the epoll and the io_uring loop.
+# Extra arguments go to ws_fanout_bench, e.g. ./run_fanout.sh -c 2000 -m 5000
+BIN_DIR="$(dirname "$0")/../../../bin"
+
+for backend in epoll uring; do
+    "$BIN_DIR/ws_server" -b "$backend" -h 127.0.0.1 > /dev/null &
+    pid=$!
+    sleep 0.5
+
+    echo "== $backend"
+    "$BIN_DIR/ws_fanout_bench" -P "$pid" "$@"
+
+    kill "$pid"
+    wait "$pid" 2> /dev/null || true
+done
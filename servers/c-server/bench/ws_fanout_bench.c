@@ -0,0 +1,337 @@
+// Broadcast fan-out benchmark: one sender, many receivers. Measures delivered
+// messages per second and, with -P, the server's CPU time per delivered message
+// read from /proc so the epoll and io_uring loops can be compared on equal terms.
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#include "../../../lib/ws_frame.h"
+
+#define WS_BENCH_READ_SIZE (64 * 1024)
+#define WS_BENCH_STALL_MS 5000
+
+typedef struct {
+    int32_t fd;
+    wsBuffer in;
+    uint64_t received;
+} wsBenchConn;
+
+typedef struct {
+    const char* host;
+    const char* port;
+    int32_t receivers;
+    int32_t messages;
+    int32_t payloadSize;
+    int32_t window;
+    int32_t serverPid;
+} wsBenchConfig;
+
+static double wsBenchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// utime + stime of a process in seconds, -1 if it cannot be read
+static double wsBenchCpuSeconds(int32_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+
+    char stat[1024];
+    size_t n = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[n] = '\0';
+
+    // The command name may contain spaces, fields are counted after its ')'
+    char* p = strrchr(stat, ')');
+    if (!p) return -1;
+    unsigned long utime = 0, stime = 0;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// Blocking connect and upgrade, the socket is switched to non-blocking afterwards
+static int32_t wsBenchConnect(const wsBenchConfig* config) {
+    struct addrinfo hints = {0};
+    struct addrinfo* result;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(config->host, config->port, &hints, &result) != 0) {
+        fprintf(stderr, "Failed to resolve host: %s\n", config->host);
+        return WS_ERROR;
+    }
+
+    int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (fd < 0 || connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+        perror("connect failed");
+        if (fd >= 0) close(fd);
+        freeaddrinfo(result);
+        return WS_ERROR;
+    }
+    freeaddrinfo(result);
+
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    char request[256];
+    int len = snprintf(request, sizeof(request),
+        "GET / HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n", config->host);
+    if (send(fd, request, len, MSG_NOSIGNAL) != len) {
+        perror("handshake send failed");
+        close(fd);
+        return WS_ERROR;
+    }
+
+    // Read byte by byte so no frame data after the response is swallowed
+    char response[1024];
+    size_t got = 0;
+    while (got < sizeof(response) - 1) {
+        if (recv(fd, &response[got], 1, 0) != 1) break;
+        got++;
+        if (got >= 4 && memcmp(&response[got - 4], "\r\n\r\n", 4) == 0) break;
+    }
+    response[got] = '\0';
+    if (!strstr(response, " 101 ")) {
+        fprintf(stderr, "Handshake rejected: %s\n", response);
+        close(fd);
+        return WS_ERROR;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+// One masked text frame in the chat format, the all zero mask keeps the payload as is
+static uint8_t* wsBenchBuildMessage(int32_t payloadSize, size_t* outLen) {
+    char* text = malloc(payloadSize + 1);
+    char* json = malloc(payloadSize + 128);
+    uint8_t* frame = malloc(payloadSize + 128 + WS_FRAME_MAX_HEADER);
+    if (!text || !json || !frame) {
+        free(text);
+        free(json);
+        free(frame);
+        return NULL;
+    }
+
+    memset(text, 'x', payloadSize);
+    text[payloadSize] = '\0';
+    int jsonLen = snprintf(json, payloadSize + 128,
+        "{\"user\":{\"name\":\"bench\"},\"message\":{\"text\":\"%s\",\"text_len\":%d,\"info\":0}}",
+        text, payloadSize);
+
+    const uint8_t mask[4] = {0};
+    int32_t headerLen = wsFrameWriteHeader(frame, WS_OPCODE_TEXT, true, jsonLen, mask);
+    memcpy(frame + headerLen, json, jsonLen);
+    *outLen = headerLen + jsonLen;
+
+    free(text);
+    free(json);
+    return frame;
+}
+
+static int32_t wsBenchSendAll(int32_t fd, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The window keeps this rare, the server is the one to measure
+                usleep(50);
+                continue;
+            }
+            return WS_ERROR;
+        }
+        data += n;
+        len -= n;
+    }
+    return WS_OK;
+}
+
+// Counts complete frames, returns the number of new ones or WS_ERROR if the
+// server closed the connection
+static int64_t wsBenchDrain(wsBenchConn* conn, uint8_t* scratch) {
+    int64_t frames = 0;
+
+    for (;;) {
+        ssize_t n = recv(conn->fd, scratch, WS_BENCH_READ_SIZE, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return WS_ERROR;
+        }
+        if (n == 0) return WS_ERROR;
+        if (wsBufferAppend(&conn->in, scratch, n) != WS_OK) return WS_ERROR;
+
+        size_t used = 0;
+        for (;;) {
+            wsFrame frame;
+            int64_t frameLen = wsFrameParse(conn->in.data + used, conn->in.len - used, UINT32_MAX, &frame);
+            if (frameLen == WS_ERROR) return WS_ERROR;
+            if (frameLen == WS_FRAME_INCOMPLETE) break;
+            used += frameLen;
+            if (frame.opcode == WS_OPCODE_TEXT || frame.opcode == WS_OPCODE_BINARY) frames++;
+        }
+        wsBufferConsume(&conn->in, used);
+    }
+
+    conn->received += frames;
+    return frames;
+}
+
+static void wsBenchUsage(const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [-h host] [-p port] [-c receivers] [-m messages] [-s payload bytes]\n"
+        "          [-w window] [-P server pid]\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    wsBenchConfig config = {
+        .host = "127.0.0.1",
+        .port = "9999",
+        .receivers = 1000,
+        .messages = 10000,
+        .payloadSize = 64,
+        .window = 32,
+        .serverPid = 0,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            wsBenchUsage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-h") == 0) config.host = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0) config.port = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0) config.receivers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0) config.messages = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0) config.payloadSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0) config.window = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-P") == 0) config.serverPid = atoi(argv[++i]);
+        else {
+            wsBenchUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.receivers <= 0 || config.messages <= 0 || config.payloadSize < 0 || config.window <= 0) {
+        wsBenchUsage(argv[0]);
+        return 1;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)config.receivers + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    wsBenchConn* conns = calloc(config.receivers, sizeof(wsBenchConn));
+    uint8_t* scratch = malloc(WS_BENCH_READ_SIZE);
+    int epollFd = epoll_create1(0);
+    if (!conns || !scratch || epollFd < 0) {
+        perror("bench init failed");
+        return 1;
+    }
+
+    for (int32_t i = 0; i < config.receivers; i++) {
+        conns[i].fd = wsBenchConnect(&config);
+        if (conns[i].fd < 0) {
+            fprintf(stderr, "Only %d receivers connected\n", i);
+            return 1;
+        }
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conns[i];
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
+
+    int32_t sender = wsBenchConnect(&config);
+    if (sender < 0) return 1;
+
+    size_t messageLen;
+    uint8_t* message = wsBenchBuildMessage(config.payloadSize, &messageLen);
+    if (!message) return 1;
+
+    // Let the server finish the handshakes before the clock starts
+    usleep(200 * 1000);
+
+    uint64_t expected = (uint64_t)config.messages * config.receivers;
+    uint64_t delivered = 0;
+    int32_t sent = 0;
+    struct epoll_event events[256];
+
+    double cpuStart = config.serverPid ? wsBenchCpuSeconds(config.serverPid) : -1;
+    double start = wsBenchNow();
+    double lastProgress = start;
+
+    while (delivered < expected) {
+        // Keep at most window messages in flight across all receivers
+        while (sent < config.messages &&
+               (uint64_t)sent * config.receivers - delivered < (uint64_t)config.window * config.receivers) {
+            if (wsBenchSendAll(sender, message, messageLen) != WS_OK) {
+                perror("sender failed");
+                return 1;
+            }
+            sent++;
+        }
+
+        int n = epoll_wait(epollFd, events, 256, 100);
+        for (int i = 0; i < n; i++) {
+            int64_t frames = wsBenchDrain(events[i].data.ptr, scratch);
+            if (frames < 0) {
+                fprintf(stderr, "Server closed a receiver\n");
+                return 1;
+            }
+            delivered += frames;
+        }
+
+        double now = wsBenchNow();
+        if (n > 0) lastProgress = now;
+        else if ((now - lastProgress) * 1000 > WS_BENCH_STALL_MS) {
+            fprintf(stderr, "No progress for %d ms, giving up\n", WS_BENCH_STALL_MS);
+            break;
+        }
+    }
+
+    double elapsed = wsBenchNow() - start;
+    double cpuEnd = config.serverPid ? wsBenchCpuSeconds(config.serverPid) : -1;
+
+    printf("receivers %d, messages %d, payload %d bytes, window %d\n",
+           config.receivers, sent, config.payloadSize, config.window);
+    printf("delivered %llu of %llu in %.3f s\n",
+           (unsigned long long)delivered, (unsigned long long)expected, elapsed);
+    printf("%.0f messages/s, %.0f deliveries/s\n", sent / elapsed, delivered / elapsed);
+    if (cpuStart >= 0 && cpuEnd >= 0 && delivered > 0) {
+        double cpu = cpuEnd - cpuStart;
+        printf("server cpu %.3f s, %.3f us per delivered message\n", cpu, cpu * 1e6 / delivered);
+    }
+
+    for (int32_t i = 0; i < config.receivers; i++) {
+        close(conns[i].fd);
+        wsBufferFree(&conns[i].in);
+    }
+    close(sender);
+    free(conns);
+    free(scratch);
+    free(message);
+    return delivered == expected ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+// Handshake micro-benchmark: upgrade requests per second on one core, for every
+// SHA-1 implementation the CPU supports. Each implementation is checked against
+// the RFC 6455 example first and the run fails if it does not match.
+// "accept" only hashes and encodes the keys, "full" also parses the request and
+// builds the 101 response like the server does.
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ws_accept.h"
+#include "../ws_http.h"
+#include "../ws_logger.h"
+#include "../../../lib/ws_globals.h"
+
+#define WS_BENCH_POOL 1024
+#define WS_BENCH_MAX_BATCH 256
+
+typedef struct {
+    uint8_t data[256];
+    size_t len;
+} wsBenchRequest;
+
+static double wsBenchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Distinct keys, so nothing is served from a warm cache of one input
+static void wsBenchRequests(wsBenchRequest* requests) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t seed = 12345;
+
+    for (int32_t r = 0; r < WS_BENCH_POOL; r++) {
+        char key[WS_ACCEPT_KEY_LEN + 1];
+        for (int32_t i = 0; i < WS_ACCEPT_KEY_LEN - 2; i++) {
+            seed = seed * 1664525 + 1013904223;
+            key[i] = alphabet[seed >> 26];
+        }
+        memcpy(key + WS_ACCEPT_KEY_LEN - 2, "==", 3);
+
+        requests[r].len = snprintf((char*)requests[r].data, sizeof(requests[r].data),
+            "GET /chat HTTP/1.1\r\n"
+            "Host: 127.0.0.1:9999\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: %s\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n", key);
+    }
+}
+
+static double wsBenchAccept(const wsBenchRequest* requests, const wsHttpUpgrade* parsed,
+                            int64_t count, int32_t batch) {
+    const uint8_t* keys[WS_BENCH_MAX_BATCH];
+    char accept[WS_BENCH_MAX_BATCH][WS_ACCEPT_LEN];
+    volatile char sink = 0;
+
+    double start = wsBenchNow();
+    for (int64_t done = 0; done < count; done += batch) {
+        for (int32_t i = 0; i < batch; i++) {
+            int32_t r = (done + i) % WS_BENCH_POOL;
+            keys[i] = (const uint8_t*)wsHttpUpgradeKey(&parsed[r], requests[r].data);
+        }
+        wsAcceptCompute(keys, accept, batch);
+        sink ^= accept[batch - 1][0];
+    }
+    (void)sink;
+    return wsBenchNow() - start;
+}
+
+static double wsBenchFull(const wsBenchRequest* requests, int64_t count, int32_t batch) {
+    static const char head[] =
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: ";
+    wsHttpUpgrade parsers[WS_BENCH_MAX_BATCH];
+    const uint8_t* keys[WS_BENCH_MAX_BATCH];
+    char accept[WS_BENCH_MAX_BATCH][WS_ACCEPT_LEN];
+    char response[sizeof(head) - 1 + WS_ACCEPT_LEN + 4];
+    volatile char sink = 0;
+
+    double start = wsBenchNow();
+    for (int64_t done = 0; done < count; done += batch) {
+        for (int32_t i = 0; i < batch; i++) {
+            const wsBenchRequest* request = &requests[(done + i) % WS_BENCH_POOL];
+            memset(&parsers[i], 0, sizeof(parsers[i]));
+            if (wsHttpUpgradeParse(&parsers[i], request->data, request->len, 8192) <= 0) {
+                fprintf(stderr, "Benchmark request did not parse\n");
+                exit(1);
+            }
+            keys[i] = (const uint8_t*)wsHttpUpgradeKey(&parsers[i], request->data);
+        }
+        wsAcceptCompute(keys, accept, batch);
+
+        for (int32_t i = 0; i < batch; i++) {
+            memcpy(response, head, sizeof(head) - 1);
+            memcpy(response + sizeof(head) - 1, accept[i], WS_ACCEPT_LEN);
+            memcpy(response + sizeof(head) - 1 + WS_ACCEPT_LEN, "\r\n\r\n", 4);
+            sink ^= response[sizeof(response) - 5];
+        }
+    }
+    (void)sink;
+    return wsBenchNow() - start;
+}
+
+static void wsBenchRun(const char* name, const wsBenchRequest* requests, const wsHttpUpgrade* parsed,
+                       int64_t count, int32_t batch) {
+    double acceptTime = wsBenchAccept(requests, parsed, count, batch);
+    double fullTime = wsBenchFull(requests, count, batch);
+    printf("%-12s accept %10.0f/s (%6.1f ns)   full %10.0f/s (%6.1f ns)\n", name,
+           count / acceptTime, acceptTime * 1e9 / count, count / fullTime, fullTime * 1e9 / count);
+}
+
+static void wsBenchUsage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [-n handshakes] [-b batch size, at most %d]\n", argv0, WS_BENCH_MAX_BATCH);
+}
+
+int main(int argc, char* argv[]) {
+    int64_t count = 2000000;
+    int32_t batch = 64;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            wsBenchUsage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-n") == 0) count = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0) batch = atoi(argv[++i]);
+        else {
+            wsBenchUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (count <= 0 || batch <= 0 || batch > WS_BENCH_MAX_BATCH) {
+        wsBenchUsage(argv[0]);
+        return 1;
+    }
+    count = (count + batch - 1) / batch * batch;
+    // Self test mismatches are reported through the server log
+    if (wsLoggerStart() != WS_OK) return 1;
+
+    static wsBenchRequest requests[WS_BENCH_POOL];
+    static wsHttpUpgrade parsed[WS_BENCH_POOL];
+    wsBenchRequests(requests);
+    for (int32_t r = 0; r < WS_BENCH_POOL; r++) {
+        wsHttpUpgradeParse(&parsed[r], requests[r].data, requests[r].len, 8192);
+    }
+
+    printf("handshakes %lld, batch %d\n", (long long)count, batch);
+
+    int32_t failed = 0;
+    for (wsAcceptImpl impl = WS_ACCEPT_SCALAR; impl < WS_ACCEPT_IMPL_COUNT; impl++) {
+        if (!wsAcceptSupported(impl)) {
+            printf("%-12s not supported on this CPU\n", wsAcceptImplName(impl));
+            continue;
+        }
+        if (wsAcceptSelfTest(impl) != WS_OK) {
+            printf("%-12s FAILED the RFC 6455 check\n", wsAcceptImplName(impl));
+            failed = 1;
+            continue;
+        }
+        wsAcceptSetImpl(impl);
+        wsBenchRun(wsAcceptImplName(impl), requests, parsed, count, batch);
+    }
+
+    // What the server picks: one implementation for single keys, one for groups of eight
+    wsAcceptInit();
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%s", wsAcceptImplName(wsAcceptGetImpl(false)),
+             wsAcceptImplName(wsAcceptGetImpl(true)));
+    wsBenchRun(name, requests, parsed, count, batch);
+    return failed;
+}
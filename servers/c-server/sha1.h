@@ -110,7 +110,7 @@ void sha1(const unsigned char *data, size_t len, unsigned char *hash) {
         // First 16 words are directly copied from the block (in big-endian format)
         for (int j = 0; j < 16; j++) {
             // Combine 4 bytes into a 32-bit word (big-endian byte order)
-            w[j] = (block[j * 4] << 24) |      // Most significant byte
+            w[j] = ((uint32_t)block[j * 4] << 24) | // Most significant byte
                    (block[j * 4 + 1] << 16) |  // Second byte
                    (block[j * 4 + 2] << 8) |   // Third byte
                    block[j * 4 + 3];           // Least significant byte
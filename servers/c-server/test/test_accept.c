@@ -0,0 +1,70 @@
+#include "../ws_accept.h"
+#include "../../../lib/ws_globals.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+static const char* implName = "";
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL [%s] %s:%d: %s\n", implName, __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// The RFC 6455 example and values worked out with another SHA-1
+static const char* const vectors[][2] = {
+    { "dGhlIHNhbXBsZSBub25jZQ==", "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" },
+    { "AAAAAAAAAAAAAAAAAAAAAA==", "ICX+Yqv66kxgM0FcWaLWlFLwTAI=" },
+    { "/////////////////////w==", "XXpj4jYzLM2yUE0C7TIgMwTQh2g=" },
+    { "x3JJHMbDL1EzLkh9GBhXDw==", "HSmrc0sMlYUkAGmm5OPpG2HaGWk=" },
+};
+#define VECTOR_COUNT (sizeof(vectors) / sizeof(vectors[0]))
+
+// Batches of every size up to a few AVX2 passes, with the vectors at every lane
+static void testBatches(void) {
+    const uint8_t* keys[40];
+    char accept[40][WS_ACCEPT_LEN];
+    for (size_t count = 1; count <= 40; count++) {
+        for (size_t shift = 0; shift < VECTOR_COUNT; shift++) {
+            for (size_t i = 0; i < count; i++) keys[i] = (const uint8_t*)vectors[(i + shift) % VECTOR_COUNT][0];
+            memset(accept, 0, sizeof(accept));
+            wsAcceptCompute(keys, accept, count);
+            for (size_t i = 0; i < count; i++) {
+                CHECK(memcmp(accept[i], vectors[(i + shift) % VECTOR_COUNT][1], WS_ACCEPT_LEN) == 0);
+            }
+        }
+    }
+}
+
+int main(void) {
+    // Whatever wsAcceptInit picks for single keys and batches
+    wsAcceptInit();
+    implName = "auto";
+    testBatches();
+
+    for (wsAcceptImpl impl = 0; impl < WS_ACCEPT_IMPL_COUNT; impl++) {
+        implName = wsAcceptImplName(impl);
+        if (!wsAcceptSupported(impl)) {
+            printf("skipping %s, not supported here\n", implName);
+            continue;
+        }
+        CHECK(wsAcceptSelfTest(impl) == WS_OK);
+        CHECK(wsAcceptSetImpl(impl) == WS_OK);
+        CHECK(wsAcceptGetImpl(false) == impl && wsAcceptGetImpl(true) == impl);
+        testBatches();
+    }
+
+    implName = "";
+    CHECK(wsAcceptSetImpl(WS_ACCEPT_IMPL_COUNT) == WS_ERROR);
+
+    if (failures) {
+        printf("%d accept checks failed\n", failures);
+        return 1;
+    }
+    printf("All accept tests passed\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "../ws_history.h"
+#include "../../../lib/ws_globals.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// A frame whose single byte tells which message it is
+static wsOutFrame* newFrame(uint8_t id) {
+    wsOutFrame* frame = wsOutFrameCreate(1);
+    frame->data[0] = id;
+    return frame;
+}
+
+static bool collected(wsHistory* history, const char* room, uint64_t afterSeq, uint32_t limit, const char* ids) {
+    wsOutFrame* frames[64];
+    uint32_t count = wsHistoryCollect(history, room, afterSeq, limit, frames);
+    if (count != strlen(ids)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (frames[i]->data[0] != (uint8_t)ids[i]) return false;
+    }
+    return true;
+}
+
+static void testRing(void) {
+    wsHistory history;
+    CHECK(wsHistoryInit(&history, 4) == WS_OK);
+
+    wsOutFrame* frames[10];
+    for (int32_t i = 0; i < 10; i++) {
+        frames[i] = newFrame('a' + i);
+        wsHistoryAppend(&history, NULL, i + 1, frames[i]);
+    }
+    // Only the newest four are kept, each with a reference of its own
+    for (int32_t i = 0; i < 10; i++) CHECK(atomic_load(&frames[i]->refs) == (i < 6 ? 1 : 2));
+
+    CHECK(collected(&history, NULL, 0, 0, "ghij"));
+    CHECK(collected(&history, "", 0, 0, "ghij"));
+    CHECK(collected(&history, NULL, 8, 0, "ij"));
+    CHECK(collected(&history, NULL, 0, 2, "ij"));
+    CHECK(collected(&history, NULL, 7, 10, "hij"));
+    CHECK(collected(&history, NULL, 10, 0, ""));
+
+    wsHistoryFree(&history);
+    for (int32_t i = 0; i < 10; i++) {
+        CHECK(atomic_load(&frames[i]->refs) == 1);
+        wsOutFrameRelease(frames[i]);
+    }
+}
+
+// Shards relay each other's messages, the seqs in a ring are only roughly ordered
+static void testOrder(void) {
+    wsHistory history;
+    CHECK(wsHistoryInit(&history, 8) == WS_OK);
+    const uint64_t seqs[] = { 5, 3, 6, 4, 8, 7 };
+    for (int32_t i = 0; i < 6; i++) {
+        wsOutFrame* frame = newFrame('a' + i);
+        wsHistoryAppend(&history, NULL, seqs[i], frame);
+        wsOutFrameRelease(frame);
+    }
+    CHECK(collected(&history, NULL, 4, 0, "acef"));
+    CHECK(collected(&history, NULL, 4, 2, "ef"));
+    CHECK(collected(&history, NULL, 3, 3, "def"));
+    wsHistoryFree(&history);
+}
+
+typedef struct {
+    uint32_t global;
+    uint32_t rooms;
+    uint32_t stopAfter;
+} testCounts;
+
+static int32_t countEntry(void* ctx, uint64_t seq, const char* room, wsOutFrame* frame) {
+    testCounts* counts = ctx;
+    if (room) counts->rooms++;
+    else counts->global++;
+    return counts->global + counts->rooms == counts->stopAfter ? WS_ERROR : WS_OK;
+}
+
+static void testRooms(void) {
+    wsHistory history;
+    CHECK(wsHistoryInit(&history, 2) == WS_OK);
+
+    // The least recently used room goes once there are too many
+    uint64_t seq = 0;
+    char name[32];
+    for (uint32_t r = 0; r <= WS_HISTORY_MAX_ROOMS; r++) {
+        snprintf(name, sizeof(name), "room%u", r);
+        wsOutFrame* frame = newFrame('a' + r % 26);
+        wsHistoryAppend(&history, name, ++seq, frame);
+        wsOutFrameRelease(frame);
+        // Keeps room0 in use
+        if (r == 10) {
+            frame = newFrame('z');
+            wsHistoryAppend(&history, "room0", ++seq, frame);
+            wsOutFrameRelease(frame);
+        }
+    }
+    CHECK(history.roomCount == WS_HISTORY_MAX_ROOMS);
+    CHECK(collected(&history, "room0", 0, 0, "az"));
+    CHECK(collected(&history, "room1", 0, 0, ""));
+    CHECK(collected(&history, "room2", 0, 0, "c"));
+    CHECK(collected(&history, NULL, 0, 0, ""));
+
+    // Looking at a room that has no history does not create one
+    CHECK(collected(&history, "nowhere", 0, 0, ""));
+    CHECK(history.roomCount == WS_HISTORY_MAX_ROOMS);
+
+    wsOutFrame* frame = newFrame('g');
+    wsHistoryAppend(&history, NULL, ++seq, frame);
+    wsOutFrameRelease(frame);
+    testCounts counts = {0};
+    CHECK(wsHistoryForEach(&history, countEntry, &counts) == WS_OK);
+    CHECK(counts.global == 1 && counts.rooms == WS_HISTORY_MAX_ROOMS + 1);
+    counts = (testCounts){ .stopAfter = 5 };
+    CHECK(wsHistoryForEach(&history, countEntry, &counts) == WS_ERROR);
+    CHECK(counts.global + counts.rooms == 5);
+    wsHistoryFree(&history);
+
+    // Capacity 0 keeps nothing
+    CHECK(wsHistoryInit(&history, 0) == WS_OK);
+    frame = newFrame('x');
+    wsHistoryAppend(&history, "room", 1, frame);
+    CHECK(atomic_load(&frame->refs) == 1);
+    CHECK(collected(&history, "room", 0, 0, ""));
+    wsOutFrameRelease(frame);
+    wsHistoryFree(&history);
+}
+
+int main(void) {
+    testRing();
+    testOrder();
+    testRooms();
+
+    if (failures) {
+        printf("%d history checks failed\n", failures);
+        return 1;
+    }
+    printf("All history tests passed\n");
+    return 0;
+}
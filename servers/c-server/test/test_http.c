@@ -0,0 +1,119 @@
+#include "../ws_http.h"
+#include "../../../lib/ws_globals.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static const char request[] =
+    "GET /chat HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "upgrade: WebSocket\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Sec-WebSocket-Key:   dGhlIHNhbXBsZSBub25jZQ==  \r\n"
+    "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+    "Sec-WebSocket-Extensions: x-other\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n"
+    "\x81\x80";
+
+static int64_t parse(const char* text, size_t maxLen, wsHttpUpgrade* parser) {
+    memset(parser, 0, sizeof(*parser));
+    return wsHttpUpgradeParse(parser, (const uint8_t*)text, strlen(text), maxLen);
+}
+
+// The same request in one piece and a byte at a time
+static void testComplete(void) {
+    const uint8_t* data = (const uint8_t*)request;
+    size_t total = strlen(request) - 2;
+    for (size_t step = 1; step <= total + 2; step += step < 4 ? 1 : 37) {
+        wsHttpUpgrade parser = {0};
+        int64_t ret = WS_HTTP_INCOMPLETE;
+        size_t len = 0;
+        while (ret == WS_HTTP_INCOMPLETE && len < total + 2) {
+            len = len + step < total + 2 ? len + step : total + 2;
+            ret = wsHttpUpgradeParse(&parser, data, len, 8192);
+        }
+        CHECK(ret == (int64_t)total);
+        CHECK(memcmp(wsHttpUpgradeKey(&parser, data), "dGhlIHNhbXBsZSBub25jZQ==", WS_HTTP_KEY_LEN) == 0);
+
+        size_t extensionsLen;
+        const char* extensions = wsHttpUpgradeExtensions(&parser, data, &extensionsLen);
+        const char* expected = "permessage-deflate; client_max_window_bits";
+        CHECK(extensionsLen == strlen(expected) && memcmp(extensions, expected, extensionsLen) == 0);
+        CHECK(!parser.metrics);
+    }
+}
+
+static void testRejected(void) {
+    static const struct {
+        const char* text;
+        uint16_t status;
+    } cases[] = {
+        { "POST / HTTP/1.1\r\n\r\n", 400 },
+        { "GET / HTTP/1.0\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\nUpgrade: h2c\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: close\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Key: short\r\nSec-WebSocket-Version: 13\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Version: 13\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 8\r\n\r\n", 426 },
+        { "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n", 426 },
+        { "GET / HTTP/1.1\r\n Folded: value\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\nBad Name: value\r\n\r\n", 400 },
+        { "GET / HTTP/1.1\r\n\rx", 400 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        wsHttpUpgrade parser;
+        CHECK(parse(cases[i].text, 8192, &parser) == WS_ERROR);
+        CHECK(parser.status == cases[i].status);
+    }
+
+    // Too long only once the limit is reached without the end of the request
+    wsHttpUpgrade parser;
+    size_t total = strlen(request) - 2;
+    CHECK(parse(request, total, &parser) == (int64_t)total);
+    CHECK(parse(request, total - 1, &parser) == WS_ERROR && parser.status == 431);
+    CHECK(wsHttpUpgradeParse(&(wsHttpUpgrade){0}, (const uint8_t*)request, 20, total - 1) == WS_HTTP_INCOMPLETE);
+}
+
+static void testMetrics(void) {
+    wsHttpUpgrade parser;
+    const char* plain = "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n";
+    CHECK(parse(plain, 8192, &parser) == (int64_t)strlen(plain) && parser.metrics);
+    const char* query = "GET /metrics?format=text HTTP/1.1\r\n\r\n";
+    CHECK(parse(query, 8192, &parser) == (int64_t)strlen(query) && parser.metrics);
+
+    // Other paths need the upgrade, and /metrics with an upgrade is a WebSocket
+    CHECK(parse("GET /metricsx HTTP/1.1\r\n\r\n", 8192, &parser) == WS_ERROR);
+    const char* upgrade = "GET /metrics HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    CHECK(parse(upgrade, 8192, &parser) == (int64_t)strlen(upgrade) && !parser.metrics);
+}
+
+int main(void) {
+    testComplete();
+    testRejected();
+    testMetrics();
+
+    if (failures) {
+        printf("%d HTTP checks failed\n", failures);
+        return 1;
+    }
+    printf("All HTTP tests passed\n");
+    return 0;
+}
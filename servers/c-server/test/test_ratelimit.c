@@ -0,0 +1,74 @@
+#include "../ws_ratelimit.h"
+
+#include <stdio.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// 10 messages a second with a burst of 5
+static void testBurstAndDebt(void) {
+    wsTokenRate rate = { .rate = 10, .burst = 5 };
+    wsTokenBucket bucket;
+    wsTokenBucketInit(&bucket, &rate, 1000);
+
+    for (int i = 0; i < 5; i++) CHECK(wsTokenBucketCharge(&bucket, &rate, 1, 1000) == 0);
+    // One over the burst costs a tenth of a second
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 1, 1000) == 100);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 0, 1050) == 50);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 0, 1100) == 0);
+
+    // The wait shrinks as the debt is paid off
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 1, 1100) == 100);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 0, 1199) == 1);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 0, 1200) == 0);
+}
+
+// A quiet client saves up no more than the burst
+static void testRefillCap(void) {
+    wsTokenRate rate = { .rate = 10, .burst = 5 };
+    wsTokenBucket bucket;
+    wsTokenBucketInit(&bucket, &rate, 0);
+
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 5, 0) == 0);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 5, 60000) == 0);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 1, 60000) == 100);
+}
+
+// A charge larger than the burst is taken and paid off afterwards
+static void testLargeCharge(void) {
+    wsTokenRate rate = { .rate = 1000, .burst = 4096 };
+    wsTokenBucket bucket;
+    wsTokenBucketInit(&bucket, &rate, 0);
+
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 65536, 0) == 61440);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 0, 61439) == 1);
+    CHECK(wsTokenBucketCharge(&bucket, &rate, 0, 61440) == 0);
+}
+
+static void testUnlimited(void) {
+    wsTokenRate rate = { .rate = 0, .burst = 0 };
+    wsTokenBucket bucket;
+    wsTokenBucketInit(&bucket, &rate, 0);
+    for (uint64_t i = 0; i < 1000; i++) CHECK(wsTokenBucketCharge(&bucket, &rate, 1 << 20, i) == 0);
+}
+
+int main(void) {
+    testBurstAndDebt();
+    testRefillCap();
+    testLargeCharge();
+    testUnlimited();
+
+    if (failures) {
+        printf("%d rate limit checks failed\n", failures);
+        return 1;
+    }
+    printf("All rate limit tests passed\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "../ws_timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+#define TIMER_COUNT 2000
+
+// Each timer remembers when it is due, the model the wheel is checked against
+typedef struct {
+    wsTimer timer;
+    uint64_t dueMs; // WS_TIMER_NONE while not armed
+    uint32_t fired;
+} testTimer;
+
+typedef struct {
+    testTimer* timers;
+    wsTimerWheel* wheel;
+    uint64_t now;
+    uint64_t rng;
+} testState;
+
+static uint64_t nextRandom(testState* state) {
+    state->rng ^= state->rng << 13;
+    state->rng ^= state->rng >> 7;
+    state->rng ^= state->rng << 17;
+    return state->rng;
+}
+
+static void arm(testState* state, testTimer* t, uint64_t dueMs) {
+    wsTimerArm(state->wheel, &t->timer, dueMs);
+    t->dueMs = dueMs;
+}
+
+static void cancel(testState* state, testTimer* t) {
+    wsTimerCancel(state->wheel, &t->timer);
+    t->dueMs = WS_TIMER_NONE;
+}
+
+// Never early, and never later than the tick that covers it
+static void expired(wsTimer* timer, void* ctx) {
+    testState* state = ctx;
+    testTimer* t = (testTimer*)timer;
+    CHECK(!wsTimerArmed(timer));
+    CHECK(t->dueMs != WS_TIMER_NONE && t->dueMs <= state->now);
+    t->fired++;
+    t->dueMs = WS_TIMER_NONE;
+
+    // Callbacks move other timers around, some of them still waiting in this slot
+    uint64_t r = nextRandom(state);
+    testTimer* other = &state->timers[r % TIMER_COUNT];
+    if (r & 0x100) cancel(state, other);
+    else if (r & 0x200) arm(state, other, state->now + (r >> 20) % 150000);
+    if (r & 0x400) arm(state, t, state->now + (r >> 40) % 500);
+}
+
+static void checkDue(testState* state) {
+    uint32_t armed = 0;
+    for (int32_t i = 0; i < TIMER_COUNT; i++) {
+        testTimer* t = &state->timers[i];
+        CHECK(wsTimerArmed(&t->timer) == (t->dueMs != WS_TIMER_NONE));
+        if (t->dueMs == WS_TIMER_NONE) continue;
+        armed++;
+        // Whatever is left is due later than the last whole tick
+        CHECK(t->dueMs > state->now - state->now % WS_TIMER_TICK_MS);
+    }
+    CHECK(armed == state->wheel->count);
+}
+
+static void testRandom(void) {
+    static testTimer timers[TIMER_COUNT];
+    static wsTimerWheel wheel;
+    testState state = { .timers = timers, .wheel = &wheel, .now = 5000000, .rng = 0x2545F4914F6CDD1DULL };
+    memset(timers, 0, sizeof(timers));
+    wsTimerWheelInit(&wheel, state.now);
+    CHECK(wsTimerWaitMs(&wheel, state.now) == -1);
+
+    for (int32_t i = 0; i < TIMER_COUNT; i++) {
+        timers[i].dueMs = WS_TIMER_NONE;
+        // Up to three laps of the wheel out
+        arm(&state, &timers[i], state.now + nextRandom(&state) % (3 * WS_TIMER_SLOTS * WS_TIMER_TICK_MS));
+    }
+    CHECK(wheel.count == TIMER_COUNT);
+
+    for (int32_t round = 0; round < 3000; round++) {
+        uint64_t r = nextRandom(&state);
+        int32_t wait = wsTimerWaitMs(&wheel, state.now);
+        CHECK(wait >= -1 && wait <= WS_TIMER_SLOTS * WS_TIMER_TICK_MS);
+
+        // Mostly short steps, now and then a stall of more than a lap
+        uint64_t step = r % 7 == 0 ? (r >> 8) % (2 * WS_TIMER_SLOTS * WS_TIMER_TICK_MS) : (r >> 8) % 250;
+        state.now += step;
+        wsTimerAdvance(&wheel, state.now, expired, &state);
+        checkDue(&state);
+
+        testTimer* t = &timers[(r >> 32) % TIMER_COUNT];
+        if (r & 0x10) arm(&state, t, state.now + (r >> 48) % 200000);
+        else if (r & 0x20) cancel(&state, t);
+    }
+
+    // Past everything, nothing may be left
+    state.now += 4 * WS_TIMER_SLOTS * WS_TIMER_TICK_MS;
+    while (wheel.count) {
+        wsTimerAdvance(&wheel, state.now, expired, &state);
+        state.now += WS_TIMER_TICK_MS;
+    }
+    checkDue(&state);
+}
+
+static void testWait(void) {
+    wsTimerWheel wheel;
+    wsTimer a = {0};
+    wsTimer b = {0};
+    wsTimerWheelInit(&wheel, 1000);
+
+    // Rounded up to the tick, a due time already passed goes to the next one
+    wsTimerArm(&wheel, &a, 1250);
+    CHECK(wsTimerWaitMs(&wheel, 1000) == 300);
+    wsTimerArm(&wheel, &b, 10);
+    CHECK(wsTimerWaitMs(&wheel, 1000) == 100);
+    CHECK(wsTimerWaitMs(&wheel, 1150) == 0);
+
+    // Re-arming moves a timer, cancelling twice is harmless
+    wsTimerArm(&wheel, &b, 5000);
+    CHECK(wheel.count == 2 && wsTimerWaitMs(&wheel, 1000) == 300);
+    wsTimerCancel(&wheel, &a);
+    wsTimerCancel(&wheel, &a);
+    CHECK(wheel.count == 1 && wsTimerWaitMs(&wheel, 1000) == 4000);
+    wsTimerCancel(&wheel, &b);
+    CHECK(wheel.count == 0 && wsTimerWaitMs(&wheel, 1000) == -1);
+}
+
+int main(void) {
+    testRandom();
+    testWait();
+
+    if (failures) {
+        printf("%d timer checks failed\n", failures);
+        return 1;
+    }
+    printf("All timer tests passed\n");
+    return 0;
+}
@@ -0,0 +1,480 @@
+#include "ws_accept.h"
+#include "sha1.h"
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define WS_ACCEPT_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const char wsAcceptGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Bytes 24..63 of the first block: the GUID and the start of the padding
+static const uint8_t wsAcceptTail[40] =
+    "258EAFA5-E914-47DA-95CA-C5AB0DC85B11\x80\0\0";
+
+// The second block only holds the message length, 60 bytes = 480 bits
+static const uint8_t wsAcceptLastBlock[64] __attribute__((aligned(16))) = {
+    [62] = 0x01, [63] = 0xE0,
+};
+
+static const uint32_t wsSha1Init[5] = {
+    0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0,
+};
+
+static const char wsBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline uint32_t wsLoadBe32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return __builtin_bswap32(v);
+}
+
+static inline void wsStoreBe32(uint8_t* p, uint32_t v) {
+    v = __builtin_bswap32(v);
+    memcpy(p, &v, 4);
+}
+
+// Encodes the 20 byte hash, the vector paths only cover the first 12 bytes
+static void wsBase64Tail(const uint8_t* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t n = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+        *out++ = wsBase64Alphabet[(n >> 18) & 63];
+        *out++ = wsBase64Alphabet[(n >> 12) & 63];
+        *out++ = wsBase64Alphabet[(n >> 6) & 63];
+        *out++ = wsBase64Alphabet[n & 63];
+    }
+    if (i < len) {
+        uint32_t n = (in[i] << 16) | (i + 1 < len ? in[i + 1] << 8 : 0);
+        *out++ = wsBase64Alphabet[(n >> 18) & 63];
+        *out++ = wsBase64Alphabet[(n >> 12) & 63];
+        *out++ = i + 1 < len ? wsBase64Alphabet[(n >> 6) & 63] : '=';
+        *out++ = '=';
+    }
+}
+
+static void wsAcceptScalar(const uint8_t* const* keys, char (*accept)[WS_ACCEPT_LEN], size_t count) {
+    for (size_t k = 0; k < count; k++) {
+        uint8_t message[WS_ACCEPT_KEY_LEN + sizeof(wsAcceptGuid) - 1];
+        memcpy(message, keys[k], WS_ACCEPT_KEY_LEN);
+        memcpy(message + WS_ACCEPT_KEY_LEN, wsAcceptGuid, sizeof(wsAcceptGuid) - 1);
+
+        uint8_t hash[20];
+        sha1(message, sizeof(message), hash);
+
+        char b64[WS_ACCEPT_LEN + 1];
+        base64_encode(hash, sizeof(hash), b64);
+        memcpy(accept[k], b64, WS_ACCEPT_LEN);
+    }
+}
+
+#ifdef WS_ACCEPT_X86
+
+// 12 input bytes to 16 characters with pshufb, reads 16 bytes of input
+__attribute__((target("ssse3")))
+static void wsBase64Ssse3(const uint8_t* in, size_t len, char* out) {
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shiftLut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    while (len >= 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)in), shuffle);
+
+        // Spread the four 6 bit fields of every 3 byte group into their own bytes
+        __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(t1, t3);
+
+        // Map the ranges A-Z, a-z, 0-9, + and / to an offset added to the index
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        __m128i chars = _mm_add_epi8(_mm_shuffle_epi8(shiftLut, range), indices);
+
+        _mm_storeu_si128((__m128i*)out, chars);
+        in += 12;
+        len -= 12;
+        out += 16;
+    }
+    wsBase64Tail(in, len, out);
+}
+
+// Both blocks of one key through the SHA extensions
+__attribute__((target("sha,ssse3,sse4.1")))
+static void wsSha1ShaNi(const uint8_t* block, uint8_t* hash) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)wsSha1Init), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)wsSha1Init[4], 0, 0, 0);
+
+    for (int32_t b = 0; b < 2; b++) {
+        const uint8_t* data = b == 0 ? block : wsAcceptLastBlock;
+        __m128i abcdSave = abcd;
+        __m128i e0Save = e0;
+        __m128i e1;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), mask);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+
+        // Four rounds per step, e0 and e1 take turns holding the next E
+#define WS_SHA1_STEP(e, eNext, m, func) \
+        e = _mm_sha1nexte_epu32(e, m);  \
+        eNext = abcd;                   \
+        abcd = _mm_sha1rnds4_epu32(abcd, e, func)
+
+        // Rounds 0-15
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        WS_SHA1_STEP(e1, e0, m1, 0);
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+        WS_SHA1_STEP(e0, e1, m2, 0);
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+        WS_SHA1_STEP(e1, e0, m3, 0);
+        m0 = _mm_sha1msg2_epu32(m0, m3);
+        m2 = _mm_sha1msg1_epu32(m2, m3);
+        m1 = _mm_xor_si128(m1, m3);
+
+        // Rounds 16-63, the schedule runs three steps ahead
+#define WS_SHA1_STEP_SCHEDULE(e, eNext, m, mNext, mPrev, mPrev2, func) \
+        WS_SHA1_STEP(e, eNext, m, func);                               \
+        mNext = _mm_sha1msg2_epu32(mNext, m);                          \
+        mPrev = _mm_sha1msg1_epu32(mPrev, m);                          \
+        mPrev2 = _mm_xor_si128(mPrev2, m)
+
+        WS_SHA1_STEP_SCHEDULE(e0, e1, m0, m1, m3, m2, 0);
+        WS_SHA1_STEP_SCHEDULE(e1, e0, m1, m2, m0, m3, 1);
+        WS_SHA1_STEP_SCHEDULE(e0, e1, m2, m3, m1, m0, 1);
+        WS_SHA1_STEP_SCHEDULE(e1, e0, m3, m0, m2, m1, 1);
+        WS_SHA1_STEP_SCHEDULE(e0, e1, m0, m1, m3, m2, 1);
+        WS_SHA1_STEP_SCHEDULE(e1, e0, m1, m2, m0, m3, 1);
+        WS_SHA1_STEP_SCHEDULE(e0, e1, m2, m3, m1, m0, 2);
+        WS_SHA1_STEP_SCHEDULE(e1, e0, m3, m0, m2, m1, 2);
+        WS_SHA1_STEP_SCHEDULE(e0, e1, m0, m1, m3, m2, 2);
+        WS_SHA1_STEP_SCHEDULE(e1, e0, m1, m2, m0, m3, 2);
+        WS_SHA1_STEP_SCHEDULE(e0, e1, m2, m3, m1, m0, 2);
+        WS_SHA1_STEP_SCHEDULE(e1, e0, m3, m0, m2, m1, 3);
+
+        // Rounds 64-79, the schedule winds down
+        WS_SHA1_STEP(e0, e1, m0, 3);
+        m1 = _mm_sha1msg2_epu32(m1, m0);
+        m3 = _mm_sha1msg1_epu32(m3, m0);
+        m2 = _mm_xor_si128(m2, m0);
+        WS_SHA1_STEP(e1, e0, m1, 3);
+        m2 = _mm_sha1msg2_epu32(m2, m1);
+        m3 = _mm_xor_si128(m3, m1);
+        WS_SHA1_STEP(e0, e1, m2, 3);
+        m3 = _mm_sha1msg2_epu32(m3, m2);
+        WS_SHA1_STEP(e1, e0, m3, 3);
+#undef WS_SHA1_STEP_SCHEDULE
+#undef WS_SHA1_STEP
+
+        e0 = _mm_sha1nexte_epu32(e0, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    abcd = _mm_shuffle_epi8(abcd, mask);
+    _mm_storeu_si128((__m128i*)hash, abcd);
+    wsStoreBe32(hash + 16, (uint32_t)_mm_extract_epi32(e0, 3));
+}
+
+__attribute__((target("sha,ssse3,sse4.1")))
+static void wsAcceptShaNi(const uint8_t* const* keys, char (*accept)[WS_ACCEPT_LEN], size_t count) {
+    uint8_t block[64];
+    memcpy(block + WS_ACCEPT_KEY_LEN, wsAcceptTail, sizeof(wsAcceptTail));
+
+    for (size_t k = 0; k < count; k++) {
+        memcpy(block, keys[k], WS_ACCEPT_KEY_LEN);
+
+        // Room for the 16 byte load of the base64 encoder
+        uint8_t hash[32];
+        wsSha1ShaNi(block, hash);
+        wsBase64Ssse3(hash, 20, accept[k]);
+    }
+}
+
+#define WS_ROTL8(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+// Plain SHA-1 compression on eight independent states, lane i belongs to key i
+__attribute__((target("avx2")))
+static void wsSha1x8Block(__m256i state[5], __m256i w[16]) {
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+#define WS_SHA1X8_ROUND(f, k)                                                            \
+    do {                                                                                 \
+        if (t >= 16) {                                                                   \
+            __m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]), \
+                                         _mm256_xor_si256(w[(t - 14) & 15], w[t & 15])); \
+            w[t & 15] = WS_ROTL8(x, 1);                                                  \
+        }                                                                                \
+        __m256i tmp = _mm256_add_epi32(_mm256_add_epi32(WS_ROTL8(a, 5), f),              \
+                                       _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15])); \
+        e = d;                                                                           \
+        d = c;                                                                           \
+        c = WS_ROTL8(b, 30);                                                             \
+        b = a;                                                                           \
+        a = tmp;                                                                         \
+    } while (0)
+
+    const __m256i k0 = _mm256_set1_epi32(0x5A827999);
+    const __m256i k1 = _mm256_set1_epi32(0x6ED9EBA1);
+    const __m256i k2 = _mm256_set1_epi32((int)0x8F1BBCDC);
+    const __m256i k3 = _mm256_set1_epi32((int)0xCA62C1D6);
+
+    int32_t t = 0;
+    for (; t < 20; t++) {
+        // (b & c) | (~b & d)
+        WS_SHA1X8_ROUND(_mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d)), k0);
+    }
+    for (; t < 40; t++) {
+        WS_SHA1X8_ROUND(_mm256_xor_si256(_mm256_xor_si256(b, c), d), k1);
+    }
+    for (; t < 60; t++) {
+        // (b & c) | (b & d) | (c & d)
+        WS_SHA1X8_ROUND(_mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c))), k2);
+    }
+    for (; t < 80; t++) {
+        WS_SHA1X8_ROUND(_mm256_xor_si256(_mm256_xor_si256(b, c), d), k3);
+    }
+#undef WS_SHA1X8_ROUND
+
+    state[0] = _mm256_add_epi32(state[0], a);
+    state[1] = _mm256_add_epi32(state[1], b);
+    state[2] = _mm256_add_epi32(state[2], c);
+    state[3] = _mm256_add_epi32(state[3], d);
+    state[4] = _mm256_add_epi32(state[4], e);
+}
+
+__attribute__((target("avx2")))
+static void wsSha1x8(const uint8_t* const keys[8], uint8_t hashes[8][32]) {
+    __m256i state[5];
+    for (int32_t i = 0; i < 5; i++) {
+        state[i] = _mm256_set1_epi32((int)wsSha1Init[i]);
+    }
+
+    // Only the first six words differ between lanes
+    __m256i w[16];
+    for (int32_t i = 0; i < 6; i++) {
+        w[i] = _mm256_setr_epi32((int)wsLoadBe32(keys[0] + 4 * i), (int)wsLoadBe32(keys[1] + 4 * i),
+                                 (int)wsLoadBe32(keys[2] + 4 * i), (int)wsLoadBe32(keys[3] + 4 * i),
+                                 (int)wsLoadBe32(keys[4] + 4 * i), (int)wsLoadBe32(keys[5] + 4 * i),
+                                 (int)wsLoadBe32(keys[6] + 4 * i), (int)wsLoadBe32(keys[7] + 4 * i));
+    }
+    for (int32_t i = 6; i < 16; i++) {
+        w[i] = _mm256_set1_epi32((int)wsLoadBe32(wsAcceptTail + 4 * (i - 6)));
+    }
+    wsSha1x8Block(state, w);
+
+    for (int32_t i = 0; i < 16; i++) {
+        w[i] = _mm256_set1_epi32((int)wsLoadBe32(wsAcceptLastBlock + 4 * i));
+    }
+    wsSha1x8Block(state, w);
+
+    uint32_t words[5][8];
+    for (int32_t i = 0; i < 5; i++) {
+        _mm256_storeu_si256((__m256i*)words[i], state[i]);
+    }
+    for (int32_t lane = 0; lane < 8; lane++) {
+        for (int32_t i = 0; i < 5; i++) {
+            wsStoreBe32(hashes[lane] + 4 * i, words[i][lane]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void wsAcceptAvx2(const uint8_t* const* keys, char (*accept)[WS_ACCEPT_LEN], size_t count) {
+    for (size_t k = 0; k < count; k += 8) {
+        size_t lanes = count - k < 8 ? count - k : 8;
+
+        // A short batch repeats its last key in the unused lanes
+        const uint8_t* batch[8];
+        for (size_t i = 0; i < 8; i++) {
+            batch[i] = keys[k + (i < lanes ? i : lanes - 1)];
+        }
+
+        uint8_t hashes[8][32];
+        wsSha1x8(batch, hashes);
+        for (size_t i = 0; i < lanes; i++) {
+            wsBase64Ssse3(hashes[i], 20, accept[k + i]);
+        }
+    }
+}
+
+#endif
+
+typedef void (*wsAcceptPFN)(const uint8_t* const* keys, char (*accept)[WS_ACCEPT_LEN], size_t count);
+
+static wsAcceptPFN wsAcceptFns[WS_ACCEPT_IMPL_COUNT] = {
+    [WS_ACCEPT_SCALAR] = wsAcceptScalar,
+#ifdef WS_ACCEPT_X86
+    [WS_ACCEPT_AVX2] = wsAcceptAvx2,
+    [WS_ACCEPT_SHANI] = wsAcceptShaNi,
+#endif
+};
+
+// Full groups of eight keys go to the batch implementation, the rest to the single one
+#define WS_ACCEPT_GROUP 8
+static wsAcceptImpl wsAcceptSingle = WS_ACCEPT_SCALAR;
+static wsAcceptImpl wsAcceptBatch = WS_ACCEPT_SCALAR;
+
+bool wsAcceptSupported(wsAcceptImpl impl) {
+    if (impl == WS_ACCEPT_SCALAR) return true;
+#ifdef WS_ACCEPT_X86
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+    bool ssse3 = ecx & bit_SSSE3;
+    bool sse41 = ecx & bit_SSE4_1;
+    // AVX state has to be enabled by the OS as well, not just present in the CPU
+    bool osAvx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX);
+    if (osAvx) {
+        unsigned xcr0Lo, xcr0Hi;
+        __asm__ volatile("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+        osAvx = (xcr0Lo & 6) == 6;
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+    switch (impl) {
+        case WS_ACCEPT_AVX2:
+            return osAvx && (ebx & bit_AVX2) && ssse3;
+        case WS_ACCEPT_SHANI:
+            return (ebx & bit_SHA) && ssse3 && sse41;
+        default:
+            return false;
+    }
+#else
+    return false;
+#endif
+}
+
+const char* wsAcceptImplName(wsAcceptImpl impl) {
+    switch (impl) {
+        case WS_ACCEPT_SCALAR: return "scalar";
+        case WS_ACCEPT_AVX2: return "avx2";
+        case WS_ACCEPT_SHANI: return "sha-ni";
+        default: return "unknown";
+    }
+}
+
+int32_t wsAcceptSetImpl(wsAcceptImpl impl) {
+    if (impl >= WS_ACCEPT_IMPL_COUNT || !wsAcceptFns[impl] || !wsAcceptSupported(impl)) {
+        return WS_ERROR;
+    }
+    wsAcceptSingle = impl;
+    wsAcceptBatch = impl;
+    return WS_OK;
+}
+
+wsAcceptImpl wsAcceptGetImpl(bool batch) {
+    return batch ? wsAcceptBatch : wsAcceptSingle;
+}
+
+void wsAcceptCompute(const uint8_t* const* keys, char (*accept)[WS_ACCEPT_LEN], size_t count) {
+    size_t batched = wsAcceptBatch != wsAcceptSingle ? count & ~(size_t)(WS_ACCEPT_GROUP - 1) : 0;
+    if (batched) wsAcceptFns[wsAcceptBatch](keys, accept, batched);
+    if (count > batched) wsAcceptFns[wsAcceptSingle](keys + batched, accept + batched, count - batched);
+}
+
+// Every base64 character shows up in some key
+static void wsAcceptTestKeys(uint8_t (*keys)[WS_ACCEPT_KEY_LEN], const uint8_t** keyPtrs, size_t count) {
+    uint32_t seed = 0x9E3779B9;
+    for (size_t k = 0; k < count; k++) {
+        for (int32_t i = 0; i < WS_ACCEPT_KEY_LEN - 2; i++) {
+            seed = seed * 1664525 + 1013904223;
+            keys[k][i] = wsBase64Alphabet[seed >> 26];
+        }
+        keys[k][WS_ACCEPT_KEY_LEN - 2] = '=';
+        keys[k][WS_ACCEPT_KEY_LEN - 1] = '=';
+        keyPtrs[k] = keys[k];
+    }
+}
+
+int32_t wsAcceptSelfTest(wsAcceptImpl impl) {
+    if (impl >= WS_ACCEPT_IMPL_COUNT || !wsAcceptFns[impl] || !wsAcceptSupported(impl)) {
+        return WS_ERROR;
+    }
+
+    // RFC 6455 section 1.3, repeated so a batch fills more than one AVX2 pass
+    static const char* rfcKey = "dGhlIHNhbXBsZSBub25jZQ==";
+    static const char* rfcAccept = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+    enum { COUNT = 19 };
+    uint8_t keys[COUNT][WS_ACCEPT_KEY_LEN];
+    const uint8_t* keyPtrs[COUNT];
+    wsAcceptTestKeys(keys, keyPtrs, COUNT);
+    memcpy(keys[0], rfcKey, WS_ACCEPT_KEY_LEN);
+    memcpy(keys[COUNT - 1], rfcKey, WS_ACCEPT_KEY_LEN);
+
+    char expected[COUNT][WS_ACCEPT_LEN];
+    char actual[COUNT][WS_ACCEPT_LEN];
+    wsAcceptScalar(keyPtrs, expected, COUNT);
+    wsAcceptFns[impl](keyPtrs, actual, COUNT);
+
+    if (memcmp(expected[0], rfcAccept, WS_ACCEPT_LEN) != 0 ||
+        memcmp(actual[0], rfcAccept, WS_ACCEPT_LEN) != 0 ||
+        memcmp(actual[COUNT - 1], rfcAccept, WS_ACCEPT_LEN) != 0 ||
+        memcmp(expected, actual, sizeof(actual)) != 0) {
+        WS_LOG(ERROR, "%s handshake hashing does not match RFC 6455", wsAcceptImplName(impl));
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
+
+// Best of a few short runs in nanoseconds per key
+static double wsAcceptMeasure(wsAcceptImpl impl, size_t count) {
+    uint8_t keys[WS_ACCEPT_GROUP * 8][WS_ACCEPT_KEY_LEN];
+    const uint8_t* keyPtrs[WS_ACCEPT_GROUP * 8];
+    char accept[WS_ACCEPT_GROUP * 8][WS_ACCEPT_LEN];
+    wsAcceptTestKeys(keys, keyPtrs, count);
+
+    double best = 0;
+    for (int32_t run = 0; run < 5; run++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int32_t rep = 0; rep < 16; rep++) {
+            wsAcceptFns[impl](keyPtrs, accept, count);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        double ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (16.0 * count);
+        if (run == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+void wsAcceptInit(void) {
+    // Which one wins depends on the CPU: SHA-NI is always ahead for a single
+    // key, but eight AVX2 lanes can beat it per key on some cores. Both are
+    // timed on a single key and on a full batch, which takes well under a millisecond.
+    wsAcceptSingle = WS_ACCEPT_SCALAR;
+    wsAcceptBatch = WS_ACCEPT_SCALAR;
+    double bestSingle = wsAcceptMeasure(WS_ACCEPT_SCALAR, 1);
+    double bestBatch = wsAcceptMeasure(WS_ACCEPT_SCALAR, WS_ACCEPT_GROUP * 8);
+
+    for (wsAcceptImpl impl = WS_ACCEPT_SCALAR + 1; impl < WS_ACCEPT_IMPL_COUNT; impl++) {
+        if (!wsAcceptSupported(impl) || wsAcceptSelfTest(impl) != WS_OK) continue;
+
+        double single = wsAcceptMeasure(impl, 1);
+        double batch = wsAcceptMeasure(impl, WS_ACCEPT_GROUP * 8);
+        if (single < bestSingle) {
+            bestSingle = single;
+            wsAcceptSingle = impl;
+        }
+        if (batch < bestBatch) {
+            bestBatch = batch;
+            wsAcceptBatch = impl;
+        }
+    }
+}
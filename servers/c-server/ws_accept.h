@@ -0,0 +1,38 @@
+#ifndef WS_ACCEPT_H
+#define WS_ACCEPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define WS_ACCEPT_KEY_LEN 24 // Sec-WebSocket-Key, base64 of a 16 byte nonce
+#define WS_ACCEPT_LEN 28     // Sec-WebSocket-Accept, base64 of a SHA-1, not terminated
+
+// Sec-WebSocket-Accept is base64(SHA-1(key + GUID)). The input is always 60
+// bytes, so every handshake hashes exactly two blocks and the second one is
+// the same for every key.
+typedef enum {
+    WS_ACCEPT_SCALAR, // sha1.h, runs everywhere
+    WS_ACCEPT_AVX2,   // eight keys per pass, one per 32 bit lane
+    WS_ACCEPT_SHANI,  // SHA extensions, one key at a time
+    WS_ACCEPT_IMPL_COUNT,
+} wsAcceptImpl;
+
+// Picks the fastest implementations the CPU supports that pass wsAcceptSelfTest,
+// one for single keys and one for groups of eight. Call once before any thread
+// computes keys, until then the scalar code is used.
+void wsAcceptInit(void);
+
+bool wsAcceptSupported(wsAcceptImpl impl);
+// Uses impl for every key, for benchmarks
+int32_t wsAcceptSetImpl(wsAcceptImpl impl);
+wsAcceptImpl wsAcceptGetImpl(bool batch);
+const char* wsAcceptImplName(wsAcceptImpl impl);
+
+// Computes count accept values at once, the AVX2 path needs batches to fill its lanes
+void wsAcceptCompute(const uint8_t* const* keys, char (*accept)[WS_ACCEPT_LEN], size_t count);
+
+// Checks impl against the RFC 6455 example and the scalar code, WS_ERROR on a mismatch
+int32_t wsAcceptSelfTest(wsAcceptImpl impl);
+
+#endif
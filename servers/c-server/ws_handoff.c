@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "ws_handoff.h"
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Control space for the descriptors of one message, only one is ever sent
+#define WS_HANDOFF_MAX_FDS 4
+
+static int32_t wsHandoffAddress(const char* path, struct sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        WS_LOG(ERROR, "Handoff socket path is too long: %s", path);
+        errno = ENAMETOOLONG;
+        return WS_ERROR;
+    }
+    strcpy(addr->sun_path, path);
+    return WS_OK;
+}
+
+static void wsHandoffSetTimeouts(int32_t sock) {
+    struct timeval tv = {
+        .tv_sec = WS_HANDOFF_TIMEOUT_MS / 1000,
+        .tv_usec = (WS_HANDOFF_TIMEOUT_MS % 1000) * 1000,
+    };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int32_t wsHandoffListen(const char* path) {
+    struct sockaddr_un addr;
+    if (wsHandoffAddress(path, &addr) != WS_OK) return WS_ERROR;
+
+    int32_t sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        WS_LOG(ERROR, "Failed to create handoff socket: %s", strerror(errno));
+        return WS_ERROR;
+    }
+
+    // The previous process keeps its socket open until it exits, only the name moves over
+    unlink(path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 1) < 0) {
+        WS_LOG(ERROR, "Failed to listen on handoff socket %s: %s", path, strerror(errno));
+        close(sock);
+        return WS_ERROR;
+    }
+    return sock;
+}
+
+int32_t wsHandoffAccept(int32_t listenFd) {
+    int32_t sock = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (sock < 0) return WS_ERROR;
+    wsHandoffSetTimeouts(sock);
+    return sock;
+}
+
+int32_t wsHandoffConnect(const char* path) {
+    struct sockaddr_un addr;
+    if (wsHandoffAddress(path, &addr) != WS_OK) return WS_ERROR;
+
+    int32_t sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return WS_ERROR;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return WS_ERROR;
+    }
+    wsHandoffSetTimeouts(sock);
+    return sock;
+}
+
+int32_t wsHandoffSend(int32_t sock, uint32_t type, const void* data, size_t len, int32_t fd) {
+    wsHandoffHeader header = { .type = type, .len = len };
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = sizeof(header) },
+        { .iov_base = (void*)data, .iov_len = len },
+    };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len ? 2 : 1;
+    if (fd >= 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    }
+
+    // The descriptor rides on the first byte of the header, a large payload may
+    // take more than one call
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return WS_ERROR;
+        }
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return WS_OK;
+}
+
+// Keeps the first passed descriptor, a stray one is closed
+static void wsHandoffTakeFds(struct msghdr* msg, int32_t* fd) {
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+
+        size_t count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int received;
+            memcpy(&received, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+            if (*fd < 0) *fd = received;
+            else close(received);
+        }
+    }
+}
+
+// Reads exactly len bytes. Reads never cross into the next message, so a
+// descriptor always arrives with the header it was sent with.
+static int32_t wsHandoffRead(int32_t sock, void* data, size_t len, int32_t* fd) {
+    uint8_t* p = data;
+    while (len > 0) {
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(int) * WS_HANDOFF_MAX_FDS)];
+        } control;
+        struct iovec iov = { .iov_base = p, .iov_len = len };
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return WS_ERROR;
+        }
+        wsHandoffTakeFds(&msg, fd);
+        if (n == 0) {
+            errno = ECONNRESET;
+            return WS_ERROR;
+        }
+        p += n;
+        len -= n;
+    }
+    return WS_OK;
+}
+
+int32_t wsHandoffRecv(int32_t sock, uint32_t* type, wsBuffer* data, int32_t* fd) {
+    wsHandoffHeader header;
+    *fd = -1;
+    data->len = 0;
+    if (wsHandoffRead(sock, &header, sizeof(header), fd) != WS_OK) goto fail;
+    if (header.len && wsBufferReserve(data, header.len) != WS_OK) goto fail;
+    if (wsHandoffRead(sock, data->data, header.len, fd) != WS_OK) goto fail;
+    data->len = header.len;
+    *type = header.type;
+    return WS_OK;
+
+fail:
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+    return WS_ERROR;
+}
+
+int32_t wsHandoffExpect(int32_t sock, uint32_t type, size_t minLen, wsBuffer* data, int32_t* fd) {
+    uint32_t got;
+    if (wsHandoffRecv(sock, &got, data, fd) != WS_OK) return WS_ERROR;
+    if (got == type && data->len >= minLen) return WS_OK;
+
+    WS_LOG(ERROR, "Unexpected handoff message %u of %zu bytes, wanted %u", got, data->len, type);
+    if (*fd >= 0) close(*fd);
+    *fd = -1;
+    return WS_ERROR;
+}
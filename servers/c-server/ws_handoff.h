@@ -0,0 +1,96 @@
+#ifndef WS_HANDOFF_H
+#define WS_HANDOFF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../../lib/ws_deflate.h"
+#include "../../lib/ws_frame.h"
+
+#define WS_HANDOFF_VERSION 1        // both processes have to speak the same layout
+#define WS_HANDOFF_TIMEOUT_MS 10000 // a peer that stays silent this long fails the handoff
+
+// Hot restart over a unix socket, every message is a wsHandoffHeader and its
+// payload in host byte order. The new process connects and the old one sends
+// HELLO and one LISTENER per shard. Nothing stops before the new process
+// answered READY. The old process then parks its shards and sends every client
+// and, without a message log, its history, followed by END. The new process
+// answers DONE once it holds everything, the old one answers BYE and exits. If
+// anything fails before BYE the clients stay with the old process.
+typedef enum {
+    WS_HANDOFF_HELLO = 1, // wsHandoffHello
+    WS_HANDOFF_READY,
+    WS_HANDOFF_LISTENER,  // listening socket attached
+    WS_HANDOFF_CONN,      // client socket attached, wsHandoffConn and its data
+    WS_HANDOFF_HISTORY,   // wsHandoffHistory, room name and frame
+    WS_HANDOFF_END,       // wsHandoffEnd
+    WS_HANDOFF_DONE,
+    WS_HANDOFF_BYE,
+} wsHandoffType;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t len; // payload bytes after the header
+} wsHandoffHeader;
+
+typedef struct {
+    uint32_t version;
+    uint32_t listeners;
+} wsHandoffHello;
+
+// One client, followed by its username, its room names each with a NUL, the
+// unparsed input, the fragments of an unfinished message, the unsent output and
+// the window of its inflater, each as long as given here
+typedef struct {
+    bool handshakeDone;
+    bool closeAfterFlush;
+    bool binary;
+    bool deflate;
+    bool fragmentCompressed;
+    uint8_t fragmentOpcode;
+    wsDeflateParams deflateParams;
+    uint32_t zerocopyNextId; // the kernel numbers MSG_ZEROCOPY sends per socket
+    uint32_t usernameLen;    // 0 for Anonym
+    uint32_t roomCount;
+    uint32_t roomsLen;
+    uint64_t inLen;
+    uint64_t fragmentsLen;
+    uint64_t outLen;
+    uint64_t windowLen;
+} wsHandoffConn;
+
+// A kept broadcast, followed by the room name and the frame
+typedef struct {
+    uint64_t seq;
+    uint32_t roomLen; // 0 for the global channel
+    uint32_t frameLen;
+} wsHandoffHistory;
+
+typedef struct {
+    uint64_t nextSeq;
+    uint32_t conns;
+    uint32_t reserved;
+} wsHandoffEnd;
+
+// Listens on path for the next process, a leftover socket file is replaced
+int32_t wsHandoffListen(const char* path);
+
+// Accepts the next process, both directions time out after WS_HANDOFF_TIMEOUT_MS
+int32_t wsHandoffAccept(int32_t listenFd);
+
+// Connects to the running server. WS_ERROR with errno ENOENT or ECONNREFUSED
+// means nobody listens and the server starts from scratch.
+int32_t wsHandoffConnect(const char* path);
+
+// Sends one message, fd goes along with it unless it is -1
+int32_t wsHandoffSend(int32_t sock, uint32_t type, const void* data, size_t len, int32_t fd);
+
+// Receives the next message into data, replacing its contents. *fd is the
+// attached descriptor or -1, it belongs to the caller.
+int32_t wsHandoffRecv(int32_t sock, uint32_t* type, wsBuffer* data, int32_t* fd);
+
+// Receives the next message and fails unless it is of the given type and carries at least minLen bytes
+int32_t wsHandoffExpect(int32_t sock, uint32_t type, size_t minLen, wsBuffer* data, int32_t* fd);
+
+#endif
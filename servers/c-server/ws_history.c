@@ -0,0 +1,172 @@
+#include "ws_history.h"
+#include "ws_registry.h"
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+int32_t wsHistoryInit(wsHistory* history, uint32_t capacity) {
+    memset(history, 0, sizeof(*history));
+    history->capacity = capacity;
+    if (capacity == 0) return WS_OK;
+
+    history->global.entries = calloc(capacity, sizeof(wsHistoryEntry));
+    history->buckets = calloc(WS_HISTORY_MAX_ROOMS, sizeof(wsHistoryRoom*));
+    if (!history->global.entries || !history->buckets) {
+        WS_LOG(ERROR, "Failed to allocate the message history");
+        wsHistoryFree(history);
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
+
+static void wsHistoryRingClear(wsHistory* history, wsHistoryRing* ring) {
+    for (uint32_t i = 0; i < ring->count; i++) {
+        wsOutFrameRelease(ring->entries[(ring->head + i) % history->capacity].frame);
+    }
+    free(ring->entries);
+    memset(ring, 0, sizeof(*ring));
+}
+
+void wsHistoryFree(wsHistory* history) {
+    if (history->buckets) {
+        for (uint32_t b = 0; b < WS_HISTORY_MAX_ROOMS; b++) {
+            wsHistoryRoom* room = history->buckets[b];
+            while (room) {
+                wsHistoryRoom* next = room->next;
+                wsHistoryRingClear(history, &room->ring);
+                free(room);
+                room = next;
+            }
+        }
+        free(history->buckets);
+    }
+    wsHistoryRingClear(history, &history->global);
+    memset(history, 0, sizeof(*history));
+}
+
+static wsHistoryRoom* wsHistoryLookup(wsHistory* history, const char* name, uint32_t hash) {
+    wsHistoryRoom* room = history->buckets[hash % WS_HISTORY_MAX_ROOMS];
+    while (room && (room->hash != hash || strcmp(room->name, name) != 0)) {
+        room = room->next;
+    }
+    return room;
+}
+
+// Only runs when a new room pushes the count over the limit, a full scan is fine
+static void wsHistoryEvictRoom(wsHistory* history) {
+    wsHistoryRoom** oldest = NULL;
+    for (uint32_t b = 0; b < WS_HISTORY_MAX_ROOMS; b++) {
+        for (wsHistoryRoom** link = &history->buckets[b]; *link; link = &(*link)->next) {
+            if (!oldest || (*link)->lastSeq < (*oldest)->lastSeq) oldest = link;
+        }
+    }
+    if (!oldest) return;
+
+    wsHistoryRoom* room = *oldest;
+    *oldest = room->next;
+    wsHistoryRingClear(history, &room->ring);
+    free(room);
+    history->roomCount--;
+}
+
+static wsHistoryRoom* wsHistoryRoomGet(wsHistory* history, const char* name, bool create) {
+    uint32_t hash = wsNameHash(name);
+    wsHistoryRoom* room = wsHistoryLookup(history, name, hash);
+    if (room || !create) return room;
+
+    if (history->roomCount >= WS_HISTORY_MAX_ROOMS) wsHistoryEvictRoom(history);
+
+    room = calloc(1, sizeof(wsHistoryRoom));
+    wsHistoryEntry* entries = calloc(history->capacity, sizeof(wsHistoryEntry));
+    if (!room || !entries) {
+        WS_LOG(ERROR, "Failed to allocate history for room %s", name);
+        free(room);
+        free(entries);
+        return NULL;
+    }
+    strncpy(room->name, name, WS_ROOM_MAX_NAME - 1);
+    room->hash = hash;
+    room->ring.entries = entries;
+
+    uint32_t b = hash % WS_HISTORY_MAX_ROOMS;
+    room->next = history->buckets[b];
+    history->buckets[b] = room;
+    history->roomCount++;
+    return room;
+}
+
+void wsHistoryAppend(wsHistory* history, const char* room, uint64_t seq, wsOutFrame* frame) {
+    if (history->capacity == 0) return;
+
+    wsHistoryRing* ring = &history->global;
+    if (room && room[0]) {
+        wsHistoryRoom* entry = wsHistoryRoomGet(history, room, true);
+        if (!entry) return;
+        entry->lastSeq = seq;
+        ring = &entry->ring;
+    }
+
+    uint32_t slot = (ring->head + ring->count) % history->capacity;
+    if (ring->count == history->capacity) {
+        // Full, the oldest entry sits where the new one goes
+        wsOutFrameRelease(ring->entries[slot].frame);
+        ring->head = (ring->head + 1) % history->capacity;
+    } else {
+        ring->count++;
+    }
+    ring->entries[slot] = (wsHistoryEntry){ .seq = seq, .frame = wsOutFrameRetain(frame) };
+}
+
+uint32_t wsHistoryCollect(wsHistory* history, const char* room, uint64_t afterSeq, uint32_t limit,
+                          wsOutFrame** frames) {
+    if (history->capacity == 0) return 0;
+
+    wsHistoryRing* ring = &history->global;
+    if (room && room[0]) {
+        wsHistoryRoom* entry = wsHistoryRoomGet(history, room, false);
+        if (!entry) return 0;
+        ring = &entry->ring;
+    }
+    if (limit == 0 || limit > ring->count) limit = ring->count;
+
+    // Shards relay each other's messages, so sequence numbers are only roughly
+    // ordered within a ring. Walk back from the newest end to find where the
+    // last limit matches start, then copy them out in ring order.
+    uint32_t matches = 0;
+    uint32_t start = ring->count;
+    while (start > 0 && matches < limit) {
+        start--;
+        if (ring->entries[(ring->head + start) % history->capacity].seq > afterSeq) matches++;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = start; i < ring->count; i++) {
+        wsHistoryEntry* entry = &ring->entries[(ring->head + i) % history->capacity];
+        if (entry->seq > afterSeq) frames[count++] = entry->frame;
+    }
+    return count;
+}
+
+static int32_t wsHistoryRingForEach(wsHistory* history, wsHistoryRing* ring, const char* room,
+                                    wsHistoryEntryPFN onEntry, void* ctx) {
+    for (uint32_t i = 0; i < ring->count; i++) {
+        wsHistoryEntry* entry = &ring->entries[(ring->head + i) % history->capacity];
+        if (onEntry(ctx, entry->seq, room, entry->frame) != WS_OK) return WS_ERROR;
+    }
+    return WS_OK;
+}
+
+int32_t wsHistoryForEach(wsHistory* history, wsHistoryEntryPFN onEntry, void* ctx) {
+    if (history->capacity == 0) return WS_OK;
+    if (wsHistoryRingForEach(history, &history->global, NULL, onEntry, ctx) != WS_OK) return WS_ERROR;
+
+    for (uint32_t b = 0; b < WS_HISTORY_MAX_ROOMS; b++) {
+        for (wsHistoryRoom* room = history->buckets[b]; room; room = room->next) {
+            if (wsHistoryRingForEach(history, &room->ring, room->name, onEntry, ctx) != WS_OK) return WS_ERROR;
+        }
+    }
+    return WS_OK;
+}
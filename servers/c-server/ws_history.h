@@ -0,0 +1,61 @@
+#ifndef WS_HISTORY_H
+#define WS_HISTORY_H
+
+#include <stdint.h>
+
+#include "ws_outq.h"
+#include "ws_room.h"
+
+#define WS_HISTORY_MAX_ROOMS 1024 // rooms with history per shard, the least recently used one goes first
+
+// A relayed message, the frame is the encoded broadcast every recipient got
+typedef struct {
+    uint64_t seq;
+    wsOutFrame* frame;
+} wsHistoryEntry;
+
+// The newest frames of one channel in one contiguous array, oldest first from head
+typedef struct {
+    wsHistoryEntry* entries;
+    uint32_t head;
+    uint32_t count;
+} wsHistoryRing;
+
+typedef struct wsHistoryRoom {
+    char name[WS_ROOM_MAX_NAME];
+    uint32_t hash;
+    uint64_t lastSeq; // newest message, picks the room to evict
+    wsHistoryRing ring;
+    struct wsHistoryRoom* next;
+} wsHistoryRoom;
+
+// Per shard copy of the recent broadcasts. Every shard sees every broadcast, so
+// each keeps references to the same shared frames and replays without locking.
+typedef struct {
+    uint32_t capacity;      // frames kept per channel, 0 disables history
+    wsHistoryRing global;   // messages without a room
+    wsHistoryRoom** buckets; // WS_HISTORY_MAX_ROOMS of them
+    uint32_t roomCount;
+} wsHistory;
+
+int32_t wsHistoryInit(wsHistory* history, uint32_t capacity);
+void wsHistoryFree(wsHistory* history);
+
+// Keeps a reference to frame, dropping the oldest frame of the channel once it is full.
+// room NULL or empty is the global channel.
+void wsHistoryAppend(wsHistory* history, const char* room, uint64_t seq, wsOutFrame* frame);
+
+// Fills frames with the newest frames of the channel whose seq is above afterSeq,
+// at most limit of them (0 for all that are kept), oldest first. frames needs room
+// for history->capacity entries. No references are taken, the frames stay valid
+// until the next append. Returns the number of frames.
+uint32_t wsHistoryCollect(wsHistory* history, const char* room, uint64_t afterSeq, uint32_t limit,
+                          wsOutFrame** frames);
+
+// Called for every kept frame, room is NULL for the global channel
+typedef int32_t (*wsHistoryEntryPFN)(void* ctx, uint64_t seq, const char* room, wsOutFrame* frame);
+
+// Walks every channel oldest first and stops at the first callback that fails
+int32_t wsHistoryForEach(wsHistory* history, wsHistoryEntryPFN onEntry, void* ctx);
+
+#endif
@@ -0,0 +1,221 @@
+#include "ws_http.h"
+#include "../../lib/ws_globals.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+enum {
+    WS_HTTP_METHOD,       // matching "GET "
+    WS_HTTP_REQUEST_LINE, // target and version up to the line end
+    WS_HTTP_LINE_START,   // first byte of a header line or the blank line
+    WS_HTTP_NAME,
+    WS_HTTP_VALUE_START,  // blanks between the colon and the value
+    WS_HTTP_VALUE,
+    WS_HTTP_END_LF,       // CR seen on the blank line
+};
+
+enum {
+    WS_HTTP_OTHER,
+    WS_HTTP_UPGRADE,
+    WS_HTTP_CONNECTION,
+    WS_HTTP_KEY,
+    WS_HTTP_VERSION,
+    WS_HTTP_EXTENSIONS,
+};
+
+#define WS_HTTP_SEEN(header) (1u << (header))
+#define WS_HTTP_SEEN_ALL (WS_HTTP_SEEN(WS_HTTP_UPGRADE) | WS_HTTP_SEEN(WS_HTTP_CONNECTION) | \
+                          WS_HTTP_SEEN(WS_HTTP_KEY) | WS_HTTP_SEEN(WS_HTTP_VERSION))
+
+static inline bool wsHttpIsBlank(uint8_t c) {
+    return c == ' ' || c == '\t';
+}
+
+// Only the names the upgrade depends on or may use, everything else is skipped
+static uint8_t wsHttpClassify(const uint8_t* name, size_t len) {
+    switch (len) {
+        case 7:
+            if (strncasecmp((const char*)name, "upgrade", 7) == 0) return WS_HTTP_UPGRADE;
+            break;
+        case 10:
+            if (strncasecmp((const char*)name, "connection", 10) == 0) return WS_HTTP_CONNECTION;
+            break;
+        case 17:
+            if (strncasecmp((const char*)name, "sec-websocket-key", 17) == 0) return WS_HTTP_KEY;
+            break;
+        case 21:
+            if (strncasecmp((const char*)name, "sec-websocket-version", 21) == 0) return WS_HTTP_VERSION;
+            break;
+        case 24:
+            if (strncasecmp((const char*)name, "sec-websocket-extensions", 24) == 0) return WS_HTTP_EXTENSIONS;
+            break;
+    }
+    return WS_HTTP_OTHER;
+}
+
+// Comma separated list such as "keep-alive, Upgrade", tokens are case insensitive
+static bool wsHttpHasToken(const uint8_t* value, size_t len, const char* token) {
+    size_t tokenLen = strlen(token);
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (wsHttpIsBlank(value[i]) || value[i] == ',')) i++;
+        size_t start = i;
+        while (i < len && value[i] != ',') i++;
+        size_t end = i;
+        while (end > start && wsHttpIsBlank(value[end - 1])) end--;
+
+        if (end - start == tokenLen && strncasecmp((const char*)value + start, token, tokenLen) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// lineEnd is the LF, the CR and blanks before it are not part of the value
+static int32_t wsHttpValueDone(wsHttpUpgrade* parser, const uint8_t* data, uint32_t lineEnd) {
+    while (lineEnd > parser->tokenStart &&
+           (data[lineEnd - 1] == '\r' || wsHttpIsBlank(data[lineEnd - 1]))) {
+        lineEnd--;
+    }
+    const uint8_t* value = data + parser->tokenStart;
+    size_t len = lineEnd - parser->tokenStart;
+
+    switch (parser->header) {
+        case WS_HTTP_UPGRADE:
+            if (!wsHttpHasToken(value, len, "websocket")) return WS_ERROR;
+            break;
+        case WS_HTTP_CONNECTION:
+            if (!wsHttpHasToken(value, len, "upgrade")) return WS_ERROR;
+            break;
+        case WS_HTTP_KEY:
+            if (len != WS_HTTP_KEY_LEN) return WS_ERROR;
+            parser->keyStart = parser->tokenStart;
+            break;
+        case WS_HTTP_VERSION:
+            if (len != 2 || value[0] != '1' || value[1] != '3') {
+                parser->status = 426;
+                return WS_ERROR;
+            }
+            break;
+        case WS_HTTP_EXTENSIONS:
+            // Optional, only the first one is looked at
+            if (parser->seen & WS_HTTP_SEEN(WS_HTTP_EXTENSIONS) || len > UINT16_MAX) return WS_OK;
+            parser->extensionsStart = parser->tokenStart;
+            parser->extensionsLen = (uint16_t)len;
+            break;
+        default:
+            return WS_OK;
+    }
+    parser->seen |= WS_HTTP_SEEN(parser->header);
+    return WS_OK;
+}
+
+// Request line has to be "GET <target> HTTP/1.1", the version is checked once the line is over
+static bool wsHttpRequestLineDone(const uint8_t* data, uint32_t end) {
+    if (end > 0 && data[end - 1] == '\r') end--;
+    return end >= 4 + 1 + 9 && memcmp(data + end - 9, " HTTP/1.1", 9) == 0;
+}
+
+// The metrics endpoint, with or without a query string
+static bool wsHttpIsMetrics(const uint8_t* data, uint32_t end) {
+    static const char target[] = "/metrics";
+    if (end > 0 && data[end - 1] == '\r') end--;
+    size_t len = end - 9 - 4;
+    return len >= sizeof(target) - 1 && memcmp(data + 4, target, sizeof(target) - 1) == 0 &&
+           (len == sizeof(target) - 1 || data[4 + sizeof(target) - 1] == '?');
+}
+
+int64_t wsHttpUpgradeParse(wsHttpUpgrade* parser, const uint8_t* data, size_t len, size_t maxLen) {
+    static const char method[] = "GET ";
+
+    size_t end = len < maxLen ? len : maxLen;
+    parser->status = 400;
+
+    uint32_t i = parser->offset;
+    for (; i < end; i++) {
+        uint8_t c = data[i];
+
+        switch (parser->state) {
+            case WS_HTTP_METHOD:
+                if (c != (uint8_t)method[i]) return WS_ERROR;
+                if (i == sizeof(method) - 2) parser->state = WS_HTTP_REQUEST_LINE;
+                break;
+
+            case WS_HTTP_REQUEST_LINE: {
+                // Nothing in the line matters until its end, let memchr find it
+                const uint8_t* lf = memchr(data + i, '\n', end - i);
+                if (!lf) {
+                    i = end - 1;
+                    break;
+                }
+                i = lf - data;
+                if (!wsHttpRequestLineDone(data, i)) return WS_ERROR;
+                parser->metrics = wsHttpIsMetrics(data, i);
+                parser->state = WS_HTTP_LINE_START;
+                break;
+            }
+
+            case WS_HTTP_LINE_START:
+                if (c == '\r') {
+                    parser->state = WS_HTTP_END_LF;
+                    break;
+                }
+                if (c == '\n') goto done;
+                if (c == ':' || wsHttpIsBlank(c)) return WS_ERROR;
+                parser->tokenStart = i;
+                parser->state = WS_HTTP_NAME;
+                break;
+
+            case WS_HTTP_NAME:
+                if (c == ':') {
+                    parser->header = wsHttpClassify(data + parser->tokenStart, i - parser->tokenStart);
+                    parser->state = WS_HTTP_VALUE_START;
+                }
+                else if (c == '\r' || c == '\n' || wsHttpIsBlank(c)) {
+                    return WS_ERROR;
+                }
+                break;
+
+            case WS_HTTP_VALUE_START:
+                if (wsHttpIsBlank(c)) break;
+                parser->tokenStart = i;
+                parser->state = WS_HTTP_VALUE;
+                // fallthrough
+            case WS_HTTP_VALUE: {
+                const uint8_t* lf = memchr(data + i, '\n', end - i);
+                if (!lf) {
+                    i = end - 1;
+                    break;
+                }
+                i = lf - data;
+                if (wsHttpValueDone(parser, data, i) != WS_OK) return WS_ERROR;
+                parser->state = WS_HTTP_LINE_START;
+                break;
+            }
+
+            case WS_HTTP_END_LF:
+                if (c != '\n') return WS_ERROR;
+                goto done;
+        }
+    }
+
+    parser->offset = i;
+    if (i >= maxLen) {
+        parser->status = 431;
+        return WS_ERROR;
+    }
+    return WS_HTTP_INCOMPLETE;
+
+done:
+    parser->offset = i + 1;
+    // A plain request for the metrics, with an Upgrade header /metrics is a WebSocket like any other path
+    if (parser->metrics && !(parser->seen & WS_HTTP_SEEN(WS_HTTP_UPGRADE))) return parser->offset;
+    parser->metrics = false;
+    if (!(parser->seen & WS_HTTP_SEEN(WS_HTTP_VERSION))) {
+        parser->status = 426;
+        return WS_ERROR;
+    }
+    if ((parser->seen & WS_HTTP_SEEN_ALL) != WS_HTTP_SEEN_ALL) return WS_ERROR;
+    return parser->offset;
+}
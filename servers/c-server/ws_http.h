@@ -0,0 +1,46 @@
+#ifndef WS_HTTP_H
+#define WS_HTTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WS_HTTP_INCOMPLETE 0
+#define WS_HTTP_KEY_LEN 24 // base64 of the 16 byte nonce
+
+// Parser state for one HTTP/1.1 upgrade request. Every byte is looked at once,
+// values are skipped with memchr up to their line end and only the ones the
+// upgrade needs are checked. A call after more data arrived continues where the
+// last one stopped. The request has to stay at the start of the buffer until it
+// is complete, the key is only remembered as an offset into it.
+typedef struct {
+    uint32_t offset;     // bytes scanned so far
+    uint32_t tokenStart; // start of the current header name or value
+    uint32_t keyStart;
+    uint32_t extensionsStart; // first Sec-WebSocket-Extensions value, length 0 without one
+    uint16_t extensionsLen;
+    uint16_t status;     // HTTP status to answer with once parsing failed
+    uint8_t state;
+    uint8_t header;      // which of the known headers the current line is
+    uint8_t seen;        // headers that were present and valid
+    bool metrics;        // GET /metrics, once complete only set if it asked for no upgrade
+} wsHttpUpgrade;
+
+// Returns the length of the request including the blank line, WS_HTTP_INCOMPLETE
+// if it needs more bytes, or WS_ERROR with parser->status set to 400, 426 (wrong
+// Sec-WebSocket-Version) or 431 (longer than maxLen). A plain GET /metrics
+// without an Upgrade header is complete as well, with parser->metrics set.
+int64_t wsHttpUpgradeParse(wsHttpUpgrade* parser, const uint8_t* data, size_t len, size_t maxLen);
+
+// Sec-WebSocket-Key of a complete request, points into data
+static inline const char* wsHttpUpgradeKey(const wsHttpUpgrade* parser, const uint8_t* data) {
+    return (const char*)data + parser->keyStart;
+}
+
+// Sec-WebSocket-Extensions of a complete request, points into data
+static inline const char* wsHttpUpgradeExtensions(const wsHttpUpgrade* parser, const uint8_t* data, size_t* len) {
+    *len = parser->extensionsLen;
+    return (const char*)data + parser->extensionsStart;
+}
+
+#endif
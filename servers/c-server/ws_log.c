@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include "ws_log.h"
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WS_LOG_MAX_RECORD (16 * 1024 * 1024)
+
+static uint32_t wsLogCrcTable[256];
+static pthread_once_t wsLogCrcOnce = PTHREAD_ONCE_INIT;
+
+static void wsLogCrcInit(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int32_t k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        wsLogCrcTable[i] = c;
+    }
+}
+
+// Plain CRC-32 (zlib polynomial), chained by passing the previous result
+static uint32_t wsLogCrc(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = wsLogCrcTable[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t wsLogRecordCrc(const wsLogRecord* record, const void* room, const void* frame) {
+    const size_t fixed = sizeof(wsLogRecord) - offsetof(wsLogRecord, seq);
+    uint32_t crc = wsLogCrc(0, &record->seq, fixed);
+    crc = wsLogCrc(crc, room, record->roomLen);
+    return wsLogCrc(crc, frame, record->frameLen);
+}
+
+static void wsLogSegmentPath(const wsLog* log, uint32_t segment, char* path, size_t size) {
+    snprintf(path, size, "%s/%08u.wslog", log->dir, segment);
+}
+
+// Makes the name of a new segment durable, not only its contents
+static void wsLogSyncDir(const wsLog* log) {
+    int fd = open(log->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+static int32_t wsLogOpenSegment(wsLog* log, uint32_t segment) {
+    char path[4096];
+    wsLogSegmentPath(log, segment, path, sizeof(path));
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        WS_LOG(ERROR, "Failed to create log segment %s: %s", path, strerror(errno));
+        return WS_ERROR;
+    }
+    wsLogSyncDir(log);
+
+    log->fd = fd;
+    log->segment = segment;
+    log->segmentBytes = 0;
+    return WS_OK;
+}
+
+// Walks the records of one mapped segment, a short or corrupt record ends it
+static uint64_t wsLogReplaySegment(const uint8_t* data, size_t len, wsLogRecordPFN onRecord, void* ctx) {
+    uint64_t count = 0;
+    size_t offset = 0;
+    char room[UINT16_MAX + 1];
+
+    while (len - offset >= sizeof(wsLogRecord)) {
+        wsLogRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (record.size < sizeof(record) || record.size > len - offset ||
+            record.size != sizeof(record) + record.roomLen + record.frameLen) break;
+
+        const uint8_t* roomData = data + offset + sizeof(record);
+        const uint8_t* frame = roomData + record.roomLen;
+        if (wsLogRecordCrc(&record, roomData, frame) != record.crc) break;
+
+        memcpy(room, roomData, record.roomLen);
+        room[record.roomLen] = '\0';
+        onRecord(ctx, record.seq, room, frame, record.frameLen);
+
+        offset += record.size;
+        count++;
+    }
+
+    if (offset < len) {
+        WS_LOG(WARN, "Log segment ends in %zu unreadable bytes, ignoring them", len - offset);
+    }
+    return count;
+}
+
+static int wsLogCompareSegments(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void wsLogRemoveSegment(const wsLog* log, uint32_t segment) {
+    char path[4096];
+    wsLogSegmentPath(log, segment, path, sizeof(path));
+    if (unlink(path) < 0 && errno != ENOENT) {
+        WS_LOG(WARN, "Failed to remove log segment %s: %s", path, strerror(errno));
+    }
+}
+
+// Removes every segment before keep, they fell out of the recovery window
+static void wsLogPrune(wsLog* log, uint32_t keep) {
+    for (; log->oldest < keep; log->oldest++) wsLogRemoveSegment(log, log->oldest);
+}
+
+static void wsLogReplayFile(const char* path, wsLogRecordPFN onRecord, void* ctx, uint64_t* records) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        WS_LOG(ERROR, "Failed to open log segment %s: %s", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return;
+    }
+
+    // Read once front to back, the kernel can read ahead the whole file
+    uint8_t* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        WS_LOG(ERROR, "Failed to map log segment %s: %s", path, strerror(errno));
+        return;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    *records += wsLogReplaySegment(data, st.st_size, onRecord, ctx);
+    munmap(data, st.st_size);
+}
+
+// Replays the newest segments that hold records and returns the index the next
+// segment gets. Every start opens a segment of its own, so restarts without
+// traffic leave empty ones behind, those go first. Segments older than the
+// recovery window are removed as well.
+static uint32_t wsLogRecover(wsLog* log, wsLogRecordPFN onRecord, void* ctx) {
+    DIR* dir = opendir(log->dir);
+    if (!dir) return 0;
+
+    uint32_t* segments = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        uint32_t segment;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%8u.%7s", &segment, suffix) != 2 || strcmp(suffix, "wslog") != 0) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            uint32_t* grown = realloc(segments, capacity * sizeof(uint32_t));
+            if (!grown) break;
+            segments = grown;
+        }
+        segments[count++] = segment;
+    }
+    closedir(dir);
+    if (count == 0) {
+        free(segments);
+        return 0;
+    }
+    qsort(segments, count, sizeof(uint32_t), wsLogCompareSegments);
+
+    // Newest first, the window takes the first segments with data
+    uint32_t window[WS_LOG_RECOVER_SEGMENTS];
+    size_t kept = 0;
+    size_t removed = 0;
+    for (size_t i = count; i-- > 0;) {
+        char path[4096];
+        wsLogSegmentPath(log, segments[i], path, sizeof(path));
+        struct stat st;
+        if (stat(path, &st) == 0 && st.st_size > 0 && kept < WS_LOG_RECOVER_SEGMENTS) {
+            window[kept++] = segments[i];
+            continue;
+        }
+        wsLogRemoveSegment(log, segments[i]);
+        removed++;
+    }
+
+    uint64_t records = 0;
+    for (size_t i = kept; i-- > 0;) {
+        char path[4096];
+        wsLogSegmentPath(log, window[i], path, sizeof(path));
+        wsLogReplayFile(path, onRecord, ctx, &records);
+    }
+
+    uint32_t next = segments[count - 1] + 1;
+    log->oldest = kept ? window[kept - 1] : next;
+    log->previous = kept ? window[0] : next;
+    WS_LOG(INFO, "Recovered %llu messages from %zu log segments in %s, removed %zu old or empty ones",
+           (unsigned long long)records, kept, log->dir, removed);
+    free(segments);
+    return next;
+}
+
+static int32_t wsLogWriteAll(int fd, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return WS_ERROR;
+        }
+        data += n;
+        len -= n;
+    }
+    return WS_OK;
+}
+
+static void* wsLogRun(void* arg) {
+    wsLog* log = arg;
+
+    pthread_mutex_lock(&log->lock);
+    for (;;) {
+        while (log->staging.len == 0) pthread_cond_wait(&log->wake, &log->lock);
+
+        // Take everything queued so far, the shards keep appending into the spare buffer
+        wsBuffer batch = log->staging;
+        log->staging = log->spare;
+        log->spare = (wsBuffer){0};
+        log->writing = true;
+        pthread_mutex_unlock(&log->lock);
+
+        bool failed = wsLogWriteAll(log->fd, batch.data, batch.len) != WS_OK || fdatasync(log->fd) < 0;
+        if (failed) {
+            WS_LOG(ERROR, "Failed to write log segment %08u: %s", log->segment, strerror(errno));
+        }
+        log->segmentBytes += batch.len;
+
+        // Recovery stops at a partial record, so records after a failed write go to a new segment.
+        // Once the new one has data the window is it and the one just closed.
+        if (failed || log->segmentBytes >= WS_LOG_SEGMENT_SIZE) {
+            int fd = log->fd;
+            uint32_t closed = log->segment;
+            if (wsLogOpenSegment(log, log->segment + 1) == WS_OK) {
+                close(fd);
+                wsLogPrune(log, log->previous);
+                log->previous = closed;
+            }
+        }
+
+        batch.len = 0;
+        pthread_mutex_lock(&log->lock);
+        if (!log->spare.data) log->spare = batch;
+        else wsBufferFree(&batch);
+        log->writing = false;
+        pthread_cond_broadcast(&log->idle);
+    }
+    return NULL;
+}
+
+int32_t wsLogOpen(wsLog* log, const char* dir, wsLogRecordPFN onRecord, void* ctx) {
+    memset(log, 0, sizeof(*log));
+    pthread_once(&wsLogCrcOnce, wsLogCrcInit);
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        WS_LOG(ERROR, "Failed to create log directory %s: %s", dir, strerror(errno));
+        return WS_ERROR;
+    }
+    log->dir = strdup(dir);
+    if (!log->dir) return WS_ERROR;
+
+    uint32_t segment = wsLogRecover(log, onRecord, ctx);
+
+    // Never append behind a possibly torn tail, every start gets its own segment
+    if (wsLogOpenSegment(log, segment) != WS_OK) return WS_ERROR;
+
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->wake, NULL);
+    pthread_cond_init(&log->idle, NULL);
+    if (pthread_create(&log->thread, NULL, wsLogRun, log) != 0) {
+        WS_LOG(ERROR, "Failed to start the log writer");
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
+
+int32_t wsLogAppend(wsLog* log, uint64_t seq, const char* room, const uint8_t* frame, uint32_t frameLen) {
+    size_t roomLen = room ? strlen(room) : 0;
+    wsLogRecord record = {
+        .size = (uint32_t)(sizeof(wsLogRecord) + roomLen + frameLen),
+        .seq = seq,
+        .frameLen = frameLen,
+        .roomLen = (uint16_t)roomLen,
+    };
+    if (roomLen > UINT16_MAX || record.size > WS_LOG_MAX_RECORD) return WS_ERROR;
+    record.crc = wsLogRecordCrc(&record, room, frame);
+
+    pthread_mutex_lock(&log->lock);
+    if (log->staging.len + record.size > WS_LOG_MAX_PENDING ||
+        wsBufferReserve(&log->staging, record.size) != WS_OK) {
+        // Only the first drop of a backlog is reported
+        if (log->dropped++ == 0) WS_LOG(ERROR, "Message log is falling behind, dropping records");
+        pthread_mutex_unlock(&log->lock);
+        return WS_ERROR;
+    }
+    if (log->dropped) log->dropped = 0;
+
+    // The writer only sleeps while staging is empty
+    bool wake = log->staging.len == 0;
+    memcpy(log->staging.data + log->staging.len, &record, sizeof(record));
+    if (roomLen) memcpy(log->staging.data + log->staging.len + sizeof(record), room, roomLen);
+    memcpy(log->staging.data + log->staging.len + sizeof(record) + roomLen, frame, frameLen);
+    log->staging.len += record.size;
+    pthread_mutex_unlock(&log->lock);
+
+    if (wake) pthread_cond_signal(&log->wake);
+    return WS_OK;
+}
+
+void wsLogFlush(wsLog* log) {
+    pthread_mutex_lock(&log->lock);
+    while (log->staging.len > 0 || log->writing) pthread_cond_wait(&log->idle, &log->lock);
+    pthread_mutex_unlock(&log->lock);
+}
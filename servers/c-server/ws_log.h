@@ -0,0 +1,62 @@
+#ifndef WS_LOG_H
+#define WS_LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "../../lib/ws_frame.h"
+
+#define WS_LOG_SEGMENT_SIZE (64 * 1024 * 1024) // a new segment is started once one grows past this
+#define WS_LOG_RECOVER_SEGMENTS 2              // newest segments with records read back at startup, older ones are removed
+#define WS_LOG_MAX_PENDING (64 * 1024 * 1024)  // unwritten bytes before appends are dropped
+
+// On disk every record is this header, the room name and the encoded frame,
+// in host byte order. Segments are named <index>.wslog, 8 decimal digits.
+typedef struct {
+    uint32_t size;     // whole record including this header
+    uint32_t crc;      // CRC-32 of everything after this field, a torn tail fails it
+    uint64_t seq;
+    uint32_t frameLen;
+    uint16_t roomLen;  // 0 for a message to everyone
+    uint16_t reserved;
+} wsLogRecord;
+
+// Append-only message log. Shards copy records into a staging buffer under a
+// short lock, a background thread writes whatever piled up while the previous
+// write was running and fdatasyncs it in one go (group commit). The event loop
+// never waits for the disk.
+typedef struct {
+    char* dir;
+    int32_t fd;            // segment being written, owned by the writer thread
+    uint32_t segment;
+    uint64_t segmentBytes;
+    uint32_t oldest;       // first segment that may still exist
+    uint32_t previous;     // last closed segment with records, the rest of the recovery window
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;   // signalled when staging goes from empty to non-empty
+    wsBuffer staging;      // filled by the shards
+    wsBuffer spare;        // the previous batch, reused to avoid reallocating
+    uint64_t dropped;      // records lost since the disk fell too far behind, 0 once it caught up
+    bool writing;          // the writer holds a batch that is not synced yet
+    pthread_cond_t idle;   // signalled after every batch, see wsLogFlush
+    pthread_t thread;
+} wsLog;
+
+// Called for every intact record found during recovery, in log order.
+// room is NUL terminated and empty for a message to everyone.
+typedef void (*wsLogRecordPFN)(void* ctx, uint64_t seq, const char* room, const uint8_t* frame, uint32_t frameLen);
+
+// Creates dir if needed, maps the newest segments with records and replays
+// them through onRecord, then starts a fresh segment and the writer thread.
+// Empty segments and those behind the recovery window are removed.
+int32_t wsLogOpen(wsLog* log, const char* dir, wsLogRecordPFN onRecord, void* ctx);
+
+// Queues one record, safe from any shard. WS_ERROR if it had to be dropped.
+int32_t wsLogAppend(wsLog* log, uint64_t seq, const char* room, const uint8_t* frame, uint32_t frameLen);
+
+// Waits until everything appended so far is written and synced
+void wsLogFlush(wsLog* log);
+
+#endif
@@ -0,0 +1,467 @@
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define WS_LOGGER_RING_SIZE (1024 * 1024) // per thread, a power of two
+#define WS_LOGGER_MAX_RECORD 4096
+#define WS_LOGGER_MAX_STRING 1024         // string arguments are cut after this many bytes
+#define WS_LOGGER_IDLE_MS 10              // pause of the drain thread between passes
+#define WS_LOGGER_OUT_SIZE (64 * 1024)
+#define WS_LOGGER_PAD UINT32_MAX          // level of the filler in front of a wrap
+
+// A message as queued: the format pointer and the raw arguments in 8 byte
+// slots, a string as its length followed by its bytes
+typedef struct {
+    uint32_t size; // the whole record, a multiple of 8
+    uint32_t level;
+    uint64_t timeNs;
+    const char* fmt;
+} wsLogRecord;
+
+typedef enum {
+    WS_LOG_ARG_NONE, // %% or a conversion that takes no argument
+    WS_LOG_ARG_INT,
+    WS_LOG_ARG_LONG,
+    WS_LOG_ARG_LLONG,
+    WS_LOG_ARG_SIZE,
+    WS_LOG_ARG_INTMAX,
+    WS_LOG_ARG_PTRDIFF,
+    WS_LOG_ARG_DOUBLE,
+    WS_LOG_ARG_PTR,
+    WS_LOG_ARG_STRING,
+} wsLogArg;
+
+// One producer, the owning thread, and one consumer, whoever holds the drain
+// lock. head and tail count bytes and are only masked for access.
+typedef struct wsLogRing {
+    _Alignas(64) atomic_uint_fast64_t head;
+    _Alignas(64) atomic_uint_fast64_t tail;
+    atomic_uint_fast64_t dropped;
+    uint64_t reported; // drops the drain side already wrote a warning about
+    uint8_t* data;
+    struct wsLogRing* next;
+} wsLogRing;
+
+typedef struct {
+    int fd;
+    size_t len;
+    char data[WS_LOGGER_OUT_SIZE];
+} wsLogOut;
+
+// Rings are never freed, a thread that exits leaves its last messages behind for the drain
+static _Atomic(wsLogRing*) wsLoggerRings;
+static __thread wsLogRing* wsLoggerRing;
+static __thread uint64_t wsLoggerTickNs;
+
+// Everything below is only touched with the drain lock held
+static pthread_mutex_t wsLoggerDrainLock = PTHREAD_MUTEX_INITIALIZER;
+static wsLogOut wsLoggerStdout = {.fd = STDOUT_FILENO};
+static wsLogOut wsLoggerStderr = {.fd = STDERR_FILENO};
+static time_t wsLoggerSecond = -1;
+static char wsLoggerSecondText[32];
+
+static uint64_t wsLoggerClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void wsLoggerTick(void) {
+    wsLoggerTickNs = wsLoggerClock();
+}
+
+// Length of the printf conversion at fmt, which points at its '%'. stars counts
+// the '*' width and precision arguments in front of the value.
+static size_t wsLoggerSpec(const char* fmt, wsLogArg* kind, int32_t* stars) {
+    size_t i = 1;
+    *kind = WS_LOG_ARG_NONE;
+    *stars = 0;
+
+    while (fmt[i] && strchr("-+ #0'", fmt[i])) i++;
+    if (fmt[i] == '*') {
+        (*stars)++;
+        i++;
+    }
+    while (fmt[i] >= '0' && fmt[i] <= '9') i++;
+    if (fmt[i] == '.') {
+        i++;
+        if (fmt[i] == '*') {
+            (*stars)++;
+            i++;
+        }
+        while (fmt[i] >= '0' && fmt[i] <= '9') i++;
+    }
+
+    int32_t longs = 0;
+    char size = 0;
+    for (;; i++) {
+        if (fmt[i] == 'l') longs++;
+        else if (fmt[i] == 'z' || fmt[i] == 'j' || fmt[i] == 't') size = fmt[i];
+        else if (fmt[i] != 'h') break;
+    }
+
+    switch (fmt[i]) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            if (size == 'z') *kind = WS_LOG_ARG_SIZE;
+            else if (size == 'j') *kind = WS_LOG_ARG_INTMAX;
+            else if (size == 't') *kind = WS_LOG_ARG_PTRDIFF;
+            else *kind = longs >= 2 ? WS_LOG_ARG_LLONG : longs ? WS_LOG_ARG_LONG : WS_LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            *kind = WS_LOG_ARG_DOUBLE;
+            break;
+        case 'p':
+            *kind = WS_LOG_ARG_PTR;
+            break;
+        case 's':
+            *kind = WS_LOG_ARG_STRING;
+            break;
+        default:
+            // %%, long double and %n are not supported
+            break;
+    }
+    return fmt[i] ? i + 1 : i;
+}
+
+static void wsLoggerPutSlot(uint8_t* record, size_t* len, bool* full, uint64_t value) {
+    if (*full || *len + 8 > WS_LOGGER_MAX_RECORD) {
+        *full = true;
+        return;
+    }
+    memcpy(record + *len, &value, 8);
+    *len += 8;
+}
+
+static void wsLoggerPutString(uint8_t* record, size_t* len, bool* full, const char* s) {
+    if (!s) s = "(null)";
+    if (*full || *len + 8 > WS_LOGGER_MAX_RECORD) {
+        *full = true;
+        return;
+    }
+    size_t n = strnlen(s, WS_LOGGER_MAX_STRING);
+    size_t room = WS_LOGGER_MAX_RECORD - *len - 8;
+    if (n > room) n = room;
+
+    uint64_t slot = n;
+    memcpy(record + *len, &slot, 8);
+    memcpy(record + *len + 8, s, n);
+    *len += 8 + ((n + 7) & ~(size_t)7);
+}
+
+static wsLogRing* wsLoggerRegister(void) {
+    wsLogRing* ring = calloc(1, sizeof(wsLogRing));
+    if (!ring) return NULL;
+    ring->data = malloc(WS_LOGGER_RING_SIZE);
+    if (!ring->data) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->next = atomic_load_explicit(&wsLoggerRings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&wsLoggerRings, &ring->next, ring, memory_order_release,
+                                                  memory_order_relaxed)) {
+    }
+    wsLoggerRing = ring;
+    return ring;
+}
+
+// Never waits for the drain, a message that does not fit is counted and dropped
+static void wsLoggerPush(wsLogRing* ring, const uint8_t* record, size_t len) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t pos = head & (WS_LOGGER_RING_SIZE - 1);
+    size_t pad = WS_LOGGER_RING_SIZE - pos < len ? WS_LOGGER_RING_SIZE - pos : 0;
+
+    if (head + pad + len - tail > WS_LOGGER_RING_SIZE) {
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        atomic_store_explicit(&ring->dropped, dropped + 1, memory_order_relaxed);
+        return;
+    }
+    // Records stay contiguous, the rest of the ring is skipped instead
+    if (pad) {
+        uint32_t filler[2] = {(uint32_t)pad, WS_LOGGER_PAD};
+        memcpy(ring->data + pos, filler, sizeof(filler));
+        pos = 0;
+    }
+    memcpy(ring->data + pos, record, len);
+    atomic_store_explicit(&ring->head, head + pad + len, memory_order_release);
+}
+
+void wsLoggerWrite(int32_t level, const char* fmt, ...) {
+    wsLogRing* ring = wsLoggerRing ? wsLoggerRing : wsLoggerRegister();
+    if (!ring) return;
+
+    _Alignas(8) uint8_t record[WS_LOGGER_MAX_RECORD];
+    size_t len = sizeof(wsLogRecord);
+    bool full = false;
+
+    // Only the argument types are worked out here, nothing is converted to text
+    va_list args;
+    va_start(args, fmt);
+    for (const char* p = fmt; *p; p++) {
+        if (*p != '%') continue;
+        wsLogArg kind;
+        int32_t stars;
+        p += wsLoggerSpec(p, &kind, &stars) - 1;
+
+        for (int32_t s = 0; s < stars; s++) {
+            wsLoggerPutSlot(record, &len, &full, (uint64_t)(int64_t)va_arg(args, int));
+        }
+
+        uint64_t slot = 0;
+        switch (kind) {
+            case WS_LOG_ARG_NONE:
+                continue;
+            case WS_LOG_ARG_STRING:
+                wsLoggerPutString(record, &len, &full, va_arg(args, const char*));
+                continue;
+            case WS_LOG_ARG_INT:
+                slot = (uint64_t)(int64_t)va_arg(args, int);
+                break;
+            case WS_LOG_ARG_LONG:
+                slot = (uint64_t)va_arg(args, long);
+                break;
+            case WS_LOG_ARG_LLONG:
+                slot = (uint64_t)va_arg(args, long long);
+                break;
+            case WS_LOG_ARG_SIZE:
+                slot = (uint64_t)va_arg(args, size_t);
+                break;
+            case WS_LOG_ARG_INTMAX:
+                slot = (uint64_t)va_arg(args, intmax_t);
+                break;
+            case WS_LOG_ARG_PTRDIFF:
+                slot = (uint64_t)va_arg(args, ptrdiff_t);
+                break;
+            case WS_LOG_ARG_DOUBLE: {
+                double value = va_arg(args, double);
+                memcpy(&slot, &value, 8);
+                break;
+            }
+            case WS_LOG_ARG_PTR:
+                slot = (uint64_t)(uintptr_t)va_arg(args, void*);
+                break;
+        }
+        wsLoggerPutSlot(record, &len, &full, slot);
+    }
+    va_end(args);
+
+    wsLogRecord header = {
+        .size = (uint32_t)len,
+        .level = (uint32_t)level,
+        .timeNs = wsLoggerTickNs ? wsLoggerTickNs : wsLoggerClock(),
+        .fmt = fmt,
+    };
+    memcpy(record, &header, sizeof(header));
+    wsLoggerPush(ring, record, len);
+}
+
+static void wsLoggerFlushOut(wsLogOut* out) {
+    size_t done = 0;
+    while (done < out->len) {
+        ssize_t n = write(out->fd, out->data + done, out->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    out->len = 0;
+}
+
+static void wsLoggerEmit(wsLogOut* out, const char* data, size_t len) {
+    if (out->len + len > sizeof(out->data)) wsLoggerFlushOut(out);
+    if (len > sizeof(out->data)) len = sizeof(out->data);
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+static void wsLoggerPrefix(wsLogOut* out, uint64_t timeNs, uint32_t level) {
+    static const char* names[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+    // The date only changes once a second
+    time_t second = (time_t)(timeNs / 1000000000);
+    if (second != wsLoggerSecond) {
+        struct tm tm;
+        gmtime_r(&second, &tm);
+        strftime(wsLoggerSecondText, sizeof(wsLoggerSecondText), "%Y-%m-%dT%H:%M:%S", &tm);
+        wsLoggerSecond = second;
+    }
+
+    char prefix[64];
+    int len = snprintf(prefix, sizeof(prefix), "%s.%03uZ %-5s ", wsLoggerSecondText,
+                       (unsigned)(timeNs / 1000000 % 1000), level <= WS_LOG_LEVEL_DEBUG ? names[level] : "?");
+    if (len > 0) wsLoggerEmit(out, prefix, (size_t)len < sizeof(prefix) ? (size_t)len : sizeof(prefix) - 1);
+}
+
+#define WS_LOGGER_FORMAT(value) \
+    (stars == 0 ? snprintf(piece, sizeof(piece), spec, value) \
+     : stars == 1 ? snprintf(piece, sizeof(piece), spec, starValues[0], value) \
+     : snprintf(piece, sizeof(piece), spec, starValues[0], starValues[1], value))
+
+// Runs the format against the stored arguments one conversion at a time
+static void wsLoggerFormat(const wsLogRecord* record) {
+    wsLogOut* out = record->level <= WS_LOG_LEVEL_WARN ? &wsLoggerStderr : &wsLoggerStdout;
+    const uint8_t* args = (const uint8_t*)(record + 1);
+    const uint8_t* end = (const uint8_t*)record + record->size;
+    wsLoggerPrefix(out, record->timeNs, record->level);
+
+    const char* p = record->fmt;
+    const char* literal = p;
+    bool truncated = false;
+    while (*p) {
+        if (*p != '%') {
+            p++;
+            continue;
+        }
+        wsLoggerEmit(out, literal, p - literal);
+
+        wsLogArg kind;
+        int32_t stars;
+        size_t specLen = wsLoggerSpec(p, &kind, &stars);
+        char spec[32];
+        if (specLen >= sizeof(spec)) specLen = sizeof(spec) - 1;
+        memcpy(spec, p, specLen);
+        spec[specLen] = '\0';
+        p += specLen;
+        literal = p;
+
+        if (kind == WS_LOG_ARG_NONE) {
+            if (strcmp(spec, "%%") == 0) wsLoggerEmit(out, "%", 1);
+            else wsLoggerEmit(out, spec, specLen);
+            continue;
+        }
+
+        // A record that ran out of room ends with the last argument that fit
+        size_t need = (size_t)(stars + 1) * 8;
+        if ((size_t)(end - args) < need) {
+            truncated = true;
+            break;
+        }
+        int starValues[2] = {0, 0};
+        for (int32_t s = 0; s < stars; s++) {
+            uint64_t slot;
+            memcpy(&slot, args, 8);
+            starValues[s] = (int)(int64_t)slot;
+            args += 8;
+        }
+        uint64_t slot;
+        memcpy(&slot, args, 8);
+        args += 8;
+
+        char piece[WS_LOGGER_MAX_STRING + 64];
+        int len = 0;
+        switch (kind) {
+            case WS_LOG_ARG_STRING: {
+                char text[WS_LOGGER_MAX_STRING + 1];
+                size_t n = slot < (uint64_t)(end - args) ? (size_t)slot : (size_t)(end - args);
+                if (n > WS_LOGGER_MAX_STRING) n = WS_LOGGER_MAX_STRING;
+                memcpy(text, args, n);
+                text[n] = '\0';
+                args += (n + 7) & ~(size_t)7;
+                len = WS_LOGGER_FORMAT(text);
+                break;
+            }
+            case WS_LOG_ARG_DOUBLE: {
+                double value;
+                memcpy(&value, &slot, 8);
+                len = WS_LOGGER_FORMAT(value);
+                break;
+            }
+            case WS_LOG_ARG_INT:
+                len = WS_LOGGER_FORMAT((int)(int64_t)slot);
+                break;
+            case WS_LOG_ARG_LONG:
+                len = WS_LOGGER_FORMAT((long)slot);
+                break;
+            case WS_LOG_ARG_LLONG:
+                len = WS_LOGGER_FORMAT((long long)slot);
+                break;
+            case WS_LOG_ARG_SIZE:
+                len = WS_LOGGER_FORMAT((size_t)slot);
+                break;
+            case WS_LOG_ARG_INTMAX:
+                len = WS_LOGGER_FORMAT((intmax_t)slot);
+                break;
+            case WS_LOG_ARG_PTRDIFF:
+                len = WS_LOGGER_FORMAT((ptrdiff_t)slot);
+                break;
+            case WS_LOG_ARG_PTR:
+                len = WS_LOGGER_FORMAT((void*)(uintptr_t)slot);
+                break;
+            case WS_LOG_ARG_NONE:
+                break;
+        }
+        if (len > 0) wsLoggerEmit(out, piece, (size_t)len < sizeof(piece) ? (size_t)len : sizeof(piece) - 1);
+    }
+    if (truncated) wsLoggerEmit(out, "...", 3);
+    else wsLoggerEmit(out, literal, p - literal);
+    wsLoggerEmit(out, "\n", 1);
+}
+
+// One pass over every ring, returns the largest backlog it found in bytes
+static uint64_t wsLoggerDrain(void) {
+    uint64_t backlog = 0;
+    for (wsLogRing* ring = atomic_load_explicit(&wsLoggerRings, memory_order_acquire); ring; ring = ring->next) {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head - tail > backlog) backlog = head - tail;
+
+        while (tail < head) {
+            const wsLogRecord* record = (const wsLogRecord*)(ring->data + (tail & (WS_LOGGER_RING_SIZE - 1)));
+            if (record->level != WS_LOGGER_PAD) wsLoggerFormat(record);
+            tail += record->size;
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if (dropped != ring->reported) {
+            char text[96];
+            int len = snprintf(text, sizeof(text), "Log ring full, dropped %llu messages\n",
+                               (unsigned long long)(dropped - ring->reported));
+            wsLoggerPrefix(&wsLoggerStderr, wsLoggerClock(), WS_LOG_LEVEL_WARN);
+            if (len > 0) wsLoggerEmit(&wsLoggerStderr, text, (size_t)len);
+            ring->reported = dropped;
+        }
+    }
+    wsLoggerFlushOut(&wsLoggerStderr);
+    wsLoggerFlushOut(&wsLoggerStdout);
+    return backlog;
+}
+
+void wsLoggerFlush(void) {
+    pthread_mutex_lock(&wsLoggerDrainLock);
+    wsLoggerDrain();
+    pthread_mutex_unlock(&wsLoggerDrainLock);
+}
+
+// Writes in batches, every WS_LOGGER_IDLE_MS or right away while a ring is filling up
+static void* wsLoggerRun(void* arg) {
+    for (;;) {
+        pthread_mutex_lock(&wsLoggerDrainLock);
+        uint64_t backlog = wsLoggerDrain();
+        pthread_mutex_unlock(&wsLoggerDrainLock);
+
+        if (backlog < WS_LOGGER_RING_SIZE / 4) {
+            struct timespec pause = {0, WS_LOGGER_IDLE_MS * 1000000L};
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+int32_t wsLoggerStart(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, wsLoggerRun, NULL) != 0) {
+        // Nothing drains the rings, so this one is written out right away
+        WS_LOG(ERROR, "Failed to start the log drain thread");
+        wsLoggerFlush();
+        return WS_ERROR;
+    }
+    pthread_detach(thread);
+    atexit(wsLoggerFlush);
+    return WS_OK;
+}
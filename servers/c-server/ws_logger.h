@@ -0,0 +1,44 @@
+#ifndef WS_LOGGER_H
+#define WS_LOGGER_H
+
+#include <stdint.h>
+
+// Server log levels, lower is more severe
+#define WS_LOG_LEVEL_ERROR 0
+#define WS_LOG_LEVEL_WARN 1
+#define WS_LOG_LEVEL_INFO 2
+#define WS_LOG_LEVEL_DEBUG 3
+
+// Messages above this level are compiled out together with their arguments,
+// set it with WS_LOG_LEVEL in the Makefile
+#ifndef WS_LOG_MAX_LEVEL
+#define WS_LOG_MAX_LEVEL WS_LOG_LEVEL_INFO
+#endif
+
+// WS_LOG(INFO, "Client connected (fd=%d)", fd), the line break is added. The
+// format has to be a string literal, it is only read when the line is written.
+#define WS_LOG(level, fmt, ...) \
+    do { \
+        if (WS_LOG_LEVEL_##level <= WS_LOG_MAX_LEVEL) wsLoggerWrite(WS_LOG_LEVEL_##level, fmt, ##__VA_ARGS__); \
+    } while (0)
+
+// Asynchronous logger. Every thread writes into a lock-free ring of its own:
+// the arguments are copied as they are, strings included, and the text is only
+// formatted by a background thread that drains all rings and writes them out,
+// errors and warnings to stderr and the rest to stdout. A full ring drops the
+// message and the drain thread reports how many were lost.
+
+// Starts the drain thread and flushes whatever is left at exit
+int32_t wsLoggerStart(void);
+
+// Takes the timestamp for the messages of the calling thread until the next
+// tick, event loops call it once per iteration. Threads that never tick read
+// the clock for every message.
+void wsLoggerTick(void);
+
+void wsLoggerWrite(int32_t level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Writes everything queued so far, used at exit
+void wsLoggerFlush(void);
+
+#endif
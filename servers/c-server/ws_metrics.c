@@ -0,0 +1,172 @@
+#include "ws_metrics.h"
+#include "../../lib/ws_globals.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stddef.h>
+
+// Prometheus wants the same buckets on every scrape, so the fine histogram is
+// exported at every power of two from about 1us to about 69s. Sub buckets never
+// straddle a power of two, the cumulative counts stay exact.
+#define WS_METRICS_EXPORT_MIN_BITS 10
+#define WS_METRICS_EXPORT_MAX_BITS 36
+
+static const double wsMetricsQuantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+
+static void wsMetricsMergeCounter(wsMetricsCounter* total, const wsMetricsCounter* shard) {
+    wsMetricsAdd(total, atomic_load_explicit(shard, memory_order_relaxed));
+}
+
+static void wsHistogramMerge(wsHistogram* total, const wsHistogram* shard) {
+    for (uint32_t i = 0; i < WS_HISTOGRAM_BUCKETS; i++) {
+        wsMetricsMergeCounter(&total->buckets[i], &shard->buckets[i]);
+    }
+    wsMetricsMergeCounter(&total->count, &shard->count);
+    wsMetricsMergeCounter(&total->sum, &shard->sum);
+}
+
+void wsMetricsMerge(wsMetrics* total, const wsMetrics* shard) {
+    wsMetricsMergeCounter(&total->accepted, &shard->accepted);
+    wsMetricsMergeCounter(&total->handshakes, &shard->handshakes);
+    wsMetricsMergeCounter(&total->rejected, &shard->rejected);
+    wsMetricsMergeCounter(&total->framesIn, &shard->framesIn);
+    wsMetricsMergeCounter(&total->bytesIn, &shard->bytesIn);
+    wsMetricsMergeCounter(&total->sends, &shard->sends);
+    wsMetricsMergeCounter(&total->bytesOut, &shard->bytesOut);
+    wsMetricsMergeCounter(&total->parseErrors, &shard->parseErrors);
+    wsMetricsMergeCounter(&total->sendErrors, &shard->sendErrors);
+    wsHistogramMerge(&total->handshake, &shard->handshake);
+    wsHistogramMerge(&total->parse, &shard->parse);
+    wsHistogramMerge(&total->fanout, &shard->fanout);
+}
+
+// Largest value that lands in bucket i
+static uint64_t wsHistogramUpper(uint32_t i) {
+    if (i < WS_HISTOGRAM_SUB) return i;
+    uint32_t shift = i / WS_HISTOGRAM_SUB - 1;
+    uint64_t sub = i % WS_HISTOGRAM_SUB + WS_HISTOGRAM_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+// Upper end of the bucket that holds the q-th fraction of the values
+static uint64_t wsHistogramQuantile(const wsHistogram* histogram, double q) {
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    uint64_t rank = (uint64_t)(q * count + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    uint64_t last = 0;
+    for (uint32_t i = 0; i < WS_HISTOGRAM_BUCKETS; i++) {
+        uint64_t n = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (n == 0) continue;
+        seen += n;
+        last = wsHistogramUpper(i);
+        if (seen >= rank) break;
+    }
+    return last;
+}
+
+static int32_t wsMetricsPrint(wsBuffer* out, const char* fmt, ...) {
+    for (size_t want = 128;;) {
+        if (wsBufferReserve(out, want) != WS_OK) return WS_ERROR;
+        size_t room = out->capacity - out->len;
+
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf((char*)out->data + out->len, room, fmt, args);
+        va_end(args);
+        if (len < 0) return WS_ERROR;
+        if ((size_t)len < room) {
+            out->len += len;
+            return WS_OK;
+        }
+        want = (size_t)len + 1;
+    }
+}
+
+static int32_t wsMetricsPrintCounter(wsBuffer* out, const char* name, const char* help, const char* type,
+                                     uint64_t value) {
+    return wsMetricsPrint(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name,
+                          (unsigned long long)value);
+}
+
+static int32_t wsMetricsPrintHistogram(wsBuffer* out, const char* name, const char* help,
+                                       const wsHistogram* histogram) {
+    if (wsMetricsPrint(out, "# HELP %s_seconds %s\n# TYPE %s_seconds histogram\n", name, help, name) != WS_OK) {
+        return WS_ERROR;
+    }
+
+    uint64_t cumulative = 0;
+    uint32_t i = 0;
+    for (uint32_t bits = WS_METRICS_EXPORT_MIN_BITS; bits <= WS_METRICS_EXPORT_MAX_BITS; bits++) {
+        uint32_t end = wsHistogramIndex(1ull << bits);
+        for (; i < end; i++) {
+            cumulative += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        }
+        if (wsMetricsPrint(out, "%s_seconds_bucket{le=\"%.9f\"} %llu\n", name, (double)(1ull << bits) / 1e9,
+                           (unsigned long long)cumulative) != WS_OK) {
+            return WS_ERROR;
+        }
+    }
+
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    uint64_t sum = atomic_load_explicit(&histogram->sum, memory_order_relaxed);
+    if (wsMetricsPrint(out, "%s_seconds_bucket{le=\"+Inf\"} %llu\n%s_seconds_sum %.9f\n%s_seconds_count %llu\n",
+                       name, (unsigned long long)count, name, (double)sum / 1e9, name,
+                       (unsigned long long)count) != WS_OK) {
+        return WS_ERROR;
+    }
+
+    // The exported buckets are coarse, the quantiles come from the fine ones
+    if (wsMetricsPrint(out, "# HELP %s_quantile_seconds %s, quantile 1 is the maximum\n"
+                            "# TYPE %s_quantile_seconds gauge\n", name, help, name) != WS_OK) {
+        return WS_ERROR;
+    }
+    for (size_t q = 0; q < sizeof(wsMetricsQuantiles) / sizeof(wsMetricsQuantiles[0]); q++) {
+        uint64_t ns = count ? wsHistogramQuantile(histogram, wsMetricsQuantiles[q]) : 0;
+        if (wsMetricsPrint(out, "%s_quantile_seconds{quantile=\"%g\"} %.9f\n", name, wsMetricsQuantiles[q],
+                           (double)ns / 1e9) != WS_OK) {
+            return WS_ERROR;
+        }
+    }
+    return WS_OK;
+}
+
+int32_t wsMetricsFormat(const wsMetrics* total, int32_t connections, wsBuffer* out) {
+    static const struct {
+        const char* name;
+        const char* help;
+        size_t offset;
+    } counters[] = {
+        {"ws_connections_accepted_total", "Accepted TCP connections", offsetof(wsMetrics, accepted)},
+        {"ws_handshakes_total", "Completed WebSocket handshakes", offsetof(wsMetrics, handshakes)},
+        {"ws_handshakes_rejected_total", "Upgrade requests answered with an error", offsetof(wsMetrics, rejected)},
+        {"ws_frames_received_total", "Frames read from clients", offsetof(wsMetrics, framesIn)},
+        {"ws_bytes_received_total", "Bytes read from clients", offsetof(wsMetrics, bytesIn)},
+        {"ws_sends_total", "Frames and HTTP responses handed to client sockets", offsetof(wsMetrics, sends)},
+        {"ws_bytes_sent_total", "Bytes handed to client sockets", offsetof(wsMetrics, bytesOut)},
+        {"ws_parse_errors_total", "Invalid frames and messages that failed to decode", offsetof(wsMetrics, parseErrors)},
+        {"ws_send_errors_total", "Sends that failed and dropped the client", offsetof(wsMetrics, sendErrors)},
+    };
+
+    if (wsMetricsPrintCounter(out, "ws_connections", "Open client connections", "gauge",
+                              (uint64_t)connections) != WS_OK) {
+        return WS_ERROR;
+    }
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        const wsMetricsCounter* counter = (const wsMetricsCounter*)((const char*)total + counters[i].offset);
+        if (wsMetricsPrintCounter(out, counters[i].name, counters[i].help, "counter",
+                                  atomic_load_explicit(counter, memory_order_relaxed)) != WS_OK) {
+            return WS_ERROR;
+        }
+    }
+
+    if (wsMetricsPrintHistogram(out, "ws_handshake", "Upgrade request read to handshake response sent",
+                                &total->handshake) != WS_OK ||
+        wsMetricsPrintHistogram(out, "ws_parse", "Time to decode one message", &total->parse) != WS_OK ||
+        wsMetricsPrintHistogram(out, "ws_fanout", "Message read to its last recipient served on any shard",
+                                &total->fanout) != WS_OK) {
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
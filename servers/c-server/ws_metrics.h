@@ -0,0 +1,73 @@
+#ifndef WS_METRICS_H
+#define WS_METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "../../lib/ws_frame.h"
+
+// Log-linear latency histogram in nanoseconds like HdrHistogram: every power of
+// two is split into WS_HISTOGRAM_SUB buckets, so a bucket is at most 1/16th as
+// wide as the values in it. Values below WS_HISTOGRAM_SUB get a bucket each.
+#define WS_HISTOGRAM_SUB_BITS 4
+#define WS_HISTOGRAM_SUB (1 << WS_HISTOGRAM_SUB_BITS)
+#define WS_HISTOGRAM_BUCKETS ((64 - WS_HISTOGRAM_SUB_BITS + 1) * WS_HISTOGRAM_SUB)
+
+typedef atomic_uint_fast64_t wsMetricsCounter;
+
+typedef struct {
+    wsMetricsCounter buckets[WS_HISTOGRAM_BUCKETS];
+    wsMetricsCounter count;
+    wsMetricsCounter sum;
+} wsHistogram;
+
+// Every shard owns one of these and is its only writer, so an update is a plain
+// load and store without a locked instruction. Other shards only read it when
+// they answer a metrics request, a counter may then be one update behind.
+typedef struct {
+    wsMetricsCounter accepted;
+    wsMetricsCounter handshakes;
+    wsMetricsCounter rejected;
+    wsMetricsCounter framesIn;
+    wsMetricsCounter bytesIn;
+    wsMetricsCounter sends;       // frames and HTTP responses handed to sockets
+    wsMetricsCounter bytesOut;
+    wsMetricsCounter parseErrors; // invalid frames and messages that failed to decode
+    wsMetricsCounter sendErrors;  // failed socket writes and queue allocations
+
+    wsHistogram handshake; // first byte of the upgrade request read to the response sent
+    wsHistogram parse;     // decoding one message into its fields, JSON or binary
+    wsHistogram fanout;    // read of a message to its last recipient on any shard
+} wsMetrics;
+
+static inline uint64_t wsMetricsNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void wsMetricsAdd(wsMetricsCounter* counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline uint32_t wsHistogramIndex(uint64_t value) {
+    if (value < WS_HISTOGRAM_SUB) return (uint32_t)value;
+    uint32_t shift = 63 - __builtin_clzll(value) - WS_HISTOGRAM_SUB_BITS;
+    return (shift + 1) * WS_HISTOGRAM_SUB + (uint32_t)(value >> shift) - WS_HISTOGRAM_SUB;
+}
+
+static inline void wsHistogramRecord(wsHistogram* histogram, uint64_t ns) {
+    wsMetricsAdd(&histogram->buckets[wsHistogramIndex(ns)], 1);
+    wsMetricsAdd(&histogram->count, 1);
+    wsMetricsAdd(&histogram->sum, ns);
+}
+
+// Adds the counts of one shard to total, which nobody else writes to
+void wsMetricsMerge(wsMetrics* total, const wsMetrics* shard);
+
+// Appends total in the Prometheus text format to out. connections is the
+// number of open client connections right now.
+int32_t wsMetricsFormat(const wsMetrics* total, int32_t connections, wsBuffer* out);
+
+#endif
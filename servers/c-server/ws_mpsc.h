@@ -0,0 +1,61 @@
+#ifndef WS_MPSC_H
+#define WS_MPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Intrusive multi producer / single consumer queue (Vyukov). Producers never
+// block or retry, the consumer is the shard that owns the queue.
+
+typedef struct wsMpscNode {
+    _Atomic(struct wsMpscNode*) next;
+} wsMpscNode;
+
+typedef struct {
+    _Atomic(wsMpscNode*) head; // producers swap themselves in here
+    wsMpscNode* tail;          // consumer side only
+    wsMpscNode stub;
+} wsMpscQueue;
+
+static inline void wsMpscInit(wsMpscQueue* q) {
+    atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+    q->tail = &q->stub;
+}
+
+static inline void wsMpscPush(wsMpscQueue* q, wsMpscNode* node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    wsMpscNode* prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// Returns NULL when empty, or when a producer is half way through a push.
+// The producer signals the consumer after the push so nothing is lost.
+static inline wsMpscNode* wsMpscPop(wsMpscQueue* q) {
+    wsMpscNode* tail = q->tail;
+    wsMpscNode* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) return NULL;
+
+    wsMpscPush(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+#endif
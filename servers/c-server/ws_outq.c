@@ -0,0 +1,272 @@
+#include "ws_outq.h"
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// Frames handed to one sendmsg call
+#define WS_OUTQ_IOV_MAX 64
+// Capacity of a new ring
+#define WS_OUTQ_RING_MIN 8
+
+wsOutFrame* wsOutFrameCreate(size_t len) {
+    if (len > UINT32_MAX) {
+        WS_LOG(ERROR, "Frame of %zu bytes is too large", len);
+        return NULL;
+    }
+    wsOutFrame* frame = malloc(sizeof(wsOutFrame) + len);
+    if (!frame) {
+        WS_LOG(ERROR, "Failed to allocate frame of %zu bytes", len);
+        return NULL;
+    }
+    atomic_init(&frame->refs, 1);
+    frame->len = (uint32_t)len;
+    frame->deflated = NULL;
+    frame->alternate = NULL;
+    frame->ingressNs = 0;
+    atomic_init(&frame->fanoutPending, 0);
+    return frame;
+}
+
+wsOutFrame* wsOutFrameFromBytes(const uint8_t* data, size_t len) {
+    wsOutFrame* frame = wsOutFrameCreate(len);
+    if (frame) memcpy(frame->data, data, len);
+    return frame;
+}
+
+void wsOutFrameRelease(wsOutFrame* frame) {
+    if (atomic_fetch_sub_explicit(&frame->refs, 1, memory_order_acq_rel) == 1) {
+        if (frame->deflated) wsOutFrameRelease(frame->deflated);
+        if (frame->alternate) wsOutFrameRelease(frame->alternate);
+        free(frame);
+    }
+}
+
+static inline wsOutFrame* wsOutRingAt(wsOutRing* ring, uint32_t i) {
+    return ring->items[(ring->head + i) & (ring->capacity - 1)];
+}
+
+static inline wsOutFrame** wsOutRingSlot(wsOutRing* ring, uint32_t i) {
+    return &ring->items[(ring->head + i) & (ring->capacity - 1)];
+}
+
+static int32_t wsOutRingPush(wsOutRing* ring, wsOutFrame* frame) {
+    if (ring->count == ring->capacity) {
+        uint32_t capacity = ring->capacity ? ring->capacity * 2 : WS_OUTQ_RING_MIN;
+        wsOutFrame** items = malloc(capacity * sizeof(wsOutFrame*));
+        if (!items) {
+            WS_LOG(ERROR, "Failed to grow outbound queue to %u frames", capacity);
+            return WS_ERROR;
+        }
+        for (uint32_t i = 0; i < ring->count; i++) {
+            items[i] = wsOutRingAt(ring, i);
+        }
+        free(ring->items);
+        ring->items = items;
+        ring->head = 0;
+        ring->capacity = capacity;
+    }
+    ring->items[(ring->head + ring->count) & (ring->capacity - 1)] = frame;
+    ring->count++;
+    return WS_OK;
+}
+
+static wsOutFrame* wsOutRingPop(wsOutRing* ring) {
+    wsOutFrame* frame = ring->items[ring->head];
+    ring->head = (ring->head + 1) & (ring->capacity - 1);
+    ring->count--;
+    return frame;
+}
+
+// Idle connections should not keep the ring array around
+static void wsOutRingReset(wsOutRing* ring) {
+    while (ring->count) wsOutFrameRelease(wsOutRingPop(ring));
+    free(ring->items);
+    ring->items = NULL;
+    ring->head = 0;
+    ring->capacity = 0;
+}
+
+static void wsOutQueueTrackZerocopy(wsOutQueue* q, wsOutFrame* frame) {
+    if (q->zerocopy.count == 0) q->zerocopyFirstId = q->zerocopyNextId;
+    q->zerocopyNextId++;
+
+    // Without a slot the frame would be freed under the kernel, keep it alive instead
+    wsOutFrameRetain(frame);
+    if (wsOutRingPush(&q->zerocopy, frame) != WS_OK) {
+        WS_LOG(ERROR, "Leaking zerocopy frame, completion cannot be tracked");
+    }
+}
+
+ssize_t wsOutQueueSendDirect(wsOutQueue* q, int32_t fd, wsOutFrame* frame, size_t offset, size_t zerocopyMin) {
+    size_t len = frame->len - offset;
+
+    if (zerocopyMin && frame->len >= zerocopyMin) {
+        ssize_t sent = send(fd, frame->data + offset, len, MSG_NOSIGNAL | MSG_DONTWAIT | MSG_ZEROCOPY);
+        if (sent > 0) {
+            wsOutQueueTrackZerocopy(q, frame);
+            return sent;
+        }
+        // Out of option memory for pinned pages, a plain copy still works
+        if (sent == 0 || errno != ENOBUFS) return sent;
+    }
+
+    return send(fd, frame->data + offset, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+int32_t wsOutQueuePush(wsOutQueue* q, wsOutFrame* frame, size_t offset) {
+    if (wsOutRingPush(&q->frames, wsOutFrameRetain(frame)) != WS_OK) {
+        wsOutFrameRelease(frame);
+        return WS_ERROR;
+    }
+    if (q->frames.count == 1) q->headSent = offset;
+    q->bytes += frame->len - offset;
+    return WS_OK;
+}
+
+void wsOutQueueRetire(wsOutQueue* q, size_t sent) {
+    q->bytes -= sent;
+
+    // Retire everything that is fully on the wire
+    while (sent > 0) {
+        wsOutFrame* frame = wsOutRingAt(&q->frames, 0);
+        size_t remaining = frame->len - q->headSent;
+        if (sent < remaining) {
+            q->headSent += sent;
+            break;
+        }
+        sent -= remaining;
+        q->headSent = 0;
+        wsOutFrameRelease(wsOutRingPop(&q->frames));
+    }
+}
+
+int32_t wsOutQueueFlush(wsOutQueue* q, int32_t fd, size_t zerocopyMin) {
+    wsOutRing* ring = &q->frames;
+
+    while (ring->count) {
+        wsOutFrame* head = wsOutRingAt(ring, 0);
+        ssize_t sent;
+
+        if (zerocopyMin && head->len >= zerocopyMin) {
+            sent = wsOutQueueSendDirect(q, fd, head, q->headSent, zerocopyMin);
+        }
+        else {
+            // Batch small frames, stop in front of the next zerocopy candidate
+            struct iovec iov[WS_OUTQ_IOV_MAX];
+            int32_t n = 0;
+            for (uint32_t i = 0; i < ring->count && n < WS_OUTQ_IOV_MAX; i++) {
+                wsOutFrame* frame = wsOutRingAt(ring, i);
+                if (i > 0 && zerocopyMin && frame->len >= zerocopyMin) break;
+
+                size_t offset = i == 0 ? q->headSent : 0;
+                iov[n].iov_base = frame->data + offset;
+                iov[n].iov_len = frame->len - offset;
+                n++;
+            }
+
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            sent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return WS_OK;
+            return WS_ERROR;
+        }
+
+        wsOutQueueRetire(q, sent);
+
+        // A short write does not always mean the buffer is full (a zerocopy send
+        // can stop early), so keep going until EAGAIN arms the next EPOLLOUT
+    }
+
+    wsOutRingReset(ring);
+    return WS_OK;
+}
+
+void wsOutQueuePopSent(wsOutQueue* q) {
+    wsOutFrame* frame = wsOutRingPop(&q->frames);
+    q->bytes -= frame->len - q->headSent;
+    q->headSent = 0;
+    wsOutFrameRelease(frame);
+
+    // Every frame passes through the queue on this path, a small ring is kept
+    // around instead of being allocated again for the next message
+    if (q->frames.count == 0 && q->frames.capacity > WS_OUTQ_RING_MIN) wsOutRingReset(&q->frames);
+}
+
+void wsOutQueueReapZerocopy(wsOutQueue* q, int32_t fd) {
+    while (q->zerocopy.count) {
+        char control[128];
+        struct msghdr msg = {0};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+
+            struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+            // Completions cover the id range [ee_info, ee_data] and arrive in order
+            uint32_t last = err->ee_data;
+            while (q->zerocopy.count && (int32_t)(last - q->zerocopyFirstId) >= 0) {
+                wsOutFrameRelease(wsOutRingPop(&q->zerocopy));
+                q->zerocopyFirstId++;
+            }
+        }
+    }
+    wsOutRingReset(&q->zerocopy);
+}
+
+int32_t wsOutQueueDropOldest(wsOutQueue* q, size_t target) {
+    wsOutRing* ring = &q->frames;
+
+    // The head stays if some of it is already on the wire, the frame would be cut in
+    // half, and so does everything an in-flight io_uring send still reads from
+    uint32_t start = q->headSent ? 1 : 0;
+    if (q->pinned > start) start = q->pinned;
+    uint32_t end = start;
+    while (q->bytes > target && end + 1 < ring->count) {
+        wsOutFrame* frame = wsOutRingAt(ring, end);
+        q->bytes -= frame->len;
+        wsOutFrameRelease(frame);
+        end++;
+    }
+
+    uint32_t dropped = end - start;
+    if (dropped == 0) return 0;
+
+    // Move the kept head frames in front of the survivors
+    for (uint32_t i = start; i-- > 0;) {
+        *wsOutRingSlot(ring, i + dropped) = wsOutRingAt(ring, i);
+    }
+    ring->head = (ring->head + dropped) & (ring->capacity - 1);
+    ring->count -= dropped;
+    return (int32_t)dropped;
+}
+
+void wsOutQueueClear(wsOutQueue* q) {
+    wsOutRingReset(&q->frames);
+    wsOutRingReset(&q->zerocopy);
+    q->headSent = 0;
+    q->bytes = 0;
+    q->pinned = 0;
+}
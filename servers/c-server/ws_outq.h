@@ -0,0 +1,88 @@
+#ifndef WS_OUTQ_H
+#define WS_OUTQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+// Encoded frame shared by every recipient, on every shard. It is immutable once
+// built and freed by whoever drops the last reference.
+typedef struct wsOutFrame {
+    atomic_int refs;
+    uint32_t len;
+    struct wsOutFrame* deflated;  // same message with permessage-deflate, owned by this frame
+    struct wsOutFrame* alternate; // same message as binary instead of JSON or the other way round, owned too
+    uint64_t ingressNs;           // when the broadcast message was read, for the fan-out latency
+    atomic_int fanoutPending;     // shards that did not hand the broadcast to their clients yet
+    uint8_t data[];
+} wsOutFrame;
+
+// Returns a frame with one reference, the caller fills data. NULL if len does
+// not fit the 32 bit length or allocation fails.
+wsOutFrame* wsOutFrameCreate(size_t len);
+wsOutFrame* wsOutFrameFromBytes(const uint8_t* data, size_t len);
+
+static inline wsOutFrame* wsOutFrameRetain(wsOutFrame* frame) {
+    atomic_fetch_add_explicit(&frame->refs, 1, memory_order_relaxed);
+    return frame;
+}
+
+void wsOutFrameRelease(wsOutFrame* frame);
+
+// Ring of frame references
+typedef struct {
+    wsOutFrame** items;
+    uint32_t head;
+    uint32_t count;
+    uint32_t capacity;
+} wsOutRing;
+
+// Per connection outbound queue. Only the head frame can be partially written.
+typedef struct {
+    wsOutRing frames;
+    size_t headSent; // bytes of the head frame already on the wire
+    size_t bytes;    // bytes still waiting to be written
+    uint32_t pinned; // frames at the head an io_uring send still reads from
+
+    // MSG_ZEROCOPY sends the kernel may still read from, in send order
+    wsOutRing zerocopy;
+    uint32_t zerocopyFirstId; // kernel id of the oldest entry in zerocopy
+    uint32_t zerocopyNextId;  // kernel id the next zerocopy send will get
+} wsOutQueue;
+
+static inline wsOutFrame* wsOutQueueAt(wsOutQueue* q, uint32_t i) {
+    return q->frames.items[(q->frames.head + i) & (q->frames.capacity - 1)];
+}
+
+// Sends frame->data + offset straight to the socket without queueing anything.
+// Frames of at least zerocopyMin bytes go out with MSG_ZEROCOPY (0 disables it)
+// and stay referenced until the kernel reports completion.
+// Returns the bytes sent or -1 with errno set.
+ssize_t wsOutQueueSendDirect(wsOutQueue* q, int32_t fd, wsOutFrame* frame, size_t offset, size_t zerocopyMin);
+
+// Queues a reference to frame, the first offset bytes are already sent
+int32_t wsOutQueuePush(wsOutQueue* q, wsOutFrame* frame, size_t offset);
+
+// Writes as much as the socket accepts without blocking, small frames are
+// batched into one sendmsg. Returns WS_OK (the queue may still hold data) or
+// WS_ERROR if the socket failed.
+int32_t wsOutQueueFlush(wsOutQueue* q, int32_t fd, size_t zerocopyMin);
+
+// Retires sent bytes from the head, the frame they end in stays partly written
+void wsOutQueueRetire(wsOutQueue* q, size_t sent);
+
+// Retires the head frame once an io_uring send wrote all of it
+void wsOutQueuePopSent(wsOutQueue* q);
+
+// Releases frames whose MSG_ZEROCOPY sends completed, call it on EPOLLERR
+void wsOutQueueReapZerocopy(wsOutQueue* q, int32_t fd);
+
+// Drops the oldest frames that have not been started until at most target bytes
+// are queued. The partially written head, pinned frames and the newest frame are always kept.
+// Returns the number of dropped frames.
+int32_t wsOutQueueDropOldest(wsOutQueue* q, size_t target);
+
+void wsOutQueueClear(wsOutQueue* q);
+
+#endif
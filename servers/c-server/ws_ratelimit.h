@@ -0,0 +1,42 @@
+#ifndef WS_RATELIMIT_H
+#define WS_RATELIMIT_H
+
+#include <stdint.h>
+
+// Allowance shared by every connection of the server
+typedef struct {
+    uint64_t rate;  // units per second, 0 means unlimited
+    uint64_t burst; // units a quiet client may spend at once
+} wsTokenRate;
+
+// Token bucket in thousandths of a unit, so the refill for the elapsed
+// milliseconds is a single multiply. A charge is taken in full even when it overdraws
+// the bucket, the client then waits until the debt is paid off. That way the
+// input is never looked at twice and a frame bigger than the burst still passes.
+typedef struct {
+    int64_t level;
+    uint64_t lastMs;
+} wsTokenBucket;
+
+static inline void wsTokenBucketInit(wsTokenBucket* bucket, const wsTokenRate* rate, uint64_t nowMs) {
+    bucket->level = (int64_t)rate->burst * 1000;
+    bucket->lastMs = nowMs;
+}
+
+// Takes cost units. Returns 0 if the bucket is still covered, otherwise the
+// milliseconds until it is out of debt.
+static inline uint32_t wsTokenBucketCharge(wsTokenBucket* bucket, const wsTokenRate* rate, uint64_t cost,
+                                           uint64_t nowMs) {
+    if (rate->rate == 0) return 0;
+
+    int64_t full = (int64_t)rate->burst * 1000;
+    bucket->level += (int64_t)(nowMs - bucket->lastMs) * (int64_t)rate->rate;
+    if (bucket->level > full) bucket->level = full;
+    bucket->lastMs = nowMs;
+
+    bucket->level -= (int64_t)cost * 1000;
+    if (bucket->level >= 0) return 0;
+    return (uint32_t)((-bucket->level + (int64_t)rate->rate - 1) / (int64_t)rate->rate);
+}
+
+#endif
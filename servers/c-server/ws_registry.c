@@ -0,0 +1,147 @@
+#include "ws_registry.h"
+#include "ws_server.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WS_REGISTRY_MIN_SLOTS 1024
+#define WS_REGISTRY_MIN_BUCKETS 64
+
+int32_t wsRegistryInit(wsRegistry* reg, uint32_t shardId) {
+    memset(reg, 0, sizeof(*reg));
+    reg->shardId = shardId;
+
+    reg->names = calloc(WS_REGISTRY_MIN_BUCKETS, sizeof(wsConn*));
+    if (!reg->names) {
+        WS_LOG(ERROR, "Failed to allocate the username index");
+        return WS_ERROR;
+    }
+    reg->nameBuckets = WS_REGISTRY_MIN_BUCKETS;
+    return WS_OK;
+}
+
+void wsRegistryFree(wsRegistry* reg) {
+    free(reg->slots);
+    free(reg->names);
+    memset(reg, 0, sizeof(*reg));
+}
+
+static int32_t wsRegistryGrowSlots(wsRegistry* reg, int32_t fd) {
+    int32_t count = reg->slotCount ? reg->slotCount : WS_REGISTRY_MIN_SLOTS;
+    while (count <= fd) count *= 2;
+
+    wsRegistrySlot* slots = realloc(reg->slots, count * sizeof(wsRegistrySlot));
+    if (!slots) {
+        WS_LOG(ERROR, "Failed to grow the registry to %d slots", count);
+        return WS_ERROR;
+    }
+    memset(slots + reg->slotCount, 0, (count - reg->slotCount) * sizeof(wsRegistrySlot));
+    reg->slots = slots;
+    reg->slotCount = count;
+    return WS_OK;
+}
+
+int32_t wsRegistryAdd(wsRegistry* reg, wsConn* conn) {
+    if (conn->fd < 0) return WS_ERROR;
+    if (conn->fd >= reg->slotCount && wsRegistryGrowSlots(reg, conn->fd) != WS_OK) {
+        return WS_ERROR;
+    }
+
+    wsRegistrySlot* slot = &reg->slots[conn->fd];
+    slot->generation = (slot->generation + 1) & WS_CONN_ID_GENERATION_MASK;
+    if (slot->generation == 0) slot->generation = 1;
+    slot->conn = conn;
+
+    conn->id = WS_CONN_ID(slot->generation, reg->shardId, conn->fd);
+    conn->nameNext = NULL;
+    return WS_OK;
+}
+
+static void wsRegistryUnlinkName(wsRegistry* reg, wsConn* conn) {
+    wsConn** link = &reg->names[wsNameHash(conn->username) & (reg->nameBuckets - 1)];
+    while (*link) {
+        if (*link == conn) {
+            *link = conn->nameNext;
+            conn->nameNext = NULL;
+            reg->nameCount--;
+            return;
+        }
+        link = &(*link)->nameNext;
+    }
+}
+
+void wsRegistryRemove(wsRegistry* reg, wsConn* conn) {
+    if (conn->username) wsRegistryUnlinkName(reg, conn);
+
+    if (conn->fd >= 0 && conn->fd < reg->slotCount && reg->slots[conn->fd].conn == conn) {
+        // The generation stays, the next connection on this fd gets a new id
+        reg->slots[conn->fd].conn = NULL;
+    }
+}
+
+wsConn* wsRegistryFindFd(wsRegistry* reg, int32_t fd) {
+    if (fd < 0 || fd >= reg->slotCount) return NULL;
+    return reg->slots[fd].conn;
+}
+
+wsConn* wsRegistryFindId(wsRegistry* reg, wsConnId id) {
+    if (WS_CONN_ID_SHARD(id) != reg->shardId) return NULL;
+
+    wsConn* conn = wsRegistryFindFd(reg, WS_CONN_ID_FD(id));
+    return conn && conn->id == id ? conn : NULL;
+}
+
+// Keeps chains short, rehashing only walks the named connections
+static void wsRegistryGrowNames(wsRegistry* reg) {
+    uint32_t buckets = reg->nameBuckets * 2;
+    wsConn** names = calloc(buckets, sizeof(wsConn*));
+    if (!names) return;
+
+    for (uint32_t i = 0; i < reg->nameBuckets; i++) {
+        wsConn* conn = reg->names[i];
+        while (conn) {
+            wsConn* next = conn->nameNext;
+            uint32_t b = wsNameHash(conn->username) & (buckets - 1);
+            conn->nameNext = names[b];
+            names[b] = conn;
+            conn = next;
+        }
+    }
+    free(reg->names);
+    reg->names = names;
+    reg->nameBuckets = buckets;
+}
+
+int32_t wsRegistrySetName(wsRegistry* reg, wsConn* conn, const char* name) {
+    char* copy = NULL;
+    if (name) {
+        copy = strdup(name);
+        if (!copy) {
+            WS_LOG(ERROR, "Failed to copy username (fd=%d)", conn->fd);
+            return WS_ERROR;
+        }
+    }
+
+    if (conn->username) {
+        wsRegistryUnlinkName(reg, conn);
+        free(conn->username);
+    }
+    conn->username = copy;
+    if (!copy) return WS_OK;
+
+    if (reg->nameCount >= reg->nameBuckets) wsRegistryGrowNames(reg);
+
+    uint32_t b = wsNameHash(copy) & (reg->nameBuckets - 1);
+    conn->nameNext = reg->names[b];
+    reg->names[b] = conn;
+    reg->nameCount++;
+    return WS_OK;
+}
+
+wsConn* wsRegistryFindName(wsRegistry* reg, const char* name, wsConn* prev) {
+    wsConn* conn = prev ? prev->nameNext : reg->names[wsNameHash(name) & (reg->nameBuckets - 1)];
+    while (conn && strcmp(conn->username, name) != 0) {
+        conn = conn->nameNext;
+    }
+    return conn;
+}
@@ -0,0 +1,67 @@
+#ifndef WS_REGISTRY_H
+#define WS_REGISTRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct wsConn;
+
+// Connection ids stay unique while fds get reused: 24 bit generation of the fd
+// slot, 8 bit shard, 32 bit fd. 0 is never a valid id.
+typedef uint64_t wsConnId;
+
+#define WS_CONN_ID(generation, shard, fd) \
+    (((uint64_t)(generation) << 40) | ((uint64_t)(shard) << 32) | (uint32_t)(fd))
+#define WS_CONN_ID_FD(id) ((int32_t)((id) & 0xFFFFFFFFu))
+#define WS_CONN_ID_SHARD(id) ((uint32_t)(((id) >> 32) & 0xFFu))
+#define WS_CONN_ID_GENERATION_MASK 0xFFFFFFu
+
+// FNV-1a, used by every name keyed index
+static inline uint32_t wsNameHash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+typedef struct {
+    struct wsConn* conn;
+    uint32_t generation;
+} wsRegistrySlot;
+
+// Per shard lookup tables, only the owning shard touches them
+typedef struct {
+    uint32_t shardId;
+
+    // Indexed by fd, fds are small and dense
+    wsRegistrySlot* slots;
+    int32_t slotCount;
+
+    // Username index, connections with a name are chained through wsConn.nameNext
+    struct wsConn** names;
+    uint32_t nameBuckets; // power of two
+    uint32_t nameCount;
+} wsRegistry;
+
+int32_t wsRegistryInit(wsRegistry* reg, uint32_t shardId);
+void wsRegistryFree(wsRegistry* reg);
+
+// Assigns conn->id and makes the connection findable by fd and id
+int32_t wsRegistryAdd(wsRegistry* reg, struct wsConn* conn);
+// Drops the connection from every index, its username stays allocated
+void wsRegistryRemove(wsRegistry* reg, struct wsConn* conn);
+
+struct wsConn* wsRegistryFindFd(wsRegistry* reg, int32_t fd);
+// NULL if the connection is gone, even if its fd was handed out again since
+struct wsConn* wsRegistryFindId(wsRegistry* reg, wsConnId id);
+
+// Replaces conn->username (NULL clears it) and moves it in the username index
+int32_t wsRegistrySetName(wsRegistry* reg, struct wsConn* conn, const char* name);
+
+// Names are not unique: returns the next connection called name after prev,
+// start with prev = NULL
+struct wsConn* wsRegistryFindName(wsRegistry* reg, const char* name, struct wsConn* prev);
+
+#endif
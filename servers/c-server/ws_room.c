@@ -0,0 +1,187 @@
+#include "ws_room.h"
+#include "ws_server.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WS_ROOM_MIN_BUCKETS 64
+#define WS_ROOM_MIN_MEMBERS 4
+
+int32_t wsRoomIndexInit(wsRoomIndex* index) {
+    memset(index, 0, sizeof(*index));
+
+    index->buckets = calloc(WS_ROOM_MIN_BUCKETS, sizeof(wsRoom*));
+    if (!index->buckets) {
+        WS_LOG(ERROR, "Failed to allocate the room index");
+        return WS_ERROR;
+    }
+    index->bucketCount = WS_ROOM_MIN_BUCKETS;
+    return WS_OK;
+}
+
+void wsRoomIndexFree(wsRoomIndex* index) {
+    for (uint32_t i = 0; i < index->bucketCount; i++) {
+        wsRoom* room = index->buckets[i];
+        while (room) {
+            wsRoom* next = room->next;
+            free(room->members);
+            free(room);
+            room = next;
+        }
+    }
+    free(index->buckets);
+    memset(index, 0, sizeof(*index));
+}
+
+static wsRoom* wsRoomLookup(wsRoomIndex* index, const char* name, uint32_t hash) {
+    wsRoom* room = index->buckets[hash & (index->bucketCount - 1)];
+    while (room && (room->hash != hash || strcmp(room->name, name) != 0)) {
+        room = room->next;
+    }
+    return room;
+}
+
+wsRoom* wsRoomFind(wsRoomIndex* index, const char* name) {
+    return wsRoomLookup(index, name, wsNameHash(name));
+}
+
+static void wsRoomGrowBuckets(wsRoomIndex* index) {
+    uint32_t count = index->bucketCount * 2;
+    wsRoom** buckets = calloc(count, sizeof(wsRoom*));
+    if (!buckets) return;
+
+    for (uint32_t i = 0; i < index->bucketCount; i++) {
+        wsRoom* room = index->buckets[i];
+        while (room) {
+            wsRoom* next = room->next;
+            uint32_t b = room->hash & (count - 1);
+            room->next = buckets[b];
+            buckets[b] = room;
+            room = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucketCount = count;
+}
+
+static wsRoom* wsRoomCreate(wsRoomIndex* index, const char* name, uint32_t hash) {
+    wsRoom* room = calloc(1, sizeof(wsRoom));
+    if (!room) {
+        WS_LOG(ERROR, "Failed to allocate room %s", name);
+        return NULL;
+    }
+    strncpy(room->name, name, WS_ROOM_MAX_NAME - 1);
+    room->hash = hash;
+
+    if (index->roomCount >= index->bucketCount) wsRoomGrowBuckets(index);
+
+    uint32_t b = hash & (index->bucketCount - 1);
+    room->next = index->buckets[b];
+    index->buckets[b] = room;
+    index->roomCount++;
+    return room;
+}
+
+static void wsRoomDestroy(wsRoomIndex* index, wsRoom* room) {
+    wsRoom** link = &index->buckets[room->hash & (index->bucketCount - 1)];
+    while (*link != room) link = &(*link)->next;
+    *link = room->next;
+    index->roomCount--;
+
+    free(room->members);
+    free(room);
+}
+
+static int32_t wsConnMembershipFind(wsConn* conn, wsRoom* room) {
+    for (int32_t i = 0; i < conn->roomCount; i++) {
+        if (conn->rooms[i].room == room) return i;
+    }
+    return -1;
+}
+
+int32_t wsRoomJoin(wsRoomIndex* index, wsConn* conn, const char* name) {
+    if (!name[0] || strlen(name) >= WS_ROOM_MAX_NAME) {
+        WS_LOG(ERROR, "Invalid room name (fd=%d)", conn->fd);
+        return WS_ERROR;
+    }
+
+    uint32_t hash = wsNameHash(name);
+    wsRoom* room = wsRoomLookup(index, name, hash);
+    if (room && wsConnMembershipFind(conn, room) >= 0) return WS_OK;
+
+    // Make room on the connection side first, a fresh empty room is easy to undo
+    if (conn->roomCount == conn->roomCapacity) {
+        int32_t capacity = conn->roomCapacity ? conn->roomCapacity * 2 : WS_ROOM_MIN_MEMBERS;
+        wsRoomMembership* rooms = realloc(conn->rooms, capacity * sizeof(wsRoomMembership));
+        if (!rooms) {
+            WS_LOG(ERROR, "Failed to grow room list (fd=%d)", conn->fd);
+            return WS_ERROR;
+        }
+        conn->rooms = rooms;
+        conn->roomCapacity = capacity;
+    }
+
+    if (!room && !(room = wsRoomCreate(index, name, hash))) return WS_ERROR;
+
+    if (room->memberCount == room->memberCapacity) {
+        int32_t capacity = room->memberCapacity ? room->memberCapacity * 2 : WS_ROOM_MIN_MEMBERS;
+        wsRoomMember* members = realloc(room->members, capacity * sizeof(wsRoomMember));
+        if (!members) {
+            WS_LOG(ERROR, "Failed to grow room %s", room->name);
+            if (room->memberCount == 0) wsRoomDestroy(index, room);
+            return WS_ERROR;
+        }
+        room->members = members;
+        room->memberCapacity = capacity;
+    }
+
+    int32_t slot = conn->roomCount++;
+    int32_t member = room->memberCount++;
+    conn->rooms[slot] = (wsRoomMembership){ .room = room, .index = member };
+    room->members[member] = (wsRoomMember){ .conn = conn, .slot = slot };
+    return WS_OK;
+}
+
+// Swap-removes both halves of the membership, fixing up the back pointers of
+// whatever got moved into the freed slots
+static void wsRoomRemoveMembership(wsRoomIndex* index, wsConn* conn, int32_t slot) {
+    wsRoom* room = conn->rooms[slot].room;
+    int32_t member = conn->rooms[slot].index;
+
+    wsRoomMember last = room->members[--room->memberCount];
+    if (member != room->memberCount) {
+        room->members[member] = last;
+        last.conn->rooms[last.slot].index = member;
+    }
+
+    wsRoomMembership lastRoom = conn->rooms[--conn->roomCount];
+    if (slot != conn->roomCount) {
+        conn->rooms[slot] = lastRoom;
+        lastRoom.room->members[lastRoom.index].slot = slot;
+    }
+
+    if (room->memberCount == 0) wsRoomDestroy(index, room);
+}
+
+void wsRoomLeave(wsRoomIndex* index, wsConn* conn, const char* name) {
+    wsRoom* room = wsRoomFind(index, name);
+    if (!room) return;
+
+    int32_t slot = wsConnMembershipFind(conn, room);
+    if (slot >= 0) wsRoomRemoveMembership(index, conn, slot);
+}
+
+void wsRoomLeaveAll(wsRoomIndex* index, wsConn* conn) {
+    while (conn->roomCount > 0) {
+        wsRoomRemoveMembership(index, conn, conn->roomCount - 1);
+    }
+    free(conn->rooms);
+    conn->rooms = NULL;
+    conn->roomCapacity = 0;
+}
+
+bool wsRoomIsMember(wsRoomIndex* index, wsConn* conn, const char* name) {
+    wsRoom* room = wsRoomFind(index, name);
+    return room && wsConnMembershipFind(conn, room) >= 0;
+}
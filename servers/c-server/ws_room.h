@@ -0,0 +1,55 @@
+#ifndef WS_ROOM_H
+#define WS_ROOM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WS_ROOM_MAX_NAME 64
+
+struct wsConn;
+struct wsRoom;
+
+// One entry per room in the member array of the room
+typedef struct {
+    struct wsConn* conn;
+    int32_t slot; // index of the matching wsRoomMembership in conn->rooms
+} wsRoomMember;
+
+// One entry per room in wsConn.rooms, both sides point at each other so
+// leaving is a swap-remove on either array
+typedef struct {
+    struct wsRoom* room;
+    int32_t index; // index of the matching wsRoomMember in room->members
+} wsRoomMembership;
+
+// Rooms only know the members of their own shard, other shards keep their own
+typedef struct wsRoom {
+    char name[WS_ROOM_MAX_NAME];
+    uint32_t hash;
+    wsRoomMember* members; // dense, walked on every room message
+    int32_t memberCount;
+    int32_t memberCapacity;
+    struct wsRoom* next;
+} wsRoom;
+
+typedef struct {
+    wsRoom** buckets;
+    uint32_t bucketCount; // power of two
+    uint32_t roomCount;
+} wsRoomIndex;
+
+int32_t wsRoomIndexInit(wsRoomIndex* index);
+void wsRoomIndexFree(wsRoomIndex* index);
+
+// NULL if nobody on this shard is in the room
+wsRoom* wsRoomFind(wsRoomIndex* index, const char* name);
+
+// Creates the room on first join, joining twice is a no-op
+int32_t wsRoomJoin(wsRoomIndex* index, struct wsConn* conn, const char* name);
+// Empty rooms are freed, leaving a room the connection is not in is a no-op
+void wsRoomLeave(wsRoomIndex* index, struct wsConn* conn, const char* name);
+void wsRoomLeaveAll(wsRoomIndex* index, struct wsConn* conn);
+
+bool wsRoomIsMember(wsRoomIndex* index, struct wsConn* conn, const char* name);
+
+#endif
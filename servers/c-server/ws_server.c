@@ -1,330 +1,2595 @@
-#include <setjmp.h>
-#include <stdint.h>
 #define _GNU_SOURCE
-#include <stdio.h>      
-#include <stdlib.h>     
-#include <string.h>    
-#include <unistd.h>     
-#include <sys/socket.h> 
-#include <netinet/in.h> 
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
-#include <arpa/inet.h>  
-#include <netdb.h>      
-#include <poll.h>       
-#include <signal.h>     
-#include "sha1.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <signal.h>
+#include <poll.h>
+
+#include "../../lib/ws_defines.h"
+#include "ws_server.h"
+
+static const char* wsConnUsername(wsConn* conn) {
+    return conn->username ? conn->username : "Anonym";
+}
+
+static void wsCloseConn(wsShard* shard, wsConn* conn) {
+    WS_LOG(INFO, "Client disconnected (fd=%d, shard=%d)", conn->fd, shard->id);
+
+    // Swap-remove from the broadcast list
+    if (conn->activeIndex >= 0) {
+        wsConn* last = shard->active[--shard->activeCount];
+        shard->active[conn->activeIndex] = last;
+        last->activeIndex = conn->activeIndex;
+        if (conn->deflate) atomic_fetch_sub_explicit(&shard->server->deflateClients, 1, memory_order_relaxed);
+        if (conn->binary) atomic_fetch_sub_explicit(&shard->server->binaryClients, 1, memory_order_relaxed);
+    }
+
+    wsRegistryRemove(&shard->registry, conn);
+    wsRoomLeaveAll(&shard->rooms, conn);
+    wsTimerCancel(&shard->timers, &conn->timer);
+
+    // close() drops the fd from the epoll set as well
+    close(conn->fd);
+    wsBufferFree(&conn->in);
+    wsBufferFree(&conn->fragments);
+    wsOutQueueClear(&conn->out);
+    wsInflateFree(conn->inflater);
+    free(conn->username);
+    free(conn);
+    atomic_fetch_sub_explicit(&shard->server->clientCount, 1, memory_order_relaxed);
+}
+
+// Marks the connection for teardown, it stays valid until wsReapClosed runs
+static void wsConnFail(wsShard* shard, wsConn* conn) {
+    if (conn->closing) return;
+    conn->closing = true;
+    conn->closeNext = shard->closeList;
+    shard->closeList = conn;
+    wsTimerCancel(&shard->timers, &conn->timer);
+}
+
+// Earliest moment the timer has to look at a handshaken connection again
+static uint64_t wsConnDeadline(const wsServerConfig* config, const wsConn* conn) {
+    uint64_t deadline = WS_TIMER_NONE;
+    if (conn->awaitingPong) deadline = conn->pingSent + config->pongTimeoutMs;
+    else if (config->pingIntervalMs) deadline = conn->lastRecv + config->pingIntervalMs;
+
+    if (config->idleTimeoutMs && conn->lastMessage + config->idleTimeoutMs < deadline) {
+        deadline = conn->lastMessage + config->idleTimeoutMs;
+    }
+    if (conn->throttled && conn->resumeAt < deadline) deadline = conn->resumeAt;
+    return deadline;
+}
+
+static void wsConnArmTimer(wsShard* shard, wsConn* conn) {
+    uint64_t deadline = wsConnDeadline(&shard->server->config, conn);
+    if (deadline == WS_TIMER_NONE) wsTimerCancel(&shard->timers, &conn->timer);
+    else wsTimerArm(&shard->timers, &conn->timer, deadline);
+}
+
+#ifdef WS_ENABLE_IO_URING
+// Completions carry the connection pointer with the request kind in the low bits
+enum {
+    WS_URING_ACCEPT,
+    WS_URING_WAKE,
+    WS_URING_RECV,
+    WS_URING_SEND,
+    WS_URING_CANCEL,
+};
+#define WS_URING_OP_MASK 7ull
+
+static inline uint64_t wsUringTag(wsConn* conn, uint64_t op) {
+    return (uint64_t)(uintptr_t)conn | op;
+}
+
+// The kernel may still be parked in a send or recv for this connection. The
+// cancel is submitted after anything queued so far, so a final close frame still
+// goes out if the socket has room, just like the direct send of the epoll path.
+static void wsUringCancelConn(wsShard* shard, wsConn* conn) {
+    struct io_uring_sqe* sqe = wsUringGetSqe(shard->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = conn->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = wsUringTag(NULL, WS_URING_CANCEL);
+}
+
+static void wsUringShutdownConn(wsShard* shard, wsConn* conn) {
+    if (conn->shutdown) return;
+    conn->shutdown = true;
+    wsUringCancelConn(shard, conn);
+}
+
+// Stops the multishot recv of a throttled connection, the socket buffer fills up
+// and TCP pushes back on the client. Completions already queued still arrive.
+static void wsUringCancelRecv(wsShard* shard, wsConn* conn) {
+    struct io_uring_sqe* sqe = wsUringGetSqe(shard->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = wsUringTag(conn, WS_URING_RECV);
+    sqe->user_data = wsUringTag(NULL, WS_URING_CANCEL);
+}
+
+// A shut down connection is freed after its last completion
+static void wsUringConnDone(wsShard* shard, wsConn* conn) {
+    if (--conn->pending == 0 && conn->shutdown) {
+        conn->closeNext = shard->closeList;
+        shard->closeList = conn;
+    }
+}
+
+// One request per connection is in flight, so frames hit the socket in order. A
+// single frame goes out as a plain send, a backlog as one sendmsg over up to
+// WS_URING_SEND_BATCH frames. The next request starts from the completion.
+static void wsUringSendQueued(wsShard* shard, wsConn* conn) {
+    wsOutQueue* q = &conn->out;
+    // A connection that just failed still gets what it queued before, like a
+    // close reply, the cancel only goes out when it is reaped
+    if (conn->shutdown || q->pinned || q->frames.count == 0) return;
+
+    wsUring* ring = shard->uring;
+    uint32_t n = q->frames.count < WS_URING_SEND_BATCH ? q->frames.count : WS_URING_SEND_BATCH;
+    struct msghdr* msg = NULL;
+
+    if (n > 1) {
+        // The kernel copies msghdr and iovec when it consumes the SQE, the slots
+        // are reused once everything prepared so far has been submitted
+        if (shard->sendMsgsUsed == WS_URING_SEND_SLOTS) {
+            if (wsUringSubmit(ring, 0) < 0 || wsUringUnsubmitted(ring) > 0) {
+                WS_LOG(WARN, "Submission failed, dropping client (fd=%d)", conn->fd);
+                wsMetricsAdd(&shard->metrics.sendErrors, 1);
+                wsConnFail(shard, conn);
+                return;
+            }
+            shard->sendMsgsUsed = 0;
+        }
+
+        wsUringSendMsg* slot = &shard->sendMsgs[shard->sendMsgsUsed++];
+        for (uint32_t i = 0; i < n; i++) {
+            wsOutFrame* frame = wsOutQueueAt(q, i);
+            size_t offset = i == 0 ? q->headSent : 0;
+            slot->iov[i].iov_base = frame->data + offset;
+            slot->iov[i].iov_len = frame->len - offset;
+        }
+        memset(&slot->msg, 0, sizeof(slot->msg));
+        slot->msg.msg_iov = slot->iov;
+        slot->msg.msg_iovlen = n;
+        msg = &slot->msg;
+    }
+
+    struct io_uring_sqe* sqe = wsUringGetSqe(ring);
+    if (!sqe) {
+        wsMetricsAdd(&shard->metrics.sendErrors, 1);
+        wsConnFail(shard, conn);
+        return;
+    }
+    sqe->fd = conn->fd;
+    if (msg) {
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t)(uintptr_t)msg;
+        sqe->len = 1;
+    }
+    else {
+        wsOutFrame* frame = wsOutQueueAt(q, 0);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)(frame->data + q->headSent);
+        sqe->len = frame->len - q->headSent;
+    }
+    // With MSG_WAITALL the kernel finishes short sends itself, anything less
+    // than everything is an error
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = wsUringTag(conn, WS_URING_SEND);
+
+    q->pinned = n;
+    conn->pending++;
+}
+
+// Sends are not started per frame, a broadcast burst would otherwise go out as
+// one short send per connection followed by a loop iteration of waiting
+static void wsUringScheduleSend(wsShard* shard, wsConn* conn) {
+    if (conn->flushQueued || conn->out.pinned) return;
+    conn->flushQueued = true;
+    conn->flushNext = shard->flushList;
+    shard->flushList = conn;
+}
+
+static void wsUringFlushSends(wsShard* shard) {
+    while (shard->flushList) {
+        wsConn* conn = shard->flushList;
+        shard->flushList = conn->flushNext;
+        conn->flushQueued = false;
+        wsUringSendQueued(shard, conn);
+    }
+}
+#endif
+
+static void wsReapClosed(wsShard* shard) {
+    while (shard->closeList) {
+        wsConn* conn = shard->closeList;
+        shard->closeList = conn->closeNext;
+#ifdef WS_ENABLE_IO_URING
+        if (conn->pending > 0) {
+            wsUringShutdownConn(shard, conn);
+            continue;
+        }
+#endif
+        wsCloseConn(shard, conn);
+    }
+}
+
+static void wsConnUpdateSlow(wsShard* shard, wsConn* conn) {
+    const wsServerConfig* config = &shard->server->config;
+
+    if (!conn->slow && conn->out.bytes > config->highWatermark) {
+        conn->slow = true;
+        WS_LOG(WARN, "Client is slow, %zu bytes queued (fd=%d)", conn->out.bytes, conn->fd);
+    }
+    else if (conn->slow && conn->out.bytes <= config->lowWatermark) {
+        conn->slow = false;
+        WS_LOG(INFO, "Client caught up (fd=%d)", conn->fd);
+    }
+}
+
+// Never blocks: whatever the socket does not take right away is queued and
+// flushed once epoll reports the socket writable again
+// The frame is shared, only a queued copy of the pointer takes a reference
+static void wsConnSend(wsShard* shard, wsConn* conn, wsOutFrame* frame) {
+    if (conn->closing) return;
+
+    const wsServerConfig* config = &shard->server->config;
+    wsMetricsAdd(&shard->metrics.sends, 1);
+    wsMetricsAdd(&shard->metrics.bytesOut, frame->len);
+    size_t offset = 0;
+    bool uring = false;
+#ifdef WS_ENABLE_IO_URING
+    uring = shard->uring != NULL;
+#endif
+
+    // Fast path, nothing is queued so write straight to the socket. The io_uring
+    // loop always queues, the send goes to the kernel with the rest of the batch.
+    if (!uring && conn->out.bytes == 0) {
+        ssize_t sent = wsOutQueueSendDirect(&conn->out, conn->fd, frame, 0, config->zerocopyMin);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                WS_LOG(WARN, "Failed to send to client (fd=%d), will be disconnected", conn->fd);
+                wsMetricsAdd(&shard->metrics.sendErrors, 1);
+                wsConnFail(shard, conn);
+                return;
+            }
+            sent = 0;
+        }
+        if ((size_t)sent == frame->len) return;
+        offset = sent;
+    }
+
+    if (conn->slow && config->slowPolicy == WS_SLOW_DISCONNECT) {
+        WS_LOG(WARN, "Disconnecting slow client, %zu bytes queued (fd=%d)", conn->out.bytes, conn->fd);
+        wsConnFail(shard, conn);
+        return;
+    }
+
+    if (wsOutQueuePush(&conn->out, frame, offset) != WS_OK) {
+        wsMetricsAdd(&shard->metrics.sendErrors, 1);
+        wsConnFail(shard, conn);
+        return;
+    }
+#ifdef WS_ENABLE_IO_URING
+    if (uring) wsUringScheduleSend(shard, conn);
+#endif
+
+    // After a partial write the socket may still have room, only EAGAIN arms EPOLLOUT
+    if (offset && wsOutQueueFlush(&conn->out, conn->fd, config->zerocopyMin) != WS_OK) {
+        wsMetricsAdd(&shard->metrics.sendErrors, 1);
+        wsConnFail(shard, conn);
+        return;
+    }
+
+    // Dropping never touches the last frame, so it runs once the new one is queued
+    if (conn->slow && config->slowPolicy == WS_SLOW_DROP_OLDEST) {
+        wsOutQueueDropOldest(&conn->out, config->highWatermark);
+    } else if (conn->slow && config->slowPolicy == WS_SLOW_COALESCE) {
+        wsOutQueueDropOldest(&conn->out, 0);
+    }
+    wsConnUpdateSlow(shard, conn);
+}
+
+static void wsHandleWritable(wsShard* shard, wsConn* conn) {
+    if (conn->closing || conn->out.bytes == 0) return;
+
+    if (wsOutQueueFlush(&conn->out, conn->fd, shard->server->config.zerocopyMin) != WS_OK) {
+        wsMetricsAdd(&shard->metrics.sendErrors, 1);
+        wsConnFail(shard, conn);
+        return;
+    }
+    if (conn->closeAfterFlush && conn->out.bytes == 0) {
+        wsConnFail(shard, conn);
+        return;
+    }
+    wsConnUpdateSlow(shard, conn);
+}
+
+// Applies the socket options and allocates the connection state. Closes the
+// socket and returns NULL if the client cannot be taken.
+static wsConn* wsNewConn(wsShard* shard, int32_t client_fd) {
+    wsServer* server = shard->server;
+
+    int32_t clients = atomic_fetch_add_explicit(&server->clientCount, 1, memory_order_relaxed);
+    if (clients >= server->config.maxClients) {
+        atomic_fetch_sub_explicit(&server->clientCount, 1, memory_order_relaxed);
+        WS_LOG(WARN, "Max clients reached, rejecting connection");
+        close(client_fd);
+        return NULL;
+    }
+
+    int keepalive = 1;
+    int keepidle = 60;
+    int keepintvl = 10;
+    int keepcnt = 6;
+    int nodelay = 1;
+
+    setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+    setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
+    setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepintvl, sizeof(keepintvl));
+    setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPCNT, &keepcnt, sizeof(keepcnt));
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    if (server->config.zerocopyMin && server->config.backend == WS_BACKEND_EPOLL) {
+        int zerocopy = 1;
+        if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &zerocopy, sizeof(zerocopy)) < 0) {
+            WS_LOG(ERROR, "SO_ZEROCOPY failed: %s", strerror(errno));
+        }
+    }
+
+    wsConn* conn = calloc(1, sizeof(wsConn));
+    if (!conn) {
+        WS_LOG(ERROR, "Failed to allocate connection state (fd=%d)", client_fd);
+        atomic_fetch_sub_explicit(&server->clientCount, 1, memory_order_relaxed);
+        close(client_fd);
+        return NULL;
+    }
+    conn->source.type = WS_EVENT_CONN;
+    conn->fd = client_fd;
+    conn->activeIndex = -1;
+    conn->lastRecv = shard->now;
+    conn->lastMessage = shard->now;
+
+    if (wsRegistryAdd(&shard->registry, conn) != WS_OK) {
+        atomic_fetch_sub_explicit(&server->clientCount, 1, memory_order_relaxed);
+        close(client_fd);
+        free(conn);
+        return NULL;
+    }
+    if (server->config.handshakeTimeoutMs) {
+        wsTimerArm(&shard->timers, &conn->timer, shard->now + server->config.handshakeTimeoutMs);
+    }
+
+    wsMetricsAdd(&shard->metrics.accepted, 1);
+    WS_LOG(INFO, "Client connected (fd=%d, id=%llx, shard=%d, clients=%d)", client_fd,
+                 (unsigned long long)conn->id, shard->id, clients + 1);
+    return conn;
+}
+
+static void wsAcceptClients(wsShard* shard) {
+    for (;;) {
+        int client_fd = accept4(shard->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) WS_LOG(ERROR, "accept failed: %s", strerror(errno));
+            return;
+        }
+
+        wsConn* conn = wsNewConn(shard, client_fd);
+        if (!conn) continue;
+
+        struct epoll_event ev = {0};
+        // EPOLLOUT stays registered, with EPOLLET it only fires once the socket
+        // becomes writable again after a send hit EAGAIN
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            WS_LOG(ERROR, "epoll_ctl failed: %s", strerror(errno));
+            wsCloseConn(shard, conn);
+        }
+    }
+}
+
+static int32_t wsActivateConn(wsShard* shard, wsConn* conn) {
+    if (shard->activeCount == shard->activeCapacity) {
+        int32_t capacity = shard->activeCapacity ? shard->activeCapacity * 2 : 64;
+        wsConn** active = realloc(shard->active, capacity * sizeof(wsConn*));
+        if (!active) return WS_ERROR;
+        shard->active = active;
+        shard->activeCapacity = capacity;
+    }
+
+    conn->handshakeDone = true;
+    conn->activeIndex = shard->activeCount;
+    shard->active[shard->activeCount++] = conn;
+    return WS_OK;
+}
+
+static const char wsHandshakeAccept[] =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: ";
+
+// Answers a rejected upgrade, the connection is closed right after
+static void wsRejectHandshake(wsShard* shard, wsConn* conn, uint16_t status) {
+    const char* response;
+    switch (status) {
+        case 426:
+            response = "HTTP/1.1 426 Upgrade Required\r\n"
+                       "Sec-WebSocket-Version: 13\r\n"
+                       "Connection: close\r\n\r\n";
+            break;
+        case 431:
+            response = "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                       "Connection: close\r\n\r\n";
+            break;
+        default:
+            response = "HTTP/1.1 400 Bad Request\r\n"
+                       "Connection: close\r\n\r\n";
+            break;
+    }
+    WS_LOG(INFO, "Rejected handshake with %u (fd=%d)", status, conn->fd);
+    wsMetricsAdd(&shard->metrics.rejected, 1);
+
+    wsOutFrame* frame = wsOutFrameFromBytes((const uint8_t*)response, strlen(response));
+    if (!frame) return;
+    wsConnSend(shard, conn, frame);
+    wsOutFrameRelease(frame);
+}
+
+// Takes the first permessage-deflate offer the shared compressor can serve. The
+// server never keeps its window between messages, a broadcast is compressed
+// once and the same bytes go to every client.
+static void wsNegotiateDeflate(wsShard* shard, wsConn* conn, const uint8_t* request) {
+    const wsServerConfig* config = &shard->server->config;
+    if (!shard->deflater) return;
+
+    size_t len;
+    const char* value = wsHttpUpgradeExtensions(&conn->http, request, &len);
+    size_t pos = 0;
+    wsDeflateParams offer;
+    while (wsDeflateNextOffer(value, len, &pos, &offer) == WS_OK) {
+        if (offer.serverMaxWindowBits && offer.serverMaxWindowBits < config->deflateWindowBits) continue;
+
+        wsDeflateParams* answer = &conn->deflateParams;
+        answer->serverNoContextTakeover = true;
+        answer->clientNoContextTakeover = offer.clientNoContextTakeover || config->deflateClientWindowBits == 0;
+        if (offer.serverMaxWindowBits || config->deflateWindowBits < WS_DEFLATE_MAX_WINDOW_BITS) {
+            answer->serverMaxWindowBits = config->deflateWindowBits;
+        }
+        // The client window can only be limited if the client said it supports that
+        if (offer.clientMaxWindowBits && config->deflateClientWindowBits) {
+            answer->clientMaxWindowBits = offer.clientMaxWindowBits < config->deflateClientWindowBits
+                                              ? offer.clientMaxWindowBits
+                                              : config->deflateClientWindowBits;
+        }
+        conn->deflate = true;
+        return;
+    }
+}
+
+// The accept value is computed later together with the other handshakes of
+// this loop iteration, see wsFinishHandshakes
+static void wsQueueHandshake(wsShard* shard, wsConn* conn, const uint8_t* request) {
+    wsNegotiateDeflate(shard, conn, request);
+    memcpy(conn->handshakeKey, wsHttpUpgradeKey(&conn->http, request), WS_ACCEPT_KEY_LEN);
+    conn->handshakeQueued = true;
+    conn->handshakeNext = shard->handshakeList;
+    shard->handshakeList = conn;
+}
+
+static int32_t wsCompleteHandshake(wsShard* shard, wsConn* conn, const char* accept) {
+    static const char extensions[] = "\r\nSec-WebSocket-Extensions: ";
+    char response[sizeof(wsHandshakeAccept) - 1 + WS_ACCEPT_LEN + sizeof(extensions) - 1 + 160 + 4];
+    size_t len = sizeof(wsHandshakeAccept) - 1;
+    memcpy(response, wsHandshakeAccept, len);
+    memcpy(response + len, accept, WS_ACCEPT_LEN);
+    len += WS_ACCEPT_LEN;
+    if (conn->deflate) {
+        memcpy(response + len, extensions, sizeof(extensions) - 1);
+        len += sizeof(extensions) - 1;
+        len += wsDeflateFormat(&conn->deflateParams, response + len, 160);
+    }
+    memcpy(response + len, "\r\n\r\n", 4);
+    len += 4;
+
+    wsOutFrame* frame = wsOutFrameFromBytes((const uint8_t*)response, len);
+    if (!frame) return WS_ERROR;
+    wsConnSend(shard, conn, frame);
+    wsOutFrameRelease(frame);
+    if (conn->closing) {
+        WS_LOG(WARN, "Failed to send handshake response (fd=%d)", conn->fd);
+        return WS_ERROR;
+    }
+
+    if (wsActivateConn(shard, conn) != WS_OK) {
+        WS_LOG(ERROR, "Failed to grow the broadcast list (fd=%d)", conn->fd);
+        return WS_ERROR;
+    }
+    if (conn->deflate) atomic_fetch_add_explicit(&shard->server->deflateClients, 1, memory_order_relaxed);
+    conn->lastRecv = shard->now;
+    conn->lastMessage = shard->now;
+    wsTokenBucketInit(&conn->messageBucket, &shard->server->config.messageRate, shard->now);
+    wsTokenBucketInit(&conn->byteBucket, &shard->server->config.byteRate, shard->now);
+    wsConnArmTimer(shard, conn);
+    wsMetricsAdd(&shard->metrics.handshakes, 1);
+    wsHistogramRecord(&shard->metrics.handshake, wsMetricsNow() - conn->requestNs);
+
+    WS_LOG(INFO, "WebSocket handshake complete (fd=%d, shard=%d%s)", conn->fd, shard->id,
+                 conn->deflate ? ", permessage-deflate" : "");
+    return WS_OK;
+}
+
+// Builds an unmasked server frame, server to client frames are never masked
+static wsOutFrame* wsBuildFrame(uint8_t opcode, const void* payload, size_t len) {
+    uint8_t header[WS_FRAME_MAX_HEADER];
+    int32_t headerLen = wsFrameWriteHeader(header, opcode, true, len, NULL);
+
+    wsOutFrame* frame = wsOutFrameCreate(headerLen + len);
+    if (!frame) return NULL;
+    memcpy(frame->data, header, headerLen);
+    if (len) memcpy(frame->data + headerLen, payload, len);
+    return frame;
+}
+
+// Encodes a binary chat message straight into its frame
+static wsOutFrame* wsBuildBinaryFrame(const wsBinaryMessage* msg) {
+    size_t len = wsBinarySize(msg);
+    uint8_t header[WS_FRAME_MAX_HEADER];
+    int32_t headerLen = wsFrameWriteHeader(header, WS_OPCODE_BINARY, true, len, NULL);
+    wsOutFrame* frame = wsOutFrameCreate(headerLen + len);
+    if (!frame) return NULL;
+    memcpy(frame->data, header, headerLen);
+    wsBinaryEncode(msg, frame->data + headerLen);
+    return frame;
+}
+
+// Attaches the compressed variant of a broadcast, it is deflated once and the
+// result is shared like the frame itself. Skipped while nobody could use it or
+// when compression does not make the message smaller.
+static void wsDeflateFrame(wsShard* shard, wsOutFrame* frame) {
+    if (!shard->deflater || atomic_load_explicit(&shard->server->deflateClients, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    // Our own frames are unmasked, parsing only locates the payload
+    wsFrame parsed;
+    if (wsFrameParse(frame->data, frame->len, UINT64_MAX, &parsed) <= 0 || parsed.payloadLen < WS_DEFLATE_MIN_SIZE) {
+        return;
+    }
+
+    wsBuffer* out = &shard->deflated;
+    out->len = 0;
+    if (wsDeflateMessage(shard->deflater, parsed.payload, parsed.payloadLen, out) != WS_OK ||
+        out->len >= parsed.payloadLen) {
+        return;
+    }
+
+    frame->deflated = wsBuildFrame(parsed.opcode, out->data, out->len);
+    if (frame->deflated) frame->deflated->data[0] |= WS_FRAME_RSV1;
+}
+
+// The variant of a broadcast the client gets: its format if the other one was
+// built, compressed if it negotiated that
+static inline wsOutFrame* wsConnFrame(const wsConn* conn, wsOutFrame* frame) {
+    bool binary = (frame->data[0] & 0x0F) == WS_OPCODE_BINARY;
+    if (binary != conn->binary && frame->alternate) frame = frame->alternate;
+    return conn->deflate && frame->deflated ? frame->deflated : frame;
+}
+
+static void wsBroadcastLocal(wsShard* shard, wsOutFrame* frame, wsConn* skip) {
+    for (int32_t j = 0; j < shard->activeCount; j++) {
+        wsConn* peer = shard->active[j];
+        if (peer == skip) continue;
+        wsConnSend(shard, peer, wsConnFrame(peer, frame));
+    }
+}
+
+// Only the subscribers of the room, every shard has its own member list
+static void wsBroadcastRoom(wsShard* shard, const char* name, wsOutFrame* frame, wsConn* skip) {
+    wsRoom* room = wsRoomFind(&shard->rooms, name);
+    if (!room) return;
+
+    for (int32_t j = 0; j < room->memberCount; j++) {
+        wsConn* peer = room->members[j].conn;
+        if (peer == skip || peer->activeIndex < 0) continue;
+        wsConnSend(shard, peer, wsConnFrame(peer, frame));
+    }
+}
+
+// Called by every shard once it handed a broadcast to its clients. The last one
+// records the time from the read of the message, so the fan-out latency covers
+// the slowest shard.
+static void wsFanoutDone(wsShard* shard, wsOutFrame* frame) {
+    if (atomic_fetch_sub_explicit(&frame->fanoutPending, 1, memory_order_acq_rel) == 1) {
+        wsHistogramRecord(&shard->metrics.fanout, wsMetricsNow() - frame->ingressNs);
+    }
+}
+
+// Only the first producer after a drain pays for the eventfd write
+static void wsShardWake(wsShard* target) {
+    if (!atomic_exchange_explicit(&target->wakePending, true, memory_order_acq_rel)) {
+        uint64_t one = 1;
+        if (write(target->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            WS_LOG(ERROR, "eventfd write failed: %s", strerror(errno));
+        }
+    }
+}
+
+// Hands a reference to the frame to another shard and wakes it if it is idle
+static int32_t wsShardPost(wsShard* target, const char* room, uint64_t seq, wsOutFrame* frame) {
+    size_t roomLen = room ? strlen(room) : 0;
+    wsShardMsg* msg = malloc(sizeof(wsShardMsg) + roomLen + 1);
+    if (!msg) {
+        WS_LOG(ERROR, "Failed to allocate cross shard message for shard %d", target->id);
+        return WS_ERROR;
+    }
+    msg->frame = wsOutFrameRetain(frame);
+    msg->seq = seq;
+    memcpy(msg->room, room ? room : "", roomLen + 1);
+
+    wsMpscPush(&target->inbound, &msg->node);
+    wsShardWake(target);
+    return WS_OK;
+}
+
+// room NULL sends to every client, otherwise only to the members of the room
+static void wsBroadcast(wsShard* shard, wsConn* sender, uint64_t flags, const char* room, uint64_t seq,
+                        wsOutFrame* frame) {
+    wsServer* server = shard->server;
+    frame->ingressNs = shard->readNs;
+    atomic_store_explicit(&frame->fanoutPending, server->shardCount, memory_order_relaxed);
+
+    // Skip sender unless SEND_BACK flag is set
+    wsConn* skip = (flags & WS_SEND_BACK) ? NULL : sender;
+    if (room) {
+        wsBroadcastRoom(shard, room, frame, skip);
+    } else {
+        wsBroadcastLocal(shard, frame, skip);
+    }
+    wsFanoutDone(shard, frame);
+    wsHistoryAppend(&shard->history, room, seq, frame);
+
+    if (server->log) wsLogAppend(server->log, seq, room, frame->data, frame->len);
+    for (int32_t s = 0; s < server->shardCount; s++) {
+        if (s != shard->id && wsShardPost(&server->shards[s], room, seq, frame) != WS_OK) {
+            wsFanoutDone(shard, frame);
+        }
+    }
+}
+
+static void wsDrainInbound(wsShard* shard) {
+    uint64_t count;
+    if (read(shard->wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        WS_LOG(ERROR, "eventfd read failed: %s", strerror(errno));
+    }
+
+    // Clear before draining, a producer that races us will signal again
+    atomic_store_explicit(&shard->wakePending, false, memory_order_release);
+
+    wsMpscNode* node;
+    while ((node = wsMpscPop(&shard->inbound))) {
+        wsShardMsg* msg = (wsShardMsg*)node;
+        if (msg->room[0]) {
+            wsBroadcastRoom(shard, msg->room, msg->frame, NULL);
+        } else {
+            wsBroadcastLocal(shard, msg->frame, NULL);
+        }
+        wsFanoutDone(shard, msg->frame);
+        wsHistoryAppend(&shard->history, msg->room, msg->seq, msg->frame);
+        wsOutFrameRelease(msg->frame);
+        free(msg);
+    }
+}
+
+// Answers ping and close frames, both may carry at most 125 bytes
+static int32_t wsSendControl(wsShard* shard, wsConn* conn, uint8_t opcode, const uint8_t* payload, uint64_t len) {
+    if (len > 125) len = 125;
+    wsOutFrame* frame = wsBuildFrame(opcode, payload, len);
+    if (!frame) return WS_ERROR;
+    wsConnSend(shard, conn, frame);
+    wsOutFrameRelease(frame);
+    return conn->closing ? WS_ERROR : WS_OK;
+}
+
+// Sends frames[from, to) as one write
+static void wsSendBatch(wsShard* shard, wsConn* conn, wsOutFrame** frames, uint32_t from, uint32_t to, size_t len) {
+    wsOutFrame* batch = wsOutFrameCreate(len);
+    if (!batch) return;
+    len = 0;
+    for (uint32_t i = from; i < to; i++) {
+        memcpy(batch->data + len, frames[i]->data, frames[i]->len);
+        len += frames[i]->len;
+    }
+    wsConnSend(shard, conn, batch);
+    wsOutFrameRelease(batch);
+}
+
+// Sends the requested part of a channel's history as one frame holding all of
+// its messages, so a reconnecting client costs a single write. Only a history
+// larger than a frame length can hold is split. limit 0 sends everything after
+// afterSeq that is still kept.
+static void wsReplayHistory(wsShard* shard, wsConn* conn, const char* room, uint64_t afterSeq, uint32_t limit) {
+    wsHistory* history = &shard->history;
+    if (history->capacity == 0) return;
+
+    wsOutFrame** frames = malloc(history->capacity * sizeof(wsOutFrame*));
+    if (!frames) return;
+    uint32_t count = wsHistoryCollect(history, room, afterSeq, limit, frames);
+
+    // Compressed messages stand on their own, so they can be mixed into one write
+    uint32_t from = 0;
+    size_t len = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        frames[i] = wsConnFrame(conn, frames[i]);
+        if (len + frames[i]->len > UINT32_MAX) {
+            wsSendBatch(shard, conn, frames, from, i, len);
+            from = i;
+            len = 0;
+        }
+        len += frames[i]->len;
+    }
+    if (count) {
+        wsSendBatch(shard, conn, frames, from, count, len);
+        WS_LOG(INFO, "Replayed %u messages of %s to client %d", count, room ? room : "everyone", conn->fd);
+    }
+    free(frames);
+}
+
+// Renames, room membership and history requests, the same for JSON and binary
+// messages. Returns true if the message is to be broadcast.
+static bool wsHandleControl(wsShard* shard, wsConn* conn, uint64_t flags, const char* name, const char* room,
+                            uint64_t afterSeq, uint32_t limit) {
+    if (flags & WS_CHANGE_USERNAME && name) {
+        WS_LOG(DEBUG, "Change username message detected!");
+        if (wsRegistrySetName(&shard->registry, conn, name) == WS_OK) {
+            WS_LOG(INFO, "Updated client: %d name to: %s", conn->fd, name);
+        }
+    }
+
+    if (flags & WS_JOIN_ROOM && room) {
+        if (wsRoomJoin(&shard->rooms, conn, room) == WS_OK) {
+            WS_LOG(INFO, "Client %d joined room %s", conn->fd, room);
+            wsReplayHistory(shard, conn, room, afterSeq, limit);
+        }
+    }
+    if (flags & WS_LEAVE_ROOM && room) {
+        wsRoomLeave(&shard->rooms, conn, room);
+        WS_LOG(INFO, "Client %d left room %s", conn->fd, room);
+    }
+    // Joining already replays, room history is only for members
+    if (flags & WS_REPLAY_HISTORY && !(flags & WS_JOIN_ROOM) &&
+        (!room || wsRoomIsMember(&shard->rooms, conn, room))) {
+        wsReplayHistory(shard, conn, room, afterSeq, limit);
+    }
+
+    // Don't broadcast if NO_BROADCAST flag is set
+    if (flags & WS_NO_BROADCAST) return false;
+
+    // Only members may post into a room
+    if (room && !wsRoomIsMember(&shard->rooms, conn, room)) {
+        WS_LOG(DEBUG, "Client %d is not in room %s, dropping message", conn->fd, room);
+        return false;
+    }
+    return true;
+}
+
+static inline bool wsServerHasTextClients(wsServer* server) {
+    return atomic_load_explicit(&server->clientCount, memory_order_relaxed) >
+           atomic_load_explicit(&server->binaryClients, memory_order_relaxed);
+}
+
+// Applies the edits to payload straight inside a new text frame, the length
+// query sizes the frame first
+static wsOutFrame* wsBuildSplicedFrame(const char* payload, size_t len, const wsJsonEdit* edits, int32_t count) {
+    int32_t outLen = wsJsonSplice(payload, len, edits, count, NULL, 0);
+    if (outLen < 0) return NULL;
+
+    uint8_t header[WS_FRAME_MAX_HEADER];
+    int32_t headerLen = wsFrameWriteHeader(header, WS_OPCODE_TEXT, true, outLen, NULL);
+    wsOutFrame* frame = wsOutFrameCreate(headerLen + outLen);
+    if (!frame) return NULL;
+    memcpy(frame->data, header, headerLen);
+    wsJsonSplice(payload, len, edits, count, (char*)frame->data + headerLen, outLen);
+    return frame;
+}
+
+// The fields routing looks at, found in one scan of the message
+enum {
+    WS_FIELD_ROOT,
+    WS_FIELD_NAME,
+    WS_FIELD_INFO,
+    WS_FIELD_TEXT,
+    WS_FIELD_ROOM,
+    WS_FIELD_AFTER,
+    WS_FIELD_LIMIT,
+    WS_FIELD_SEQ,
+    WS_FIELD_COUNT,
+};
+
+static const char* const wsFieldPaths[WS_FIELD_COUNT] = {
+    [WS_FIELD_ROOT] = "",
+    [WS_FIELD_NAME] = "user.name",
+    [WS_FIELD_INFO] = "message.info",
+    [WS_FIELD_TEXT] = "message.text",
+    [WS_FIELD_ROOM] = "room.name",
+    [WS_FIELD_AFTER] = "history.after",
+    [WS_FIELD_LIMIT] = "history.limit",
+    [WS_FIELD_SEQ] = "seq",
+};
+
+// Splices want their edits in message order
+static void wsAddEdit(wsJsonEdit* edits, int32_t* count, wsJsonEdit edit) {
+    int32_t i = *count;
+    for (; i > 0 && edits[i - 1].at > edit.at; i--) edits[i] = edits[i - 1];
+    edits[i] = edit;
+    (*count)++;
+}
+
+// The message goes out as the client wrote it, with the server side username,
+// the info flags cleared and its sequence number set. No tree is built.
+static int32_t wsHandleMessage(wsShard* shard, wsConn* conn, const char* payload, size_t len) {
+    WS_LOG(DEBUG, "Server recived Message: %s", payload);
+    uint64_t start = wsMetricsNow();
+    wsJsonSlice fields[WS_FIELD_COUNT];
+
+    // If JSON parsing failed, skip this message. A routed field that comes
+    // twice could smuggle a name or seq past the rewrite below.
+    int32_t found = wsJsonPathFindAll(payload, len, wsFieldPaths, fields, WS_FIELD_COUNT);
+    if (found != WS_OK) {
+        if (found == WS_JSON_DUPLICATE) WS_LOG(WARN, "Duplicate field in JSON message (fd=%d), skipping...", conn->fd);
+        else WS_LOG(WARN, "Failed to parse JSON message, skipping...");
+        wsMetricsAdd(&shard->metrics.parseErrors, 1);
+        return WS_OK;
+    }
+
+    const char* name = wsJsonSliceString(&fields[WS_FIELD_NAME], &shard->json, NULL);
+    double info = wsJsonSliceNumber(&fields[WS_FIELD_INFO]);
+    uint64_t flags = info > 0 ? (uint64_t)info : 0;
+    const char* room = wsJsonSliceString(&fields[WS_FIELD_ROOM], &shard->json, NULL);
+
+    // Missing fields come back as -1
+    double after = wsJsonSliceNumber(&fields[WS_FIELD_AFTER]);
+    double limit = wsJsonSliceNumber(&fields[WS_FIELD_LIMIT]);
+    wsHistogramRecord(&shard->metrics.parse, wsMetricsNow() - start);
+
+    if (!wsHandleControl(shard, conn, flags, name, room, after > 0 ? (uint64_t)after : 0,
+                         limit > 0 ? (uint32_t)limit : 0)) {
+        wsJsonArenaReset(&shard->json);
+        return WS_OK;
+    }
+
+    wsJsonEdit edits[3];
+    int32_t editCount = 0;
+
+    // Update the name field with the server-side username
+    const wsJsonSlice* nameField = &fields[WS_FIELD_NAME];
+    const char* username = wsConnUsername(conn);
+    int32_t quotedLen = wsJsonQuote(username, NULL, 0);
+    char* quoted = wsJsonArenaAlloc(&shard->json, quotedLen + 1);
+    if (nameField->data && quoted) {
+        wsJsonQuote(username, quoted, quotedLen + 1);
+        wsAddEdit(edits, &editCount, (wsJsonEdit){ nameField->data, nameField->len, quoted, quotedLen });
+    }
+
+    // Clear the info flags for broadcast
+    const wsJsonSlice* infoField = &fields[WS_FIELD_INFO];
+    if (infoField->data) wsAddEdit(edits, &editCount, (wsJsonEdit){ infoField->data, infoField->len, "0", 1 });
+
+    // Clients pass the last sequence number they saw to resume after a reconnect.
+    // A "seq" the client sent is overwritten, the scan made sure there is one at most.
+    uint64_t seq = atomic_fetch_add_explicit(&shard->server->nextSeq, 1, memory_order_relaxed) + 1;
+    const wsJsonSlice* root = &fields[WS_FIELD_ROOT];
+    const wsJsonSlice* seqSlice = &fields[WS_FIELD_SEQ];
+    char seqField[32];
+    if (seqSlice->data) {
+        int32_t seqLen = snprintf(seqField, sizeof(seqField), "%llu", (unsigned long long)seq);
+        wsAddEdit(edits, &editCount, (wsJsonEdit){ seqSlice->data, seqSlice->len, seqField, seqLen });
+    } else {
+        const char* closing = root->data + root->len - 1;
+        const char* last = closing - 1;
+        while (*last == ' ' || *last == '\n' || *last == '\r' || *last == '\t') last--;
+        int32_t seqLen = snprintf(seqField, sizeof(seqField), "%s\"seq\": %llu", *last == '{' ? "" : ",",
+                                  (unsigned long long)seq);
+        wsAddEdit(edits, &editCount, (wsJsonEdit){ closing, 0, seqField, seqLen });
+    }
+
+    // Encoded once, every recipient on every shard shares this buffer
+    wsOutFrame* frame = wsBuildSplicedFrame(payload, root->data + root->len - payload, edits, editCount);
+    if (frame) {
+        if (atomic_load_explicit(&shard->server->binaryClients, memory_order_relaxed) > 0) {
+            size_t textLen = 0;
+            const char* text = wsJsonSliceString(&fields[WS_FIELD_TEXT], &shard->json, &textLen);
+            size_t userLen = strlen(username);
+            size_t roomLen = room ? strlen(room) : 0;
+            wsBinaryMessage binary = {
+                .seq = seq,
+                .user = username,
+                .room = room,
+                .text = text,
+                .userLen = (uint8_t)(userLen > UINT8_MAX ? UINT8_MAX : userLen),
+                .roomLen = (uint8_t)(roomLen > UINT8_MAX ? UINT8_MAX : roomLen),
+                .textLen = (uint32_t)textLen,
+            };
+            frame->alternate = wsBuildBinaryFrame(&binary);
+        }
+        wsDeflateFrame(shard, frame);
+        if (frame->alternate) wsDeflateFrame(shard, frame->alternate);
+        wsBroadcast(shard, conn, flags, room, seq, frame);
+        wsOutFrameRelease(frame);
+    }
+    // room, text and the quoted username live in the arena
+    wsJsonArenaReset(&shard->json);
+    return WS_OK;
+}
+
+// Adds child to parent, a child that could not be added is freed and ret set
+// to WS_ERROR
+static void wsAddJsonField(wsJson* parent, wsJson* child, int32_t* ret) {
+    if (wsJsonAddField(parent, child) != WS_OK) {
+        if (child) wsJsonFree(child);
+        *ret = WS_ERROR;
+    }
+}
+
+// The JSON a text client would have sent for a binary message
+static wsOutFrame* wsBuildJsonFrame(const wsBinaryMessage* msg) {
+    int32_t ret = WS_OK;
+    wsJson* root = wsJsonInitChild(NULL);
+    wsJson* userObj = wsJsonInitChild("user");
+    wsAddJsonField(userObj, wsJsonInitStringN("name", msg->user, msg->userLen), &ret);
+    wsAddJsonField(root, userObj, &ret);
+
+    wsJson* message = wsJsonInitChild("message");
+    wsAddJsonField(message, wsJsonInitStringN("text", msg->text, msg->textLen), &ret);
+    wsAddJsonField(message, wsJsonInitNumber("text_len", (double)msg->textLen), &ret);
+    wsAddJsonField(message, wsJsonInitNumber("info", 0), &ret);
+    wsAddJsonField(root, message, &ret);
+
+    if (msg->roomLen) {
+        wsJson* roomObj = wsJsonInitChild("room");
+        wsAddJsonField(roomObj, wsJsonInitStringN("name", msg->room, msg->roomLen), &ret);
+        wsAddJsonField(root, roomObj, &ret);
+    }
+    wsAddJsonField(root, wsJsonInitNumber("seq", (double)msg->seq), &ret);
+    if (ret != WS_OK) {
+        WS_LOG(ERROR, "Failed to build the JSON for a binary message");
+        if (root) wsJsonFree(root);
+        return NULL;
+    }
+
+    // Sized first, then written straight behind the frame header
+    wsOutFrame* frame = NULL;
+    int32_t jsonLen = wsJsonToString(root, NULL, 0);
+    if (jsonLen >= 0) {
+        uint8_t header[WS_FRAME_MAX_HEADER];
+        int32_t headerLen = wsFrameWriteHeader(header, WS_OPCODE_TEXT, true, jsonLen, NULL);
+        frame = wsOutFrameCreate(headerLen + jsonLen);
+        if (frame) {
+            memcpy(frame->data, header, headerLen);
+            wsJsonToString(root, (char*)frame->data + headerLen, jsonLen);
+        }
+    }
+    wsJsonFree(root);
+    return frame;
+}
+
+// Binary messages are routed from their fixed header, JSON is only built for
+// the clients that still read text
+static int32_t wsHandleBinary(wsShard* shard, wsConn* conn, const uint8_t* payload, size_t len) {
+    uint64_t start = wsMetricsNow();
+    wsBinaryMessage msg;
+    if (wsBinaryDecode(payload, len, &msg) != WS_OK) {
+        WS_LOG(WARN, "Failed to decode binary message, skipping...");
+        wsMetricsAdd(&shard->metrics.parseErrors, 1);
+        return WS_OK;
+    }
+    if (!conn->binary) {
+        conn->binary = true;
+        atomic_fetch_add_explicit(&shard->server->binaryClients, 1, memory_order_relaxed);
+    }
+
+    // The registry and rooms want C strings
+    char name[UINT8_MAX + 1];
+    char room[UINT8_MAX + 1];
+    memcpy(name, msg.user, msg.userLen);
+    name[msg.userLen] = '\0';
+    memcpy(room, msg.room, msg.roomLen);
+    room[msg.roomLen] = '\0';
+    wsHistogramRecord(&shard->metrics.parse, wsMetricsNow() - start);
+
+    // A replay request carries the last sequence number the client saw
+    uint64_t flags = msg.flags;
+    const char* roomName = msg.roomLen ? room : NULL;
+    if (!wsHandleControl(shard, conn, flags, msg.userLen ? name : NULL, roomName, msg.seq, 0)) return WS_OK;
+
+    const char* username = wsConnUsername(conn);
+    size_t userLen = strlen(username);
+    msg.user = username;
+    msg.userLen = (uint8_t)(userLen > UINT8_MAX ? UINT8_MAX : userLen);
+    msg.flags = 0;
+    msg.seq = atomic_fetch_add_explicit(&shard->server->nextSeq, 1, memory_order_relaxed) + 1;
+
+    wsOutFrame* frame = wsBuildBinaryFrame(&msg);
+    if (!frame) return WS_OK;
+    if (wsServerHasTextClients(shard->server)) frame->alternate = wsBuildJsonFrame(&msg);
+    wsDeflateFrame(shard, frame);
+    if (frame->alternate) wsDeflateFrame(shard, frame->alternate);
+    wsBroadcast(shard, conn, flags, roomName, msg.seq, frame);
+    wsOutFrameRelease(frame);
+    return WS_OK;
+}
+
+// Clients that reset their window share the shard's inflater
+static wsInflateStream* wsConnInflater(wsShard* shard, wsConn* conn) {
+    if (conn->deflateParams.clientNoContextTakeover) return shard->inflater;
+    if (!conn->inflater) {
+        uint8_t windowBits = conn->deflateParams.clientMaxWindowBits;
+        conn->inflater = wsInflateCreate(windowBits ? windowBits : WS_DEFLATE_MAX_WINDOW_BITS, true);
+    }
+    return conn->inflater;
+}
+
+// Inflates into the shard buffer and points the frame at the result, with one
+// spare byte behind it like a payload in the input buffer
+static int32_t wsInflateFrame(wsShard* shard, wsConn* conn, wsFrame* frame) {
+    wsInflateStream* inflater = wsConnInflater(shard, conn);
+    wsBuffer* out = &shard->inflated;
+    out->len = 0;
+    size_t maxMessage = shard->server->config.maxMessageSize;
+    if (!inflater || wsInflateMessage(inflater, frame->payload, frame->payloadLen, maxMessage, out) != WS_OK ||
+        wsBufferReserve(out, 1) != WS_OK) {
+        WS_LOG(WARN, "Failed to inflate message (fd=%d)", conn->fd);
+        wsMetricsAdd(&shard->metrics.parseErrors, 1);
+        return WS_ERROR;
+    }
+    frame->payload = out->data;
+    frame->payloadLen = out->len;
+    return WS_OK;
+}
+
+// A whole text or binary message, possibly put together from fragments
+static int32_t wsHandleData(wsShard* shard, wsConn* conn, wsFrame* frame) {
+    if (frame->rsv1 && wsInflateFrame(shard, conn, frame) != WS_OK) return WS_ERROR;
+    if (frame->payloadLen == 0) return WS_OK;
+    if (frame->opcode == WS_OPCODE_BINARY) return wsHandleBinary(shard, conn, frame->payload, frame->payloadLen);
+
+    // The byte after the payload belongs to the next frame, terminate in place
+    // for the debug log and put it back afterwards
+    uint8_t saved = frame->payload[frame->payloadLen];
+    frame->payload[frame->payloadLen] = '\0';
+    int32_t ret = wsHandleMessage(shard, conn, (const char*)frame->payload, frame->payloadLen);
+    frame->payload[frame->payloadLen] = saved;
+    return ret;
+}
+
+// Collects the frames of a fragmented message and handles it with the last one.
+// The buffer grows with the message and is dropped afterwards, so only clients
+// in the middle of one hold it.
+static int32_t wsHandleFragment(wsShard* shard, wsConn* conn, wsFrame* frame) {
+    bool first = frame->opcode != WS_OPCODE_CONTINUATION;
+    if (first == (conn->fragmentOpcode != 0)) {
+        WS_LOG(WARN, "Unexpected %s frame (fd=%d)", first ? "data" : "continuation", conn->fd);
+        return WS_ERROR;
+    }
+    if (first) {
+        conn->fragmentOpcode = frame->opcode;
+        conn->fragmentCompressed = frame->rsv1;
+    }
+
+    size_t maxMessage = shard->server->config.maxMessageSize;
+    if (frame->payloadLen > maxMessage - conn->fragments.len) {
+        WS_LOG(WARN, "Fragmented message over %zu bytes (fd=%d)", maxMessage, conn->fd);
+        return WS_ERROR;
+    }
+    if (wsBufferAppend(&conn->fragments, frame->payload, frame->payloadLen) != WS_OK) return WS_ERROR;
+    if (!frame->fin) return WS_OK;
+
+    // Keeps the spare byte a payload in the input buffer has
+    int32_t ret = wsBufferReserve(&conn->fragments, 1);
+    if (ret == WS_OK) {
+        wsFrame message = {
+            .opcode = conn->fragmentOpcode,
+            .fin = true,
+            .rsv1 = conn->fragmentCompressed,
+            .payload = conn->fragments.data,
+            .payloadLen = conn->fragments.len,
+        };
+        ret = wsHandleData(shard, conn, &message);
+    }
+    wsBufferFree(&conn->fragments);
+    conn->fragmentOpcode = 0;
+    return ret;
+}
+
+static int32_t wsHandleFrame(wsShard* shard, wsConn* conn, wsFrame* frame) {
+    // RFC 6455 5.1, the server fails the connection on an unmasked client frame
+    if (!frame->masked) {
+        WS_LOG(WARN, "Unmasked frame from client (fd=%d)", conn->fd);
+        static const uint8_t protocolError[2] = {1002 >> 8, 1002 & 0xff};
+        wsSendControl(shard, conn, WS_OPCODE_CLOSE, protocolError, sizeof(protocolError));
+        return WS_ERROR;
+    }
+    // RSV1 marks a compressed message on its first frame, control frames are never compressed
+    if (frame->rsv1 && (!conn->deflate || frame->opcode >= WS_OPCODE_CLOSE ||
+                        frame->opcode == WS_OPCODE_CONTINUATION)) {
+        WS_LOG(WARN, "Unexpected RSV1 on opcode 0x%x (fd=%d)", frame->opcode, conn->fd);
+        return WS_ERROR;
+    }
+    // Control frames may arrive between fragments but are never fragmented themselves
+    if (frame->opcode >= WS_OPCODE_CLOSE && (!frame->fin || frame->payloadLen > 125)) {
+        WS_LOG(WARN, "Invalid control frame 0x%x (fd=%d)", frame->opcode, conn->fd);
+        return WS_ERROR;
+    }
+
+    switch (frame->opcode) {
+        case WS_OPCODE_CLOSE:
+            wsSendControl(shard, conn, WS_OPCODE_CLOSE, frame->payload, frame->payloadLen >= 2 ? 2 : 0);
+            return WS_ERROR;
+        case WS_OPCODE_PING:
+            return wsSendControl(shard, conn, WS_OPCODE_PONG, frame->payload, frame->payloadLen);
+        case WS_OPCODE_PONG:
+            return WS_OK;
+        case WS_OPCODE_TEXT:
+        case WS_OPCODE_BINARY:
+        case WS_OPCODE_CONTINUATION:
+            conn->lastMessage = shard->now;
+            break;
+        default:
+            WS_LOG(WARN, "Ignoring frame with opcode 0x%x (fd=%d)", frame->opcode, conn->fd);
+            return WS_OK;
+    }
+    if (frame->fin && frame->opcode != WS_OPCODE_CONTINUATION && !conn->fragmentOpcode) {
+        return wsHandleData(shard, conn, frame);
+    }
+    return wsHandleFragment(shard, conn, frame);
+}
+
+// Pays for one frame, a message counts with its last one. A client that overdrew
+// either bucket is not read from until the debt is paid off, its input waits in
+// the socket instead of being dropped.
+static void wsConnCharge(wsShard* shard, wsConn* conn, const wsFrame* frame, uint64_t frameLen) {
+    const wsServerConfig* config = &shard->server->config;
+    uint32_t wait = wsTokenBucketCharge(&conn->messageBucket, &config->messageRate, frame->fin ? 1 : 0, shard->now);
+    uint32_t byteWait = wsTokenBucketCharge(&conn->byteBucket, &config->byteRate, frameLen, shard->now);
+    if (byteWait > wait) wait = byteWait;
+    if (wait == 0) return;
+
+    if (!conn->throttled) {
+        WS_LOG(INFO, "Throttling client for %ums (fd=%d)", wait, conn->fd);
+    }
+    conn->throttled = true;
+    conn->resumeAt = shard->now + wait;
+    wsConnArmTimer(shard, conn);
+#ifdef WS_ENABLE_IO_URING
+    if (shard->uring) wsUringCancelRecv(shard, conn);
+#endif
+}
+
+// Answers GET /metrics with the sum over every shard. The other shards keep
+// counting meanwhile, the response is not a consistent snapshot across counters.
+static void wsServeMetrics(wsShard* shard, wsConn* conn) {
+    wsServer* server = shard->server;
+    wsMetrics* total = calloc(1, sizeof(wsMetrics));
+    wsBuffer body = {0};
+    if (!total) return;
+
+    for (int32_t s = 0; s < server->shardCount; s++) {
+        wsMetricsMerge(total, &server->shards[s].metrics);
+    }
+    int32_t connections = atomic_load_explicit(&server->clientCount, memory_order_relaxed);
+    if (wsMetricsFormat(total, connections, &body) == WS_OK) {
+        char header[160];
+        int len = snprintf(header, sizeof(header),
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %zu\r\n"
+                           "Connection: close\r\n\r\n", body.len);
+        wsOutFrame* frame = wsOutFrameCreate(len + body.len);
+        if (frame) {
+            memcpy(frame->data, header, len);
+            memcpy(frame->data + len, body.data, body.len);
+            wsConnSend(shard, conn, frame);
+            wsOutFrameRelease(frame);
+        }
+    }
+    wsBufferFree(&body);
+    free(total);
+}
+
+// Handles everything complete at the start of data. data must have one spare
+// byte past len. Returns the number of bytes consumed or WS_ERROR to drop the client.
+static int64_t wsProcessInput(wsShard* shard, wsConn* conn, uint8_t* data, size_t len) {
+    size_t used = 0;
+
+    // Frames sent right behind the request wait until the response went out
+    if (conn->handshakeQueued) return 0;
+    // Anything after a plain HTTP request is ignored
+    if (conn->closeAfterFlush) return len;
+
+    if (!conn->handshakeDone) {
+        // Only the bytes that arrived since the last call are scanned, a partial
+        // request stays at the start of the input until it is complete
+        int64_t requestLen = wsHttpUpgradeParse(&conn->http, data, len, WS_MAX_HANDSHAKE_SIZE);
+        if (requestLen == WS_HTTP_INCOMPLETE) return 0;
+        if (requestLen == WS_ERROR) {
+            wsRejectHandshake(shard, conn, conn->http.status);
+            return WS_ERROR;
+        }
+        if (conn->http.metrics) {
+            // Closed right away if the whole response went out, otherwise once it is flushed
+            wsServeMetrics(shard, conn);
+            if (conn->out.bytes == 0) return WS_ERROR;
+            conn->closeAfterFlush = true;
+            return len;
+        }
+
+        wsQueueHandshake(shard, conn, data);
+        return requestLen;
+    }
+
+    // A single read may hold many frames, a partial one stays for the next read
+    while (used < len && !conn->closing && !conn->throttled) {
+        wsFrame frame;
+        int64_t frameLen = wsFrameParse(data + used, len - used, shard->server->config.maxMessageSize, &frame);
+        if (frameLen == WS_ERROR) {
+            wsMetricsAdd(&shard->metrics.parseErrors, 1);
+            return WS_ERROR;
+        }
+        if (frameLen == WS_FRAME_INCOMPLETE) break;
+
+        used += frameLen;
+        wsMetricsAdd(&shard->metrics.framesIn, 1);
+        if (wsHandleFrame(shard, conn, &frame) != WS_OK) return WS_ERROR;
+        wsConnCharge(shard, conn, &frame, frameLen);
+    }
+    return used;
+}
+
+// Parses len freshly read bytes. With carried over input the read already went
+// to the end of conn->in, otherwise data is a transient buffer with one spare
+// byte and only an unfinished tail is copied out of it.
+static void wsConsumeRead(wsShard* shard, wsConn* conn, uint8_t* data, size_t len, bool pending) {
+    // Any bytes answer an outstanding ping, a pong is not needed for that
+    conn->lastRecv = shard->now;
+    conn->awaitingPong = false;
+
+    shard->readNs = wsMetricsNow();
+    wsMetricsAdd(&shard->metrics.bytesIn, len);
+    if (!conn->handshakeDone && !conn->requestNs) conn->requestNs = shard->readNs;
+
+    if (pending) {
+        conn->in.len += len;
+        data = conn->in.data;
+        len = conn->in.len;
+    }
+
+    int64_t used = wsProcessInput(shard, conn, data, len);
+    if (used < 0) {
+        wsConnFail(shard, conn);
+        return;
+    }
+
+    if (pending) {
+        wsBufferConsume(&conn->in, used);
+        if (conn->in.len == 0) wsBufferFree(&conn->in);
+    }
+    else if ((size_t)used < len) {
+        if (wsBufferAppend(&conn->in, data + used, len - used) != WS_OK) {
+            wsConnFail(shard, conn);
+        }
+    }
+}
+
+// Answers every upgrade request of this loop iteration. A reconnect storm
+// completes many handshakes per iteration and the SIMD hashing works on batches.
+static void wsFinishHandshakes(wsShard* shard) {
+    while (shard->handshakeList) {
+        wsConn* batch[WS_HANDSHAKE_BATCH];
+        const uint8_t* keys[WS_HANDSHAKE_BATCH];
+        char accept[WS_HANDSHAKE_BATCH][WS_ACCEPT_LEN];
+
+        int32_t count = 0;
+        while (shard->handshakeList && count < WS_HANDSHAKE_BATCH) {
+            wsConn* conn = shard->handshakeList;
+            shard->handshakeList = conn->handshakeNext;
+            conn->handshakeQueued = false;
+            if (conn->closing) continue;
+
+            batch[count] = conn;
+            keys[count] = conn->handshakeKey;
+            count++;
+        }
+        if (count == 0) break;
+
+        wsAcceptCompute(keys, accept, count);
+
+        for (int32_t i = 0; i < count; i++) {
+            wsConn* conn = batch[i];
+            if (wsCompleteHandshake(shard, conn, accept[i]) != WS_OK) {
+                wsConnFail(shard, conn);
+                continue;
+            }
+            // Frames that arrived together with the request
+            if (conn->in.len > 0) wsConsumeRead(shard, conn, conn->in.data + conn->in.len, 0, true);
+        }
+    }
+}
+
+// Edge triggered: keep reading until the socket is drained
+static void wsHandleReadable(wsShard* shard, wsConn* conn) {
+    while (!conn->closing && !conn->throttled) {
+        // Without carried over bytes the read goes into the shard scratch buffer,
+        // so idle clients hold no input memory at all
+        bool pending = conn->in.len > 0;
+        uint8_t* dst = shard->scratch;
+        size_t room = WS_READ_CHUNK;
+
+        if (pending) {
+            if (wsBufferReserve(&conn->in, WS_READ_CHUNK + 1) != WS_OK) {
+                wsConnFail(shard, conn);
+                return;
+            }
+            dst = conn->in.data + conn->in.len;
+            room = conn->in.capacity - conn->in.len - 1;
+        }
+
+        ssize_t n = recv(conn->fd, dst, room, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            wsConnFail(shard, conn);
+            return;
+        }
+        if (n == 0) {
+            wsConnFail(shard, conn);
+            return;
+        }
+
+        wsConsumeRead(shard, conn, shard->scratch, n, pending);
+    }
+}
+
+#ifdef WS_ENABLE_IO_URING
+static void wsUringArmAccept(wsShard* shard) {
+    struct io_uring_sqe* sqe = wsUringGetSqe(shard->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = shard->listenFd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = wsUringTag(NULL, WS_URING_ACCEPT);
+    shard->acceptArmed = true;
+}
+
+static void wsUringArmWake(wsShard* shard) {
+    struct io_uring_sqe* sqe = wsUringGetSqe(shard->uring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = shard->wakeFd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = wsUringTag(NULL, WS_URING_WAKE);
+}
+
+// Multishot recv, every completion picks a buffer from the shard's buffer ring
+static void wsUringArmRecv(wsShard* shard, wsConn* conn) {
+    struct io_uring_sqe* sqe = wsUringGetSqe(shard->uring);
+    if (!sqe) {
+        wsConnFail(shard, conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = shard->recvBufs.groupId;
+    sqe->user_data = wsUringTag(conn, WS_URING_RECV);
+    conn->pending++;
+}
+
+static void wsUringHandleAccept(wsShard* shard, struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        wsConn* conn = wsNewConn(shard, cqe->res);
+        // During a handoff the recv is armed by whichever process keeps the client
+        if (conn && shard->stopping) conn->recvPaused = true;
+        else if (conn) wsUringArmRecv(shard, conn);
+    }
+    else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED && cqe->res != -ECANCELED) {
+        WS_LOG(ERROR, "accept failed: %s", strerror(-cqe->res));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        shard->acceptArmed = false;
+        if (!shard->stopping) wsUringArmAccept(shard);
+    }
+}
+
+static void wsUringHandleRecv(wsShard* shard, wsConn* conn, struct io_uring_cqe* cqe) {
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t* data = wsUringBufAt(&shard->recvBufs, id);
+        size_t len = cqe->res;
+        bool pending = conn->in.len > 0;
+
+        if (!conn->closing && pending) {
+            if (wsBufferReserve(&conn->in, len + 1) == WS_OK) {
+                memcpy(conn->in.data + conn->in.len, data, len);
+            }
+            else {
+                wsConnFail(shard, conn);
+            }
+        }
+        // Unlike the epoll path the data already sits in a kernel picked buffer,
+        // it goes back to the ring right after parsing
+        if (!conn->closing) wsConsumeRead(shard, conn, data, len, pending);
+        wsUringBufRecycle(&shard->recvBufs, id);
+    }
+    else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        // 0 is EOF, ENOBUFS only means the buffer ring ran dry and the recv is re-armed,
+        // ECANCELED is a rate limit pause
+        wsConnFail(shard, conn);
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        if (conn->throttled || shard->stopping) conn->recvPaused = true;
+        else if (!conn->closing) wsUringArmRecv(shard, conn);
+        wsUringConnDone(shard, conn);
+    }
+}
+
+static void wsUringHandleSend(wsShard* shard, wsConn* conn, struct io_uring_cqe* cqe) {
+    wsOutQueue* q = &conn->out;
+    uint32_t sent = q->pinned;
+    q->pinned = 0;
+
+    if (!conn->closing) {
+        size_t expected = 0;
+        for (uint32_t i = 0; i < sent; i++) {
+            expected += wsOutQueueAt(q, i)->len;
+        }
+        expected -= q->headSent;
+
+        if (shard->stopping && (cqe->res == -ECANCELED || (cqe->res >= 0 && (size_t)cqe->res < expected))) {
+            // Cut short by a handoff, the queue keeps the rest for whichever process goes on
+            if (cqe->res > 0) wsOutQueueRetire(q, cqe->res);
+            wsUringScheduleSend(shard, conn);
+        }
+        else if (cqe->res < 0 || (size_t)cqe->res != expected) {
+            WS_LOG(WARN, "Failed to send to client (fd=%d), will be disconnected", conn->fd);
+            wsMetricsAdd(&shard->metrics.sendErrors, 1);
+            wsConnFail(shard, conn);
+        }
+        else {
+            for (uint32_t i = 0; i < sent; i++) {
+                wsOutQueuePopSent(q);
+            }
+            if (q->frames.count) wsUringScheduleSend(shard, conn);
+            else if (conn->closeAfterFlush) wsConnFail(shard, conn);
+            wsConnUpdateSlow(shard, conn);
+        }
+    }
+    wsUringConnDone(shard, conn);
+}
+
+// Cancels the accept and every request of every connection for a handoff. A
+// recv that ends is not armed again, a send that is cut short keeps the rest.
+static void wsUringStopInput(wsShard* shard) {
+    struct io_uring_sqe* sqe = wsUringGetSqe(shard->uring);
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = wsUringTag(NULL, WS_URING_ACCEPT);
+        sqe->user_data = wsUringTag(NULL, WS_URING_CANCEL);
+    }
+    for (int32_t fd = 0; fd < shard->registry.slotCount; fd++) {
+        wsConn* conn = shard->registry.slots[fd].conn;
+        if (conn && conn->pending > 0 && !conn->shutdown) wsUringCancelConn(shard, conn);
+    }
+}
+
+// A completion that is still on its way could carry data or a new client
+static bool wsUringBusy(wsShard* shard) {
+    if (shard->acceptArmed) return true;
+    for (int32_t fd = 0; fd < shard->registry.slotCount; fd++) {
+        wsConn* conn = shard->registry.slots[fd].conn;
+        if (conn && conn->pending > 0) return true;
+    }
+    return false;
+}
+
+#endif
+
+// The pause is over: parse what was left unread, then go back to the socket
+static void wsConnResume(wsShard* shard, wsConn* conn) {
+    conn->throttled = false;
+    if (conn->in.len > 0) wsConsumeRead(shard, conn, conn->in.data + conn->in.len, 0, true);
+    if (conn->throttled || conn->closing) return;
 
-#include "../../lib/ws_defines.h"
+#ifdef WS_ENABLE_IO_URING
+    if (shard->uring) {
+        if (conn->recvPaused) {
+            conn->recvPaused = false;
+            wsUringArmRecv(shard, conn);
+        }
+        return;
+    }
+#endif
+    // Edge triggered, whatever arrived during the pause raised no new event
+    wsHandleReadable(shard, conn);
+}
 
-#define MAX_CLIENTS 10
+// Runs when a connection's deadline came up: an unfinished handshake, the end
+// of a rate limit pause, a heartbeat that is due or unanswered, or an idle client
+static void wsConnTimeout(wsTimer* timer, void* ctx) {
+    wsShard* shard = ctx;
+    wsConn* conn = (wsConn*)((char*)timer - offsetof(wsConn, timer));
+    const wsServerConfig* config = &shard->server->config;
+    uint64_t now = shard->now;
+    if (conn->closing) return;
 
-int32_t getClientIndex(wsClient* clients, int32_t i) {
-    int32_t ret = -1;
-    for (int32_t j = 0; j < MAX_CLIENTS; j++) {
-        if (clients[j].id == i) {
-            ret = j;
-            break;
+    if (!conn->handshakeDone) {
+        // A complete request is answered at the end of this iteration, which re-arms the timer
+        if (conn->handshakeQueued) return;
+        WS_LOG(INFO, "Handshake timed out (fd=%d)", conn->fd);
+        wsConnFail(shard, conn);
+        return;
+    }
+
+    // A handoff leaves the pause to whichever process keeps the client
+    if (conn->throttled && now >= conn->resumeAt && !shard->stopping) {
+        wsConnResume(shard, conn);
+        if (conn->closing) return;
+    }
+
+    if (config->idleTimeoutMs && now >= conn->lastMessage + config->idleTimeoutMs) {
+        WS_LOG(INFO, "Closing idle client (fd=%d)", conn->fd);
+        static const uint8_t goingAway[2] = {1001 >> 8, 1001 & 0xff};
+        wsSendControl(shard, conn, WS_OPCODE_CLOSE, goingAway, sizeof(goingAway));
+        wsConnFail(shard, conn);
+        return;
+    }
+
+    if (conn->awaitingPong) {
+        if (now >= conn->pingSent + config->pongTimeoutMs) {
+            WS_LOG(INFO, "No pong within %ums (fd=%d)", config->pongTimeoutMs, conn->fd);
+            wsConnFail(shard, conn);
+            return;
         }
     }
-    return ret;
+    else if (config->pingIntervalMs && now >= conn->lastRecv + config->pingIntervalMs) {
+        if (wsSendControl(shard, conn, WS_OPCODE_PING, NULL, 0) != WS_OK) return;
+        conn->awaitingPong = true;
+        conn->pingSent = now;
+    }
+    wsConnArmTimer(shard, conn);
 }
 
-int main(int argc, char *argv[]) {
-    signal(SIGPIPE, SIG_IGN);
+// The handoff failed and the shard goes on: it takes the clients that queued
+// up meanwhile and reads what arrived while it was parked
+static void wsShardResume(wsShard* shard) {
+#ifdef WS_ENABLE_IO_URING
+    if (shard->uring) {
+        wsUringArmAccept(shard);
+        for (int32_t fd = 0; fd < shard->registry.slotCount; fd++) {
+            wsConn* conn = shard->registry.slots[fd].conn;
+            if (!conn || !conn->recvPaused || conn->throttled || conn->closing) continue;
+            conn->recvPaused = false;
+            wsUringArmRecv(shard, conn);
+        }
+        return;
+    }
+#endif
+    // Edge triggered, nothing that arrived while the shard stood still raised an event
+    wsAcceptClients(shard);
+    for (int32_t fd = 0; fd < shard->registry.slotCount; fd++) {
+        wsConn* conn = shard->registry.slots[fd].conn;
+        if (conn && !conn->closing) wsHandleReadable(shard, conn);
+    }
+}
+
+// The shard side of a handoff, runs at the end of a loop iteration once it was
+// requested. The shard stops reading and accepting, waits until every other
+// shard did too and delivers what they forwarded up to then. Parked, its
+// clients can be handed over without anyone touching them.
+static void wsShardHandoff(wsShard* shard) {
+    wsServer* server = shard->server;
+    wsHandoffControl* handoff = &server->handoff;
 
-    wsClient clients[MAX_CLIENTS] = {0};
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        clients[i].id = -1;
+    if (!shard->stopping) {
+        shard->stopping = true;
+#ifdef WS_ENABLE_IO_URING
+        if (shard->uring) wsUringStopInput(shard);
+#endif
     }
+#ifdef WS_ENABLE_IO_URING
+    // The cancelled requests complete first, a recv may still bring data
+    if (shard->uring && wsUringBusy(shard)) return;
+#endif
 
-    char *host = "0.0.0.0";
+    pthread_mutex_lock(&handoff->lock);
+    handoff->paused++;
+    pthread_cond_broadcast(&handoff->cond);
+    while (handoff->paused < server->shardCount) pthread_cond_wait(&handoff->cond, &handoff->lock);
+    pthread_mutex_unlock(&handoff->lock);
 
-    for (int i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
-            host = argv[i + 1];
-            i++;
+    // Nobody reads anymore, nothing is forwarded after this
+    wsDrainInbound(shard);
+    wsReapClosed(shard);
+
+    pthread_mutex_lock(&handoff->lock);
+    handoff->parked++;
+    pthread_cond_broadcast(&handoff->cond);
+    while (atomic_load_explicit(&handoff->stopping, memory_order_acquire)) {
+        pthread_cond_wait(&handoff->cond, &handoff->lock);
+    }
+    pthread_mutex_unlock(&handoff->lock);
+
+    shard->stopping = false;
+    shard->now = wsTimerNow();
+    wsShardResume(shard);
+}
+
+#ifdef WS_ENABLE_IO_URING
+static void* wsShardRunUring(wsShard* shard) {
+    wsUring* ring = shard->uring;
+    wsUringArmAccept(shard);
+    wsUringArmWake(shard);
+    // Clients taken over from the previous process may have output waiting
+    wsUringFlushSends(shard);
+
+    for (;;) {
+        // Everything prepared since the last wait goes to the kernel in one call,
+        // a broadcast to N clients costs one syscall instead of N sends
+        int32_t timeout = wsTimerWaitMs(&shard->timers, shard->now);
+        if (wsUringSubmitWait(ring, 1, timeout) < 0 && errno != EINTR && errno != EBUSY) {
+            WS_LOG(ERROR, "io_uring_enter failed: %s", strerror(errno));
+            break;
+        }
+        shard->now = wsTimerNow();
+        wsLoggerTick();
+        if (wsUringUnsubmitted(ring) == 0) shard->sendMsgsUsed = 0;
+
+        struct io_uring_cqe cqe;
+        while (wsUringPopCqe(ring, &cqe)) {
+            wsConn* conn = (wsConn*)(uintptr_t)(cqe.user_data & ~WS_URING_OP_MASK);
+            switch (cqe.user_data & WS_URING_OP_MASK) {
+                case WS_URING_ACCEPT:
+                    wsUringHandleAccept(shard, &cqe);
+                    break;
+                case WS_URING_WAKE:
+                    wsDrainInbound(shard);
+                    if (!(cqe.flags & IORING_CQE_F_MORE)) wsUringArmWake(shard);
+                    break;
+                case WS_URING_RECV:
+                    wsUringHandleRecv(shard, conn, &cqe);
+                    // One read can fan out to every client, hand the sends over now
+                    // instead of letting queues grow behind a long completion batch
+                    if (shard->flushList && !shard->stopping) {
+                        wsUringFlushSends(shard);
+                        wsUringSubmit(ring, 0);
+                        if (wsUringUnsubmitted(ring) == 0) shard->sendMsgsUsed = 0;
+                    }
+                    break;
+                case WS_URING_SEND:
+                    wsUringHandleSend(shard, conn, &cqe);
+                    break;
+                case WS_URING_CANCEL:
+                    break;
+            }
         }
+
+        // Before reaping, the lists must not hold connections that are about to be freed
+        wsTimerAdvance(&shard->timers, shard->now, wsConnTimeout, shard);
+        wsFinishHandshakes(shard);
+        if (!shard->stopping) wsUringFlushSends(shard);
+        wsReapClosed(shard);
+        if (atomic_load_explicit(&shard->server->handoff.stopping, memory_order_acquire)) wsShardHandoff(shard);
     }
 
-    struct addrinfo hints = {0}; 
-    struct addrinfo *result;       
-    hints.ai_family = AF_INET;     
-    hints.ai_socktype = SOCK_STREAM; 
-    hints.ai_flags = AI_PASSIVE;   
+    return NULL;
+}
+#endif
 
-    if (getaddrinfo(host, "9999", &hints, &result) != 0) {
-        fprintf(stderr, "Failed to resolve host: %s\n", host);
-        return 1;
+static void* wsShardRun(void* arg) {
+    wsShard* shard = arg;
+    struct epoll_event events[WS_MAX_EVENTS];
+
+#ifdef WS_ENABLE_IO_URING
+    if (shard->uring) return wsShardRunUring(shard);
+#endif
+
+    for (;;) {
+        int n = epoll_wait(shard->epollFd, events, WS_MAX_EVENTS, wsTimerWaitMs(&shard->timers, shard->now));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            WS_LOG(ERROR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        shard->now = wsTimerNow();
+        wsLoggerTick();
+
+        // Only the sockets that are ready are touched
+        for (int i = 0; i < n; i++) {
+            wsEventSource* source = events[i].data.ptr;
+            switch (source->type) {
+                case WS_EVENT_LISTENER:
+                    // During a handoff new clients wait in the backlog for the next process
+                    if (!shard->stopping) wsAcceptClients(shard);
+                    break;
+                case WS_EVENT_WAKE:
+                    wsDrainInbound(shard);
+                    break;
+                case WS_EVENT_CONN: {
+                    wsConn* conn = (wsConn*)source;
+                    if ((events[i].events & EPOLLERR) && conn->out.zerocopy.count) {
+                        wsOutQueueReapZerocopy(&conn->out, conn->fd);
+                    }
+                    if (events[i].events & EPOLLOUT) {
+                        wsHandleWritable(shard, conn);
+                    }
+                    if (!shard->stopping && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+                        wsHandleReadable(shard, conn);
+                    }
+                    break;
+                }
+            }
+        }
+
+        wsTimerAdvance(&shard->timers, shard->now, wsConnTimeout, shard);
+        wsFinishHandshakes(shard);
+        wsReapClosed(shard);
+        if (atomic_load_explicit(&shard->server->handoff.stopping, memory_order_acquire)) wsShardHandoff(shard);
+    }
+
+    return NULL;
+}
+
+// Every shard binds its own listener, the kernel spreads new connections over them
+static int32_t wsOpenListener(const wsServerConfig* config) {
+    struct addrinfo hints = {0};
+    struct addrinfo *result;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if (getaddrinfo(config->host, config->port, &hints, &result) != 0) {
+        WS_LOG(ERROR, "Failed to resolve host: %s", config->host);
+        return WS_ERROR;
     }
 
-    int server_fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    int server_fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, result->ai_protocol);
     if (server_fd < 0) {
-        perror("socket failed");
+        WS_LOG(ERROR, "socket failed: %s", strerror(errno));
         freeaddrinfo(result);
-        return 1;
+        return WS_ERROR;
     }
 
     int opt = 1;
     setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        WS_LOG(ERROR, "SO_REUSEPORT failed: %s", strerror(errno));
+    }
 
     if (bind(server_fd, result->ai_addr, result->ai_addrlen) < 0) {
-        perror("bind failed");
+        WS_LOG(ERROR, "bind failed: %s", strerror(errno));
         close(server_fd);
         freeaddrinfo(result);
-        return 1;
+        return WS_ERROR;
     }
 
     freeaddrinfo(result);
 
-    listen(server_fd, 10);
+    if (listen(server_fd, SOMAXCONN) < 0) {
+        WS_LOG(ERROR, "listen failed: %s", strerror(errno));
+        close(server_fd);
+        return WS_ERROR;
+    }
+    return server_fd;
+}
+
+#ifdef WS_ENABLE_IO_URING
+static int32_t wsShardInitUring(wsShard* shard) {
+    wsUring* ring = calloc(1, sizeof(wsUring));
+    if (!ring) return WS_ERROR;
+
+    if (wsUringInit(ring, WS_URING_ENTRIES) != WS_OK) {
+        free(ring);
+        return WS_ERROR;
+    }
+
+    shard->sendMsgs = calloc(WS_URING_SEND_SLOTS, sizeof(wsUringSendMsg));
+    if (!shard->sendMsgs) {
+        wsUringFree(ring);
+        free(ring);
+        return WS_ERROR;
+    }
+
+    // One spare byte per buffer so payloads can be terminated in place
+    if (wsUringBufRingInit(ring, &shard->recvBufs, 0, WS_URING_RECV_BUFFERS, WS_READ_CHUNK, 1) != WS_OK) {
+        free(shard->sendMsgs);
+        shard->sendMsgs = NULL;
+        wsUringFree(ring);
+        free(ring);
+        return WS_ERROR;
+    }
+
+    // io_uring waits for blocking sockets itself, accepted clients inherit nothing
+    // from the listener and are accepted without SOCK_NONBLOCK
+    int flags = fcntl(shard->listenFd, F_GETFL);
+    if (flags >= 0) fcntl(shard->listenFd, F_SETFL, flags & ~O_NONBLOCK);
+
+    shard->uring = ring;
+    return WS_OK;
+}
+#endif
+
+// listenFd is a listener taken over from the previous process, -1 opens a new one
+static int32_t wsShardInit(wsShard* shard, wsServer* server, int32_t id, int32_t listenFd) {
+    shard->server = server;
+    shard->id = id;
+    shard->listenSource.type = WS_EVENT_LISTENER;
+    shard->wakeSource.type = WS_EVENT_WAKE;
+    wsMpscInit(&shard->inbound);
+    atomic_init(&shard->wakePending, false);
+    if (wsRegistryInit(&shard->registry, id) != WS_OK) return WS_ERROR;
+    if (wsRoomIndexInit(&shard->rooms) != WS_OK) return WS_ERROR;
+    if (wsHistoryInit(&shard->history, server->config.historySize) != WS_OK) return WS_ERROR;
+    shard->now = wsTimerNow();
+    wsTimerWheelInit(&shard->timers, shard->now);
+
+    // One spare byte so payloads can be terminated in place
+    shard->scratch = malloc(WS_READ_CHUNK + 1);
+    if (!shard->scratch) return WS_ERROR;
+    wsJsonArenaInit(&shard->json);
+
+    if (server->config.deflateWindowBits) {
+        shard->deflater = wsDeflateCreate(server->config.deflateWindowBits, false);
+        shard->inflater = wsInflateCreate(WS_DEFLATE_MAX_WINDOW_BITS, false);
+        if (!shard->deflater || !shard->inflater) return WS_ERROR;
+    }
+
+    if (listenFd >= 0) {
+        // The previous process may have run io_uring with a blocking listener
+        int flags = fcntl(listenFd, F_GETFL);
+        if (flags >= 0) fcntl(listenFd, F_SETFL, flags | O_NONBLOCK);
+        shard->listenFd = listenFd;
+    } else {
+        shard->listenFd = wsOpenListener(&server->config);
+        if (shard->listenFd < 0) return WS_ERROR;
+    }
+
+    shard->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->wakeFd < 0) {
+        WS_LOG(ERROR, "shard init failed: %s", strerror(errno));
+        return WS_ERROR;
+    }
+
+#ifdef WS_ENABLE_IO_URING
+    if (server->config.backend == WS_BACKEND_URING) {
+        if (wsShardInitUring(shard) == WS_OK) return WS_OK;
+        WS_LOG(WARN, "io_uring is not available, shard %d uses epoll", id);
+    }
+#endif
+
+    shard->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epollFd < 0) {
+        WS_LOG(ERROR, "shard init failed: %s", strerror(errno));
+        return WS_ERROR;
+    }
+
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &shard->listenSource;
+    if (epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, shard->listenFd, &ev) < 0) {
+        WS_LOG(ERROR, "epoll_ctl failed: %s", strerror(errno));
+        return WS_ERROR;
+    }
+
+    // Level triggered, the counter is read back on every wakeup
+    ev.events = EPOLLIN;
+    ev.data.ptr = &shard->wakeSource;
+    if (epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, shard->wakeFd, &ev) < 0) {
+        WS_LOG(ERROR, "epoll_ctl failed: %s", strerror(errno));
+        return WS_ERROR;
+    }
+    return WS_OK;
+}
+
+// Puts a message read back from the log into the history of every shard
+static void wsRecoverMessage(void* ctx, uint64_t seq, const char* room, const uint8_t* data, uint32_t len) {
+    wsServer* server = ctx;
+    wsOutFrame* frame = wsOutFrameFromBytes(data, len);
+    if (!frame) return;
+    for (int32_t s = 0; s < server->shardCount; s++) {
+        wsHistoryAppend(&server->shards[s].history, room, seq, frame);
+    }
+    wsOutFrameRelease(frame);
+
+    if (seq > atomic_load_explicit(&server->nextSeq, memory_order_relaxed)) {
+        atomic_store_explicit(&server->nextSeq, seq, memory_order_relaxed);
+    }
+}
+
+// Everything the next process needs to carry on with one client, see wsHandoffConn
+static int32_t wsHandOverConn(int32_t sock, wsConn* conn, wsBuffer* buf) {
+    wsOutQueue* q = &conn->out;
+    wsHandoffConn state = {
+        .handshakeDone = conn->handshakeDone,
+        .closeAfterFlush = conn->closeAfterFlush,
+        .binary = conn->binary,
+        .deflate = conn->deflate,
+        .fragmentCompressed = conn->fragmentCompressed,
+        .fragmentOpcode = conn->fragmentOpcode,
+        .deflateParams = conn->deflateParams,
+        .zerocopyNextId = q->zerocopyNextId,
+        .usernameLen = conn->username ? (uint32_t)strlen(conn->username) : 0,
+        .roomCount = (uint32_t)conn->roomCount,
+        .inLen = conn->in.len,
+        .fragmentsLen = conn->fragments.len,
+        .outLen = q->bytes,
+    };
+
+    buf->len = 0;
+    if (wsBufferReserve(buf, sizeof(state)) != WS_OK) return WS_ERROR;
+    buf->len = sizeof(state);
+    if (state.usernameLen && wsBufferAppend(buf, conn->username, state.usernameLen) != WS_OK) return WS_ERROR;
 
-    printf("WebSocket server listening on %s:9999\n", host);
-    fflush(stdout);
+    size_t roomsStart = buf->len;
+    for (int32_t r = 0; r < conn->roomCount; r++) {
+        const char* name = conn->rooms[r].room->name;
+        if (wsBufferAppend(buf, name, strlen(name) + 1) != WS_OK) return WS_ERROR;
+    }
+    state.roomsLen = (uint32_t)(buf->len - roomsStart);
+
+    if (conn->in.len && wsBufferAppend(buf, conn->in.data, conn->in.len) != WS_OK) return WS_ERROR;
+    if (conn->fragments.len && wsBufferAppend(buf, conn->fragments.data, conn->fragments.len) != WS_OK) {
+        return WS_ERROR;
+    }
+    // The head frame may be partly written already
+    for (uint32_t i = 0; i < q->frames.count; i++) {
+        wsOutFrame* frame = wsOutQueueAt(q, i);
+        size_t offset = i == 0 ? q->headSent : 0;
+        if (wsBufferAppend(buf, frame->data + offset, frame->len - offset) != WS_OK) return WS_ERROR;
+    }
+
+    if (conn->inflater) {
+        size_t windowStart = buf->len;
+        if (wsInflateGetWindow(conn->inflater, buf) != WS_OK) return WS_ERROR;
+        state.windowLen = buf->len - windowStart;
+    }
+
+    memcpy(buf->data, &state, sizeof(state));
+    return wsHandoffSend(sock, WS_HANDOFF_CONN, buf->data, buf->len, conn->fd);
+}
+
+typedef struct {
+    int32_t sock;
+    wsBuffer* buf;
+} wsHandoffSink;
+
+static int32_t wsHandOverHistory(void* ctx, uint64_t seq, const char* room, wsOutFrame* frame) {
+    wsHandoffSink* sink = ctx;
+    wsHandoffHistory entry = {
+        .seq = seq,
+        .roomLen = room ? (uint32_t)strlen(room) : 0,
+        .frameLen = (uint32_t)frame->len,
+    };
+
+    wsBuffer* buf = sink->buf;
+    buf->len = 0;
+    if (wsBufferAppend(buf, &entry, sizeof(entry)) != WS_OK) return WS_ERROR;
+    if (entry.roomLen && wsBufferAppend(buf, room, entry.roomLen) != WS_OK) return WS_ERROR;
+    if (wsBufferAppend(buf, frame->data, frame->len) != WS_OK) return WS_ERROR;
+    return wsHandoffSend(sink->sock, WS_HANDOFF_HISTORY, buf->data, buf->len, -1);
+}
+
+// Asks every shard to stop and waits until all of them are parked
+static void wsServerPark(wsServer* server) {
+    wsHandoffControl* handoff = &server->handoff;
+    atomic_store_explicit(&handoff->stopping, true, memory_order_release);
+    for (int32_t s = 0; s < server->shardCount; s++) {
+        wsShardWake(&server->shards[s]);
+    }
+
+    pthread_mutex_lock(&handoff->lock);
+    while (handoff->parked < server->shardCount) pthread_cond_wait(&handoff->cond, &handoff->lock);
+    pthread_mutex_unlock(&handoff->lock);
+}
 
-    struct pollfd fds[MAX_CLIENTS + 1];
-    int handshake_done[MAX_CLIENTS] = {0};
+static void wsServerUnpark(wsServer* server) {
+    wsHandoffControl* handoff = &server->handoff;
+    pthread_mutex_lock(&handoff->lock);
+    handoff->paused = 0;
+    handoff->parked = 0;
+    atomic_store_explicit(&handoff->stopping, false, memory_order_release);
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->lock);
+}
+
+// The old process side of a hot restart, see ws_handoff.h. Returns WS_OK once
+// the new process owns every client, this process only has to exit then.
+static int32_t wsHandOver(wsServer* server, int32_t sock) {
+    wsBuffer buf = {0};
+    int32_t fd;
+
+    wsHandoffHello hello = { .version = WS_HANDOFF_VERSION, .listeners = (uint32_t)server->shardCount };
+    int32_t ret = wsHandoffSend(sock, WS_HANDOFF_HELLO, &hello, sizeof(hello), -1);
+    for (int32_t s = 0; ret == WS_OK && s < server->shardCount; s++) {
+        ret = wsHandoffSend(sock, WS_HANDOFF_LISTENER, NULL, 0, server->shards[s].listenFd);
+    }
+    if (ret == WS_OK) ret = wsHandoffExpect(sock, WS_HANDOFF_READY, 0, &buf, &fd);
+    if (ret != WS_OK) {
+        WS_LOG(ERROR, "Handoff to the new process failed before it started: %s", strerror(errno));
+        wsBufferFree(&buf);
+        return WS_ERROR;
+    }
+
+    WS_LOG(INFO, "Handing over to the new process");
+    wsServerPark(server);
+    // The new process reads the log back as soon as it has the clients
+    if (server->log) wsLogFlush(server->log);
+
+    uint32_t conns = 0;
+    for (int32_t s = 0; ret == WS_OK && s < server->shardCount; s++) {
+        wsRegistry* registry = &server->shards[s].registry;
+        for (int32_t i = 0; ret == WS_OK && i < registry->slotCount; i++) {
+            wsConn* conn = registry->slots[i].conn;
+            // Failed clients go down with this process
+            if (!conn || conn->closing) continue;
+            ret = wsHandOverConn(sock, conn, &buf);
+            if (ret == WS_OK) conns++;
+        }
+    }
+
+    // Every shard holds every broadcast, without a log the history only lives here
+    if (ret == WS_OK && !server->log) {
+        wsHandoffSink sink = { .sock = sock, .buf = &buf };
+        ret = wsHistoryForEach(&server->shards[0].history, wsHandOverHistory, &sink);
+    }
+
+    wsHandoffEnd end = {
+        .nextSeq = atomic_load_explicit(&server->nextSeq, memory_order_relaxed),
+        .conns = conns,
+    };
+    if (ret == WS_OK) ret = wsHandoffSend(sock, WS_HANDOFF_END, &end, sizeof(end), -1);
+    if (ret == WS_OK) ret = wsHandoffExpect(sock, WS_HANDOFF_DONE, 0, &buf, &fd);
+    if (ret == WS_OK) ret = wsHandoffSend(sock, WS_HANDOFF_BYE, NULL, 0, -1);
+    wsBufferFree(&buf);
 
-    fds[0].fd = server_fd;     
-    fds[0].events = POLLIN;    
-    int nfds = 1;  
+    if (ret != WS_OK) {
+        WS_LOG(ERROR, "Handoff failed, keeping the clients: %s", strerror(errno));
+        wsServerUnpark(server);
+        return WS_ERROR;
+    }
+    WS_LOG(INFO, "Handed %u clients over to the new process", conns);
+    return WS_OK;
+}
 
+// Waits for the next process for as long as this one runs
+static void* wsHandoffRun(void* arg) {
+    wsServer* server = arg;
     for (;;) {
-        poll(fds, nfds, -1);
+        int32_t sock = wsHandoffAccept(server->handoff.listenFd);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            WS_LOG(ERROR, "Handoff accept failed: %s", strerror(errno));
+            return NULL;
+        }
+
+        int32_t ret = wsHandOver(server, sock);
+        close(sock);
+        // Our copies of the sockets close with us, the new process holds its own
+        if (ret == WS_OK) exit(0);
+    }
+}
 
-        if (fds[0].revents & POLLIN) {
-            int client_fd = accept(server_fd, NULL, NULL);
+// Sets up a client with the state the previous process sent. data points
+// behind the wsHandoffConn, a zeroed state is a client that just connected.
+static int32_t wsAdoptConn(wsShard* shard, int32_t fd, const wsHandoffConn* state, const uint8_t* data) {
+    // The previous process may have run the other backend, only epoll wants non-blocking sockets
+    bool blocking = false;
+#ifdef WS_ENABLE_IO_URING
+    blocking = shard->uring != NULL;
+#endif
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
 
-            if (client_fd >= 0 && nfds < MAX_CLIENTS + 1) {
-                int client_slot = -1;
-                for (int k = 0; k < MAX_CLIENTS; k++) {
-                    if (clients[k].id == -1) {
-                        client_slot = k;
-                        break;
-                    }
-                }
+    wsConn* conn = wsNewConn(shard, fd);
+    if (!conn) return WS_ERROR;
 
-                if (client_slot == -1) {
-                    printf("Max clients reached, rejecting connection\n");
-                    fflush(stdout);
-                    close(client_fd);
-                    continue;
-                }
+    conn->closeAfterFlush = state->closeAfterFlush;
+    conn->binary = state->binary;
+    conn->deflate = state->deflate;
+    conn->deflateParams = state->deflateParams;
+    conn->fragmentOpcode = state->fragmentOpcode;
+    conn->fragmentCompressed = state->fragmentCompressed;
+    conn->out.zerocopyFirstId = state->zerocopyNextId;
+    conn->out.zerocopyNextId = state->zerocopyNextId;
 
-                int keepalive = 1;   
-                int keepidle = 60;   
-                int keepintvl = 10; 
-                int keepcnt = 6;    
+    const uint8_t* p = data;
+    char* username = state->usernameLen ? strndup((const char*)p, state->usernameLen) : NULL;
+    p += state->usernameLen;
+    const char* rooms = (const char*)p;
+    p += state->roomsLen;
 
-                setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
-                setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
-                setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPINTVL, &keepintvl, sizeof(keepintvl));
-                setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPCNT, &keepcnt, sizeof(keepcnt));
+    // One spare byte for both buffers, payloads are terminated in place
+    bool ok = !state->usernameLen || username;
+    if (ok && state->inLen) {
+        ok = wsBufferAppend(&conn->in, p, state->inLen) == WS_OK && wsBufferReserve(&conn->in, 1) == WS_OK;
+    }
+    p += state->inLen;
+    if (ok && state->fragmentsLen) {
+        ok = wsBufferAppend(&conn->fragments, p, state->fragmentsLen) == WS_OK &&
+             wsBufferReserve(&conn->fragments, 1) == WS_OK;
+    }
+    p += state->fragmentsLen;
+    if (ok && state->outLen) {
+        wsOutFrame* frame = wsOutFrameFromBytes(p, state->outLen);
+        ok = frame && wsOutQueuePush(&conn->out, frame, 0) == WS_OK;
+        if (frame) wsOutFrameRelease(frame);
+    }
+    p += state->outLen;
+    if (ok && state->windowLen) {
+        uint8_t windowBits = conn->deflateParams.clientMaxWindowBits;
+        conn->inflater = wsInflateCreate(windowBits ? windowBits : WS_DEFLATE_MAX_WINDOW_BITS, true);
+        ok = conn->inflater && wsInflateSetWindow(conn->inflater, p, state->windowLen) == WS_OK;
+    }
 
-                clients[client_slot].id = client_fd; 
-                clients[client_slot].username = "Anonym\0";
+    if (ok && state->handshakeDone) {
+        ok = wsActivateConn(shard, conn) == WS_OK;
+        if (ok && username) ok = wsRegistrySetName(&shard->registry, conn, username) == WS_OK;
+        for (uint32_t r = 0; ok && r < state->roomCount; r++) {
+            ok = wsRoomJoin(&shard->rooms, conn, rooms) == WS_OK;
+            rooms += strlen(rooms) + 1;
+        }
+    }
+    free(username);
+    if (!ok) {
+        WS_LOG(ERROR, "Failed to take over client (fd=%d)", fd);
+        wsCloseConn(shard, conn);
+        return WS_ERROR;
+    }
 
-                fds[nfds].fd = client_fd;    
-                fds[nfds].events = POLLIN;  
-                handshake_done[nfds - 1] = 0;
-                nfds++;
+    if (conn->handshakeDone) {
+        if (conn->deflate) atomic_fetch_add_explicit(&shard->server->deflateClients, 1, memory_order_relaxed);
+        if (conn->binary) atomic_fetch_add_explicit(&shard->server->binaryClients, 1, memory_order_relaxed);
+        wsTokenBucketInit(&conn->messageBucket, &shard->server->config.messageRate, shard->now);
+        wsTokenBucketInit(&conn->byteBucket, &shard->server->config.byteRate, shard->now);
+        wsConnArmTimer(shard, conn);
+    }
 
-                printf("Client connected (fd=%d, slot=%d)\n", client_fd, client_slot);
-                fflush(stdout);
-            }
+#ifdef WS_ENABLE_IO_URING
+    if (shard->uring) {
+        wsUringArmRecv(shard, conn);
+        if (conn->out.bytes) wsUringScheduleSend(shard, conn);
+    } else
+#endif
+    {
+        struct epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(shard->epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            WS_LOG(ERROR, "epoll_ctl failed: %s", strerror(errno));
+            wsCloseConn(shard, conn);
+            return WS_ERROR;
         }
+    }
+    return WS_OK;
+}
 
-        // Check all client sockets for activity
-        for (int i = 1; i < nfds; i++) {
-            // Check if this client socket has incoming data
-            if (fds[i].revents & POLLIN) {
-                unsigned char buffer[WS_BUFFER_SIZE];
-                int len = recv(fds[i].fd, buffer, WS_BUFFER_SIZE - 1, 0);
+// Complete frames the previous process had not parsed yet, once the log is
+// open so that their messages are logged and numbered after the recovered
+// ones. A partial upgrade request is parsed again from the start with the next read.
+static void wsConsumeAdopted(wsShard* shard) {
+    for (int32_t i = 0; i < shard->registry.slotCount; i++) {
+        wsConn* conn = shard->registry.slots[i].conn;
+        if (conn && conn->handshakeDone && !conn->closing && conn->in.len > 0) {
+            wsConsumeRead(shard, conn, conn->in.data + conn->in.len, 0, true);
+        }
+    }
+}
 
-                if (len <= 0) {
-                    printf("Client disconnected (fd=%d)\n", fds[i].fd);
+// Checks that the lengths in the state add up to the message and that every room name ends
+static bool wsHandoffConnValid(const wsHandoffConn* state, const uint8_t* data, size_t len) {
+    uint64_t total = (uint64_t)state->usernameLen + state->roomsLen + state->inLen + state->fragmentsLen +
+                     state->outLen + state->windowLen;
+    if (total != len) return false;
 
-                    for (int k = 0; k < MAX_CLIENTS; k++) {
-                        if (clients[k].id == fds[i].fd) {
-                            clients[k].id = -1;
-                            break;
-                        }
-                    }
+    const uint8_t* rooms = data + state->usernameLen;
+    uint32_t names = 0;
+    for (uint32_t i = 0; i < state->roomsLen; i++) {
+        if (rooms[i] == 0) names++;
+    }
+    return names == state->roomCount && (state->roomsLen == 0 || rooms[state->roomsLen - 1] == 0);
+}
 
-                    close(fds[i].fd);
+// The new process side of a hot restart, up to READY: the listeners of the
+// running server, one per shard it had
+static int32_t wsTakeOverListeners(int32_t sock, int32_t** listeners, uint32_t* count) {
+    wsBuffer buf = {0};
+    int32_t fd;
+    if (wsHandoffExpect(sock, WS_HANDOFF_HELLO, sizeof(wsHandoffHello), &buf, &fd) != WS_OK) {
+        wsBufferFree(&buf);
+        return WS_ERROR;
+    }
+    wsHandoffHello hello;
+    memcpy(&hello, buf.data, sizeof(hello));
+    if (hello.version != WS_HANDOFF_VERSION || hello.listeners == 0) {
+        WS_LOG(ERROR, "Running server speaks handoff version %u, this one %u", hello.version, WS_HANDOFF_VERSION);
+        wsBufferFree(&buf);
+        return WS_ERROR;
+    }
 
-                    // Remove this client from the poll array by shifting remaining entries
-                    for (int j = i; j < nfds - 1; j++) {
-                        fds[j] = fds[j + 1];  
-                        handshake_done[j - 1] = handshake_done[j];
-                    }
-                    nfds--;
-                    i--;
-                    continue;
-                }
+    *listeners = calloc(hello.listeners, sizeof(int32_t));
+    if (!*listeners) {
+        wsBufferFree(&buf);
+        return WS_ERROR;
+    }
+    for (*count = 0; *count < hello.listeners; (*count)++) {
+        if (wsHandoffExpect(sock, WS_HANDOFF_LISTENER, 0, &buf, &fd) != WS_OK || fd < 0) {
+            WS_LOG(ERROR, "Failed to receive the listeners: %s", strerror(errno));
+            wsBufferFree(&buf);
+            return WS_ERROR;
+        }
+        (*listeners)[*count] = fd;
+    }
+    wsBufferFree(&buf);
+    return wsHandoffSend(sock, WS_HANDOFF_READY, NULL, 0, -1);
+}
 
-                buffer[len] = '\0';
-
-                // Check if this client has completed the WebSocket handshake
-                if (!handshake_done[i - 1]) {
-                    char response[WS_BUFFER_SIZE];
-
-                    if (__ws_server_handshake(buffer, len) == 0) {
-                        handshake_done[i - 1] = 1;
-                        printf("WebSocket handshake complete (fd=%d)\n", fds[i].fd);
-                        fflush(stdout);
-
-                        char key[256] = {0};  // Buffer for the key
-                        char *key_line = strcasestr((char*)buffer, "sec-websocket-key:");
-                        if (key_line) {
-                            char *key_start = strchr(key_line, ':');
-                            if (key_start) {
-                                sscanf(key_start + 1, " %[^\r\n]", key);
-                                char *end = key + strlen(key) - 1;
-                                while (end > key && (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')) {
-                                    *end = '\0';
-                                    end--;
-                                }
-                                printf("Extracted WebSocket key: '%s' (len=%zu)\n", key, strlen(key));
-                                fflush(stdout);
-                            }
-
-                            char accept_key[512];
-                            snprintf(accept_key, sizeof(accept_key), "%s258EAFA5-E914-47DA-95CA-C5AB0DC85B11", key);
-
-                            unsigned char hash[20];  // SHA1 produces 20 bytes
-                            sha1((unsigned char*)accept_key, strlen(accept_key), hash);
-
-                            char b64[256];
-                            base64_encode(hash, 20, b64);
-
-                            // Build the HTTP response for successful WebSocket upgrade
-                            snprintf(response, sizeof(response),
-                                "HTTP/1.1 101 Switching Protocols\r\n"  // Status code 101
-                                "Upgrade: websocket\r\n"                 // Upgrade header
-                                "Connection: Upgrade\r\n"               // Connection header
-                                "Sec-WebSocket-Accept: %s\r\n\r\n", b64); // Accept key
-
-                            printf("Sending handshake response with key: %s\n", b64);
-                            fflush(stdout);
-
-                            // Send the handshake response to the client
-                            int sent = send(fds[i].fd, response, strlen(response), 0);
-                            if (sent < 0) {
-                                printf("Failed to send handshake response (fd=%d)\n", fds[i].fd);
-                                fflush(stdout);
-                                close(fds[i].fd);
-                                // Mark client slot as free
-                                for (int k = 0; k < MAX_CLIENTS; k++) {
-                                    if (clients[k].id == fds[i].fd) {
-                                        clients[k].id = -1;
-                                        break;
-                                    }
-                                }
-                                continue;
-                            }
-
-                            // Debug: print number of bytes sent
-                            printf("Sent %d bytes\n", sent);
-                            fflush(stdout);
-                        }
-                    }
-                } else {
-                    // Client has completed handshake, this is a WebSocket frame
+// Listeners of shards this process does not have. Whoever waits in their
+// backlog is taken like a new client before the listener is closed.
+static void wsDrainListener(wsServer* server, int32_t listenFd, uint32_t* next) {
+    static const wsHandoffConn fresh = {0};
+    int flags = fcntl(listenFd, F_GETFL);
+    if (flags >= 0) fcntl(listenFd, F_SETFL, flags | O_NONBLOCK);
+    for (;;) {
+        int client_fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        wsAdoptConn(&server->shards[(*next)++ % server->shardCount], client_fd, &fresh, NULL);
+    }
+    close(listenFd);
+}
 
-                    // Buffer for the decoded payload
-                    char payload[WS_BUFFER_SIZE];
-                    int payload_len = __ws_decode_frame(buffer, len, payload);
+// The rest of the takeover, before any shard runs: clients and history up to
+// END, then DONE, and the previous process is gone once BYE arrived
+static int32_t wsTakeOverClients(wsServer* server, int32_t sock, int32_t* listeners, uint32_t listenerCount) {
+    wsBuffer buf = {0};
+    uint32_t next = 0;
+    uint32_t conns = 0;
+    int32_t ret = WS_ERROR;
 
-                    // Close connection
-                    if (payload_len == -2) {
-                        close(fds[i].fd);
-                        continue;
-                    }
+    for (;;) {
+        uint32_t type;
+        int32_t fd;
+        if (wsHandoffRecv(sock, &type, &buf, &fd) != WS_OK) {
+            WS_LOG(ERROR, "Handoff broke off: %s", strerror(errno));
+            break;
+        }
+
+        if (type == WS_HANDOFF_CONN && fd >= 0 && buf.len >= sizeof(wsHandoffConn)) {
+            wsHandoffConn state;
+            memcpy(&state, buf.data, sizeof(state));
+            const uint8_t* data = buf.data + sizeof(state);
+            if (!wsHandoffConnValid(&state, data, buf.len - sizeof(state))) {
+                WS_LOG(ERROR, "Handoff state of client fd=%d does not add up", fd);
+                close(fd);
+                break;
+            }
+            // The clients are spread over the shards of this process, which may be more or fewer than before
+            if (wsAdoptConn(&server->shards[next++ % server->shardCount], fd, &state, data) == WS_OK) conns++;
+        }
+        else if (type == WS_HANDOFF_HISTORY && fd < 0 && buf.len >= sizeof(wsHandoffHistory)) {
+            wsHandoffHistory entry;
+            memcpy(&entry, buf.data, sizeof(entry));
+            if (entry.roomLen >= WS_ROOM_MAX_NAME || sizeof(entry) + entry.roomLen + entry.frameLen != buf.len) {
+                WS_LOG(ERROR, "Handoff history entry %llu does not add up", (unsigned long long)entry.seq);
+                break;
+            }
+            char room[WS_ROOM_MAX_NAME] = {0};
+            memcpy(room, buf.data + sizeof(entry), entry.roomLen);
+            wsRecoverMessage(server, entry.seq, room, buf.data + sizeof(entry) + entry.roomLen, entry.frameLen);
+        }
+        else if (type == WS_HANDOFF_END && fd < 0 && buf.len >= sizeof(wsHandoffEnd)) {
+            wsHandoffEnd end;
+            memcpy(&end, buf.data, sizeof(end));
+            if (end.nextSeq > atomic_load_explicit(&server->nextSeq, memory_order_relaxed)) {
+                atomic_store_explicit(&server->nextSeq, end.nextSeq, memory_order_relaxed);
+            }
+            WS_LOG(INFO, "Took over %u of %u clients from the previous process", conns, end.conns);
+            ret = WS_OK;
+            break;
+        }
+        else {
+            WS_LOG(ERROR, "Unexpected handoff message %u of %zu bytes", type, buf.len);
+            if (fd >= 0) close(fd);
+            break;
+        }
+    }
 
-                    const char* cp = payload;
-                    printf("Server recived Message: %s\n", payload);
-                    wsJson* root = wsStringToJson(&cp);
+    int32_t fd;
+    if (ret == WS_OK) ret = wsHandoffSend(sock, WS_HANDOFF_DONE, NULL, 0, -1);
+    if (ret == WS_OK) ret = wsHandoffExpect(sock, WS_HANDOFF_BYE, 0, &buf, &fd);
+    wsBufferFree(&buf);
+    if (ret != WS_OK) return WS_ERROR;
 
-                    // If JSON parsing failed, skip this message
-                    if (!root) {
-                        printf("Failed to parse JSON message, skipping...\n");
-                        continue;
-                    }
+    for (uint32_t i = (uint32_t)server->shardCount; i < listenerCount; i++) {
+        wsDrainListener(server, listeners[i], &next);
+    }
+    return WS_OK;
+}
 
-                    // If we successfully decoded a payload
-                    if (payload_len > 0) {
-                        wsJson* user = wsJsonGet(root, "user");
-                        const char* name = wsJsonGetString(user, "name");
-
-                        wsJson* message = wsJsonGet(root, "message");
-                        const char* text = wsJsonGetString(message, "text");
-                        double textLen = wsJsonGetNumber(message, "text_len");
-
-                        double info = wsJsonGetNumber(message, "info");
-                        uint64_t flags = (uint64_t)info;
-
-                        int32_t index = getClientIndex(clients, fds[i].fd);
-                        if (index == -1) {
-                            WS_LOG_ERROR("Failed to find client with fitting index: %d\n", fds[i].fd);
-                            continue;
-                        }
-
-                        if (flags & WS_CHANGE_USERNAME) {
-                            printf("Change username message detected!\n");
-                            clients[index].username = strdup(name);
-                            printf("Updated client: %d name to: %s\n", clients[index].id, name);
-                        }
-
-                        // Don't broadcast if NO_BROADCAST flag is set
-                        if (flags & WS_NO_BROADCAST) {
-                            wsJsonFree(root);
-                            continue;
-                        }
-
-                        // Update the username in the existing JSON (no need to rebuild)
-                        wsJson* userToUpdate = wsJsonGet(root, "user");
-                        if (userToUpdate) {
-                            // Update the name field with the server-side username
-                            strncpy(userToUpdate->object.children[0]->stringValue,
-                                    clients[index].username,
-                                    WS_JSON_MAX_VALUE_SIZE - 1);
-                        }
-
-                        // Clear the info flags for broadcast
-                        wsJson* messageToUpdate = wsJsonGet(root, "message");
-                        if (messageToUpdate) {
-                            wsJson* infoField = wsJsonGet(messageToUpdate, "info");
-                            if (infoField) infoField->numberValue = 0;
-                        }
-
-                        // Convert to string and broadcast
-                        char jsonString[WS_BUFFER_SIZE];
-                        int32_t len = wsJsonToString(root, jsonString, WS_BUFFER_SIZE);
-
-                        unsigned char frame[WS_BUFFER_SIZE];
-                        int frame_len = __ws_encode_frame(jsonString, len, frame);
-
-                        // Broadcast to clients
-                        for (int j = 1; j < nfds; j++) {
-                            // Skip sender unless SEND_BACK flag is set
-                            if (j == i && !(flags & WS_SEND_BACK)) continue;
-
-                            if (handshake_done[j - 1]) {
-                                int sent = send(fds[j].fd, frame, frame_len, 0);
-                                if (sent < 0) {
-                                    printf("Failed to send to client (fd=%d), will be disconnected\n", fds[j].fd);
-                                    fflush(stdout);
-                                }
-                            }
-                        }
-                    }
-                    wsJsonFree(root);
-                }
+static void wsRaiseFdLimit(int32_t maxClients) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+
+    rlim_t want = (rlim_t)maxClients + 64;
+    if (rl.rlim_cur >= want) return;
+
+    rl.rlim_cur = want < rl.rlim_max ? want : rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        WS_LOG(ERROR, "setrlimit failed: %s", strerror(errno));
+    }
+    if (rl.rlim_cur < want) {
+        WS_LOG(WARN, "Open file limit is %lu, fewer than %d clients can connect",
+                     (unsigned long)rl.rlim_cur, maxClients);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    wsServer server = {0};
+    server.config.host = "0.0.0.0";
+    server.config.port = "9999";
+    server.config.maxClients = WS_DEFAULT_MAX_CLIENTS;
+    server.config.workers = 1;
+    server.config.highWatermark = WS_DEFAULT_HIGH_WATERMARK;
+    server.config.lowWatermark = WS_DEFAULT_LOW_WATERMARK;
+    server.config.slowPolicy = WS_SLOW_DROP_OLDEST;
+    server.config.handshakeTimeoutMs = WS_DEFAULT_HANDSHAKE_TIMEOUT_MS;
+    server.config.pingIntervalMs = WS_DEFAULT_PING_INTERVAL_MS;
+    server.config.pongTimeoutMs = WS_DEFAULT_PONG_TIMEOUT_MS;
+    server.config.historySize = WS_DEFAULT_HISTORY_SIZE;
+    server.config.maxMessageSize = WS_DEFAULT_MAX_MESSAGE_SIZE;
+#ifdef WS_ENABLE_DEFLATE
+    server.config.deflateWindowBits = WS_DEFLATE_MAX_WINDOW_BITS;
+    server.config.deflateClientWindowBits = WS_DEFLATE_MAX_WINDOW_BITS;
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+            server.config.host = argv[i + 1];
+            i++;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            server.config.maxClients = atoi(argv[i + 1]);
+            if (server.config.maxClients <= 0) server.config.maxClients = WS_DEFAULT_MAX_CLIENTS;
+            i++;
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            int32_t workers = atoi(argv[i + 1]);
+            if (workers <= 0) workers = (int32_t)sysconf(_SC_NPROCESSORS_ONLN);
+            if (workers <= 0) workers = 1;
+            if (workers > WS_MAX_WORKERS) workers = WS_MAX_WORKERS;
+            server.config.workers = workers;
+            i++;
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            // -w <high>[:<low>] in bytes
+            char* end;
+            size_t high = strtoull(argv[i + 1], &end, 10);
+            size_t low = *end == ':' ? strtoull(end + 1, NULL, 10) : high / 4;
+            if (high > 0 && low < high) {
+                server.config.highWatermark = high;
+                server.config.lowWatermark = low;
+            } else {
+                fprintf(stderr, "Invalid watermarks %s, keeping %zu:%zu\n", argv[i + 1],
+                        server.config.highWatermark, server.config.lowWatermark);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+            // Frames of at least this many bytes are sent with MSG_ZEROCOPY, 0 disables it
+            server.config.zerocopyMin = strtoull(argv[i + 1], NULL, 10);
+            i++;
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "epoll") == 0) server.config.backend = WS_BACKEND_EPOLL;
+            else if (strcmp(argv[i + 1], "uring") == 0) server.config.backend = WS_BACKEND_URING;
+            else fprintf(stderr, "Unknown backend %s, use epoll or uring\n", argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (strcmp(argv[i + 1], "drop") == 0) server.config.slowPolicy = WS_SLOW_DROP_OLDEST;
+            else if (strcmp(argv[i + 1], "coalesce") == 0) server.config.slowPolicy = WS_SLOW_COALESCE;
+            else if (strcmp(argv[i + 1], "disconnect") == 0) server.config.slowPolicy = WS_SLOW_DISCONNECT;
+            else fprintf(stderr, "Unknown slow client policy %s, use drop, coalesce or disconnect\n", argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            // Seconds a client gets to complete the upgrade request, 0 waits forever
+            server.config.handshakeTimeoutMs = (uint32_t)(strtod(argv[i + 1], NULL) * 1000);
+            i++;
+        }
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            // -k <ping interval>[:<pong timeout>] in seconds, 0 disables heartbeats
+            char* end;
+            double interval = strtod(argv[i + 1], &end);
+            double timeout = *end == ':' ? strtod(end + 1, NULL) : server.config.pongTimeoutMs / 1000.0;
+            if (interval >= 0 && timeout > 0) {
+                server.config.pingIntervalMs = (uint32_t)(interval * 1000);
+                server.config.pongTimeoutMs = (uint32_t)(timeout * 1000);
+            } else {
+                fprintf(stderr, "Invalid heartbeat %s, keeping %u:%u ms\n", argv[i + 1],
+                        server.config.pingIntervalMs, server.config.pongTimeoutMs);
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            // Messages kept for replay per room and for everyone, 0 disables history
+            server.config.historySize = (uint32_t)strtoul(argv[i + 1], NULL, 10);
+            i++;
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            // Directory for the durable message log, history survives restarts
+            server.config.logDir = argv[i + 1];
+            i++;
+        }
+        else if ((strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "-B") == 0) && i + 1 < argc) {
+            // -m <messages/s>[:<burst>] and -B <bytes/s>[:<burst>] per client, the burst defaults to one second
+            wsTokenRate* rate = argv[i][1] == 'm' ? &server.config.messageRate : &server.config.byteRate;
+            char* end;
+            rate->rate = strtoull(argv[i + 1], &end, 10);
+            rate->burst = *end == ':' ? strtoull(end + 1, NULL, 10) : rate->rate;
+            if (rate->burst == 0) rate->burst = rate->rate;
+            i++;
+        }
+        else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+            // -x <server window bits>[:<client window bits>] for permessage-deflate, 0 turns it
+            // down, a client window of 0 asks clients to reset it after every message
+            char* end;
+            unsigned long bits = strtoul(argv[i + 1], &end, 10);
+            unsigned long clientBits = *end == ':' ? strtoul(end + 1, NULL, 10) : WS_DEFLATE_MAX_WINDOW_BITS;
+            if ((bits == 0 || (bits >= WS_DEFLATE_MIN_WINDOW_BITS && bits <= WS_DEFLATE_MAX_WINDOW_BITS)) &&
+                (clientBits == 0 || (clientBits >= 8 && clientBits <= WS_DEFLATE_MAX_WINDOW_BITS))) {
+                server.config.deflateWindowBits = (uint8_t)bits;
+                server.config.deflateClientWindowBits = (uint8_t)clientBits;
+            } else {
+                fprintf(stderr, "Invalid deflate window bits %s, use %d-%d[:0 or 8-%d]\n", argv[i + 1],
+                        WS_DEFLATE_MIN_WINDOW_BITS, WS_DEFLATE_MAX_WINDOW_BITS, WS_DEFLATE_MAX_WINDOW_BITS);
             }
+            i++;
+        }
+        else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+            // Largest message in bytes a client may send, fragmented or not
+            unsigned long long size = strtoull(argv[i + 1], NULL, 10);
+            if (size > 0 && size <= UINT32_MAX) server.config.maxMessageSize = (size_t)size;
+            else fprintf(stderr, "Invalid message size %s, use 1-%u\n", argv[i + 1], UINT32_MAX);
+            i++;
+        }
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            // Seconds without a message before a client is closed, 0 disables it
+            server.config.idleTimeoutMs = (uint32_t)(strtod(argv[i + 1], NULL) * 1000);
+            i++;
+        }
+        else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            // Unix socket for hot restarts: take over from the server listening there, then wait for the next one
+            server.config.handoffPath = argv[i + 1];
+            i++;
+        }
+    }
+
+#ifndef WS_ENABLE_IO_URING
+    if (server.config.backend == WS_BACKEND_URING) {
+        fprintf(stderr, "Built without WS_ENABLE_IO_URING, using epoll\n");
+        server.config.backend = WS_BACKEND_EPOLL;
+    }
+#endif
+#ifndef WS_ENABLE_DEFLATE
+    if (server.config.deflateWindowBits) {
+        fprintf(stderr, "Built without WS_ENABLE_DEFLATE, permessage-deflate is off\n");
+        server.config.deflateWindowBits = 0;
+    }
+#endif
+
+    if (wsLoggerStart() != WS_OK) return 1;
+    wsRaiseFdLimit(server.config.maxClients);
+    wsAcceptInit();
+
+    server.shardCount = server.config.workers;
+    server.shards = calloc(server.shardCount, sizeof(wsShard));
+    if (!server.shards) {
+        WS_LOG(ERROR, "server init failed: %s", strerror(errno));
+        return 1;
+    }
+    atomic_init(&server.clientCount, 0);
+    atomic_init(&server.nextSeq, 0);
+    atomic_init(&server.deflateClients, 0);
+    atomic_init(&server.binaryClients, 0);
+    atomic_init(&server.handoff.stopping, false);
+    pthread_mutex_init(&server.handoff.lock, NULL);
+    pthread_cond_init(&server.handoff.cond, NULL);
+    server.handoff.listenFd = -1;
+
+    // A running server hands over its listeners first, nothing stops until READY
+    int32_t handoffSock = -1;
+    int32_t* listeners = NULL;
+    uint32_t listenerCount = 0;
+    if (server.config.handoffPath) {
+        handoffSock = wsHandoffConnect(server.config.handoffPath);
+        if (handoffSock < 0 && errno != ENOENT && errno != ECONNREFUSED) {
+            WS_LOG(ERROR, "Failed to reach the running server at %s: %s", server.config.handoffPath, strerror(errno));
+            return 1;
+        }
+        if (handoffSock >= 0 && wsTakeOverListeners(handoffSock, &listeners, &listenerCount) != WS_OK) return 1;
+    }
+
+    for (int32_t s = 0; s < server.shardCount; s++) {
+        int32_t listenFd = (uint32_t)s < listenerCount ? listeners[s] : -1;
+        if (wsShardInit(&server.shards[s], &server, s, listenFd) != WS_OK) return 1;
+    }
+
+    if (handoffSock >= 0) {
+        if (wsTakeOverClients(&server, handoffSock, listeners, listenerCount) != WS_OK) return 1;
+        close(handoffSock);
+        free(listeners);
+    }
+
+    // Before any shard runs, recovery fills their histories directly
+    if (server.config.logDir) {
+        server.log = calloc(1, sizeof(wsLog));
+        if (!server.log || wsLogOpen(server.log, server.config.logDir, wsRecoverMessage, &server) != WS_OK) {
+            return 1;
+        }
+    }
+    for (int32_t s = 0; s < server.shardCount; s++) {
+        wsConsumeAdopted(&server.shards[s]);
+    }
+
+    WS_LOG(INFO, "WebSocket server listening on %s:%s (max clients %d, workers %d, %s, %s/%s handshakes)",
+                 server.config.host, server.config.port, server.config.maxClients, server.shardCount,
+                 server.config.backend == WS_BACKEND_URING ? "io_uring" : "epoll",
+                 wsAcceptImplName(wsAcceptGetImpl(false)), wsAcceptImplName(wsAcceptGetImpl(true)));
+
+    if (server.config.handoffPath) {
+        server.handoff.listenFd = wsHandoffListen(server.config.handoffPath);
+        if (server.handoff.listenFd < 0) return 1;
+        if (pthread_create(&server.handoff.thread, NULL, wsHandoffRun, &server) != 0) {
+            WS_LOG(ERROR, "pthread_create failed: %s", strerror(errno));
+            return 1;
+        }
+    }
+
+    // Shard 0 runs on the main thread
+    for (int32_t s = 1; s < server.shardCount; s++) {
+        if (pthread_create(&server.shards[s].thread, NULL, wsShardRun, &server.shards[s]) != 0) {
+            WS_LOG(ERROR, "pthread_create failed: %s", strerror(errno));
+            return 1;
         }
     }
+    wsShardRun(&server.shards[0]);
 
-    // This line is never reached (infinite loop above)
+    for (int32_t s = 1; s < server.shardCount; s++) {
+        pthread_join(server.shards[s].thread, NULL);
+    }
     return 0;
 }
-
@@ -0,0 +1,278 @@
+#ifndef WS_SERVER_H
+#define WS_SERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "ws_accept.h"
+#include "ws_handoff.h"
+#include "ws_history.h"
+#include "ws_http.h"
+#include "ws_log.h"
+#include "ws_logger.h"
+#include "ws_metrics.h"
+#include "ws_mpsc.h"
+#include "ws_outq.h"
+#include "ws_ratelimit.h"
+#include "ws_registry.h"
+#include "ws_room.h"
+#include "ws_timer.h"
+#include "ws_uring.h"
+#include "../../lib/ws_binary.h"
+#include "../../lib/ws_deflate.h"
+#include "../../lib/ws_globals.h"
+#include "../../lib/ws_frame.h"
+#include "../../lib/ws_json.h"
+
+#define WS_DEFAULT_MAX_CLIENTS 65536
+#define WS_MAX_EVENTS 256
+#define WS_SEND_TIMEOUT_MS 1000
+#define WS_MAX_WORKERS 256
+#define WS_READ_CHUNK (16 * 1024)
+#define WS_DEFAULT_MAX_MESSAGE_SIZE (1024 * 1024)
+#define WS_MAX_HANDSHAKE_SIZE (8 * 1024)
+#define WS_HANDSHAKE_BATCH 64
+#define WS_DEFAULT_HIGH_WATERMARK (1024 * 1024)
+#define WS_DEFAULT_LOW_WATERMARK (256 * 1024)
+#define WS_DEFAULT_HANDSHAKE_TIMEOUT_MS 10000
+#define WS_DEFAULT_PING_INTERVAL_MS 30000
+#define WS_DEFAULT_PONG_TIMEOUT_MS 10000
+#define WS_DEFAULT_HISTORY_SIZE 100
+#define WS_DEFLATE_MIN_SIZE 64 // shorter broadcasts are sent uncompressed only
+#define WS_URING_ENTRIES 4096
+#define WS_URING_RECV_BUFFERS 128
+#define WS_URING_SEND_BATCH 64
+#define WS_URING_SEND_SLOTS 64
+
+typedef struct wsServer wsServer;
+typedef struct wsShard wsShard;
+
+// Everything registered with a shard's epoll starts with one of these
+typedef enum {
+    WS_EVENT_LISTENER,
+    WS_EVENT_WAKE,
+    WS_EVENT_CONN,
+} wsEventType;
+
+typedef struct {
+    wsEventType type;
+} wsEventSource;
+
+typedef enum {
+    WS_BACKEND_EPOLL, // readiness loop, non-blocking sockets
+    WS_BACKEND_URING, // completion loop, needs a build with WS_ENABLE_IO_URING
+} wsBackend;
+
+// What happens to a client whose outbound queue is still above the high watermark
+typedef enum {
+    WS_SLOW_DROP_OLDEST, // drop the oldest unsent frames to get back under the high watermark
+    WS_SLOW_COALESCE,    // keep only the newest unsent frame
+    WS_SLOW_DISCONNECT,  // close the connection
+} wsSlowPolicy;
+
+// Per connection state, handed to epoll as the event data pointer
+typedef struct wsConn {
+    wsEventSource source;
+    int32_t fd;
+    wsConnId id;         // stays unique when the fd is reused, see wsRegistry
+    int32_t activeIndex; // slot in wsShard.active, -1 until the handshake is done
+    bool handshakeDone;
+    wsHttpUpgrade http;  // upgrade request parsed so far, unused after the handshake
+    bool handshakeQueued; // on wsShard.handshakeList, waiting for its accept value
+    uint8_t handshakeKey[WS_ACCEPT_KEY_LEN];
+    struct wsConn* handshakeNext;
+    uint64_t requestNs;  // first read of the upgrade request, for the handshake latency
+    bool closeAfterFlush; // answered a plain HTTP request, closed once the response is written
+    char* username;      // NULL means "Anonym", set through wsRegistrySetName
+    struct wsConn* nameNext; // username index chain
+    wsRoomMembership* rooms; // rooms joined on this shard, see wsRoomIndex
+    int32_t roomCount;
+    int32_t roomCapacity;
+    wsBuffer in;         // unparsed bytes carried over to the next read, empty for idle clients
+    wsOutQueue out;      // frames the socket did not take yet, flushed on EPOLLOUT
+    bool slow;           // went above the high watermark and has not drained to the low one yet
+    bool closing;        // queued on wsShard.closeList, freed at the end of the loop iteration
+    struct wsConn* closeNext;
+
+    // One timer per connection for the handshake deadline, heartbeat and idle
+    // timeout. Reads only record the time, the timer works out the next deadline
+    // when it fires, so busy connections never touch the wheel.
+    wsTimer timer;
+    uint64_t lastRecv;    // any bytes, the peer is alive
+    uint64_t lastMessage; // text or binary frames, the client is not idle
+    uint64_t pingSent;
+    bool awaitingPong;
+
+    // Input rate limits, see wsTokenBucket. A throttled connection is not read
+    // from until resumeAt, its frames stay in the socket or in wsConn.in.
+    wsTokenBucket messageBucket;
+    wsTokenBucket byteBucket;
+    uint64_t resumeAt;
+    bool throttled;
+
+    // permessage-deflate as answered in the handshake. Broadcasts go out with the
+    // shard's shared compressor, only a client that keeps its window between
+    // messages needs an inflater of its own, created with its first compressed message.
+    bool deflate;
+    wsDeflateParams deflateParams;
+    wsInflateStream* inflater;
+
+    // Set by the first binary chat message, broadcasts reach the client as binary from then on
+    bool binary;
+
+    // Fragmented message being put together, only allocated while one is open
+    wsBuffer fragments;
+    uint8_t fragmentOpcode; // opcode of its first frame, 0 while none is open
+    bool fragmentCompressed;
+
+    // io_uring backend only
+    int32_t pending;     // submitted requests whose completion still points at this connection
+    bool shutdown;       // closing, waits for pending to reach 0 before it is freed
+    bool flushQueued;    // on wsShard.flushList, its queue is sent before the next submit
+    bool recvPaused;     // multishot recv ended while throttled or stopping, re-armed on resume
+    struct wsConn* flushNext;
+} wsConn;
+
+// A broadcast forwarded from another shard, holds one reference to the frame
+typedef struct {
+    wsMpscNode node;
+    wsOutFrame* frame;
+    uint64_t seq;
+    char room[]; // empty for a message to everyone
+} wsShardMsg;
+
+#ifdef WS_ENABLE_IO_URING
+// msghdr and iovec of a sendmsg SQE, only needed until the SQE is submitted
+typedef struct {
+    struct msghdr msg;
+    struct iovec iov[WS_URING_SEND_BATCH];
+} wsUringSendMsg;
+#endif
+
+struct wsShard {
+    wsServer* server;
+    int32_t id;
+    pthread_t thread;
+
+    int32_t epollFd;
+    int32_t listenFd;
+    int32_t wakeFd;
+    wsEventSource listenSource;
+    wsEventSource wakeSource;
+
+    // Filled by other shards, drained by this one
+    wsMpscQueue inbound;
+    atomic_bool wakePending;
+
+    // Every connection of this shard by fd, id and username
+    wsRegistry registry;
+
+    // Room name to members of this shard
+    wsRoomIndex rooms;
+
+    // Recent broadcasts of every shard, replayed to clients that join or reconnect
+    wsHistory history;
+
+    // Dense list of handshaken connections, only walked for broadcasts
+    wsConn** active;
+    int32_t activeCount;
+    int32_t activeCapacity;
+
+    // Reads land here first, only leftovers are copied into wsConn.in
+    uint8_t* scratch;
+
+    // Parse tree of the message being handled, reset once it is broadcast
+    wsJsonArena json;
+
+    // Connections that failed during this iteration, a broadcast can fail peers
+    // while it walks the active list so they are only torn down afterwards
+    wsConn* closeList;
+
+    // Complete upgrade requests of this iteration, answered in one batch
+    wsConn* handshakeList;
+
+    // permessage-deflate. The compressor resets after every message so all
+    // recipients can share its output, the inflater serves every client that
+    // resets its window too. Both buffers are reused for every message.
+    wsDeflateStream* deflater;
+    wsInflateStream* inflater;
+    wsBuffer deflated;
+    wsBuffer inflated;
+
+    // Connection deadlines, now is refreshed once per loop iteration
+    wsTimerWheel timers;
+    uint64_t now;
+
+    // Counters and latency histograms of this shard, see wsMetrics. readNs is
+    // taken once per read and is the ingress time of every message in it.
+    wsMetrics metrics;
+    uint64_t readNs;
+
+    // A handoff to a new process is under way, the shard reads nothing and
+    // accepts nobody until it is parked, see wsShardHandoff
+    bool stopping;
+
+#ifdef WS_ENABLE_IO_URING
+    wsUring* uring;       // NULL when the shard runs the epoll loop
+    wsUringBufRing recvBufs;
+    // Connections that queued frames during this iteration, every one of them
+    // gets a single send chain covering all of it
+    wsConn* flushList;
+    wsUringSendMsg* sendMsgs;
+    int32_t sendMsgsUsed;
+    bool acceptArmed;     // the multishot accept has not ended yet
+#endif
+};
+
+typedef struct {
+    const char* host;
+    const char* port;
+    int32_t maxClients;
+    int32_t workers;
+    size_t highWatermark;
+    size_t lowWatermark;
+    wsSlowPolicy slowPolicy;
+    size_t zerocopyMin;  // smallest frame sent with MSG_ZEROCOPY, 0 disables it
+    wsBackend backend;
+    uint32_t handshakeTimeoutMs; // time from accept to a complete upgrade request
+    uint32_t pingIntervalMs;     // silence before the server pings, 0 disables heartbeats
+    uint32_t pongTimeoutMs;      // time a ping may go unanswered
+    uint32_t idleTimeoutMs;      // time without a message before eviction, 0 disables it
+    uint32_t historySize;        // messages kept per room and globally, 0 disables replay
+    size_t maxMessageSize;       // largest message a client may send, all of its fragments together
+    const char* logDir;          // message log directory, NULL keeps history in memory only
+    wsTokenRate messageRate;     // messages per client, 0 is unlimited
+    wsTokenRate byteRate;        // frame bytes per client, 0 is unlimited
+    uint8_t deflateWindowBits;   // window of the broadcast compressor, 0 turns permessage-deflate down
+    uint8_t deflateClientWindowBits; // largest window clients may compress with, 0 makes them reset it
+    const char* handoffPath;     // unix socket for hot restarts, NULL disables them
+} wsServerConfig;
+
+// Hot restart, see wsHandOver. Shards stop reading once stopping is set and
+// park once all of them did, until the handoff failed or the process exits.
+typedef struct {
+    atomic_bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int32_t paused;   // shards that stopped reading
+    int32_t parked;   // shards that also delivered every broadcast forwarded to them
+    int32_t listenFd; // -1 without -H
+    pthread_t thread;
+} wsHandoffControl;
+
+struct wsServer {
+    wsServerConfig config;
+    wsShard* shards;
+    int32_t shardCount;
+    atomic_int clientCount;
+    atomic_uint_fast64_t nextSeq; // last sequence number handed to a broadcast
+    atomic_int deflateClients;    // clients with permessage-deflate, broadcasts are only compressed for them
+    atomic_int binaryClients;     // clients reading binary, the other format is only built while someone needs it
+    wsLog* log;                   // NULL without -l
+    wsHandoffControl handoff;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "ws_timer.h"
+
+#include <string.h>
+#include <time.h>
+
+uint64_t wsTimerNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void wsTimerWheelInit(wsTimerWheel* wheel, uint64_t nowMs) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->tick = nowMs / WS_TIMER_TICK_MS;
+}
+
+static void wsTimerLink(wsTimerWheel* wheel, wsTimer* timer) {
+    wsTimer** slot = &wheel->slots[timer->expiresTick & (WS_TIMER_SLOTS - 1)];
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+static void wsTimerUnlink(wsTimer* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void wsTimerArm(wsTimerWheel* wheel, wsTimer* timer, uint64_t expiresMs) {
+    if (wsTimerArmed(timer)) {
+        wsTimerUnlink(timer);
+    }
+    else {
+        wheel->count++;
+    }
+
+    // Round up so a timer never fires early, and never into a tick already processed
+    uint64_t tick = (expiresMs + WS_TIMER_TICK_MS - 1) / WS_TIMER_TICK_MS;
+    timer->expiresTick = tick > wheel->tick ? tick : wheel->tick + 1;
+    wsTimerLink(wheel, timer);
+}
+
+void wsTimerCancel(wsTimerWheel* wheel, wsTimer* timer) {
+    if (!wsTimerArmed(timer)) return;
+    wsTimerUnlink(timer);
+    wheel->count--;
+}
+
+void wsTimerAdvance(wsTimerWheel* wheel, uint64_t nowMs, wsTimerExpiredPFN expired, void* ctx) {
+    uint64_t target = nowMs / WS_TIMER_TICK_MS;
+
+    // After a long stall every slot is due at most once
+    if (target - wheel->tick > WS_TIMER_SLOTS) wheel->tick = target - WS_TIMER_SLOTS;
+
+    while (wheel->tick < target) {
+        wheel->tick++;
+        wsTimer** slot = &wheel->slots[wheel->tick & (WS_TIMER_SLOTS - 1)];
+
+        // Detach the slot first: callbacks may arm timers into this slot for a
+        // later lap, and may cancel timers that are still waiting on the local list
+        wsTimer* pending = *slot;
+        *slot = NULL;
+        if (pending) pending->pprev = &pending;
+
+        while (pending) {
+            wsTimer* timer = pending;
+            wsTimerUnlink(timer);
+            if (timer->expiresTick > wheel->tick) {
+                wsTimerLink(wheel, timer);
+                continue;
+            }
+            wheel->count--;
+            expired(timer, ctx);
+        }
+    }
+}
+
+int32_t wsTimerWaitMs(const wsTimerWheel* wheel, uint64_t nowMs) {
+    if (wheel->count == 0) return -1;
+
+    for (uint64_t tick = wheel->tick + 1; tick <= wheel->tick + WS_TIMER_SLOTS; tick++) {
+        if (!wheel->slots[tick & (WS_TIMER_SLOTS - 1)]) continue;
+
+        uint64_t due = tick * WS_TIMER_TICK_MS;
+        return due > nowMs ? (int32_t)(due - nowMs) : 0;
+    }
+    return -1;
+}
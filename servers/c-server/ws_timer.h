@@ -0,0 +1,49 @@
+#ifndef WS_TIMER_H
+#define WS_TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define WS_TIMER_TICK_MS 100
+#define WS_TIMER_SLOTS 1024 // power of two, one lap is 102.4 s
+#define WS_TIMER_NONE UINT64_MAX
+
+// Intrusive, lives inside whatever it times. Arm and cancel are O(1).
+typedef struct wsTimer {
+    struct wsTimer* next;
+    struct wsTimer** pprev; // NULL while not armed
+    uint64_t expiresTick;
+} wsTimer;
+
+// Hashed wheel: a timer sits in slot expiresTick % WS_TIMER_SLOTS, timers more
+// than one lap out stay in their slot until the wheel comes around again
+typedef struct {
+    wsTimer* slots[WS_TIMER_SLOTS];
+    uint64_t tick;  // last tick that was processed
+    uint32_t count; // armed timers
+} wsTimerWheel;
+
+typedef void (*wsTimerExpiredPFN)(wsTimer* timer, void* ctx);
+
+// Milliseconds from a coarse monotonic clock, cheap enough for every loop iteration
+uint64_t wsTimerNow(void);
+
+void wsTimerWheelInit(wsTimerWheel* wheel, uint64_t nowMs);
+
+// Re-arming an armed timer moves it. Fires on the first tick at or after expiresMs.
+void wsTimerArm(wsTimerWheel* wheel, wsTimer* timer, uint64_t expiresMs);
+void wsTimerCancel(wsTimerWheel* wheel, wsTimer* timer);
+
+static inline bool wsTimerArmed(const wsTimer* timer) {
+    return timer->pprev != NULL;
+}
+
+// Fires everything due up to nowMs. expired may re-arm or cancel any timer.
+void wsTimerAdvance(wsTimerWheel* wheel, uint64_t nowMs, wsTimerExpiredPFN expired, void* ctx);
+
+// Milliseconds until the next occupied slot comes up, -1 if nothing is armed.
+// Meant as the timeout of the next epoll_wait or io_uring_enter.
+int32_t wsTimerWaitMs(const wsTimerWheel* wheel, uint64_t nowMs);
+
+#endif
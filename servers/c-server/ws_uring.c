@@ -0,0 +1,223 @@
+#ifdef WS_ENABLE_IO_URING
+
+#include "ws_uring.h"
+#include "ws_logger.h"
+#include "../../lib/ws_globals.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int wsUringSetupSys(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int wsUringEnterSys(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                           void* arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int wsUringRegisterSys(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+int32_t wsUringInit(wsUring* ring, unsigned entries) {
+    memset(ring, 0, sizeof(*ring));
+
+    // Fan-out produces one completion per recipient, give the CQ more room than the SQ.
+    // No COOP_TASKRUN or DEFER_TASKRUN, both made the fan-out benchmark slower.
+    struct io_uring_params params = {0};
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 8;
+
+    int fd = wsUringSetupSys(entries, &params);
+    if (fd < 0) {
+        WS_LOG(ERROR, "io_uring_setup failed: %s", strerror(errno));
+        return WS_ERROR;
+    }
+    ring->fd = fd;
+
+    // EXT_ARG passes the wait timeout for timers without an extra SQE
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        WS_LOG(ERROR, "Kernel io_uring is too old (features 0x%x)", params.features);
+        close(fd);
+        return WS_ERROR;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ringSize = sqSize > cqSize ? sqSize : cqSize;
+    ring->ringMem = mmap(NULL, ring->ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+    if (ring->ringMem == MAP_FAILED) {
+        WS_LOG(ERROR, "Failed to map io_uring rings: %s", strerror(errno));
+        close(fd);
+        return WS_ERROR;
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        WS_LOG(ERROR, "Failed to map io_uring SQEs: %s", strerror(errno));
+        munmap(ring->ringMem, ring->ringSize);
+        close(fd);
+        return WS_ERROR;
+    }
+
+    uint8_t* base = ring->ringMem;
+    ring->sqHead = (unsigned*)(base + params.sq_off.head);
+    ring->sqTail = (unsigned*)(base + params.sq_off.tail);
+    ring->sqArray = (unsigned*)(base + params.sq_off.array);
+    ring->sqMask = *(unsigned*)(base + params.sq_off.ring_mask);
+    ring->sqEntries = params.sq_entries;
+    ring->cqHead = (unsigned*)(base + params.cq_off.head);
+    ring->cqTail = (unsigned*)(base + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(base + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(base + params.cq_off.cqes);
+
+    // SQEs are always used in ring order, the index array never changes
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        ring->sqArray[i] = i;
+    }
+    ring->sqeTail = *ring->sqTail;
+    ring->sqeSubmitted = ring->sqeTail;
+    return WS_OK;
+}
+
+void wsUringFree(wsUring* ring) {
+    if (ring->sqes) munmap(ring->sqes, ring->sqesSize);
+    if (ring->ringMem) munmap(ring->ringMem, ring->ringSize);
+    if (ring->fd > 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+}
+
+unsigned wsUringSqSpace(wsUring* ring) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned*)ring->sqHead, memory_order_acquire);
+    return ring->sqEntries - (ring->sqeTail - head);
+}
+
+struct io_uring_sqe* wsUringGetSqe(wsUring* ring) {
+    if (wsUringSqSpace(ring) == 0) {
+        if (wsUringSubmit(ring, 0) < 0 || wsUringSqSpace(ring) == 0) return NULL;
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqeTail & ring->sqMask];
+    ring->sqeTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int32_t wsUringSubmit(wsUring* ring, unsigned waitNr) {
+    atomic_store_explicit((_Atomic unsigned*)ring->sqTail, ring->sqeTail, memory_order_release);
+
+    unsigned toSubmit = ring->sqeTail - ring->sqeSubmitted;
+    unsigned flags = waitNr ? IORING_ENTER_GETEVENTS : 0;
+    int ret = wsUringEnterSys(ring->fd, toSubmit, waitNr, flags, NULL, 0);
+    if (ret < 0) return WS_ERROR;
+
+    ring->sqeSubmitted += ret;
+    return ret;
+}
+
+int32_t wsUringSubmitWait(wsUring* ring, unsigned waitNr, int32_t timeoutMs) {
+    if (timeoutMs < 0 || waitNr == 0) return wsUringSubmit(ring, waitNr);
+
+    atomic_store_explicit((_Atomic unsigned*)ring->sqTail, ring->sqeTail, memory_order_release);
+
+    struct __kernel_timespec ts = {
+        .tv_sec = timeoutMs / 1000,
+        .tv_nsec = (long long)(timeoutMs % 1000) * 1000000,
+    };
+    struct io_uring_getevents_arg arg = {
+        .ts = (uint64_t)(uintptr_t)&ts,
+    };
+    unsigned toSubmit = ring->sqeTail - ring->sqeSubmitted;
+    int ret = wsUringEnterSys(ring->fd, toSubmit, waitNr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                              &arg, sizeof(arg));
+
+    // A timed out wait reports ETIME even when SQEs went in, the kernel moved
+    // the SQ head past everything it consumed
+    ring->sqeSubmitted = atomic_load_explicit((_Atomic unsigned*)ring->sqHead, memory_order_acquire);
+    if (ret < 0 && errno == ETIME) return 0;
+    return ret < 0 ? WS_ERROR : ret;
+}
+
+bool wsUringPopCqe(wsUring* ring, struct io_uring_cqe* out) {
+    unsigned head = *ring->cqHead;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned*)ring->cqTail, memory_order_acquire);
+    if (head == tail) return false;
+
+    *out = ring->cqes[head & ring->cqMask];
+    atomic_store_explicit((_Atomic unsigned*)ring->cqHead, head + 1, memory_order_release);
+    return true;
+}
+
+int32_t wsUringBufRingInit(wsUring* ring, wsUringBufRing* bufs, uint16_t groupId,
+                           uint16_t entries, uint32_t bufLen, uint32_t spare) {
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->entries = entries;
+    bufs->groupId = groupId;
+    bufs->bufLen = bufLen;
+    bufs->bufSize = bufLen + spare;
+
+    // The ring itself has to be page aligned
+    bufs->ringSize = entries * sizeof(struct io_uring_buf);
+    bufs->ring = mmap(NULL, bufs->ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->ring == MAP_FAILED) {
+        bufs->ring = NULL;
+        WS_LOG(ERROR, "Failed to map buffer ring: %s", strerror(errno));
+        return WS_ERROR;
+    }
+
+    bufs->base = malloc(bufs->bufSize * entries);
+    if (!bufs->base) {
+        WS_LOG(ERROR, "Failed to allocate %u receive buffers", entries);
+        wsUringBufRingFree(ring, bufs);
+        return WS_ERROR;
+    }
+
+    struct io_uring_buf_reg reg = {0};
+    reg.ring_addr = (uint64_t)(uintptr_t)bufs->ring;
+    reg.ring_entries = entries;
+    reg.bgid = groupId;
+    if (wsUringRegisterSys(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        WS_LOG(ERROR, "Failed to register buffer ring: %s", strerror(errno));
+        free(bufs->base);
+        bufs->base = NULL;
+        munmap(bufs->ring, bufs->ringSize);
+        bufs->ring = NULL;
+        return WS_ERROR;
+    }
+
+    for (uint16_t i = 0; i < entries; i++) {
+        wsUringBufRecycle(bufs, i);
+    }
+    return WS_OK;
+}
+
+void wsUringBufRingFree(wsUring* ring, wsUringBufRing* bufs) {
+    if (bufs->ring && bufs->base) {
+        struct io_uring_buf_reg reg = {0};
+        reg.bgid = bufs->groupId;
+        wsUringRegisterSys(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    free(bufs->base);
+    if (bufs->ring) munmap(bufs->ring, bufs->ringSize);
+    memset(bufs, 0, sizeof(*bufs));
+}
+
+void wsUringBufRecycle(wsUringBufRing* bufs, uint16_t id) {
+    struct io_uring_buf* buf = &bufs->ring->bufs[bufs->tail & (bufs->entries - 1)];
+    buf->addr = (uint64_t)(uintptr_t)wsUringBufAt(bufs, id);
+    buf->len = bufs->bufLen;
+    buf->bid = id;
+    bufs->tail++;
+    atomic_store_explicit((_Atomic uint16_t*)&bufs->ring->tail, bufs->tail, memory_order_release);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef WS_URING_H
+#define WS_URING_H
+
+// Minimal io_uring wrapper on top of the raw syscalls, only built with
+// -DWS_ENABLE_IO_URING so the server keeps compiling without kernel headers
+// that know about provided buffer rings
+#ifdef WS_ENABLE_IO_URING
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int32_t fd;
+
+    // Submission queue, sqeTail runs ahead of the shared tail until the next submit
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe* sqes;
+    unsigned sqeTail;
+    unsigned sqeSubmitted;
+
+    // Completion queue
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+
+    void* ringMem;
+    size_t ringSize;
+    size_t sqesSize;
+} wsUring;
+
+// Kernel owned receive buffers, a multishot recv picks one per completion
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    uint8_t* base;
+    size_t ringSize;
+    size_t bufSize;   // stride between buffers
+    uint32_t bufLen;  // bytes the kernel may fill, the rest is spare
+    uint16_t entries;
+    uint16_t tail;
+    uint16_t groupId;
+} wsUringBufRing;
+
+int32_t wsUringInit(wsUring* ring, unsigned entries);
+void wsUringFree(wsUring* ring);
+
+// Free submission slots, a linked chain must fit before it is started because
+// links do not carry over from one submit to the next
+unsigned wsUringSqSpace(wsUring* ring);
+
+// Returns a zeroed SQE, submitting what is queued if the ring is full.
+// NULL only if the kernel refused the submit.
+struct io_uring_sqe* wsUringGetSqe(wsUring* ring);
+
+// Submits every prepared SQE and waits for at least waitNr completions.
+// Returns the number submitted or -1 with errno set.
+int32_t wsUringSubmit(wsUring* ring, unsigned waitNr);
+
+// Same, but gives up waiting after timeoutMs, -1 waits forever.
+// A timeout is not an error, it returns 0.
+int32_t wsUringSubmitWait(wsUring* ring, unsigned waitNr, int32_t timeoutMs);
+
+// SQEs prepared but not handed to the kernel yet
+static inline unsigned wsUringUnsubmitted(wsUring* ring) {
+    return ring->sqeTail - ring->sqeSubmitted;
+}
+
+// Copies the oldest completion out and frees its slot, false if there is none
+bool wsUringPopCqe(wsUring* ring, struct io_uring_cqe* out);
+
+// Registers entries buffers of bufLen bytes under groupId. Every buffer gets
+// spare bytes past bufLen that the kernel never writes.
+int32_t wsUringBufRingInit(wsUring* ring, wsUringBufRing* bufs, uint16_t groupId,
+                           uint16_t entries, uint32_t bufLen, uint32_t spare);
+void wsUringBufRingFree(wsUring* ring, wsUringBufRing* bufs);
+
+static inline uint8_t* wsUringBufAt(wsUringBufRing* bufs, uint16_t id) {
+    return bufs->base + (size_t)id * bufs->bufSize;
+}
+
+// Hands a buffer back to the kernel once its data has been consumed
+void wsUringBufRecycle(wsUringBufRing* bufs, uint16_t id);
+
+#endif
+
+#endif
@@ -6,6 +6,10 @@ const PORT = 9999;
 const HOST = process.argv.includes('-h')
   ? process.argv[process.argv.indexOf('-h') + 1]
   : '0.0.0.0';
+// Largest message a client may send, fragments are put together by ws
+const MAX_MESSAGE_SIZE = process.argv.includes('-M')
+  ? parseInt(process.argv[process.argv.indexOf('-M') + 1], 10)
+  : 1024 * 1024;
 
 // Message flags
 const WS_NO_BROADCAST = 1 << 0;
@@ -26,7 +30,7 @@ let nextClientId = 1;
 const wss = new WebSocket.Server({
   host: HOST,
   port: PORT,
-  maxPayload: 4096
+  maxPayload: MAX_MESSAGE_SIZE
 });
 
 console.log(`WebSocket server listening on ${HOST}:${PORT}`);
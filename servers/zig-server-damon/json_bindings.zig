@@ -10,24 +10,28 @@ pub const wsJsonType = enum(c_int) {
     WS_JSON_NULL = 5,
 };
 
-pub const wsJson = extern struct {
-    key: [256]u8,
-    type: wsJsonType,
-    // Union data follows, but we'll access it through helper functions
-};
+// The node layout belongs to the C library, everything goes through its accessors
+pub const wsJson = opaque {};
 
 // External C functions from the JSON library
 extern fn wsStringToJson(string: [*c]const [*c]const u8) ?*wsJson;
 extern fn wsJsonGet(obj: ?*wsJson, key: [*c]const u8) ?*wsJson;
 extern fn wsJsonGetString(obj: ?*wsJson, key: [*c]const u8) [*c]const u8;
 extern fn wsJsonGetNumber(obj: ?*wsJson, key: [*c]const u8) f64;
-extern fn wsJsonToString(obj: ?*wsJson, out: [*c]u8, size: i32) i32;
+extern fn wsJsonToString(obj: ?*wsJson, out: [*c]u8, size: usize) i32;
 extern fn wsJsonFree(obj: ?*wsJson) void;
 extern fn wsJsonInitChild(key: [*c]const u8) ?*wsJson;
 extern fn wsJsonInitString(key: [*c]const u8, val: [*c]const u8) ?*wsJson;
 extern fn wsJsonInitNumber(key: [*c]const u8, val: f64) ?*wsJson;
 extern fn wsJsonInitBool(key: [*c]const u8, val: bool) ?*wsJson;
-extern fn wsJsonAddField(parent: ?*wsJson, child: ?*wsJson) void;
+extern fn wsJsonAddField(parent: ?*wsJson, child: ?*wsJson) i32;
+extern fn wsJsonGetType(obj: ?*const wsJson) wsJsonType;
+extern fn wsJsonGetKey(obj: ?*const wsJson) [*c]const u8;
+extern fn wsJsonStringValue(obj: ?*const wsJson, len: ?*usize) [*c]const u8;
+extern fn wsJsonNumberValue(obj: ?*const wsJson) f64;
+extern fn wsJsonBoolValue(obj: ?*const wsJson) bool;
+extern fn wsJsonCount(obj: ?*const wsJson) i32;
+extern fn wsJsonAt(obj: ?*const wsJson, index: i32) ?*wsJson;
 
 // Helper functions for safer Zig usage
 pub fn parseJson(json_str: []const u8) ?*wsJson {
@@ -54,7 +58,7 @@ pub fn getNumber(obj: ?*wsJson, key: []const u8) f64 {
 
 pub fn toString(obj: ?*wsJson, buffer: []u8) i32 {
     const c_buf = @as([*c]u8, @ptrCast(buffer.ptr));
-    return wsJsonToString(obj, c_buf, @intCast(buffer.len));
+    return wsJsonToString(obj, c_buf, buffer.len);
 }
 
 pub fn free(obj: ?*wsJson) void {
@@ -82,6 +86,39 @@ pub fn initBool(key: []const u8, value: bool) ?*wsJson {
     return wsJsonInitBool(c_key, value);
 }
 
-pub fn addField(parent: ?*wsJson, child: ?*wsJson) void {
-    wsJsonAddField(parent, child);
+// On failure the child was not added and still has to be freed
+pub fn addField(parent: ?*wsJson, child: ?*wsJson) error{JsonAddField}!void {
+    if (wsJsonAddField(parent, child) != 0) return error.JsonAddField;
+}
+
+pub fn getType(obj: ?*const wsJson) wsJsonType {
+    return wsJsonGetType(obj);
+}
+
+pub fn getKey(obj: ?*const wsJson) []const u8 {
+    return std.mem.span(wsJsonGetKey(obj));
+}
+
+pub fn stringValue(obj: ?*const wsJson) ?[]const u8 {
+    var len: usize = 0;
+    const result = wsJsonStringValue(obj, &len);
+    if (result == null) return null;
+    return result[0..len];
+}
+
+pub fn numberValue(obj: ?*const wsJson) f64 {
+    return wsJsonNumberValue(obj);
+}
+
+pub fn boolValue(obj: ?*const wsJson) bool {
+    return wsJsonBoolValue(obj);
+}
+
+// Fields of an object or elements of an array
+pub fn count(obj: ?*const wsJson) usize {
+    return @intCast(wsJsonCount(obj));
+}
+
+pub fn at(obj: ?*const wsJson, index: usize) ?*wsJson {
+    return wsJsonAt(obj, @intCast(index));
 }
@@ -320,21 +320,21 @@ pub fn main() !void {
                     // Create user object with server-side username
                     const new_user = json.initChild("user") orelse continue;
                     const user_name = json.initString("name", client.username) orelse continue;
-                    json.addField(new_user, user_name);
-                    json.addField(new_root, new_user);
+                    json.addField(new_user, user_name) catch continue;
+                    json.addField(new_root, new_user) catch continue;
 
                     // Create message object with text, text_len, and cleared info
                     const new_message = json.initChild("message") orelse continue;
                     if (json.getString(message_obj, "text")) |text| {
                         const msg_text = json.initString("text", text) orelse continue;
-                        json.addField(new_message, msg_text);
+                        json.addField(new_message, msg_text) catch continue;
                     }
                     const text_len = json.getNumber(message_obj, "text_len");
                     const msg_len = json.initNumber("text_len", text_len) orelse continue;
-                    json.addField(new_message, msg_len);
+                    json.addField(new_message, msg_len) catch continue;
                     const msg_info = json.initNumber("info", 0) orelse continue; // Clear flags
-                    json.addField(new_message, msg_info);
-                    json.addField(new_root, new_message);
+                    json.addField(new_message, msg_info) catch continue;
+                    json.addField(new_root, new_message) catch continue;
 
                     const json_len = json.toString(new_root, &json_buffer);
                     const json_str = json_buffer[0..@intCast(json_len)];
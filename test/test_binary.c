@@ -0,0 +1,113 @@
+#include "../lib/ws_binary.h"
+#include "../lib/ws_globals.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void roundTrip(const wsBinaryMessage* msg) {
+    uint8_t data[WS_BINARY_HEADER_SIZE + 255 + 255 + 1024];
+    size_t len = wsBinarySize(msg);
+    CHECK(len <= sizeof(data));
+    if (len > sizeof(data)) return;
+    wsBinaryEncode(msg, data);
+
+    wsBinaryMessage decoded;
+    CHECK(wsBinaryDecode(data, len, &decoded) == WS_OK);
+    CHECK(decoded.flags == msg->flags && decoded.seq == msg->seq);
+    CHECK(decoded.userLen == msg->userLen && memcmp(decoded.user, msg->user, msg->userLen) == 0);
+    CHECK(decoded.roomLen == msg->roomLen && memcmp(decoded.room, msg->room, msg->roomLen) == 0);
+    CHECK(decoded.textLen == msg->textLen && memcmp(decoded.text, msg->text, msg->textLen) == 0);
+
+    // The lengths have to add up exactly
+    CHECK(wsBinaryDecode(data, len - 1, &decoded) == WS_ERROR);
+    CHECK(wsBinaryDecode(data, len + 1, &decoded) == WS_ERROR);
+}
+
+static void testRoundTrip(void) {
+    char user[255];
+    char room[255];
+    char text[1024];
+    memset(user, 'u', sizeof(user));
+    memset(room, 'r', sizeof(room));
+    for (size_t i = 0; i < sizeof(text); i++) text[i] = (char)i;
+
+    wsBinaryMessage msg = { .flags = 0, .seq = 0, .user = user, .room = room, .text = text };
+    roundTrip(&msg);
+
+    msg.userLen = 5;
+    msg.textLen = 11;
+    msg.flags = 0x21;
+    msg.seq = 42;
+    roundTrip(&msg);
+
+    // Largest strings, and values that need every byte of their field
+    msg.userLen = 255;
+    msg.roomLen = 255;
+    msg.textLen = sizeof(text);
+    msg.flags = 0x80402010;
+    msg.seq = 0x0123456789abcdefULL;
+    roundTrip(&msg);
+}
+
+// The header is little endian whatever the host does
+static void testLayout(void) {
+    wsBinaryMessage msg = {
+        .flags = 0x04030201, .seq = 0x0c0b0a0908070605ULL,
+        .user = "ab", .userLen = 2, .room = "c", .roomLen = 1, .text = "hi", .textLen = 2,
+    };
+    static const uint8_t expected[] = {
+        WS_BINARY_VERSION, 2, 1, 0,
+        0x01, 0x02, 0x03, 0x04,
+        0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c,
+        0x02, 0x00, 0x00, 0x00,
+        'a', 'b', 'c', 'h', 'i',
+    };
+    uint8_t data[sizeof(expected)];
+    CHECK(wsBinarySize(&msg) == sizeof(expected));
+    wsBinaryEncode(&msg, data);
+    CHECK(memcmp(data, expected, sizeof(expected)) == 0);
+}
+
+static void testInvalid(void) {
+    wsBinaryMessage msg = { .user = "bob", .userLen = 3, .text = "x", .textLen = 1 };
+    uint8_t data[WS_BINARY_HEADER_SIZE + 4];
+    wsBinaryEncode(&msg, data);
+
+    wsBinaryMessage decoded;
+    CHECK(wsBinaryDecode(data, sizeof(data), &decoded) == WS_OK);
+    CHECK(wsBinaryDecode(data, WS_BINARY_HEADER_SIZE - 1, &decoded) == WS_ERROR);
+
+    data[0] = WS_BINARY_VERSION + 1;
+    CHECK(wsBinaryDecode(data, sizeof(data), &decoded) == WS_ERROR);
+    data[0] = WS_BINARY_VERSION;
+
+    // A text length far past the end of the data
+    data[16] = 0xff;
+    data[17] = 0xff;
+    data[18] = 0xff;
+    data[19] = 0xff;
+    CHECK(wsBinaryDecode(data, sizeof(data), &decoded) == WS_ERROR);
+}
+
+int main(void) {
+    testRoundTrip();
+    testLayout();
+    testInvalid();
+
+    if (failures) {
+        printf("%d binary checks failed\n", failures);
+        return 1;
+    }
+    printf("All binary tests passed\n");
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include "../lib/ws_deflate.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static bool offer(const char* value, size_t* pos, wsDeflateParams* params) {
+    return wsDeflateNextOffer(value, strlen(value), pos, params) == WS_OK;
+}
+
+static void testOffers(void) {
+    wsDeflateParams params;
+    size_t pos = 0;
+
+    // Other extensions are passed over, a bare client_max_window_bits reads as 15
+    const char* value = "x-webkit-deflate-frame, permessage-deflate; client_max_window_bits";
+    CHECK(offer(value, &pos, &params));
+    CHECK(params.clientMaxWindowBits == 15 && !params.serverMaxWindowBits);
+    CHECK(!params.serverNoContextTakeover && !params.clientNoContextTakeover);
+    CHECK(!offer(value, &pos, &params));
+
+    // Offers come out in order, invalid ones are skipped
+    value = "permessage-deflate; server_max_window_bits=7, "
+            "Permessage-Deflate ; server_max_window_bits=\"10\" ; client_no_context_takeover, "
+            "permessage-deflate; server_no_context_takeover; server_no_context_takeover, "
+            "permessage-deflate; server_max_window_bits=08, "
+            "permessage-deflate; mystery, "
+            "permessage-deflate; client_max_window_bits=9; server_no_context_takeover";
+    pos = 0;
+    CHECK(offer(value, &pos, &params));
+    CHECK(params.serverMaxWindowBits == 10 && params.clientNoContextTakeover);
+    CHECK(offer(value, &pos, &params));
+    CHECK(params.clientMaxWindowBits == 9 && params.serverNoContextTakeover && !params.serverMaxWindowBits);
+    CHECK(!offer(value, &pos, &params));
+    CHECK(pos == strlen(value));
+
+    pos = 0;
+    CHECK(!offer("permessage-deflate; server_max_window_bits", &pos, &params));
+    pos = 0;
+    CHECK(!offer("permessage-deflate; server_no_context_takeover=1", &pos, &params));
+    pos = 0;
+    CHECK(!offer("", &pos, &params));
+}
+
+static void testFormat(void) {
+    wsDeflateParams params = {
+        .serverNoContextTakeover = true, .serverMaxWindowBits = 12, .clientMaxWindowBits = 10,
+    };
+    char out[128];
+    int32_t len = wsDeflateFormat(&params, out, sizeof(out));
+    CHECK(len > 0 && (size_t)len == strlen(out));
+    CHECK(strcmp(out, "permessage-deflate; server_no_context_takeover; server_max_window_bits=12; "
+                      "client_max_window_bits=10") == 0);
+
+    // What is written parses back to the same parameters
+    wsDeflateParams parsed;
+    size_t pos = 0;
+    CHECK(offer(out, &pos, &parsed));
+    CHECK(memcmp(&parsed, &params, sizeof(params)) == 0);
+
+    CHECK(wsDeflateFormat(&params, out, (size_t)len) == WS_ERROR);
+    CHECK(wsDeflateFormat(&params, out, (size_t)len + 1) == len);
+}
+
+#ifdef WS_ENABLE_DEFLATE
+
+static const char* messages[] = {
+    "{\"user\":{\"name\":\"alice\"},\"message\":{\"text\":\"hello everyone\",\"text_len\":14,\"info\":0}}",
+    "{\"user\":{\"name\":\"alice\"},\"message\":{\"text\":\"hello again\",\"text_len\":11,\"info\":0}}",
+    "",
+    "{\"user\":{\"name\":\"bob\"},\"message\":{\"text\":\"hello everyone\",\"text_len\":14,\"info\":0}}",
+};
+#define MESSAGE_COUNT (sizeof(messages) / sizeof(messages[0]))
+
+static bool inflatesTo(wsInflateStream* inflater, const wsBuffer* compressed, const char* expected) {
+    wsBuffer out = {0};
+    bool ok = wsInflateMessage(inflater, compressed->data, compressed->len, 1 << 20, &out) == WS_OK &&
+              out.len == strlen(expected) && (out.len == 0 || memcmp(out.data, expected, out.len) == 0);
+    wsBufferFree(&out);
+    return ok;
+}
+
+// With context takeover later messages refer back to earlier ones and come out smaller
+static void testContextTakeover(void) {
+    for (int takeover = 0; takeover < 2; takeover++) {
+        wsDeflateStream* deflater = wsDeflateCreate(15, takeover);
+        wsInflateStream* inflater = wsInflateCreate(15, takeover);
+        CHECK(deflater && inflater);
+        if (!deflater || !inflater) return;
+
+        size_t sizes[MESSAGE_COUNT];
+        for (size_t i = 0; i < MESSAGE_COUNT; i++) {
+            wsBuffer compressed = {0};
+            CHECK(wsDeflateMessage(deflater, (const uint8_t*)messages[i], strlen(messages[i]), &compressed) == WS_OK);
+            sizes[i] = compressed.len;
+            CHECK(inflatesTo(inflater, &compressed, messages[i]));
+
+            // Without takeover every message decodes on its own
+            if (!takeover) {
+                wsInflateStream* fresh = wsInflateCreate(15, false);
+                CHECK(fresh && inflatesTo(fresh, &compressed, messages[i]));
+                wsInflateFree(fresh);
+            }
+            wsBufferFree(&compressed);
+        }
+        if (takeover) CHECK(sizes[3] < sizes[0]);
+        else CHECK(sizes[3] >= sizes[0] - 3);
+
+        wsDeflateFree(deflater);
+        wsInflateFree(inflater);
+    }
+}
+
+// The window a hot restart carries over lets a fresh stream go on
+static void testWindow(void) {
+    wsDeflateStream* deflater = wsDeflateCreate(15, true);
+    wsInflateStream* inflater = wsInflateCreate(15, true);
+    wsBuffer compressed = {0};
+    wsBuffer window = {0};
+
+    CHECK(wsDeflateMessage(deflater, (const uint8_t*)messages[0], strlen(messages[0]), &compressed) == WS_OK);
+    CHECK(inflatesTo(inflater, &compressed, messages[0]));
+    CHECK(wsInflateGetWindow(inflater, &window) == WS_OK);
+    CHECK(window.len == strlen(messages[0]));
+
+    wsInflateStream* next = wsInflateCreate(15, true);
+    CHECK(wsInflateSetWindow(next, window.data, window.len) == WS_OK);
+    compressed.len = 0;
+    CHECK(wsDeflateMessage(deflater, (const uint8_t*)messages[3], strlen(messages[3]), &compressed) == WS_OK);
+    CHECK(inflatesTo(next, &compressed, messages[3]));
+
+    wsBufferFree(&compressed);
+    wsBufferFree(&window);
+    wsDeflateFree(deflater);
+    wsInflateFree(inflater);
+    wsInflateFree(next);
+}
+
+// A message fed in pieces decodes the same, and one that grows too large is refused
+static void testFragmentsAndLimit(void) {
+    char text[20000];
+    for (size_t i = 0; i < sizeof(text); i++) text[i] = "abcdefgh"[(i * 7 + i / 100) % 8];
+
+    wsDeflateStream* deflater = wsDeflateCreate(15, false);
+    wsInflateStream* inflater = wsInflateCreate(15, false);
+    wsBuffer compressed = {0};
+    wsBuffer out = {0};
+    CHECK(wsDeflateMessage(deflater, (const uint8_t*)text, sizeof(text), &compressed) == WS_OK);
+
+    for (size_t piece = 1; piece <= compressed.len; piece *= 3) {
+        out.len = 0;
+        int32_t ret = WS_OK;
+        for (size_t at = 0; at < compressed.len && ret == WS_OK; at += piece) {
+            size_t len = compressed.len - at < piece ? compressed.len - at : piece;
+            ret = wsInflateFragment(inflater, compressed.data + at, len, at + len == compressed.len, sizeof(text),
+                                    &out);
+        }
+        CHECK(ret == WS_OK && out.len == sizeof(text) && memcmp(out.data, text, sizeof(text)) == 0);
+    }
+
+    out.len = 0;
+    CHECK(wsInflateMessage(inflater, compressed.data, compressed.len, sizeof(text) - 1, &out) == WS_ERROR);
+    // The stream starts over after the failure
+    out.len = 0;
+    CHECK(wsInflateMessage(inflater, compressed.data, compressed.len, sizeof(text), &out) == WS_OK);
+    CHECK(out.len == sizeof(text));
+
+    // Corrupt data is an error as well
+    memset(compressed.data, 0xff, compressed.len);
+    out.len = 0;
+    CHECK(wsInflateMessage(inflater, compressed.data, compressed.len, sizeof(text), &out) == WS_ERROR);
+
+    wsBufferFree(&compressed);
+    wsBufferFree(&out);
+    wsDeflateFree(deflater);
+    wsInflateFree(inflater);
+}
+
+#endif
+
+int main(void) {
+    // The rejected messages would fill the output with inflate errors
+    if (!freopen("/dev/null", "w", stderr)) return 1;
+
+    testOffers();
+    testFormat();
+#ifdef WS_ENABLE_DEFLATE
+    testContextTakeover();
+    testWindow();
+    testFragmentsAndLimit();
+#else
+    CHECK(wsDeflateCreate(15, true) == NULL);
+    printf("built without WS_ENABLE_DEFLATE, compression not tested\n");
+#endif
+
+    if (failures) {
+        printf("%d deflate checks failed\n", failures);
+        return 1;
+    }
+    printf("All deflate tests passed\n");
+    return 0;
+}
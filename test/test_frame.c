@@ -0,0 +1,145 @@
+#include "../lib/ws_frame.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int32_t failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Header plus payload, masked like a client does it when mask is set
+static size_t buildFrame(uint8_t* out, uint8_t opcode, bool fin, const uint8_t* payload, uint64_t len,
+                         const uint8_t* mask) {
+    int32_t headerLen = wsFrameWriteHeader(out, opcode, fin, len, mask);
+    for (uint64_t i = 0; i < len; i++) {
+        out[headerLen + i] = mask ? payload[i] ^ mask[i & 3] : payload[i];
+    }
+    return headerLen + len;
+}
+
+// Every length encoding, masked and not
+static void testRoundTrip(void) {
+    static const uint64_t lengths[] = { 0, 1, 125, 126, 127, 65535, 65536, 70000 };
+    static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    uint8_t* payload = malloc(70000);
+    uint8_t* data = malloc(70000 + WS_FRAME_MAX_HEADER);
+    for (size_t i = 0; i < 70000; i++) payload[i] = (uint8_t)(i * 31 + 7);
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        for (int masked = 0; masked < 2; masked++) {
+            uint64_t len = lengths[i];
+            size_t size = buildFrame(data, WS_OPCODE_BINARY, true, payload, len, masked ? mask : NULL);
+            size_t headerLen = size - len;
+            CHECK(headerLen == (len <= 125 ? 2 : len <= 65535 ? 4 : 10) + (masked ? 4 : 0));
+
+            wsFrame frame;
+            CHECK(wsFrameParse(data, size, UINT64_MAX, &frame) == (int64_t)size);
+            CHECK(frame.opcode == WS_OPCODE_BINARY);
+            CHECK(frame.fin && !frame.rsv1);
+            CHECK(frame.masked == (masked != 0));
+            CHECK(frame.payloadLen == len);
+            CHECK(frame.payload == data + headerLen);
+            CHECK(memcmp(frame.payload, payload, len) == 0);
+        }
+    }
+    free(payload);
+    free(data);
+}
+
+// A frame split anywhere is incomplete and left untouched until the last byte arrives
+static void testIncomplete(void) {
+    static const uint8_t mask[4] = { 1, 2, 3, 4 };
+    uint8_t payload[300];
+    uint8_t data[300 + WS_FRAME_MAX_HEADER];
+    uint8_t copy[sizeof(data)];
+    memset(payload, 'a', sizeof(payload));
+    size_t size = buildFrame(data, WS_OPCODE_TEXT, false, payload, sizeof(payload), mask);
+    memcpy(copy, data, size);
+
+    wsFrame frame;
+    for (size_t len = 0; len < size; len++) {
+        CHECK(wsFrameParse(data, len, UINT64_MAX, &frame) == WS_FRAME_INCOMPLETE);
+        CHECK(memcmp(data, copy, size) == 0);
+    }
+    CHECK(wsFrameParse(data, size, UINT64_MAX, &frame) == (int64_t)size);
+    CHECK(!frame.fin && frame.masked);
+
+    // Two frames in one read come out one at a time
+    size_t second = buildFrame(data, WS_OPCODE_PING, true, payload, 5, mask);
+    second += buildFrame(data + second, WS_OPCODE_PONG, true, payload, 3, NULL);
+    CHECK(wsFrameParse(data, second, UINT64_MAX, &frame) == 2 + 4 + 5);
+    CHECK(frame.opcode == WS_OPCODE_PING && frame.masked);
+    CHECK(wsFrameParse(data + 11, second - 11, UINT64_MAX, &frame) == 2 + 3);
+    CHECK(frame.opcode == WS_OPCODE_PONG && !frame.masked);
+}
+
+static void testInvalid(void) {
+    static const uint8_t mask[4] = { 9, 8, 7, 6 };
+    uint8_t payload[200] = { 0 };
+    uint8_t data[256];
+    wsFrame frame;
+
+    size_t size = buildFrame(data, WS_OPCODE_TEXT, true, payload, sizeof(payload), mask);
+    CHECK(wsFrameParse(data, size, sizeof(payload), &frame) == (int64_t)size);
+    size = buildFrame(data, WS_OPCODE_TEXT, true, payload, sizeof(payload), mask);
+    CHECK(wsFrameParse(data, size, sizeof(payload) - 1, &frame) == WS_ERROR);
+    // The length alone is enough to refuse it
+    CHECK(wsFrameParse(data, 4, sizeof(payload) - 1, &frame) == WS_ERROR);
+
+    // RSV2 and RSV3 are refused, RSV1 is reported
+    size = buildFrame(data, WS_OPCODE_TEXT, true, payload, 4, mask);
+    data[0] |= 0x20;
+    CHECK(wsFrameParse(data, size, UINT64_MAX, &frame) == WS_ERROR);
+    data[0] = (data[0] & ~0x30) | 0x10;
+    CHECK(wsFrameParse(data, size, UINT64_MAX, &frame) == WS_ERROR);
+    data[0] = (data[0] & ~0x30) | WS_FRAME_RSV1;
+    CHECK(wsFrameParse(data, size, UINT64_MAX, &frame) == (int64_t)size);
+    CHECK(frame.rsv1);
+
+    CHECK(wsFrameParse(NULL, 0, UINT64_MAX, &frame) == WS_ERROR);
+}
+
+static void testBuffer(void) {
+    wsBuffer buf = { 0 };
+    char chunk[100];
+    for (int i = 0; i < 50; i++) {
+        memset(chunk, 'a' + i % 26, sizeof(chunk));
+        CHECK(wsBufferAppend(&buf, chunk, sizeof(chunk)) == WS_OK);
+    }
+    CHECK(buf.len == 5000 && buf.capacity >= buf.len);
+    CHECK(buf.data[0] == 'a' && buf.data[4999] == 'a' + 49 % 26);
+
+    wsBufferConsume(&buf, 4950);
+    CHECK(buf.len == 50 && buf.data[0] == 'a' + 49 % 26);
+    CHECK(wsBufferReserve(&buf, 10000) == WS_OK);
+    CHECK(buf.capacity - buf.len >= 10000);
+
+    wsBufferConsume(&buf, 50);
+    CHECK(buf.len == 0);
+    wsBufferFree(&buf);
+    CHECK(buf.data == NULL && buf.len == 0 && buf.capacity == 0);
+}
+
+int main(void) {
+    // The rejected frames would fill the output with parser errors
+    if (!freopen("/dev/null", "w", stderr)) return 1;
+
+    testRoundTrip();
+    testIncomplete();
+    testInvalid();
+    testBuffer();
+
+    if (failures) {
+        printf("%d frame checks failed\n", failures);
+        return 1;
+    }
+    printf("All frame tests passed\n");
+    return 0;
+}
@@ -0,0 +1,582 @@
+#include "../lib/ws_json.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static int32_t failures = 0;
+static const char* isaName = "auto";
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL [%s] %s:%d: %s\n", isaName, __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// Parses with malloc and with an arena, both have to agree on whether text is valid
+static bool parses(const char* text) {
+    const char* p = text;
+    wsJson* tree = wsStringToJson(&p);
+    wsJsonArena arena;
+    wsJsonArenaInit(&arena);
+    p = text;
+    bool inArena = wsStringToJsonArena(&p, &arena) != NULL;
+    wsJsonArenaFree(&arena);
+
+    CHECK((tree != NULL) == inArena);
+    wsJsonFree(tree);
+    return inArena;
+}
+
+// Both parsers and the path scanner
+static bool valid(const char* text) {
+    wsJsonSlice root;
+    bool tree = parses(text);
+    bool scanned = wsJsonPathFind(text, strlen(text), "", &root) == WS_OK;
+    CHECK(tree == scanned);
+    return tree;
+}
+
+// {"pad": "xxx", "k": "<escaped>", "n": 1} with escaped starting after pad
+// bytes, so that every alignment to the 64 byte blocks is covered
+static void buildMessage(char* out, size_t size, size_t pad, const char* escaped) {
+    char padding[256];
+    memset(padding, 'x', pad);
+    padding[pad] = '\0';
+    snprintf(out, size, "{\"pad\": \"%s\", \"k\": \"%s\", \"n\": 1}", padding, escaped);
+}
+
+static void expectString(const char* text, const char* expected, size_t expectedLen) {
+    const char* p = text;
+    wsJson* root = wsStringToJson(&p);
+    CHECK(root != NULL);
+    if (!root) return;
+
+    size_t len = 0;
+    const char* value = wsJsonStringValue(wsJsonGet(root, "k"), &len);
+    CHECK(value && len == expectedLen && memcmp(value, expected, len) == 0);
+    CHECK(wsJsonGetNumber(root, "n") == 1);
+
+    wsJsonSlice slice;
+    wsJsonArena arena;
+    wsJsonArenaInit(&arena);
+    CHECK(wsJsonPathFind(text, strlen(text), "k", &slice) == WS_OK);
+    value = wsJsonSliceString(&slice, &arena, &len);
+    CHECK(value && len == expectedLen && memcmp(value, expected, len) == 0);
+    wsJsonArenaFree(&arena);
+    wsJsonFree(root);
+}
+
+static void testEscapes(void) {
+    char text[512];
+    char escaped[64];
+    char expected[64];
+
+    for (size_t pad = 0; pad < 140; pad++) {
+        // Runs of escaped backslashes followed by an escaped quote
+        for (size_t run = 1; run <= 4; run++) {
+            size_t n = 0;
+            size_t m = 0;
+            for (size_t i = 0; i < run; i++) {
+                escaped[n++] = '\\';
+                escaped[n++] = '\\';
+                expected[m++] = '\\';
+            }
+            memcpy(escaped + n, "\\\"y", 4);
+            expected[m++] = '"';
+            expected[m++] = 'y';
+            buildMessage(text, sizeof(text), pad, escaped);
+            expectString(text, expected, m);
+        }
+
+        // An odd run escapes the closing quote, the string never ends
+        buildMessage(text, sizeof(text), pad, "\\\\\\");
+        CHECK(!valid(text));
+
+        buildMessage(text, sizeof(text), pad, "a\\n\\t\\/b");
+        expectString(text, "a\n\t/b", 5);
+
+        // U+1F600 from a surrogate pair
+        buildMessage(text, sizeof(text), pad, "\\ud83d\\ude00");
+        expectString(text, "\xF0\x9F\x98\x80", 4);
+        buildMessage(text, sizeof(text), pad, "\\u00e9\\u20ac");
+        expectString(text, "\xC3\xA9\xE2\x82\xAC", 5);
+
+        buildMessage(text, sizeof(text), pad, "\\ud83d");
+        CHECK(!valid(text));
+        buildMessage(text, sizeof(text), pad, "\\ude00\\ud83d");
+        CHECK(!valid(text));
+        buildMessage(text, sizeof(text), pad, "\\ud83d\\u0041");
+        CHECK(!valid(text));
+        buildMessage(text, sizeof(text), pad, "\\x41");
+        CHECK(!valid(text));
+        buildMessage(text, sizeof(text), pad, "\\u12g4");
+        CHECK(!valid(text));
+
+        // Raw control characters have to be escaped, outside of strings they are whitespace
+        buildMessage(text, sizeof(text), pad, "a\tb");
+        CHECK(!valid(text));
+        buildMessage(text, sizeof(text), pad, "a\x01");
+        CHECK(!valid(text));
+        buildMessage(text, sizeof(text), pad, "\x7F\xC3\xA9");
+        expectString(text, "\x7F\xC3\xA9", 3);
+    }
+    CHECK(valid("{\n\t\"a\":\r\n 1\n}"));
+}
+
+static void testNesting(void) {
+    static char text[4 * WS_JSON_MAX_DEPTH + 64];
+    for (int32_t depth = WS_JSON_MAX_DEPTH; depth <= WS_JSON_MAX_DEPTH + 1; depth++) {
+        // Objects on odd levels and arrays on even ones, the root object is level 1
+        size_t n = 0;
+        for (int32_t level = 1; level <= depth; level++) {
+            if (level % 2 == 0) {
+                memcpy(text + n, "\"a\":[", 5);
+                n += 5;
+            } else {
+                text[n++] = '{';
+            }
+        }
+        for (int32_t level = depth; level >= 1; level--) text[n++] = level % 2 ? '}' : ']';
+        text[n] = '\0';
+        CHECK(valid(text) == (depth <= WS_JSON_MAX_DEPTH));
+    }
+}
+
+static void testValidation(void) {
+    const char* good[] = {
+        "{}", "{\"a\":0}", "{\"a\":-0}", "{\"a\":-0.5e+3}", "{\"a\":1E5}", "{\"a\":10.25}",
+        "{\"a\":[1,true,false,null,\"s\",{}]}", "{\"a\":{\"b\":[]}}",
+    };
+    const char* bad[] = {
+        "", "[]", "{", "{\"a\"}", "{\"a\":}", "{\"a\":1,}", "{\"a\":[1,]}", "{\"a\":[1}", "{\"a\":01}",
+        "{\"a\":-01}", "{\"a\":1.}", "{\"a\":.5}", "{\"a\":1e}", "{\"a\":-}", "{\"a\":+1}", "{\"a\":tru}",
+        "{\"a\":nul}", "{\"a\":\"x}", "{a:1}",
+    };
+    for (size_t i = 0; i < sizeof(good) / sizeof(good[0]); i++) CHECK(valid(good[i]));
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) CHECK(!valid(bad[i]));
+}
+
+static void testPaths(void) {
+    const char* text = "{\"user\": {\"name\": \"a\\\"b\", \"id\": 5}, \"message\": {\"text\": \"hi\", \"info\": 12},"
+                       " \"list\": [{\"name\": \"no\"}], \"seq\": 1, \"other\": 2, \"other\": 3}";
+    const char* const paths[] = { "", "user.name", "message.info", "message.missing", "list.name", "seq", "user" };
+    wsJsonSlice out[7];
+    wsJsonArena arena;
+    wsJsonArenaInit(&arena);
+
+    CHECK(wsJsonPathFindAll(text, strlen(text), paths, out, 7) == WS_OK);
+    CHECK(out[0].data == text && out[0].len == strlen(text) && out[0].type == WS_JSON_OBJECT);
+
+    size_t len = 0;
+    const char* name = wsJsonSliceString(&out[1], &arena, &len);
+    CHECK(name && len == 3 && memcmp(name, "a\"b", 3) == 0);
+    CHECK(out[1].len == 6 && out[1].type == WS_JSON_STRING);
+    CHECK(wsJsonSliceNumber(&out[2]) == 12);
+
+    // Missing values and paths through arrays leave the slice empty
+    CHECK(out[3].data == NULL && wsJsonSliceNumber(&out[3]) == -1);
+    CHECK(out[4].data == NULL);
+    CHECK(out[5].len == 1 && out[5].data[0] == '1');
+    CHECK(out[6].type == WS_JSON_OBJECT && out[6].data[0] == '{' && out[6].data[out[6].len - 1] == '}');
+
+    // Keys are compared decoded
+    const char* escaped = "{\"us\\u0065r\": {\"n\\u0061me\": \"e\"}}";
+    CHECK(wsJsonPathFind(escaped, strlen(escaped), "user.name", out) == WS_OK && out->data[1] == 'e');
+
+    // Only the slice of the object is looked at, trailing bytes are the caller's
+    CHECK(wsJsonPathFindAll(text, strlen(text) - 1, paths, out, 7) == WS_ERROR);
+    CHECK(wsJsonPathFind("{\"a\": 1} trailing", 17, "a", out) == WS_OK);
+    wsJsonArenaFree(&arena);
+}
+
+// A second key on the way to a path fails the scan, other duplicates are left alone
+static void testDuplicates(void) {
+    const char* const paths[] = { "user.name", "seq" };
+    const char* duplicated[] = {
+        "{\"user\": {\"name\": \"x\"}, \"user\": {\"name\": \"Mallory\"}}",
+        "{\"user\": {\"name\": \"x\", \"name\": \"Mallory\"}}",
+        "{\"user\": {\"id\": 1}, \"user\": {\"name\": \"Mallory\"}}",
+        "{\"seq\": 5, \"seq\": 1}",
+        "{\"seq\": 5, \"s\\u0065q\": 1}",
+        "{\"user\": {\"name\": \"x\", \"n\\u0061me\": \"Mallory\"}}",
+    };
+    const char* allowed[] = {
+        "{\"a\": 1, \"a\": 2, \"seq\": 3}",
+        "{\"user\": {\"id\": 1, \"id\": 2, \"name\": \"x\"}}",
+        "{\"list\": [{\"seq\": 1}, {\"seq\": 2}], \"seq\": 3}",
+    };
+    wsJsonSlice out[2];
+    for (size_t i = 0; i < sizeof(duplicated) / sizeof(duplicated[0]); i++) {
+        CHECK(wsJsonPathFindAll(duplicated[i], strlen(duplicated[i]), paths, out, 2) == WS_JSON_DUPLICATE);
+        CHECK(out[0].data == NULL && out[1].data == NULL);
+    }
+    for (size_t i = 0; i < sizeof(allowed) / sizeof(allowed[0]); i++) {
+        CHECK(wsJsonPathFindAll(allowed[i], strlen(allowed[i]), paths, out, 2) == WS_OK);
+    }
+}
+
+static void testSplice(void) {
+    const char* text = "{\"user\": {\"name\": \"x\"}, \"info\": 5}";
+    size_t len = strlen(text);
+    const char* name = strstr(text, "\"x\"");
+    const char* info = strstr(text, "5}");
+
+    wsJsonEdit edits[3] = {
+        { name, 3, "\"alice\"", 7 },
+        { info, 1, "0", 1 },
+        { text + len - 1, 0, ", \"seq\": 7", 10 },
+    };
+    const char* expected = "{\"user\": {\"name\": \"alice\"}, \"info\": 0, \"seq\": 7}";
+    int32_t need = wsJsonSplice(text, len, edits, 3, NULL, 0);
+    CHECK(need == (int32_t)strlen(expected));
+
+    char out[128];
+    memset(out, '#', sizeof(out));
+    CHECK(wsJsonSplice(text, len, edits, 3, out, need - 1) == need);
+    CHECK(out[0] == '#');
+    CHECK(wsJsonSplice(text, len, edits, 3, out, need) == need);
+    CHECK(memcmp(out, expected, need) == 0);
+    CHECK(valid(expected));
+
+    // No edits copies the text, edits out of order or past the end are refused
+    CHECK(wsJsonSplice(text, len, NULL, 0, out, sizeof(out)) == (int32_t)len && memcmp(out, text, len) == 0);
+    wsJsonEdit reversed[2] = { edits[1], edits[0] };
+    CHECK(wsJsonSplice(text, len, reversed, 2, out, sizeof(out)) == WS_ERROR);
+    wsJsonEdit overlapping[2] = { { name, 10, "", 0 }, { name + 5, 1, "", 0 } };
+    CHECK(wsJsonSplice(text, len, overlapping, 2, out, sizeof(out)) == WS_ERROR);
+    wsJsonEdit past[1] = { { text + len - 1, 2, "", 0 } };
+    CHECK(wsJsonSplice(text, len, past, 1, out, sizeof(out)) == WS_ERROR);
+}
+
+static void testArena(void) {
+    wsJsonArena arena;
+    wsJsonArenaInit(&arena);
+
+    // 16 byte aligned, an allocation past the block size gets a block of its own
+    uint8_t* a = wsJsonArenaAlloc(&arena, 1);
+    uint8_t* b = wsJsonArenaAlloc(&arena, 17);
+    uint8_t* c = wsJsonArenaAlloc(&arena, 3 * WS_JSON_ARENA_BLOCK_SIZE);
+    CHECK(a && b && c);
+    CHECK(((uintptr_t)a & 15) == 0 && ((uintptr_t)b & 15) == 0 && ((uintptr_t)c & 15) == 0);
+    CHECK(b == a + 16);
+    memset(c, 0xab, 3 * WS_JSON_ARENA_BLOCK_SIZE);
+    CHECK(arena.used == 3 * WS_JSON_ARENA_BLOCK_SIZE && arena.total == arena.used + 48);
+    wsJsonArenaFree(&arena);
+    CHECK(arena.blocks == NULL);
+
+    // A document that needs several blocks
+    static char text[200000];
+    size_t n = 0;
+    text[n++] = '{';
+    for (int32_t i = 0; i < 3000; i++) {
+        n += snprintf(text + n, sizeof(text) - n, "%s\"k%d\": {\"s\": \"value %d\", \"n\": %d}", i ? "," : "", i, i, i);
+    }
+    text[n++] = '}';
+    text[n] = '\0';
+
+    // After a reset the next parse fits one block, and the arena stays there.
+    // Everything came from the newest block when used and total agree.
+    for (int32_t round = 0; round < 3; round++) {
+        const char* p = text;
+        wsJson* root = wsStringToJsonArena(&p, &arena);
+        CHECK(root && root->inArena && wsJsonCount(root) == 3000);
+        wsJson* last = wsJsonAt(root, 2999);
+        CHECK(last && last->inArena && strcmp(wsJsonGetKey(last), "k2999") == 0);
+        CHECK(wsJsonGetNumber(last, "n") == 2999);
+        CHECK(round == 0 ? arena.used < arena.total : arena.used == arena.total);
+
+        // Nodes added to the tree come from the same arena, wsJsonFree leaves them all alone
+        wsJson* extra = wsJsonArenaNode(&arena, WS_JSON_STRING, "extra");
+        CHECK(extra && wsJsonArenaSetString(&arena, extra, "added") == WS_OK);
+        wsJsonAddField(root, extra);
+        CHECK(strcmp(wsJsonGetString(root, "extra"), "added") == 0);
+        wsJsonFree(root);
+        wsJsonArenaReset(&arena);
+    }
+
+    // A failed parse leaves nothing behind that a reset does not take
+    const char* p = "{\"a\": [1, 2, }";
+    CHECK(wsStringToJsonArena(&p, &arena) == NULL);
+    wsJsonArenaReset(&arena);
+    CHECK(arena.used == 0 && arena.total == 0);
+    CHECK(wsJsonArenaNode(NULL, WS_JSON_NULL, "x") == NULL);
+    wsJsonArenaFree(&arena);
+}
+
+static void expectNumber(double value, const char* text) {
+    wsJson* root = wsJsonInitChild(NULL);
+    wsJsonAddField(root, wsJsonInitNumber("n", value));
+    char out[64];
+    int32_t len = wsJsonToString(root, out, sizeof(out));
+    CHECK(len == wsJsonToString(root, NULL, 0));
+    if (text) CHECK(strcmp(out, text) == 0);
+
+    const char* p = out;
+    wsJson* back = isfinite(value) ? wsStringToJson(&p) : NULL;
+    if (back) {
+        double parsed = wsJsonGetNumber(back, "n");
+        CHECK(parsed == value && signbit(parsed) == signbit(value));
+        wsJsonFree(back);
+    } else {
+        CHECK(!isfinite(value));
+    }
+    wsJsonFree(root);
+}
+
+static void testNumbers(void) {
+    expectNumber(0, "{\"n\": 0}");
+    expectNumber(-0.0, "{\"n\": -0}");
+    expectNumber(42, "{\"n\": 42}");
+    expectNumber(-1234567, "{\"n\": -1234567}");
+    expectNumber(9007199254740991.0, "{\"n\": 9007199254740991}");
+    expectNumber(0.1, "{\"n\": 0.1}");
+    expectNumber(2.5, "{\"n\": 2.5}");
+    expectNumber(1.0 / 3, "{\"n\": 0.3333333333333333}");
+    expectNumber(5e-324, "{\"n\": 5e-324}");
+    expectNumber(1.7976931348623157e308, "{\"n\": 1.7976931348623157e+308}");
+    expectNumber(1e21, NULL);
+    expectNumber(123456789012345678.0, NULL);
+    expectNumber(NAN, "{\"n\": null}");
+    expectNumber(-INFINITY, "{\"n\": null}");
+
+    // Arbitrary bit patterns, every finite double has to come back exactly
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (int32_t i = 0; i < 20000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double value;
+        memcpy(&value, &state, sizeof(value));
+        if (isfinite(value)) expectNumber(value, NULL);
+    }
+}
+
+static void testWriter(void) {
+    wsJson* root = wsJsonInitChild(NULL);
+    wsJsonAddField(root, wsJsonInitStringN("s", "a\0\"\\\n\x1f", 6));
+    wsJson* list = wsJsonInitArray("l");
+    wsJsonAddElement(list, wsJsonInitBool(NULL, true));
+    wsJsonAddElement(list, wsJsonInitNull(NULL));
+    wsJsonAddField(root, list);
+
+    const char* expected = "{\"s\": \"a\\u0000\\\"\\\\\\n\\u001f\",\"l\": [true,null]}";
+    int32_t need = wsJsonToString(root, NULL, 0);
+    CHECK(need == (int32_t)strlen(expected));
+
+    // Short buffers are cut and terminated, the result still tells the full length
+    char out[128];
+    for (int32_t size = 1; size <= need + 1; size++) {
+        memset(out, '#', sizeof(out));
+        CHECK(wsJsonToString(root, out, size) == need);
+        if (size < need) CHECK(strlen(out) == (size_t)size - 1 && memcmp(out, expected, size - 1) == 0);
+        else CHECK(memcmp(out, expected, need) == 0);
+        if (size > need) CHECK(out[need] == '\0');
+    }
+
+    wsBuffer buffer = {0};
+    CHECK(wsBufferAppend(&buffer, "x", 1) == WS_OK);
+    CHECK(wsJsonToBuffer(root, &buffer) == WS_OK);
+    CHECK(buffer.len == (size_t)need + 1 && memcmp(buffer.data + 1, expected, need) == 0);
+    wsBufferFree(&buffer);
+
+    char quoted[8];
+    CHECK(wsJsonQuote("he\"llo", quoted, sizeof(quoted)) == 9);
+    CHECK(strcmp(quoted, "\"he\\\"ll") == 0);
+    wsJsonFree(root);
+}
+
+// Byte by byte reference for the 8 byte wide escaping
+static size_t quoteReference(const char* s, size_t len, char* out) {
+    size_t n = 0;
+    out[n++] = '"';
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') n += sprintf(out + n, "\\%c", c);
+        else if (c == '\n') n += sprintf(out + n, "\\n");
+        else if (c == '\r') n += sprintf(out + n, "\\r");
+        else if (c == '\t') n += sprintf(out + n, "\\t");
+        else if (c == '\b') n += sprintf(out + n, "\\b");
+        else if (c == '\f') n += sprintf(out + n, "\\f");
+        else if (c < 0x20) n += sprintf(out + n, "\\u%04x", c);
+        else out[n++] = c;
+    }
+    out[n++] = '"';
+    out[n] = '\0';
+    return n;
+}
+
+// Every byte value at every position of the 8 byte blocks and the tail
+static void testWriterEscapes(void) {
+    char text[24];
+    char expected[24 * 6 + 3];
+    char out[sizeof(expected)];
+    for (int32_t c = 1; c < 256; c++) {
+        for (size_t at = 0; at < sizeof(text) - 1; at++) {
+            memset(text, 'a', sizeof(text) - 1);
+            text[sizeof(text) - 1] = '\0';
+            text[at] = (char)c;
+            size_t n = quoteReference(text, sizeof(text) - 1, expected);
+            CHECK(wsJsonQuote(text, out, sizeof(out)) == (int32_t)n && strcmp(out, expected) == 0);
+        }
+    }
+
+    // Keys are escaped like values, and ASCII comes back unchanged through the parser
+    wsJson* root = wsJsonInitChild(NULL);
+    char all[128];
+    for (int32_t i = 0; i < 127; i++) all[i] = (char)(i + 1);
+    all[127] = '\0';
+    wsJsonAddField(root, wsJsonInitString("k\"\n", all));
+    char json[1024];
+    CHECK(wsJsonToString(root, json, sizeof(json)) > 0);
+    const char* p = json;
+    wsJson* back = wsStringToJson(&p);
+    CHECK(back && wsJsonCount(back) == 1 && strcmp(wsJsonGetKey(wsJsonAt(back, 0)), "k\"\n") == 0);
+    CHECK(back && strcmp(wsJsonGetString(back, "k\"\n"), all) == 0);
+    wsJsonFree(back);
+    wsJsonFree(root);
+}
+
+static void testWriterNesting(void) {
+    wsJson* root = wsJsonInitChild(NULL);
+    wsJson* inner = wsJsonInitChild("o");
+    wsJsonAddField(inner, wsJsonInitArray("empty"));
+    wsJsonAddField(inner, wsJsonInitChild("none"));
+    wsJsonAddField(root, inner);
+    wsJson* list = wsJsonInitArray("l");
+    for (int32_t i = 0; i < 3; i++) {
+        wsJson* item = wsJsonInitChild(NULL);
+        wsJsonAddField(item, wsJsonInitNumber("i", i));
+        wsJsonAddElement(list, item);
+    }
+    wsJsonAddElement(list, wsJsonInitBool(NULL, false));
+    wsJsonAddField(root, list);
+
+    const char* expected = "{\"o\": {\"empty\": [],\"none\": {}},\"l\": [{\"i\": 0},{\"i\": 1},{\"i\": 2},false]}";
+    char out[128];
+    CHECK(wsJsonToString(root, out, sizeof(out)) == (int32_t)strlen(expected) && strcmp(out, expected) == 0);
+    CHECK(valid(out));
+
+    // A buffer grows from nothing through many slow path writes
+    wsJson* big = wsJsonInitArray(NULL);
+    for (int32_t i = 0; i < 5000; i++) wsJsonAddElement(big, wsJsonInitStringN(NULL, "x\"y", 3));
+    wsBuffer buffer = {0};
+    CHECK(wsJsonToBuffer(big, &buffer) == WS_OK);
+    CHECK(buffer.len == 2 + 5000 * 6 + 4999);
+    CHECK(buffer.len == (size_t)wsJsonToString(big, NULL, 0));
+    CHECK(memcmp(buffer.data, "[\"x\\\"y\",", 8) == 0 && buffer.data[buffer.len - 1] == ']');
+    wsBufferFree(&buffer);
+    wsJsonFree(big);
+    wsJsonFree(root);
+}
+
+// What the bindings read a tree with, on every kind of node and on the wrong one
+static void testAccessors(void) {
+    const char* text = "{\"s\": \"a\\u0000b\", \"n\": -2.5, \"t\": true, \"z\": null, \"a\": [1, \"x\", {}]}";
+    const char* p = text;
+    wsJson* root = wsStringToJson(&p);
+    CHECK(root && wsJsonGetType(root) == WS_JSON_OBJECT && wsJsonCount(root) == 5);
+    if (!root) return;
+
+    wsJson* str = wsJsonAt(root, 0);
+    size_t len = 0;
+    CHECK(wsJsonGetType(str) == WS_JSON_STRING && strcmp(wsJsonGetKey(str), "s") == 0);
+    const char* value = wsJsonStringValue(str, &len);
+    CHECK(value && len == 3 && memcmp(value, "a\0b", 3) == 0);
+    CHECK(wsJsonStringValue(str, NULL) == value);
+    CHECK(wsJsonNumberValue(str) == 0 && !wsJsonBoolValue(str) && wsJsonCount(str) == 0);
+
+    CHECK(wsJsonGetType(wsJsonAt(root, 1)) == WS_JSON_NUMBER && wsJsonNumberValue(wsJsonAt(root, 1)) == -2.5);
+    CHECK(wsJsonGetType(wsJsonAt(root, 2)) == WS_JSON_BOOL && wsJsonBoolValue(wsJsonAt(root, 2)));
+    CHECK(wsJsonGetType(wsJsonAt(root, 3)) == WS_JSON_NULL && wsJsonStringValue(wsJsonAt(root, 3), &len) == NULL);
+
+    wsJson* array = wsJsonAt(root, 4);
+    CHECK(wsJsonGetType(array) == WS_JSON_ARRAY && wsJsonCount(array) == 3);
+    CHECK(strcmp(wsJsonGetKey(wsJsonAt(array, 1)), "") == 0);
+    CHECK(wsJsonGetType(wsJsonAt(array, 2)) == WS_JSON_OBJECT && wsJsonCount(wsJsonAt(array, 2)) == 0);
+    CHECK(wsJsonAt(array, 3) == NULL && wsJsonAt(array, -1) == NULL);
+
+    // A missing node reads as null with no key
+    CHECK(wsJsonGetType(NULL) == WS_JSON_NULL && strcmp(wsJsonGetKey(NULL), "") == 0);
+    CHECK(wsJsonCount(NULL) == 0 && wsJsonAt(NULL, 0) == NULL);
+    wsJsonFree(root);
+}
+
+// Adding reports what was refused, the refused node stays with the caller
+static void testAdd(void) {
+    wsJson* root = wsJsonInitChild(NULL);
+    wsJson* list = wsJsonInitArray("list");
+    wsJson* number = wsJsonInitNumber("n", 1);
+
+    CHECK(wsJsonAddField(NULL, number) == WS_ERROR);
+    CHECK(wsJsonAddField(root, NULL) == WS_ERROR);
+    CHECK(wsJsonAddField(list, number) == WS_ERROR);
+    CHECK(wsJsonAddElement(root, number) == WS_ERROR);
+    CHECK(wsJsonAddElement(list, NULL) == WS_ERROR);
+    CHECK(wsJsonCount(root) == 0 && wsJsonCount(list) == 0);
+
+    CHECK(wsJsonAddField(root, number) == WS_OK);
+    for (int32_t i = 0; i < 100; i++) CHECK(wsJsonAddElement(list, wsJsonInitNumber(NULL, i)) == WS_OK);
+    CHECK(wsJsonAddField(root, list) == WS_OK);
+    CHECK(wsJsonCount(root) == 2 && wsJsonCount(list) == 100);
+    CHECK(wsJsonNumberValue(wsJsonAt(list, 99)) == 99);
+
+    // A tree in an arena grows its child list in there too
+    wsJsonArena arena;
+    wsJsonArenaInit(&arena);
+    const char* text = "{\"a\": 1}";
+    wsJson* parsed = wsStringToJsonArena(&text, &arena);
+    for (int32_t i = 0; i < 20; i++) {
+        CHECK(wsJsonAddField(parsed, wsJsonArenaNode(&arena, WS_JSON_NULL, "x")) == WS_OK);
+    }
+    CHECK(wsJsonCount(parsed) == 21 && wsJsonGetType(wsJsonAt(parsed, 20)) == WS_JSON_NULL);
+
+    wsJsonArenaFree(&arena);
+    wsJsonFree(root);
+}
+
+int main(void) {
+    // The rejected inputs would fill the output with parser errors
+    if (!freopen("/dev/null", "w", stderr)) return 1;
+
+    const struct {
+        wsJsonIsa isa;
+        const char* name;
+    } isas[] = {
+        { WS_JSON_ISA_SCALAR, "scalar" },
+        { WS_JSON_ISA_SSE2, "sse2" },
+        { WS_JSON_ISA_AVX2, "avx2" },
+    };
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        isaName = isas[i].name;
+        if (!wsJsonSetIsa(isas[i].isa)) {
+            printf("skipping %s, not supported here\n", isaName);
+            continue;
+        }
+        testEscapes();
+        testNesting();
+        testValidation();
+        testPaths();
+    }
+
+    isaName = "auto";
+    wsJsonSetIsa(WS_JSON_ISA_AUTO);
+    testDuplicates();
+    testSplice();
+    testArena();
+    testNumbers();
+    testWriter();
+    testWriterEscapes();
+    testWriterNesting();
+    testAccessors();
+    testAdd();
+
+    if (failures) {
+        printf("%d JSON checks failed\n", failures);
+        return 1;
+    }
+    printf("All JSON tests passed\n");
+    return 0;
+}